@@ -6,11 +6,8 @@
 // Copyright (c) Microsoft Corporation. All rights reserved.
 
 #include "Grayscale.h"
-#include "bufferlock.h"
 
 #include <math.h>
-#include <vector>
-#include <algorithm>
 
 #pragma comment(lib, "d2d1")
 
@@ -34,9 +31,37 @@ const GUID g_MediaSubtypes[] =
     MFVideoFormat_UYVY
 };
 
+// Kernels for each subtype, one instantiation of the layout templates per
+// format: unfiltered, then filtered (used when the scratch is available),
+// and the colour edges where the format has them.
+struct TRANSFORM_ENTRY
+{
+    const GUID          *pSubtype;
+    IMAGE_TRANSFORM_FN  pEdgeFn;
+    IMAGE_TRANSFORM_FN  pEdgeFFn;
+    IMAGE_BAND_FN       pEdgeBandFn;
+    IMAGE_BAND_FN       pEdgeFBandFn;
+    SKETCH_TILE_FN      pEdgeTileFn;
+    SKETCH_TILE_FN      pEdgeFTileFn;
+    IMAGE_SCALED_FN     pEdgeScaledFn;
+    IMAGE_TRANSFORM_FN  pEdgeColorFn;
+};
+
+#define TRANSFORM_ENTRY_OF(subtype, LAYOUT, colorFn) \
+    { &subtype, EdgeDectection<LAYOUT>, EdgeDectectionF<LAYOUT>, EdgeDectectionBand<LAYOUT>, EdgeDectectionFBand<LAYOUT>, \
+      EdgeDectectionTile<LAYOUT>, EdgeDectectionFTile<LAYOUT>, EdgeDectectionScaled<LAYOUT>, colorFn }
+
+const TRANSFORM_ENTRY g_TransformFns[] =
+{
+    TRANSFORM_ENTRY_OF(MFVideoFormat_NV12, SKETCH_LAYOUT_NV12, NULL),
+    TRANSFORM_ENTRY_OF(MFVideoFormat_YUY2, SKETCH_LAYOUT_YUY2, EdgeDectection_YUY2RGB),
+    TRANSFORM_ENTRY_OF(MFVideoFormat_UYVY, SKETCH_LAYOUT_UYVY, NULL)
+};
+
 HRESULT GetImageSize(DWORD fcc, UINT32 width, UINT32 height, DWORD* pcbImage);
 HRESULT GetDefaultStride(IMFMediaType *pType, LONG *plStride);
 bool ValidateRect(const RECT& rc);
+bool ValidateRegions(const SKETCH_REGION *pRegions, UINT32 cbRegions);
 
 template <typename T>
 inline T clamp(const T& val, const T& minVal, const T& maxVal)
@@ -44,947 +69,22 @@ inline T clamp(const T& val, const T& minVal, const T& maxVal)
     return (val < minVal ? minVal : (val > maxVal ? maxVal : val));
 }
 
-
-#define abs(x) (x>0) ? (x) : -(x)
-#define GRAYTHRESH 48
-#define GETPIXELVALUE(val) (255 - ((val+26<255) ? (BYTE)(val+26) : 255))
-//#define GETPIXELVALUE(val) (((val+GRAYTHRESH)<255) ? (BYTE)(val+GRAYTHRESH) : 255);
-
-//-------------------------------------------------------------------
-// Functions to get median value of input 9 parameters.
-//------------------------------------------------------------------
-
-///
-///get median value
-///
-BYTE GetMedian(BYTE _11, BYTE _12, BYTE _13,
-			   BYTE _21, BYTE _22, BYTE _23,
-			   BYTE _31, BYTE _32, BYTE _33)
-{
-	DWORD L = 9;
-	BYTE data[9] = {_11, _12, _13, 
-					_21, _22, _23,
-					_31, _32, _33}; 
-	/*DWORD L = 5;
-	BYTE data[5] = { _12, _21, _22, _23, _32};*/
-
-#if 0
-	//bubble
-	bool sorted;
-	for (DWORD i=0; i<L-1; i++)
-	{
-		sorted = true;
-		for (DWORD j=0; j<L-i-1; j++)
-		{
-			if (data[j] > data[j+1] )
-			{
-				BYTE tmp = data[j+1];
-				data[j+1] = data[j];
-				data[j] = tmp;
-				sorted = false;
-			}
-		}
-		if (sorted)
-			break;
-	}
-	return data[L>>1];
-#else
-	//quick sort
-	//int partition(int data[], int p, int r)
-	DWORD p, r;
-	DWORD M = (L+1)>>1;
-	p = 0;
-	r = L-1;
-
-	while (true)
-	{
-		DWORD i,j;
-		BYTE pivot = data[p];
-
-		i = p;
-		j = r;
-		while(i<j)
-		{
-			while(i<j && data[j]>=pivot) --j;
-			data[i] = data[j];
-			while(i<j && data[i]<=pivot) ++i;
-			data[j] = data[i];
-		}
-		data[i] = pivot;
-		if (i+1 == M)
-		{
-			return data[i];
-		}
-		else if(i+1 < M)
-		{
-			p = i+1;
-		}
-		else
-		{
-			r = i-1;
-		}
-	}
-	return data[0];
-#endif
-}
-
-///
-///Using C++ STL lib functions to get median value
-///
-using std::vector;
-inline BYTE GetMedianSTL(	BYTE _11, BYTE _12, BYTE _13,
-						BYTE _21, BYTE _22, BYTE _23,
-						BYTE _31, BYTE _32, BYTE _33)
-{
-	vector<BYTE> vec;
-	vec.push_back(_11);	vec.push_back(_12);	vec.push_back(_13);
-	vec.push_back(_21);	vec.push_back(_22);	vec.push_back(_23);
-	vec.push_back(_31);	vec.push_back(_32);	vec.push_back(_33);
-
-	std::sort(vec.begin(), vec.end());
-	return vec[vec.size()>>1];
-}
-
-//-------------------------------------------------------------------
-// Functions to do median filtering on Y component of YUV images.
-//
-// Three YUV formats which have difference pixel layout in memory
-// are supported here:
-// YUY2:	Y0 U0 Y1 V1 Y2 U1 ... 
-// UYVY:	U0 Y0 V0 Y1 U1 Y2 ...
-// NV12:	YYYYYYYY
-//			YYYYYYYY
-//			YYYYYYYY
-//			YYYYYYYY
-//			UVUVUVUV
-//			UVUVUVUV
-//
-// The filtering functions take the following parameters:
-//
-// pDest             Pointer to the destination buffer, sizeof which
-//					 is imagewidth*imageheight in bytes.
-// pSrc              Pointer to the source buffer.
-// lSrcStride        Stride of the source buffer, in bytes.
-// lDestStride       Stride of the destination buffer, in bytes.
-// dwWidthInPixels   Frame width in pixels.
-// dwHeightInPixels  Frame height, in pixels.
-//-------------------------------------------------------------------
-
-///
-///Median filter for YUY2 image
-///
-void MedianFilter_YUY2(
-    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-	_In_ LONG lSrcStride, 
-	_In_ LONG lDestStride,		//width
-    _In_ DWORD dwWidthInPixels, 
-    _In_ DWORD dwHeightInPixels)
-{
-	DWORD y = 0;
-	DWORD pVal = 0;
-
-	//1st line
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x] = pSrc[x<<1];
-	}
-	pSrc	+= lSrcStride;
-	pDest	+= lDestStride;
-
-    for ( y=1; y < dwHeightInPixels-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-		BYTE *pDest_Pixel= (BYTE*)pDest;
-		DWORD x = 2, p = 1;
-
-		//1st column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-		
-		//Columns from the first to the last 
-		for ( ; p<dwWidthInPixels-1; x += 2, p++)
-        {
-			pDest_Pixel[p] = GetMedian(	pSrc_Pixel[x-2-lSrcStride], pSrc_Pixel[x-lSrcStride], pSrc_Pixel[x+2-lSrcStride],
-										pSrc_Pixel[x-2],			pSrc_Pixel[x],				pSrc_Pixel[x+2],
-										pSrc_Pixel[x-2+lSrcStride],	pSrc_Pixel[x+lSrcStride],	pSrc_Pixel[x+2+lSrcStride]);
-        }
-
-		//Last column
-		pDest_Pixel[p] = pSrc_Pixel[x];
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-	}
-
-	//Last line
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x] = pSrc[x<<1];
-	}
-}
-
-
-///
-///Meidan filter for UYVY image.
-///
-void MedianFilter_UYVY(
-	_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-	_In_ LONG lSrcStride, 
-	_In_ LONG lDestStride,		
-    _In_ DWORD dwWidthInPixels, 
-    _In_ DWORD dwHeightInPixels)
-{
-	DWORD y = 0, pVal = 0;
-
-	//1st line
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x] = pSrc[(x<<1)+1];
-	}
-	pSrc	+= lSrcStride;
-	pDest	+= lDestStride;
-
-    for ( y=1; y < dwHeightInPixels-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-		BYTE *pDest_Pixel= (BYTE*)pDest;
-		DWORD x = 3, p = 1;
-
-		//1st column
-		pDest_Pixel[0] = pSrc_Pixel[1];
-		
-		//Columns from the first to the last 
-		for ( ; p<dwWidthInPixels-1; x += 2, p++)
-        {
-			pDest_Pixel[p] = GetMedian(	pSrc_Pixel[x-2-lSrcStride], pSrc_Pixel[x-lSrcStride], pSrc_Pixel[x+2-lSrcStride],
-										pSrc_Pixel[x-2],			pSrc_Pixel[x],				pSrc_Pixel[x+2],
-										pSrc_Pixel[x-2+lSrcStride],	pSrc_Pixel[x+lSrcStride],	pSrc_Pixel[x+2+lSrcStride]);
-        }
-
-		//Last column
-		pDest_Pixel[p] = pSrc_Pixel[x];
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-	}
-
-	//Last line
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x] = pSrc[(x<<1)+1];
-	}
-}
-
-///
-///Median filter for NV12 image
-///
-void MedianFilter_NV12(
-	_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-	_In_ LONG lSrcStride, 
-	_In_ LONG lDestStride,		
-    _In_ DWORD dwWidthInPixels, 
-    _In_ DWORD dwHeightInPixels)
-{
-	DWORD y = 0, pVal = 0;
-
-	//1st line
-	memcpy(pDest, pSrc, lDestStride*sizeof(BYTE));
-	pSrc	+= lSrcStride;
-	pDest	+= lDestStride;
-
-	for (y=1; y<dwHeightInPixels-1; y++)
-	{
-		BYTE *pSrc_Pixel	= (BYTE*)pSrc;
-		BYTE *pDest_Pixel	= (BYTE*)pDest;
-		DWORD x;
-
-		//The 1st column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-
-		for (x=1; x<dwWidthInPixels-1; x++)
-		{
-			pDest_Pixel[x] = GetMedian( pSrc_Pixel[x-1-lSrcStride], pSrc_Pixel[x-lSrcStride],	pSrc_Pixel[x+1-lSrcStride],
-										pSrc_Pixel[x-1],			pSrc_Pixel[x],				pSrc_Pixel[x+1],
-										pSrc_Pixel[x-1+lSrcStride], pSrc_Pixel[x+lSrcStride],	pSrc_Pixel[x+1+lSrcStride]);
-		}
-
-		//last column
-		pDest_Pixel[x] = pSrc_Pixel[x];
-
-		pDest	+= lDestStride;
-		pSrc	+= lSrcStride;
-	}
-
-	//last line
-	memcpy(pDest, pSrc, lDestStride*sizeof(BYTE));
-}
-
-
-//-------------------------------------------------------------------
-// Functions to do image detection, which take the following parameters:
-//
-// mat               Transfomation matrix for chroma values.
-// rcDest            Destination rectangle.
-// pDest             Pointer to the destination buffer.
-// lDestStride       Stride of the destination buffer, in bytes.
-// pSrc              Pointer to the source buffer.
-// lSrcStride        Stride of the source buffer, in bytes.
-// dwWidthInPixels   Frame width in pixels.
-// dwHeightInPixels  Frame height, in pixels.
-//-------------------------------------------------------------------
-
-///
-///Edge detection for YUY2 image
-///
-void EdgeDectection_YUY2(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE *pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-    // Lines above the destination rectangle and the first line in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
-
-	// Lines from the first to the last line [1, y0)
-    for ( y=1; y < y0-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-
-		//Pixel in the fist column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-		pDest_Pixel[1] = 128;	//u
-
-		//Columns from the first to the last 
-		for (DWORD x = 2, p = 0; (LONG)x < lSrcStride-2; x += 2, p++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+x)-*(pSrc_Pixel+lSrcStride+x+2)) + abs(*(pSrc_Pixel+x+2)-*(pSrc_Pixel+lSrcStride+x));
-			
-			//Laplician detector
-			//	1	1	1
-			//	1	-8	1
-			//	1	1	1
-			/*SHORT tmp = 0;
-			tmp =	*(pSrc_Pixel+x-2) + *(pSrc_Pixel+x+2);
-			tmp	+=	*(pSrc_Pixel+x-2 - lSrcStride) + *(pSrc_Pixel+x - lSrcStride) + *(pSrc_Pixel+x+2 - lSrcStride);
-			tmp +=	*(pSrc_Pixel+x-2 + lSrcStride) + *(pSrc_Pixel+x + lSrcStride) + *(pSrc_Pixel+x+2 + lSrcStride);
-			tmp -= pSrc_Pixel[x]*8;
-			pVal = abs(tmp);*/
-			
-			//
-			//pDest_Pixel[x] = (pVal>30) ? 0 : 210;							//threshhold way
-			//pDest_Pixel[x] = 255 - ((pVal+32<255) ? pVal+32 : 255);		//white bck.
-			//pDest_Pixel[x] = (pVal+64<255) ? pVal+64 : 255;
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-
-			//to U/V Comp.
-			pDest_Pixel[x+1] = 128;	
-        }
-
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-2] = pSrc_Pixel[lSrcStride-2];
-		pDest_Pixel[lDestStride-1] = 128; //v
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-
-    //The last line in the dest. rect. 
-	memcpy(pDest, pSrc, dwWidthInPixels * 2);
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[(x<<1)+1] = 128;		//u, v
-	}
-}
-
-//
-// Edge detection with filter for YUY2 image
-//
-void EdgeDectectionF_YUY2(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE* pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-	//Apply median filter to Y comp.
-	MedianFilter_YUY2(pFilteredYSrc, pSrc,lSrcStride, dwWidthInPixels, dwWidthInPixels, dwHeightInPixels);
-
-	const BYTE *pSrcFiltered = pFilteredYSrc;
-
-    // Lines above the destination rectangle and the first line in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-		pSrcFiltered += dwWidthInPixels;
-    }
-
-	// Lines from the first to the last line [1, y0)
-	for ( y=1; y < dwHeightInPixels-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrcFiltered;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-
-		//Pixel in the fist column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-		pDest_Pixel[1] = 128;	//u
-
-		//Columns from the first to the last 
-		for (DWORD x = 2, p = 1; (LONG)x < lSrcStride-2; x += 2, p++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+p)-*(pSrc_Pixel+dwWidthInPixels+p+1)) + abs(*(pSrc_Pixel+p+1)-*(pSrc_Pixel+lSrcStride+p));
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-
-			//to U/V Comp.
-			pDest_Pixel[x+1] = 128;	
-        }
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-2] = pSrc_Pixel[dwWidthInPixels-1];
-		pDest_Pixel[lDestStride-1] = 128; //v
-
-        pDest	+= lDestStride;
-		pSrc	+= lSrcStride;
-		pSrcFiltered += dwWidthInPixels;
-    }
-
-    //The last line in the dest. rect. 
-	memcpy(pDest, pSrc, dwWidthInPixels * 2);
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[(x<<1)+1] = 128;		//u, v
-	}
-}
-
-///
-///Edge detection for UYVY image
-///
-void EdgeDectection_UYVY(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE *pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-    // Lines above the destination rectangle and the first line in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
-
-	// Lines between the first and the last line [1, y0)
-    for ( y=1; y < y0-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-
-		//Pixel in the fist column
-		pDest_Pixel[0] = 128;	//u
-		pDest_Pixel[1] = pSrc_Pixel[1];
-
-		//Columns from the first to the last 
-		for (DWORD x = 3, p = 0; (LONG)x < lSrcStride-1; x += 2, p++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+x)-*(pSrc_Pixel+lSrcStride+x+2)) + abs(*(pSrc_Pixel+x+2)-*(pSrc_Pixel+lSrcStride+x));
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-
-			//to U/V Comp.
-			pDest_Pixel[x-1] = 128;	
-        }
-
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-2] = 128; //v
-		pDest_Pixel[lDestStride-1] = pSrc_Pixel[lSrcStride-1];
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-
-    //The last line in the dest. rect. 
-	memcpy(pDest, pSrc, dwWidthInPixels * 2);
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x<<1] = 128;		//u, v
-	}
-}
-
-///
-/// Ede detection with filtr for UYVY image
-///
-void EdgeDectectionF_UYVY(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE* pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-	//Apply median filter to Y comp.
-	MedianFilter_UYVY(pFilteredYSrc, pSrc,lSrcStride, dwWidthInPixels, dwWidthInPixels, dwHeightInPixels);
-
-	const BYTE *pSrcFiltered = pFilteredYSrc;
-
-    // Lines above the destination rectangle and the first line (line 0) in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-		pSrcFiltered += dwWidthInPixels;
-    }
-
-	// Lines from the first to the last line [1, y0)
-    for ( y=1; y < y0-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrcFiltered;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-
-		//Pixel in the first column
-		pDest_Pixel[0] = 128;	//U
-		pDest_Pixel[1] = pSrc_Pixel[1];
-
-		//Columns from the first to the last 
-		for (DWORD x = 3, p = 1; p < dwWidthInPixels-1; x += 2, p++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+p)-*(pSrc_Pixel+dwWidthInPixels+p+1)) + abs(*(pSrc_Pixel+p+1)-*(pSrc_Pixel+lSrcStride+p));
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-
-			//to U/V Comp.
-			pDest_Pixel[x-1] = 128;	
-        }
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-1] = pSrc_Pixel[dwWidthInPixels-1];
-		pDest_Pixel[lDestStride-2] = 128; //v
-
-        pDest	+= lDestStride;
-		pSrc	+= lSrcStride;
-		pSrcFiltered += dwWidthInPixels;
-    }
-
-     //The last line in the dest. rect. 
-	memcpy(pDest, pSrc, dwWidthInPixels * 2);
-	for (DWORD x=0; x<dwWidthInPixels; x++)
-	{
-		pDest[x<<1] = 128;		//u, v
-	}
-}
-
-///
-///Edge detection for NV12 image
-///
-void EdgeDectection_NV12(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE *pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-	//-----------------------------------------------------------------------------------------//
-	// Y component
-	//-----------------------------------------------------------------------------------------//
-
-    // Lines above the destination rectangle and the first line in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
-
-	// Lines between the first and the last line [1, y0)
-    for ( y=1; y < y0-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-		DWORD x;
-
-		//Pixel in the fist column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-
-		//Columns from the first to the last 
-		for (x = 1; (LONG)x < lSrcStride-1; x ++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+x)-*(pSrc_Pixel+lSrcStride+x+1)) + abs(*(pSrc_Pixel+x+1)-*(pSrc_Pixel+lSrcStride+x));
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-        }
-
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-1] = pSrc_Pixel[lSrcStride-1];
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-
-    //The last line in the dest. rect. 
-	memcpy(pDest, pSrc, dwWidthInPixels);
-	pDest	+= lDestStride;
-
-	//-----------------------------------------------------------------------------------------//
-	// U/V component
-	//-----------------------------------------------------------------------------------------//
-	memset(pDest, 128, (dwHeightInPixels>>1)*dwWidthInPixels);
-}
-
-///
-/// Edde detection with filter for NV12 image
-///
-void EdgeDectectionF_NV12(
-const D2D1::Matrix3x2F& mat,
-const D2D_RECT_U& rcDest,
-_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-_In_ LONG lDestStride, 
-_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-_In_ LONG lSrcStride, 
-_In_ DWORD dwWidthInPixels, 
-_In_ DWORD dwHeightInPixels,
-_In_ BYTE* pFilteredYSrc)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-	// Apply median filter to Y comp.
-	MedianFilter_NV12(pFilteredYSrc, pSrc,lSrcStride, dwWidthInPixels, dwWidthInPixels, dwHeightInPixels);
-
-	const BYTE *pSrcFiltered = pFilteredYSrc;
-
-	//-----------------------------------------------------------------------------------------//
-	// Y component
-	//-----------------------------------------------------------------------------------------//
-	// The first line
-	memcpy(pDest, pSrc, lDestStride);
-	pSrc	+= lSrcStride;
-	pDest	+= lDestStride;
-
-	// Lines between the 2nd and the last line
-	for ( y=1; y<dwHeightInPixels-1; y++)
-	{
-		BYTE *pSrc_Pixel = (BYTE*)pSrcFiltered;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-		DWORD x;
-
-		// Pixel in the first column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-
-		//Columns between the first and the last column
-		for (x = 1; x < dwWidthInPixels-1; x ++)
-        {
-			DWORD dwVal = 0;
-
-			//Roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal	=	abs(*(pSrc_Pixel+x)-*(pSrc_Pixel+dwWidthInPixels+x+1)) + abs(*(pSrc_Pixel+x+1)-*(pSrc_Pixel+lSrcStride+x));
-
-			//
-			dwVal = pVal*pVal;	
-			pDest_Pixel[x] = GETPIXELVALUE(dwVal);
-        }
-
-		//The last column
-		pDest_Pixel[x] = pSrc_Pixel[x];
-
-		pSrc	+= lSrcStride;
-		pDest	+= lDestStride;
-		pSrcFiltered += dwWidthInPixels;
-	}
-
-	//The last line
-	memcpy(pDest, pSrc, dwWidthInPixels);
-	pDest	+= lDestStride;
-
-	
-	//-----------------------------------------------------------------------------------------//
-	// U/V component
-	//-----------------------------------------------------------------------------------------//
-	memset(pDest, 128, (dwHeightInPixels>>1)*dwWidthInPixels);
-}
-
-
-///
-///Convert YUY2 data to RGB pixels
-///
-void YUY2toRGB(
-    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-	_In_ LONG lSrcStride, 
-	_In_ LONG lDestStride,		//width
-    _In_ DWORD dwWidthInPixels, 
-    _In_ DWORD dwHeightInPixels)
-{
-	DWORD y = 0;
-	DWORD pVal = 0;
-
-    for ( y=0; y < dwHeightInPixels; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-        BYTE *pR = (BYTE*)pDest;
-		BYTE *pG = pR + dwWidthInPixels*dwHeightInPixels;
-		BYTE *pB = pG + dwWidthInPixels*dwHeightInPixels;
-
-		//Columns from the first to the last 
-		for (DWORD x = 0, p = 0; p<dwWidthInPixels; x += 2, p++)
-        {
-			SHORT rdif=0, invdif=0, bdif=0;
-			/*float a = 0;
-			float b = 0;
-			float c = 0;
-			if (p%2==0)
-			{
-				SHORT U, V;
-				U = pSrc_Pixel[x+1] - 128;
-				V = pSrc_Pixel[x+3] - 128;
-				a = 1.5*V;
-				b = 0.35*U + 0.7*V;
-				c = 1.8*U;
-			}
-			pR[p] = (pSrc_Pixel[x] + a)>255 ? 255 : (BYTE)(pSrc_Pixel[x] + a);
-			pG[p] = (pSrc_Pixel[x] - b)>255 ? 255 : (BYTE)(pSrc_Pixel[x] - b);
-			pB[p] = (pSrc_Pixel[x] + c)>255 ? 255 : (BYTE)(pSrc_Pixel[x] + c);*/
-			if (p%2 == 0)
-			{
-				SHORT U, V;
-				U = pSrc_Pixel[x+1] - 128;
-				V = pSrc_Pixel[x+3] - 128;
-				rdif	 = V + ((V*103)>>8);
-				invdif	 = ((U*88)>>8) + ((V*183)>>8);
-				bdif	 = U + ((U*198>>8));
-			}			
-			pVal	= (pSrc_Pixel[x] + rdif);
-			pR[p]	= pVal > 255 ? 255 : (BYTE)pVal;
-			pVal	= pSrc_Pixel[x] - invdif;
-			pG[p]	= pVal > 255 ? 255 : (BYTE)pVal;
-			pVal	= pSrc_Pixel[x] + bdif;
-			pB[p]	= pVal > 255 ? 255 : (BYTE)pVal;
-        }
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-
-}
-
-///
-///Do edge detection on RGB data
-///
-void EdgeDectection_YUY2RGB(
-    const D2D1::Matrix3x2F& mat,
-    const D2D_RECT_U& rcDest,
-    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
-    _In_ LONG lDestStride, 
-    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
-    _In_ LONG lSrcStride, 
-    _In_ DWORD dwWidthInPixels, 
-    _In_ DWORD dwHeightInPixels)
-{
-	DWORD y = 0;
-    const DWORD y0 = min(rcDest.bottom, dwHeightInPixels);
-	DWORD pVal = 0;
-
-	BYTE *rgbBuf, *pR;
-	rgbBuf = (BYTE*)calloc(dwHeightInPixels*dwWidthInPixels*3, sizeof(BYTE));
-
-	//convert yuv to rgb
-	YUY2toRGB(rgbBuf, pSrc,lSrcStride, dwWidthInPixels, dwWidthInPixels, dwHeightInPixels);
-
-    // Lines above the destination rectangle and the first line in the dest. Rec.
-    for ( ; y < rcDest.top + 1; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
-
-	pR = rgbBuf;
-	pR += dwWidthInPixels;
-
-	// Lines from the first to the last line [1, y0)
-    for ( y=1; y < y0-1; y++)
-    {
-        BYTE *pSrc_Pixel = (BYTE*)pSrc;
-        BYTE *pDest_Pixel = (BYTE*)pDest;
-		BYTE *pG = pR + dwWidthInPixels*dwHeightInPixels;
-		BYTE *pB = pG + dwWidthInPixels*dwHeightInPixels;
-
-		//Pixel in the fist column
-		pDest_Pixel[0] = pSrc_Pixel[0];
-		pDest_Pixel[1] = 128;	//u
-
-		//Columns from the first to the last 
-		for (DWORD x = 2, p = 1; (LONG)x < lSrcStride-2; x += 2, p++)
-        {
-			//Apply roberts detector.
-			//	P1	p2
-			//	P3	P4
-			//  P1 = |p1-p4|+|p2-p3|
-			pVal =	abs(pR[p]-pR[p+dwWidthInPixels+1])+abs(pR[p+1]-pR[p+dwWidthInPixels]);
-			pVal +=	abs(pG[p]-pG[p+dwWidthInPixels+1])+abs(pG[p+1]-pG[p+dwWidthInPixels]);
-			pVal += abs(pB[p]-pB[p+dwWidthInPixels+1])+abs(pB[p+1]-pB[p+dwWidthInPixels]);
-			
-			//Laplician detector
-			//	1	1	1
-			//	1	-8	1
-			//	1	1	1
-			/*SHORT tmp = 0;
-			tmp =	pR[p-1] + pR[p+1];
-			tmp +=  pR[p-1-dwWidthInPixels] + pR[p-dwWidthInPixels] + pR[p-dwWidthInPixels+1];
-			tmp +=  pR[p-1+dwWidthInPixels] + pR[p+dwWidthInPixels] + pR[p+dwWidthInPixels+1];
-			tmp -=  8*pR[p];
-			pVal = abs(tmp);
-			tmp =	pG[p-1] + pG[p+1];
-			tmp +=  pG[p-1-dwWidthInPixels] + pG[p-dwWidthInPixels] + pG[p-dwWidthInPixels+1];
-			tmp +=  pG[p-1+dwWidthInPixels] + pG[p+dwWidthInPixels] + pG[p+dwWidthInPixels+1];
-			tmp -=  8*pG[p];
-			pVal  += abs(tmp);
-			tmp =	pB[p-1] + pB[p+1];
-			tmp +=  pB[p-1-dwWidthInPixels] + pB[p-dwWidthInPixels] + pB[p-dwWidthInPixels+1];
-			tmp +=  pB[p-1+dwWidthInPixels] + pB[p+dwWidthInPixels] + pB[p+dwWidthInPixels+1];
-			tmp -=  8*pB[p];
-			pVal += abs(tmp);*/
-
-			/*float ftmp = 0.3*pR[p] + 0.6*pG[p] + 0.1*pB[p];
-			pDest_Pixel[x] = ((BYTE)ftmp)<255 ? (BYTE)ftmp : 255;*/
-			
-			//pDest_Pixel[x] = (pVal>35) ? 0 : 255;					//threshhold way
-			//pDest_Pixel[x] = 255 - ((pVal<255) ? pVal : 255);		//white bck.
-			pDest_Pixel[x] = (pVal<255) ? (BYTE)pVal : 255;
-
-			//to U/V Comp.
-			pDest_Pixel[x+1] = 128;	
-        }
-
-
-		//Pixel in the last column
-		pDest_Pixel[lDestStride-2] = pSrc_Pixel[lSrcStride-2];
-		pDest_Pixel[lDestStride-1] = 128; //v
-
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-		pR += dwWidthInPixels;
-    }
-
-    // Lines below the destination rectangle. and the last line in the dest. rect. 
-    for ( ; y < dwHeightInPixels; y++)
-    {
-        memcpy(pDest, pSrc, dwWidthInPixels * 2);
-        pSrc += lSrcStride;
-        pDest += lDestStride;
-    }
-
-	if (rgbBuf)
-	{
-		free(rgbBuf);
-	}
-}
+// The median filters and edge detectors live in the portable SketchKernels
+// library (MediaExtensions\SketchKernels).
 
 CGrayscale::CGrayscale() :
-    m_pSample(NULL), m_pInputType(NULL), m_pOutputType(NULL), m_pTransformFn(NULL),m_pFilteredYSrc(NULL),
+    m_pSample(NULL), m_pInputType(NULL), m_pOutputType(NULL), m_pTransformFn(NULL), m_pBandFn(NULL), m_pScaledFn(NULL), m_pFilteredYSrc(NULL),
+    m_pScaledScratch(NULL), m_dwScale(1), m_pColorFn(NULL), m_pColorScratch(NULL), m_pThreadPool(NULL), m_pTemporal(NULL),
+    m_pFrameQueue(NULL), m_pJobs(NULL), m_pFreeJobs(NULL), m_pSampleAllocator(NULL), m_bDraining(FALSE), m_bInPlace(FALSE),
     m_imageWidthInPixels(0), m_imageHeightInPixels(0), m_cbImageSize(0),
-    m_transform(D2D1::Matrix3x2F::Identity()), m_rcDest(D2D1::RectU()), m_bStreamingInitialized(false),
+    m_rcDest(D2D1::RectU()), m_cRegions(0),
+    m_prefilter(SKETCH_PREFILTER_MEDIAN3), m_dwMedianRadius(0), m_bStreamingInitialized(false),
 	m_pAttributes(NULL), m_bBlackFigure(FALSE)
 {
     InitializeCriticalSectionEx(&m_critSec, 3000, 0);
+    InitializeCriticalSectionEx(&m_counters.critSec, 3000, 0);
+    m_counters.cThreads = 0;
+    m_counters.bTemporal = FALSE;
 }
 
 CGrayscale::~CGrayscale()
@@ -994,10 +94,18 @@ CGrayscale::~CGrayscale()
     SafeRelease(&m_pSample);
     SafeRelease(&m_pAttributes);
 
-	if (m_pFilteredYSrc)
-	{
-		free(m_pFilteredYSrc);
-	}
+    // The queue's worker uses the pool and the scratch; stop it first.
+    if (m_pFrameQueue != NULL)
+    {
+        FlushFrameQueue();
+        DeleteFrameQueue();
+    }
+    SafeRelease(&m_pSampleAllocator);
+
+    m_scratch.Release();
+    delete m_pTemporal;
+    delete m_pThreadPool;
+    DeleteCriticalSection(&m_counters.critSec);
     DeleteCriticalSection(&m_critSec);
 }
 
@@ -1175,6 +283,11 @@ HRESULT CGrayscale::GetOutputStreamInfo(
         MFT_OUTPUT_STREAM_SINGLE_SAMPLE_PER_BUFFER |
         MFT_OUTPUT_STREAM_FIXED_SAMPLE_SIZE ;
 
+    if (ProvidesSamples())
+    {
+        pStreamInfo->dwFlags |= MFT_OUTPUT_STREAM_PROVIDES_SAMPLES;
+    }
+
     if (m_pOutputType == NULL)
     {
         pStreamInfo->cbSize = 0;
@@ -1205,6 +318,8 @@ HRESULT CGrayscale::GetAttributes(IMFAttributes** ppAttributes)
 
     EnterCriticalSection(&m_critSec);
 
+    PublishCounters();
+
     *ppAttributes = m_pAttributes;
     (*ppAttributes)->AddRef();
 
@@ -1592,7 +707,14 @@ HRESULT CGrayscale::GetInputStatus(
     // samples. For the video effect, each sample is transformed independently, so
     // there is no reason to queue multiple input samples.
 
-    if (m_pSample == NULL)
+    // In asynchronous mode, input is accepted until the queue is full.
+
+    if (IsAsync())
+    {
+        BOOL bAccept = !m_bDraining && m_pFrameQueue->GetCount() < m_pFrameQueue->GetDepth();
+        *pdwFlags = bAccept ? MFT_INPUT_STATUS_ACCEPT_DATA : 0;
+    }
+    else if (m_pSample == NULL)
     {
         *pdwFlags = MFT_INPUT_STATUS_ACCEPT_DATA;
     }
@@ -1622,7 +744,8 @@ HRESULT CGrayscale::GetOutputStatus(DWORD *pdwFlags)
     EnterCriticalSection(&m_critSec);
 
     // The MFT can produce an output sample if (and only if) there an input sample.
-    if (m_pSample != NULL)
+    // In asynchronous mode, once the oldest queued sample is transformed.
+    if (IsAsync() ? m_pFrameQueue->IsCompletedReady() : m_pSample != NULL)
     {
         *pdwFlags = MFT_OUTPUT_STATUS_SAMPLE_READY;
     }
@@ -1692,8 +815,12 @@ HRESULT CGrayscale::ProcessMessage(
         // Drain: Tells the MFT to reject further input until all pending samples are
         // processed. That is our default behavior already, so there is nothing to do.
         //
-        // For a decoder that accepts a queue of samples, the MFT might need to drain
-        // the queue in response to this command.
+        // In asynchronous mode, refuse input until ProcessOutput has returned every
+        // queued sample.
+        if (IsAsync() && m_pFrameQueue->GetCount() > 0)
+        {
+            m_bDraining = TRUE;
+        }
     break;
 
     case MFT_MESSAGE_SET_D3D_MANAGER:
@@ -1787,6 +914,13 @@ HRESULT CGrayscale::ProcessInput(
         goto done;
     }
 
+    // In asynchronous mode, queue the sample and start on it right away.
+    if (IsAsync())
+    {
+        hr = OnQueueInput(pSample);
+        goto done;
+    }
+
     // Cache the sample. We do the actual work in ProcessOutput.
     m_pSample = pSample;
     pSample->AddRef();  // Hold a reference count on the sample.
@@ -1833,12 +967,6 @@ HRESULT CGrayscale::ProcessOutput(
         return E_INVALIDARG;
     }
 
-    // It must contain a sample.
-    if (pOutputSamples[0].pSample == NULL)
-    {
-        return E_INVALIDARG;
-    }
-
     HRESULT hr = S_OK;
 
     IMFMediaBuffer *pInput = NULL;
@@ -1846,6 +974,22 @@ HRESULT CGrayscale::ProcessOutput(
 
     EnterCriticalSection(&m_critSec);
 
+    // In asynchronous mode, hand back the oldest transformed sample.
+    if (IsAsync())
+    {
+        hr = OnDequeueOutput(pOutputSamples, pdwStatus);
+        LeaveCriticalSection(&m_critSec);
+        return hr;
+    }
+
+    // It must contain a sample, unless the input sample is returned in its
+    // place.
+    if (pOutputSamples[0].pSample == NULL && !ProvidesSamples())
+    {
+        LeaveCriticalSection(&m_critSec);
+        return E_INVALIDARG;
+    }
+
     // There must be an input sample available for processing.
     if (m_pSample == NULL)
     {
@@ -1861,15 +1005,38 @@ HRESULT CGrayscale::ProcessOutput(
         goto done;
     }
 
+    // In place: transform the input sample and hand it back, time stamps
+    // and all.
+    if (pOutputSamples[0].pSample == NULL)
+    {
+        hr = GetFrameBuffer(m_pSample, &pInput);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        hr = OnProcessOutput(pInput, pInput);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+
+        pOutputSamples[0].pSample = m_pSample;
+        pOutputSamples[0].pSample->AddRef();    // The caller releases it.
+        pOutputSamples[0].dwStatus = 0;
+        *pdwStatus = 0;
+        goto done;
+    }
+
     // Get the input buffer.
-    hr = m_pSample->ConvertToContiguousBuffer(&pInput);
+    hr = GetFrameBuffer(m_pSample, &pInput);
     if (FAILED(hr))
     {
         goto done;
     }
 
     // Get the output buffer.
-    hr = pOutputSamples[0].pSample->ConvertToContiguousBuffer(&pOutput);
+    hr = GetFrameBuffer(pOutputSamples[0].pSample, &pOutput);
     if (FAILED(hr))
     {
         goto done;
@@ -2091,6 +1258,13 @@ void CGrayscale::OnSetInputType(IMFMediaType *pmt)
         m_pInputType->AddRef();
     }
 
+    // Queued frames still use the current scratch, which the new format
+    // may reallocate.
+    if (m_pFrameQueue != NULL)
+    {
+        m_pFrameQueue->WaitIdle();
+    }
+
     // Update the format information.
     UpdateFormatInfo();
 }
@@ -2113,6 +1287,25 @@ void CGrayscale::OnSetOutputType(IMFMediaType *pmt)
 }
 
 
+// ProvidesSamples
+//
+// In asynchronous mode the frame is transformed before ProcessOutput is
+// called, so the MFT has to allocate the output sample itself. In place,
+// it returns the input sample. Once streaming has started this is what
+// BeginStreaming set up; before, it is what it will set up, so
+// GetOutputStreamInfo and ProcessOutput never disagree.
+
+BOOL CGrayscale::ProvidesSamples() const
+{
+    if (m_bStreamingInitialized)
+    {
+        return IsAsync() || m_bInPlace;
+    }
+    return MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_QUEUE_DEPTH, 0) > 0 ||
+        MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_IN_PLACE, 0) != 0;
+}
+
+
 // Initialize streaming parameters.
 //
 // This method is called if the client sends the MFT_MESSAGE_NOTIFY_BEGIN_STREAMING
@@ -2147,14 +1340,246 @@ HRESULT CGrayscale::BeginStreaming()
             goto done;
         }
 
-        // Get the chroma transformations.
-
-        float scale = (float)MFGetAttributeDouble(m_pAttributes, MFT_GRAYSCALE_SATURATION, 0.0f);
-        float angle = (float)MFGetAttributeDouble(m_pAttributes, MFT_GRAYSCALE_CHROMA_ROTATION, 0.0f);
+        // Get the destination regions, which replace the rectangle.
 
-        m_transform = D2D1::Matrix3x2F::Scale(scale, scale) * D2D1::Matrix3x2F::Rotation(angle);
-
-        m_bStreamingInitialized = true;
+        UINT32 cbRegions = 0;
+        hr = m_pAttributes->GetBlob(MFT_GRAYSCALE_DESTINATION_REGIONS, (UINT8*)m_rgRegions, sizeof(m_rgRegions), &cbRegions);
+        if (SUCCEEDED(hr) && ValidateRegions(m_rgRegions, cbRegions))
+        {
+            m_cRegions = cbRegions / sizeof(SKETCH_REGION);
+        }
+        else if (SUCCEEDED(hr) || hr == MF_E_ATTRIBUTENOTFOUND || hr == E_NOT_SUFFICIENT_BUFFER)
+        {
+            // Not set, or not a valid list (too long, for one): use the rectangle.
+            m_cRegions = 0;
+            hr = S_OK;
+        }
+        else
+        {
+            goto done;
+        }
+
+        // Get the chroma edges and the detector. The rectangle becomes a
+        // region of its own to carry them.
+
+        const BOOL bChromaEdges = (MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_CHROMA_EDGES, 0) != 0);
+        const UINT32 uDetector = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_DETECTOR, SKETCH_DETECTOR_ROBERTS);
+
+        if (bChromaEdges || uDetector != SKETCH_DETECTOR_ROBERTS)
+        {
+            if (m_cRegions == 0)
+            {
+                ZeroMemory(&m_rgRegions[0], sizeof(m_rgRegions[0]));
+                m_rgRegions[0].rc.left = m_rcDest.left;
+                m_rgRegions[0].rc.top = m_rcDest.top;
+                m_rgRegions[0].rc.right = m_rcDest.right;
+                m_rgRegions[0].rc.bottom = m_rcDest.bottom;
+                m_rgRegions[0].bThreshold = SKETCH_THRESHOLD_DEFAULT;
+                m_cRegions = 1;
+            }
+            for (DWORD i = 0; i < m_cRegions; i++)
+            {
+                if (bChromaEdges)
+                {
+                    m_rgRegions[i].bChroma = 1;
+                }
+                if (uDetector != SKETCH_DETECTOR_ROBERTS)
+                {
+                    m_rgRegions[i].bDetector = (uDetector < SKETCH_DETECTOR_COUNT) ? (BYTE)uDetector : SKETCH_DETECTOR_ROBERTS;
+                }
+            }
+        }
+
+        // Get the pre-filter.
+
+        const UINT32 uPrefilter = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_PREFILTER, SKETCH_PREFILTER_MEDIAN3);
+        m_prefilter = (uPrefilter < SKETCH_PREFILTER_COUNT) ? (SKETCH_PREFILTER)uPrefilter : SKETCH_PREFILTER_MEDIAN3;
+        m_dwMedianRadius = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_MEDIAN_RADIUS, 3);
+
+        // The radius median keeps more rows and its histograms in the
+        // filtered luma scratch, which the format sized for the others. If
+        // it cannot grow, the 5x5 median runs in what it had.
+
+        if (m_pFilteredYSrc != NULL)
+        {
+            m_pFilteredYSrc = m_scratch.Reserve(SKETCH_SCRATCH_FILTERED,
+                GetSketchScratchSize(m_imageWidthInPixels, m_prefilter, m_dwMedianRadius));
+            if (m_pFilteredYSrc == NULL)
+            {
+                m_prefilter = SKETCH_PREFILTER_MEDIAN5;
+                m_pFilteredYSrc = m_scratch.Reserve(SKETCH_SCRATCH_FILTERED, GetSketchScratchSize(m_imageWidthInPixels));
+                if (m_pFilteredYSrc == NULL)
+                {
+                    hr = E_OUTOFMEMORY;
+                    goto done;
+                }
+            }
+        }
+
+        // Get the thread count. The pool is kept across streaming sessions
+        // unless the count changes.
+
+        UINT32 cThreads = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_THREAD_COUNT, 0);
+        if (cThreads == 0)
+        {
+            SYSTEM_INFO si;
+            GetNativeSystemInfo(&si);
+            cThreads = si.dwNumberOfProcessors;
+        }
+        if (cThreads > SKETCH_MAX_THREADS)
+        {
+            cThreads = SKETCH_MAX_THREADS;
+        }
+
+        if (m_pThreadPool != NULL && m_pThreadPool->GetThreadCount() != cThreads)
+        {
+            delete m_pThreadPool;
+            m_pThreadPool = NULL;
+        }
+        if (m_pThreadPool == NULL && cThreads > 1)
+        {
+            // If this fails, frames are processed serially.
+            m_pThreadPool = new (std::nothrow) CSketchThreadPool(cThreads);
+            if (m_pThreadPool != NULL && !m_pThreadPool->IsRunning())
+            {
+                delete m_pThreadPool;
+                m_pThreadPool = NULL;
+            }
+        }
+        if (m_pThreadPool != NULL)
+        {
+            m_pThreadPool->SetTileRows(MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_TILE_ROWS, SKETCH_DEFAULT_TILE_ROWS));
+
+            // If this fails, the first frame tries again.
+            m_pThreadPool->ReserveTiles(m_imageHeightInPixels);
+        }
+
+        // Get the temporal tolerance. A new session starts from a whole
+        // frame either way.
+
+        UINT32 tolerance = 0;
+        if (SUCCEEDED(m_pAttributes->GetUINT32(MFT_GRAYSCALE_TEMPORAL_TOLERANCE, &tolerance)))
+        {
+            if (m_pTemporal != NULL && m_pTemporal->GetTolerance() != tolerance)
+            {
+                delete m_pTemporal;
+                m_pTemporal = NULL;
+            }
+            if (m_pTemporal == NULL)
+            {
+                // If this fails, every frame is transformed whole.
+                m_pTemporal = new (std::nothrow) CSketchTemporal(tolerance);
+            }
+            if (m_pTemporal != NULL)
+            {
+                m_pTemporal->Reset();
+            }
+        }
+        else
+        {
+            delete m_pTemporal;
+            m_pTemporal = NULL;
+        }
+
+        // Get the scale. The reduced planes are sized for the current
+        // format; if they cannot be allocated, edges are detected at full
+        // size.
+
+        m_dwScale = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_SCALE, 1);
+        if (m_dwScale != SKETCH_SCALE_2X && m_dwScale != SKETCH_SCALE_4X)
+        {
+            m_dwScale = 1;
+        }
+
+        m_pScaledScratch = NULL;
+        if (m_dwScale > 1 && m_pScaledFn != NULL)
+        {
+            m_pScaledScratch = m_scratch.Reserve(SKETCH_SCRATCH_SCALED,
+                GetSketchScaledScratchSize(m_imageWidthInPixels, m_imageHeightInPixels, m_dwScale, m_prefilter, m_dwMedianRadius));
+        }
+
+        // Get the colour edges, for formats that have them. If the RGB rows
+        // cannot be allocated, the luma is sketched.
+
+        m_pColorScratch = NULL;
+        if (MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_COLOR_EDGES, 0) != 0 && m_pColorFn != NULL)
+        {
+            m_pColorScratch = m_scratch.Reserve(SKETCH_SCRATCH_RGB, GetSketchRGBScratchSize(m_imageWidthInPixels));
+        }
+
+        // Get the in-place mode. Until streaming starts, ProvidesSamples
+        // reads the attribute itself.
+
+        m_bInPlace = (MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_IN_PLACE, 0) != 0);
+
+        // Get the instruction set tier. The tier is process-wide, so it is
+        // only changed when the attribute is set: otherwise the tier forced
+        // through the SKETCH_CPU_TIER environment variable, or by another
+        // instance, stays. One the CPU lacks leaves the current tier in
+        // place; the tier in use is reported either way.
+
+        UINT32 tier = SKETCH_TIER_AUTO;
+        if (SUCCEEDED(m_pAttributes->GetUINT32(MFT_GRAYSCALE_CPU_TIER, &tier)))
+        {
+            (void)SetSketchTier((SKETCH_CPU_TIER)tier);
+        }
+        (void)m_pAttributes->SetUINT32(MFT_GRAYSCALE_CPU_TIER_IN_USE, GetSketchTier());
+
+        // Get the queue depth. A queue still holding samples from the last
+        // session is kept until they have been returned.
+
+        UINT32 cQueueDepth = MFGetAttributeUINT32(m_pAttributes, MFT_GRAYSCALE_QUEUE_DEPTH, 0);
+
+        if (m_pFrameQueue != NULL && m_pFrameQueue->GetDepth() != cQueueDepth && m_pFrameQueue->GetCount() == 0)
+        {
+            DeleteFrameQueue();
+        }
+        if (m_pFrameQueue == NULL && cQueueDepth > 0)
+        {
+            // GetOutputStreamInfo has already told the client that the MFT
+            // allocates output samples, so there is no falling back here.
+            m_pFrameQueue = new (std::nothrow) CSketchFrameQueue(cQueueDepth, ProcessFrameJob);
+            m_pJobs = new (std::nothrow) FRAME_JOB[cQueueDepth];
+            if (m_pFrameQueue == NULL || !m_pFrameQueue->IsRunning() || m_pJobs == NULL)
+            {
+                DeleteFrameQueue();
+                hr = E_OUTOFMEMORY;
+                goto done;
+            }
+
+            ZeroMemory(m_pJobs, cQueueDepth * sizeof(FRAME_JOB));
+            for (UINT32 i = 0; i < cQueueDepth; i++)
+            {
+                m_pJobs[i].pNextFree = (i + 1 < cQueueDepth) ? &m_pJobs[i + 1] : NULL;
+            }
+            m_pFreeJobs = m_pJobs;
+        }
+
+        // Allocate the output samples of this format up front. Samples of
+        // an earlier format still queued or held by the client go back to
+        // the allocator they came from. Setting the output type ends
+        // streaming, so there is one by the time a sample is queued.
+
+        SafeRelease(&m_pSampleAllocator);
+        if (m_pFrameQueue != NULL && !m_bInPlace && m_pOutputType != NULL)
+        {
+            const DWORD cSamples = 2 * m_pFrameQueue->GetDepth();
+
+            hr = MFCreateVideoSampleAllocatorEx(IID_PPV_ARGS(&m_pSampleAllocator));
+            if (FAILED(hr))
+            {
+                goto done;
+            }
+
+            hr = m_pSampleAllocator->InitializeSampleAllocatorEx(cSamples, cSamples, NULL, m_pOutputType);
+            if (FAILED(hr))
+            {
+                SafeRelease(&m_pSampleAllocator);
+                goto done;
+            }
+        }
+
+        m_bStreamingInitialized = true;
     }
 
 done:
@@ -2170,15 +1595,107 @@ done:
 
 HRESULT CGrayscale::EndStreaming()
 {
+    // Queued samples keep their own format, but they share the thread pool,
+    // which BeginStreaming may replace. Let them finish first; they can
+    // still be collected with ProcessOutput.
+    if (m_pFrameQueue != NULL)
+    {
+        m_pFrameQueue->WaitIdle();
+    }
+
     m_bStreamingInitialized = false;
     return S_OK;
 }
 
 
 
+// Capture the parameters for transforming one frame in the current format.
+
+HRESULT CGrayscale::GetFrameParams(FRAME_PARAMS *pParams)
+{
+    HRESULT hr = GetDefaultStride(m_pInputType, &pParams->lDefaultStride);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    SKETCH_RECT rcDest = { m_rcDest.left, m_rcDest.top, m_rcDest.right, m_rcDest.bottom };
+
+    pParams->imageWidthInPixels = m_imageWidthInPixels;
+    pParams->imageHeightInPixels = m_imageHeightInPixels;
+    pParams->cbLine = m_imageWidthInPixels * m_tileKernel.dwBytesPerPixel;
+    pParams->cLines = m_tileKernel.bChromaPlane ? m_imageHeightInPixels + m_imageHeightInPixels / 2 : m_imageHeightInPixels;
+    pParams->cbImageSize = m_cbImageSize;
+    pParams->rcDest = rcDest;
+    CopyMemory(pParams->rgRegions, m_rgRegions, m_cRegions * sizeof(SKETCH_REGION));
+    pParams->cRegions = m_cRegions;
+    pParams->prefilter = m_prefilter;
+    pParams->dwMedianRadius = m_dwMedianRadius;
+    pParams->pTransformFn = m_pTransformFn;
+    pParams->pBandFn = m_pBandFn;
+    pParams->tileKernel = m_tileKernel;
+    pParams->pScaledFn = m_pScaledFn;
+    pParams->dwScale = (m_pScaledScratch != NULL) ? m_dwScale : 1;
+    pParams->pScratch = m_pFilteredYSrc;
+    pParams->pScaledScratch = m_pScaledScratch;
+    pParams->pThreadPool = m_pThreadPool;
+    pParams->pTemporal = m_pTemporal;
+    pParams->pCounters = &m_counters;
+
+    // The colour edges replace the luma sketch, as a frame form only.
+    if (m_pColorScratch != NULL)
+    {
+        pParams->pTransformFn = m_pColorFn;
+        pParams->pBandFn = NULL;
+        pParams->tileKernel.pfnTile = NULL;
+        pParams->dwScale = 1;
+        pParams->pScratch = m_pColorScratch;
+    }
+    return S_OK;
+}
+
+
+// Get the buffer of a sample. A sample of one buffer, the usual case, gives
+// that buffer as it is; only a sample split over several buffers is copied
+// into a contiguous one.
+
+HRESULT CGrayscale::GetFrameBuffer(IMFSample *pSample, IMFMediaBuffer **ppBuffer)
+{
+    DWORD cBuffers = 0;
+    HRESULT hr = pSample->GetBufferCount(&cBuffers);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    if (cBuffers == 1)
+    {
+        return pSample->GetBufferByIndex(0, ppBuffer);
+    }
+    return pSample->ConvertToContiguousBuffer(ppBuffer);
+}
+
+
 // Generate output data.
 
 HRESULT CGrayscale::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
+{
+    FRAME_PARAMS params;
+
+    HRESULT hr = GetFrameParams(&params);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+    return TransformFrame(params, pIn, pOut);
+}
+
+
+// Transform one frame. Does not touch the MFT, so it can run without holding
+// m_critSec. After the first frame of a format it makes no heap allocations
+// of its own, in either mode and with the counters on; GetFrameBuffer only
+// does for a sample split over several buffers.
+
+HRESULT CGrayscale::TransformFrame(const FRAME_PARAMS& params, IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
 {
     BYTE *pDest = NULL;         // Destination buffer.
     LONG lDestStride = 0;       // Destination stride.
@@ -2186,62 +1703,350 @@ HRESULT CGrayscale::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
     BYTE *pSrc = NULL;          // Source buffer.
     LONG lSrcStride = 0;        // Source stride.
 
-    // Helper objects to lock the buffers.
-    VideoBufferLock inputLock(pIn);
-    VideoBufferLock outputLock(pOut);
+    // In place, the one buffer is both (see SKETCH_FRAME).
+    const bool bInPlace = (pIn == pOut);
 
-    // Stride if the buffer does not support IMF2DBuffer
-    LONG lDefaultStride = 0;
+    // Helper objects to lock the buffers.
+    CFrameBufferLock inputLock(pIn);
+    CFrameBufferLock outputLock(pOut);
 
-    HRESULT hr = GetDefaultStride(m_pInputType, &lDefaultStride);
+    // Lock the input buffer.
+    HRESULT hr = inputLock.Lock(bInPlace ? MF2DBuffer_LockFlags_ReadWrite : MF2DBuffer_LockFlags_Read,
+        params.lDefaultStride, params.cbLine, params.cLines, &pSrc, &lSrcStride);
     if (FAILED(hr))
     {
         goto done;
     }
 
-    // Lock the input buffer.
-    hr = inputLock.LockBuffer(lDefaultStride, m_imageHeightInPixels, &pSrc, &lSrcStride);
-    if (FAILED(hr))
+    // Lock the output buffer.
+    if (bInPlace)
     {
+        pDest = pSrc;
+        lDestStride = lSrcStride;
+    }
+    else
+    {
+        hr = outputLock.Lock(MF2DBuffer_LockFlags_Write, params.lDefaultStride, params.cbLine, params.cLines, &pDest, &lDestStride);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+    }
+
+    // Invoke the image transform function.
+    assert (params.pTransformFn != NULL);
+    if (params.pTransformFn)
+    {
+        SKETCH_FRAME frame = { params.rcDest, pDest, lDestStride, pSrc, lSrcStride,
+            params.imageWidthInPixels, params.imageHeightInPixels,
+            (params.cRegions > 0) ? params.rgRegions : NULL, params.cRegions, params.prefilter, params.dwMedianRadius };
+        CSketchThreadPool *pThreadPool = params.pThreadPool;
+
+        // Detect edges at a reduced size, each pass in bands on the worker
+        // threads if there are any. In place as well: a band only writes
+        // the lines it reads the source of, after the downsampling has read
+        // the whole frame.
+        if (params.dwScale > 1 && params.pScaledFn != NULL && params.pScaledScratch != NULL)
+        {
+            (*params.pScaledFn)(frame, params.dwScale, params.pScaledScratch, pThreadPool);
+        }
+        // Only transform what changed since the previous frame, on the
+        // worker threads if there are any. Frames are transformed one at a
+        // time and in order, in the queue as well, so the previous frame is
+        // the one before this.
+        else if (!bInPlace && params.pTemporal != NULL && params.tileKernel.pfnTile != NULL &&
+            params.pTemporal->Run(params.tileKernel, frame, pThreadPool, params.pScratch))
+        {
+            // Keep the tile counts for GetAttributes.
+            FRAME_COUNTERS *pCounters = params.pCounters;
+            EnterCriticalSection(&pCounters->critSec);
+            pCounters->temporal = params.pTemporal->GetCounters();
+            pCounters->bTemporal = TRUE;
+            LeaveCriticalSection(&pCounters->critSec);
+        }
+        // Split the frame into tiles across the worker threads. Their output
+        // is identical to the serial transform, which is the fallback, and
+        // the only way to transform in place.
+        else if (!bInPlace && pThreadPool != NULL && params.pBandFn != NULL && pThreadPool->Run(params.pBandFn, frame))
+        {
+            // Keep the per-thread tile counters for GetAttributes.
+            FRAME_COUNTERS *pCounters = params.pCounters;
+            EnterCriticalSection(&pCounters->critSec);
+            pCounters->cThreads = pThreadPool->GetThreadCount();
+            for (DWORD i = 0; i < pCounters->cThreads; i++)
+            {
+                pCounters->rgThreads[i] = pThreadPool->GetThreadCounters(i);
+            }
+            LeaveCriticalSection(&pCounters->critSec);
+        }
+        else if (params.pBandFn != NULL)
+        {
+            // The whole frame as one band: the frame form cannot take regions.
+            (*params.pBandFn)(frame, 0, params.imageHeightInPixels, params.pScratch);
+        }
+        else
+        {
+            (*params.pTransformFn)(params.rcDest, pDest, lDestStride, pSrc, lSrcStride,
+                params.imageWidthInPixels, params.imageHeightInPixels, params.pScratch);
+        }
+    }
+    else
+    {
+        hr = E_UNEXPECTED;
         goto done;
     }
 
-    // Lock the output buffer.
-    hr = outputLock.LockBuffer(lDefaultStride, m_imageHeightInPixels, &pDest, &lDestStride);
+
+    // Set the data size on the output buffer.
+    hr = pOut->SetCurrentLength(params.cbImageSize);
+
+    // The CFrameBufferLock class automatically unlocks the buffers.
+done:
+    return hr;
+}
+
+
+// Queue an input sample (asynchronous mode). The frame queue's worker
+// transforms it into a sample from m_pSampleAllocator.
+
+HRESULT CGrayscale::OnQueueInput(IMFSample *pSample)
+{
+    FRAME_JOB *pJob = NULL;
+
+    // Hold back while draining or when the queue is full. Every job the
+    // queue does not hold is free, so there is one for the sample.
+    if (m_bDraining || m_pFrameQueue->GetCount() >= m_pFrameQueue->GetDepth() || m_pFreeJobs == NULL)
+    {
+        return MF_E_NOTACCEPTING;
+    }
+
+    pJob = m_pFreeJobs;
+    m_pFreeJobs = pJob->pNextFree;
+    pJob->pNextFree = NULL;
+    pJob->hr = S_OK;
+
+    HRESULT hr = GetFrameParams(&pJob->params);
     if (FAILED(hr))
     {
         goto done;
     }
 
-    // Invoke the image transform function.
-    assert (m_pTransformFn != NULL);
-    if (m_pTransformFn)
+    if (m_bInPlace)
     {
-        (*m_pTransformFn)(m_transform, m_rcDest, pDest, lDestStride, pSrc, lSrcStride,
-            m_imageWidthInPixels, m_imageHeightInPixels, m_pFilteredYSrc);
+        // The input sample is transformed and returned.
+        pJob->pOutput = pSample;
+        pSample->AddRef();
     }
     else
     {
-        hr = E_UNEXPECTED;
-        goto done;
+        // Every sample is out when the client holds more than its half;
+        // take the input again once it has released some.
+        hr = m_pSampleAllocator->AllocateSample(&pJob->pOutput);
+        if (hr == MF_E_SAMPLEALLOCATOR_EMPTY)
+        {
+            hr = MF_E_NOTACCEPTING;
+        }
+        if (FAILED(hr))
+        {
+            goto done;
+        }
     }
 
+    pJob->pInput = pSample;
+    pSample->AddRef();  // Held until the worker is done with it.
 
-    // Set the data size on the output buffer.
-    hr = pOut->SetCurrentLength(m_cbImageSize);
+    if (!m_pFrameQueue->Submit(pJob))
+    {
+        hr = MF_E_NOTACCEPTING;
+        goto done;
+    }
+    pJob = NULL;        // The queue owns it now.
 
-    // The VideoBufferLock class automatically unlocks the buffers.
 done:
+    if (pJob != NULL)
+    {
+        ReleaseFrameJob(pJob);
+    }
+    return hr;
+}
+
+
+// Return the oldest queued sample once it is transformed (asynchronous mode).
+
+HRESULT CGrayscale::OnDequeueOutput(MFT_OUTPUT_DATA_BUFFER *pOutputSamples, DWORD *pdwStatus)
+{
+    // The MFT allocates the output samples.
+    if (pOutputSamples[0].pSample != NULL)
+    {
+        return E_INVALIDARG;
+    }
+
+    DWORD cQueued = m_pFrameQueue->GetCount();
+    if (cQueued == 0)
+    {
+        m_bDraining = FALSE;
+        return MF_E_TRANSFORM_NEED_MORE_INPUT;
+    }
+
+    // While more input can be queued, ask for it rather than waiting, so
+    // the next sample is on its way while this one is transformed. Wait
+    // only when the queue is full or the client is draining.
+    BOOL bWait = m_bDraining || cQueued >= m_pFrameQueue->GetDepth();
+
+    FRAME_JOB *pJob = (FRAME_JOB*)m_pFrameQueue->PopCompleted(bWait != FALSE);
+    if (pJob == NULL)
+    {
+        return MF_E_TRANSFORM_NEED_MORE_INPUT;
+    }
+
+    HRESULT hr = pJob->hr;
+    if (SUCCEEDED(hr))
+    {
+        // Hand our reference on the output sample to the caller.
+        pOutputSamples[0].pSample = pJob->pOutput;
+        pJob->pOutput = NULL;
+        pOutputSamples[0].dwStatus = 0;
+        *pdwStatus = 0;
+    }
+
+    ReleaseFrameJob(pJob);
     return hr;
 }
 
 
+// Transform a queued sample. Runs on the frame queue's worker thread.
+
+void CGrayscale::ProcessFrameJob(void *pContext)
+{
+    FRAME_JOB *pJob = (FRAME_JOB*)pContext;
+
+    IMFMediaBuffer *pInput = NULL;
+    IMFMediaBuffer *pOutput = NULL;
+
+    LONGLONG hnsDuration = 0;
+    LONGLONG hnsTime = 0;
+
+    // Get the input buffer.
+    HRESULT hr = GetFrameBuffer(pJob->pInput, &pInput);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    // Get the output buffer.
+    hr = GetFrameBuffer(pJob->pOutput, &pOutput);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    hr = TransformFrame(pJob->params, pInput, pOutput);
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+
+    // Copy the duration and time stamp from the input sample, if present.
+
+    if (SUCCEEDED(pJob->pInput->GetSampleDuration(&hnsDuration)))
+    {
+        hr = pJob->pOutput->SetSampleDuration(hnsDuration);
+        if (FAILED(hr))
+        {
+            goto done;
+        }
+    }
+
+    if (SUCCEEDED(pJob->pInput->GetSampleTime(&hnsTime)))
+    {
+        hr = pJob->pOutput->SetSampleTime(hnsTime);
+    }
+
+done:
+    pJob->hr = hr;
+    SafeRelease(&pJob->pInput);    // Give the input buffer back early.
+    SafeRelease(&pInput);
+    SafeRelease(&pOutput);
+}
+
+
+// Copy the counters of the last frame into the attribute store. Only done
+// when the client asks for the attributes: SetBlob allocates, and takes the
+// store's lock, which every frame would otherwise pay for. Failing to is not
+// an error.
+
+void CGrayscale::PublishCounters()
+{
+    SKETCH_THREAD_COUNTERS counters[SKETCH_MAX_THREADS];
+    SKETCH_TEMPORAL_COUNTERS temporal;
+
+    EnterCriticalSection(&m_counters.critSec);
+    const DWORD cThreads = m_counters.cThreads;
+    CopyMemory(counters, m_counters.rgThreads, cThreads * sizeof(counters[0]));
+    const BOOL bTemporal = m_counters.bTemporal;
+    temporal = m_counters.temporal;
+    LeaveCriticalSection(&m_counters.critSec);
+
+    if (cThreads > 0)
+    {
+        (void)m_pAttributes->SetBlob(MFT_GRAYSCALE_TILE_COUNTERS, (UINT8*)counters, cThreads * sizeof(counters[0]));
+    }
+    if (bTemporal)
+    {
+        (void)m_pAttributes->SetBlob(MFT_GRAYSCALE_TEMPORAL_COUNTERS, (UINT8*)&temporal, sizeof(temporal));
+    }
+}
+
+
+// Release a job's samples and give it back to the free list.
+
+void CGrayscale::ReleaseFrameJob(FRAME_JOB *pJob)
+{
+    SafeRelease(&pJob->pInput);
+    SafeRelease(&pJob->pOutput);
+    pJob->pNextFree = m_pFreeJobs;
+    m_pFreeJobs = pJob;
+}
+
+
+// Delete the frame queue and its jobs. The queue must not hold any.
+
+void CGrayscale::DeleteFrameQueue()
+{
+    delete m_pFrameQueue;
+    m_pFrameQueue = NULL;
+    delete [] m_pJobs;
+    m_pJobs = NULL;
+    m_pFreeJobs = NULL;
+}
+
+
+// Drop every queued sample, waiting for the one being transformed.
+
+void CGrayscale::FlushFrameQueue()
+{
+    std::vector<void*> jobs;
+
+    m_pFrameQueue->Flush(&jobs);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        ReleaseFrameJob((FRAME_JOB*)jobs[i]);
+    }
+    m_bDraining = FALSE;
+}
+
+
 // Flush the MFT.
 
 HRESULT CGrayscale::OnFlush()
 {
-    // For this MFT, flushing just means releasing the input sample.
+    // For this MFT, flushing just means releasing the input sample,
+    // or in asynchronous mode every queued sample.
     SafeRelease(&m_pSample);
+    if (m_pFrameQueue != NULL)
+    {
+        FlushFrameQueue();
+    }
     return S_OK;
 }
 
@@ -2260,7 +2065,13 @@ HRESULT CGrayscale::UpdateFormatInfo()
     m_cbImageSize = 0;
 
     m_pTransformFn = NULL;
+    m_pBandFn = NULL;
+    ZeroMemory(&m_tileKernel, sizeof(m_tileKernel));
+    m_pScaledFn = NULL;
 	m_pFilteredYSrc= NULL;
+    m_pScaledScratch = NULL;
+    m_pColorFn = NULL;
+    m_pColorScratch = NULL;
 
     if (m_pInputType != NULL)
     {
@@ -2276,30 +2087,40 @@ HRESULT CGrayscale::UpdateFormatInfo()
             goto done;
         }
 
-		m_pFilteredYSrc = (BYTE *)calloc(m_imageHeightInPixels*m_imageWidthInPixels, sizeof(BYTE));
-        if (subtype == MFVideoFormat_YUY2)
-        {
-            //m_pTransformFn = TransformImage_YUY2;
-			m_pTransformFn = (NULL== m_pFilteredYSrc) ? EdgeDectection_YUY2 : EdgeDectectionF_YUY2;
-        }
-        else if (subtype == MFVideoFormat_UYVY)
-        {
-            //m_pTransformFn = TransformImage_UYVY;
-			m_pTransformFn = (NULL== m_pFilteredYSrc) ? EdgeDectection_UYVY : EdgeDectectionF_UYVY;
-        }
-        else if (subtype == MFVideoFormat_NV12)
+		// The filtered kernels only keep a few rows of luma in flight. The
+		// buffer is kept across format changes and only grows.
+		m_pFilteredYSrc = m_scratch.Reserve(SKETCH_SCRATCH_FILTERED, GetSketchScratchSize(m_imageWidthInPixels));
+        const TRANSFORM_ENTRY *pEntry = NULL;
+        for (DWORD i = 0; i < ARRAYSIZE(g_TransformFns); i++)
         {
-            m_pTransformFn = (NULL== m_pFilteredYSrc) ? EdgeDectection_NV12 : EdgeDectectionF_NV12;
+            if (subtype == *g_TransformFns[i].pSubtype)
+            {
+                pEntry = &g_TransformFns[i];
+                break;
+            }
         }
-        else
+        if (pEntry == NULL)
         {
             hr = E_UNEXPECTED;
             goto done;
         }
 
+        m_pTransformFn = (NULL== m_pFilteredYSrc) ? pEntry->pEdgeFn : pEntry->pEdgeFFn;
+        m_pBandFn = (NULL== m_pFilteredYSrc) ? pEntry->pEdgeBandFn : pEntry->pEdgeFBandFn;
+        m_tileKernel.pfnTile = (NULL== m_pFilteredYSrc) ? pEntry->pEdgeTileFn : pEntry->pEdgeFTileFn;
+        m_tileKernel.dwBytesPerPixel = (subtype == MFVideoFormat_NV12) ? 1 : 2;
+        m_tileKernel.bChromaPlane = (subtype == MFVideoFormat_NV12);
+        m_pScaledFn = pEntry->pEdgeScaledFn;
+        m_pColorFn = pEntry->pEdgeColorFn;
+
         // Calculate the image size (not including padding)
         hr = GetImageSize(subtype.Data1, m_imageWidthInPixels, m_imageHeightInPixels, &m_cbImageSize);
     }
+    else
+    {
+        // No format, nothing to keep scratch for.
+        m_scratch.Release();
+    }
 
 done:
     return hr;
@@ -2419,3 +2240,121 @@ bool ValidateRect(const RECT& rc)
     }
     return true;
 }
+
+
+// Validate a list of destination regions: a whole number of 1 to
+// SKETCH_MAX_REGIONS regions, each meeting the rectangle criteria above.
+
+bool ValidateRegions(const SKETCH_REGION *pRegions, UINT32 cbRegions)
+{
+    if (cbRegions == 0 || cbRegions % sizeof(SKETCH_REGION) != 0 || cbRegions > SKETCH_MAX_REGIONS * sizeof(SKETCH_REGION))
+    {
+        return false;
+    }
+    for (UINT32 i = 0; i < cbRegions / sizeof(SKETCH_REGION); i++)
+    {
+        const SKETCH_RECT& rc = pRegions[i].rc;
+        if (rc.left > rc.right || rc.top > rc.bottom)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// CFrameBufferLock: Locks a video buffer for one frame.
+
+CFrameBufferLock::CFrameBufferLock(IMFMediaBuffer *pBuffer) : m_pBuffer(pBuffer), m_p2DBuffer(NULL), m_bLocked(false)
+{
+    m_pBuffer->AddRef();
+
+    // Query for the 2-D buffer interface. OK if this fails.
+    (void)m_pBuffer->QueryInterface(IID_PPV_ARGS(&m_p2DBuffer));
+}
+
+CFrameBufferLock::~CFrameBufferLock()
+{
+    Unlock();
+    SafeRelease(&m_pBuffer);
+    SafeRelease(&m_p2DBuffer);
+}
+
+
+// Lock the buffer and get line 0 of the frame and the pitch.
+//
+// flags:          Read for the input, Write for the output. Only
+//                 IMF2DBuffer2 takes them.
+// lDefaultStride: Stride of a buffer that is not 2D; negative if bottom-up.
+// cbLine, cLines: The frame, to check the buffer holds it.
+
+HRESULT CFrameBufferLock::Lock(MF2DBuffer_LockFlags flags, LONG lDefaultStride, DWORD cbLine, DWORD cLines,
+    BYTE **ppScanline0, LONG *plPitch)
+{
+    HRESULT hr = S_OK;
+
+    BYTE *pScanline0 = NULL;
+    LONG lPitch = 0;
+    BYTE *pBufferStart = NULL;  // NULL if the buffer does not tell its extent.
+    DWORD cbBuffer = 0;
+
+    IMF2DBuffer2 *p2DBuffer2 = NULL;
+
+    if (m_p2DBuffer != NULL && SUCCEEDED(m_p2DBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer2))))
+    {
+        hr = p2DBuffer2->Lock2DSize(flags, &pScanline0, &lPitch, &pBufferStart, &cbBuffer);
+        SafeRelease(&p2DBuffer2);
+    }
+    else if (m_p2DBuffer != NULL)
+    {
+        hr = m_p2DBuffer->Lock2D(&pScanline0, &lPitch);
+    }
+    else
+    {
+        // Use the default stride. The maximum length, not the current one:
+        // an output buffer has not been written yet.
+        hr = m_pBuffer->Lock(&pBufferStart, &cbBuffer, NULL);
+        if (SUCCEEDED(hr))
+        {
+            pScanline0 = GetSketchScanline0(pBufferStart, lDefaultStride, cLines);
+            lPitch = lDefaultStride;
+        }
+    }
+    if (FAILED(hr))
+    {
+        goto done;
+    }
+    m_bLocked = true;
+
+    if (pBufferStart != NULL && !IsSketchFrameInBuffer(pScanline0, lPitch, cbLine, cLines, pBufferStart, cbBuffer))
+    {
+        Unlock();
+        hr = MF_E_BUFFERTOOSMALL;
+        goto done;
+    }
+
+    *ppScanline0 = pScanline0;
+    *plPitch = lPitch;
+
+done:
+    return hr;
+}
+
+
+// Unlock the buffer, if it is locked.
+
+void CFrameBufferLock::Unlock()
+{
+    if (m_bLocked)
+    {
+        if (m_p2DBuffer != NULL)
+        {
+            (void)m_p2DBuffer->Unlock2D();
+        }
+        else
+        {
+            (void)m_pBuffer->Unlock();
+        }
+        m_bLocked = false;
+    }
+}
@@ -26,6 +26,13 @@
 #include <windows.media.h>
 
 #include "GrayscaleTransform.h"
+#include "..\SketchKernels\SketchBuffer.h"
+#include "..\SketchKernels\SketchCpu.h"
+#include "..\SketchKernels\SketchKernels.h"
+#include "..\SketchKernels\SketchThreadPool.h"
+#include "..\SketchKernels\SketchFrameQueue.h"
+#include "..\SketchKernels\SketchScratch.h"
+#include "..\SketchKernels\SketchTemporal.h"
 
 // CLSID of the MFT.
 DEFINE_GUID(CLSID_GrayscaleMFT,
@@ -38,19 +45,165 @@ DEFINE_GUID(CLSID_GrayscaleMFT,
 
 // Configuration attributes
 
+// Destination rectangle (RECT blob). Only the pixels inside it, clipped to
+// the frame, get the effect; the rest of the frame is passed through.
 // {7BBBB051-133B-41F5-B6AA-5AFF9B33A2CB}
 DEFINE_GUID(MFT_GRAYSCALE_DESTINATION_RECT, 
 0x7bbbb051, 0x133b, 0x41f5, 0xb6, 0xaa, 0x5a, 0xff, 0x9b, 0x33, 0xa2, 0xcb);
 
+// {4C512491-CE81-4736-80E2-A29AAFB2E1E2}
+// Blob of 1 to SKETCH_MAX_REGIONS SKETCH_REGION, read when streaming starts.
+// Sketches each region with its own threshold and inversion instead of the
+// destination rectangle; where regions overlap, the later one wins. An
+// invalid list is ignored.
+DEFINE_GUID(MFT_GRAYSCALE_DESTINATION_REGIONS, 
+0x4c512491, 0xce81, 0x4736, 0x80, 0xe2, 0xa2, 0x9a, 0xaf, 0xb2, 0xe1, 0xe2);
+
 
 // {14782342-93E8-4565-872C-D9A2973D5CBF}
+// Ignored: kept so that existing callers still build. The sketch replaces
+// the chroma with grey, so there is no saturation left to scale.
 DEFINE_GUID(MFT_GRAYSCALE_SATURATION, 
 0x14782342, 0x93e8, 0x4565, 0x87, 0x2c, 0xd9, 0xa2, 0x97, 0x3d, 0x5c, 0xbf);
 
 // {E0BADE5D-E4B9-4689-9DBA-E2F00D9CED0E}
+// Ignored, as MFT_GRAYSCALE_SATURATION.
 DEFINE_GUID(MFT_GRAYSCALE_CHROMA_ROTATION, 
 0xe0bade5d, 0xe4b9, 0x4689, 0x9d, 0xba, 0xe2, 0xf0, 0xd, 0x9c, 0xed, 0xe);
 
+// {C1E14DF3-A43E-4846-8BC6-E85EA22F8C01}
+// UINT32. Threads per frame: 0 (default) uses every core, 1 runs serially.
+// At most SKETCH_MAX_THREADS (64) are used.
+DEFINE_GUID(MFT_GRAYSCALE_THREAD_COUNT, 
+0xc1e14df3, 0xa43e, 0x4846, 0x8b, 0xc6, 0xe8, 0x5e, 0xa2, 0x2f, 0x8c, 0x1);
+
+// {76909420-7503-41E0-BC44-0428AA35D264}
+// UINT32. Lines per tile handed to a worker thread. Default 64.
+DEFINE_GUID(MFT_GRAYSCALE_TILE_ROWS, 
+0x76909420, 0x7503, 0x41e0, 0xbc, 0x44, 0x4, 0x28, 0xaa, 0x35, 0xd2, 0x64);
+
+// {0FC269F4-19DE-459A-80B7-E82E71282125}
+// Blob, set by the MFT. One SKETCH_THREAD_COUNTERS per worker thread, for
+// spotting threads that get less than their share. Kept by the MFT as of the
+// last frame and copied here each time IMFTransform::GetAttributes is
+// called, so call it again for newer counts.
+DEFINE_GUID(MFT_GRAYSCALE_TILE_COUNTERS, 
+0x0fc269f4, 0x19de, 0x459a, 0x80, 0xb7, 0xe8, 0x2e, 0x71, 0x28, 0x21, 0x25);
+
+// {A433B818-4F0A-4606-9858-337B231299E6}
+// UINT32, read when streaming starts. 0 (default) holds one input sample and
+// transforms it in ProcessOutput. N > 0 accepts up to N samples, transforms
+// each on a worker thread as soon as it arrives, and returns them from
+// ProcessOutput in order in samples the MFT allocates. The MFT keeps 2N
+// output samples, half for the queue and half for the client to hold, and
+// reuses each once the client releases it; while the client holds more,
+// ProcessInput returns MF_E_NOTACCEPTING.
+DEFINE_GUID(MFT_GRAYSCALE_QUEUE_DEPTH, 
+0xa433b818, 0x4f0a, 0x4606, 0x98, 0x58, 0x33, 0x7b, 0x23, 0x12, 0x99, 0xe6);
+
+// {515CCA51-635A-48B5-B414-5D7BDB8C9419}
+// UINT32, read when streaming starts. Not set (default) transforms every
+// frame whole. Set, only the tiles whose source changed since the previous
+// frame are transformed and the rest keep the previous output: 0 skips
+// tiles that are exactly the same, so the output does not change; N > 0
+// also skips tiles whose mean absolute difference is at most N per pixel.
+DEFINE_GUID(MFT_GRAYSCALE_TEMPORAL_TOLERANCE, 
+0x515cca51, 0x635a, 0x48b5, 0xb4, 0x14, 0x5d, 0x7b, 0xdb, 0x8c, 0x94, 0x19);
+
+// {ACD3C7A9-B3AA-453B-80FE-5FE3473A6F1C}
+// Blob, set by the MFT. SKETCH_TEMPORAL_COUNTERS as of the last frame run
+// while MFT_GRAYSCALE_TEMPORAL_TOLERANCE is set, copied here each time
+// IMFTransform::GetAttributes is called, as MFT_GRAYSCALE_TILE_COUNTERS.
+DEFINE_GUID(MFT_GRAYSCALE_TEMPORAL_COUNTERS, 
+0xacd3c7a9, 0xb3aa, 0x453b, 0x80, 0xfe, 0x5f, 0xe3, 0x47, 0x3a, 0x6f, 0x1c);
+
+// {2DBBDBC0-05B8-4B69-95D7-09C00FF14679}
+// UINT32, read when streaming starts. 1 (default) detects edges at full
+// size. SKETCH_SCALE_2X or SKETCH_SCALE_4X detects them on a reduced copy of
+// the luma and scales the result back up, which is faster and gives thicker,
+// softer lines. Each pass runs in bands on the threads of
+// MFT_GRAYSCALE_THREAD_COUNT; MFT_GRAYSCALE_TEMPORAL_TOLERANCE is not used.
+// Other values are taken as 1.
+DEFINE_GUID(MFT_GRAYSCALE_SCALE,
+0x2dbbdbc0, 0x05b8, 0x4b69, 0x95, 0xd7, 0x09, 0xc0, 0x0f, 0xf1, 0x46, 0x79);
+
+// {9DFF51DA-9E7B-404A-8092-2EE3CEE9A29F}
+// UINT32, read when streaming starts. 0 (default) writes the effect into a separate output sample.
+// Nonzero writes it back into the input sample, which ProcessOutput then
+// returns as the output (MFT_OUTPUT_STREAM_PROVIDES_SAMPLES): no second
+// frame buffer, and nothing outside the regions is copied.
+// MFT_GRAYSCALE_TEMPORAL_TOLERANCE is then not used, and only the reduced
+// path of MFT_GRAYSCALE_SCALE uses the thread pool; other frames are
+// transformed whole on one thread.
+DEFINE_GUID(MFT_GRAYSCALE_IN_PLACE,
+0x9dff51da, 0x9e7b, 0x404a, 0x80, 0x92, 0x2e, 0xe3, 0xce, 0xe9, 0xa2, 0x9f);
+
+// {33CC4F67-EC3E-4759-A7E9-6DA4FE433C7B}
+// UINT32, read when streaming starts. 0 (default) sketches the luma.
+// Nonzero draws the summed gradients of R, G and B instead, as bright lines
+// on black (EdgeDectection_YUY2RGB), so edges between colours of the same
+// brightness show. YUY2 only; the destination rectangle applies, the
+// regions and MFT_GRAYSCALE_SCALE do not, and frames are transformed whole
+// on the calling thread.
+DEFINE_GUID(MFT_GRAYSCALE_COLOR_EDGES,
+0x33cc4f67, 0xec3e, 0x4759, 0xa7, 0xe9, 0x6d, 0xa4, 0xfe, 0x43, 0x3c, 0x7b);
+
+// {5E0B8A52-71C4-4D3B-9A6E-2F8C1D94B7E3}
+// UINT32, read when streaming starts. 0 (default) takes the edges over the
+// luma, unless a region of MFT_GRAYSCALE_DESTINATION_REGIONS sets bChroma.
+// Nonzero makes the destination rectangle, or every region, chroma-aware:
+// the gradients of U and V, taken at chroma resolution, also draw edges
+// between colours of the same brightness, for a fraction of what
+// MFT_GRAYSCALE_COLOR_EDGES costs. Ignored with MFT_GRAYSCALE_SCALE.
+DEFINE_GUID(MFT_GRAYSCALE_CHROMA_EDGES,
+0x5e0b8a52, 0x71c4, 0x4d3b, 0x9a, 0x6e, 0x2f, 0x8c, 0x1d, 0x94, 0xb7, 0xe3);
+
+// {C5064499-6CD7-463E-BEBD-652B5AEBD1A4}
+// UINT32 SKETCH_DETECTOR, read when streaming starts. 0 (default) keeps the
+// Roberts cross, unless a region of MFT_GRAYSCALE_DESTINATION_REGIONS sets
+// bDetector. Otherwise the destination rectangle, or every region, takes
+// the edges with that detector: Sobel or Scharr for smoother, less noisy
+// outlines, the Laplacian for thin lines. Ignored with MFT_GRAYSCALE_SCALE.
+DEFINE_GUID(MFT_GRAYSCALE_DETECTOR,
+0xc5064499, 0x6cd7, 0x463e, 0xbe, 0xbd, 0x65, 0x2b, 0x5a, 0xeb, 0xd1, 0xa4);
+
+// {1DAABDB9-5D39-4326-9A77-708F59822C7F}
+// UINT32 SKETCH_PREFILTER, read when streaming starts. 0 (default) smooths
+// the luma with the 3x3 median before the edges are taken. Otherwise that
+// pre-filter: none for the sharpest, noisiest lines, the 5x5 median for
+// noisy sensors at about four times the cost, the binomial blur for the
+// cheapest smoothing, the box blur, which softens more and costs about
+// what the 3x3 median does, or the median of MFT_GRAYSCALE_MEDIAN_RADIUS
+// for heavier noise. Both blurs soften steps along with the noise.
+// Unknown values mean the default.
+DEFINE_GUID(MFT_GRAYSCALE_PREFILTER,
+0x1daabdb9, 0x5d39, 0x4326, 0x9a, 0x77, 0x70, 0x8f, 0x59, 0x82, 0x2c, 0x7f);
+
+// {28DD800A-A05E-47D7-AA68-60D8B1B3D158}
+// UINT32 radius of SKETCH_PREFILTER_MEDIAN_RADIUS, read when streaming
+// starts: the median of the 2r+1 pixels square around each, up to
+// SKETCH_MEDIAN_MAX_RADIUS. Default 3. Radii 1 and 2 are the 3x3 and 5x5
+// medians; from 3 up it costs about ten times the 5x5 median, at any
+// radius. If the larger scratch it takes cannot be allocated, the 5x5
+// median is used.
+DEFINE_GUID(MFT_GRAYSCALE_MEDIAN_RADIUS,
+0x28dd800a, 0xa05e, 0x47d7, 0xaa, 0x68, 0x60, 0xd8, 0xb1, 0xb3, 0xd1, 0x58);
+
+
+// {F93EEBF9-BF0F-40C9-8F41-74A48FBBFB75}
+// UINT32 SKETCH_CPU_TIER, read when streaming starts. SKETCH_TIER_AUTO runs
+// the kernels on the tier the SKETCH_CPU_TIER environment variable names,
+// or else on the best instruction set the CPU has; any other tier is used if
+// the CPU has it, for benchmarking. Process-wide: when the attribute is not
+// set (default), the tier in use is left as it is.
+DEFINE_GUID(MFT_GRAYSCALE_CPU_TIER, 
+0xf93eebf9, 0xbf0f, 0x40c9, 0x8f, 0x41, 0x74, 0xa4, 0x8f, 0xbb, 0xfb, 0x75);
+
+// {DA364666-446D-48E2-9426-F5BDDC84950D}
+// UINT32 SKETCH_CPU_TIER, set by the MFT when streaming starts: the tier the
+// kernels run on.
+DEFINE_GUID(MFT_GRAYSCALE_CPU_TIER_IN_USE, 
+0xda364666, 0x446d, 0x48e2, 0x94, 0x26, 0xf5, 0xbd, 0xdc, 0x84, 0x95, 0x0d);
 
 template <class T> void SafeRelease(T **ppT)
 {
@@ -62,17 +215,44 @@ template <class T> void SafeRelease(T **ppT)
 }
 
 // Function pointer for the function that transforms the image.
-typedef void (*IMAGE_TRANSFORM_FN)(
-    const D2D1::Matrix3x2F& mat,             // Chroma transform matrix.
-    const D2D_RECT_U&       rcDest,          // Destination rectangle for the transformation.
-    BYTE*                   pDest,           // Destination buffer.
-    LONG                    lDestStride,     // Destination stride.
-    const BYTE*             pSrc,            // Source buffer.
-    LONG                    lSrcStride,      // Source stride.
-    DWORD                   dwWidthInPixels, // Image width in pixels.
-    DWORD                   dwHeightInPixels, // Image height in pixels.
-	BYTE*                   pFilteredYSrc	  //
-    );
+// The kernels come from the portable SketchKernels library.
+typedef SKETCH_TRANSFORM_FN IMAGE_TRANSFORM_FN;
+
+// Function pointer for the function that transforms a band of the image.
+typedef SKETCH_BAND_FN IMAGE_BAND_FN;
+
+// Function pointer for the function that transforms the image at a reduced size.
+typedef SKETCH_SCALED_FN IMAGE_SCALED_FN;
+
+// CFrameBufferLock class:
+// Locks a video buffer for one frame and gives its line 0 and pitch. A 2D
+// buffer is locked where it lies, with its own pitch, which is negative
+// for a bottom-up buffer; through IMF2DBuffer2, input is locked for reading
+// and output for writing, so neither is copied to bring the other side up
+// to date. Other buffers are locked as bytes laid out with the default
+// stride. Unlocks on destruction.
+
+class CFrameBufferLock
+{
+public:
+    explicit CFrameBufferLock(IMFMediaBuffer *pBuffer);
+    ~CFrameBufferLock();
+
+    // cbLine and cLines describe the frame: bytes of each line, and lines
+    // including the NV12 chroma. Fails with MF_E_BUFFERTOOSMALL if the
+    // buffer cannot hold them.
+    HRESULT Lock(MF2DBuffer_LockFlags flags, LONG lDefaultStride, DWORD cbLine, DWORD cLines,
+        BYTE **ppScanline0, LONG *plPitch);
+    void    Unlock();
+
+private:
+    CFrameBufferLock(const CFrameBufferLock&);
+    CFrameBufferLock& operator=(const CFrameBufferLock&);
+
+    IMFMediaBuffer  *m_pBuffer;
+    IMF2DBuffer     *m_p2DBuffer;           // NULL if the buffer is not 2D.
+    bool            m_bLocked;
+};
 
 // CGrayscale class:
 // Implements a grayscale video effect.
@@ -242,11 +422,83 @@ private:
     HRESULT OnFlush();
     HRESULT UpdateFormatInfo();
 
+    // The counters of the last frame, for GetAttributes to publish. Frames
+    // copy them in under critSec rather than m_critSec, which an
+    // asynchronous frame does not hold.
+    struct FRAME_COUNTERS
+    {
+        CRITICAL_SECTION        critSec;
+        SKETCH_THREAD_COUNTERS  rgThreads[SKETCH_MAX_THREADS];
+        DWORD                   cThreads;           // 0 until the pool has run a frame.
+        SKETCH_TEMPORAL_COUNTERS temporal;
+        BOOL                    bTemporal;          // FALSE until a frame has run temporally.
+    };
+
+    // What it takes to transform one frame. Captured under m_critSec, so a
+    // queued frame keeps the format it arrived with.
+    struct FRAME_PARAMS
+    {
+        LONG                    lDefaultStride;     // Stride if the buffer does not support IMF2DBuffer.
+        DWORD                   cbLine;             // Bytes of each line of the frame.
+        DWORD                   cLines;             // Lines of the frame, NV12 chroma included.
+        UINT32                  imageWidthInPixels;
+        UINT32                  imageHeightInPixels;
+        DWORD                   cbImageSize;
+        SKETCH_RECT             rcDest;
+        SKETCH_REGION           rgRegions[SKETCH_MAX_REGIONS];
+        DWORD                   cRegions;           // 0 sketches rcDest.
+        SKETCH_PREFILTER        prefilter;
+        DWORD                   dwMedianRadius;     // Of SKETCH_PREFILTER_MEDIAN_RADIUS.
+        IMAGE_TRANSFORM_FN      pTransformFn;
+        IMAGE_BAND_FN           pBandFn;
+        SKETCH_TILE_KERNEL      tileKernel;         // Same transform, one tile at a time.
+        IMAGE_SCALED_FN         pScaledFn;          // Same transform, at a reduced size.
+        DWORD                   dwScale;            // 1 transforms at full size.
+        BYTE                    *pScratch;          // Of pTransformFn and pBandFn.
+        BYTE                    *pScaledScratch;    // NULL when dwScale is 1.
+        CSketchThreadPool       *pThreadPool;       // NULL when running serially.
+        CSketchTemporal         *pTemporal;         // NULL when every frame is transformed whole.
+        FRAME_COUNTERS          *pCounters;         // Receives the counters of each frame.
+    };
+
+    // An input sample in the asynchronous queue. The queue's jobs are
+    // allocated with it and reused.
+    struct FRAME_JOB
+    {
+        IMFSample               *pInput;            // Released once transformed.
+        IMFSample               *pOutput;           // From m_pSampleAllocator.
+        FRAME_PARAMS            params;
+        HRESULT                 hr;                 // Result of the transform.
+        FRAME_JOB               *pNextFree;         // Next job not in the queue.
+    };
+
+    // IsAsync: Returns TRUE if samples go through the frame queue.
+    BOOL IsAsync() const { return m_pFrameQueue != NULL; }
+
+    // ProvidesSamples: Returns TRUE if ProcessOutput returns samples of its
+    // own (asynchronous or in-place mode) rather than the client's.
+    BOOL ProvidesSamples() const;
+
+    HRESULT GetFrameParams(FRAME_PARAMS *pParams);
+    static HRESULT GetFrameBuffer(IMFSample *pSample, IMFMediaBuffer **ppBuffer);
+    HRESULT OnQueueInput(IMFSample *pSample);
+    HRESULT OnDequeueOutput(MFT_OUTPUT_DATA_BUFFER *pOutputSamples, DWORD *pdwStatus);
+    void    FlushFrameQueue();
+
+    static HRESULT TransformFrame(const FRAME_PARAMS& params, IMFMediaBuffer *pIn, IMFMediaBuffer *pOut);
+    static void    ProcessFrameJob(void *pContext);
+    void    ReleaseFrameJob(FRAME_JOB *pJob);
+    void    DeleteFrameQueue();
+    void    PublishCounters();
+
     CRITICAL_SECTION            m_critSec;
 
     // Transformation parameters
-    D2D1::Matrix3x2F            m_transform;                // Chroma transform matrix.
     D2D_RECT_U                  m_rcDest;                   // Destination rectangle for the effect.
+    SKETCH_REGION               m_rgRegions[SKETCH_MAX_REGIONS]; // Replace m_rcDest when there are any.
+    DWORD                       m_cRegions;
+    SKETCH_PREFILTER            m_prefilter;                // Of the filtered kernels.
+    DWORD                       m_dwMedianRadius;           // Of SKETCH_PREFILTER_MEDIAN_RADIUS.
 
     // Streaming
     bool                        m_bStreamingInitialized;
@@ -263,7 +515,34 @@ private:
 
     // Image transform function. (Changes based on the media type.)
     IMAGE_TRANSFORM_FN          m_pTransformFn;
-	BYTE*						m_pFilteredYSrc;
+    IMAGE_BAND_FN               m_pBandFn;                  // Same transform, one band at a time.
+    SKETCH_TILE_KERNEL          m_tileKernel;               // Same transform, one tile at a time.
+    IMAGE_SCALED_FN             m_pScaledFn;                // Same transform, at a reduced size.
+	BYTE*						m_pFilteredYSrc;            // In m_scratch; NULL runs the unfiltered kernels.
+    BYTE                        *m_pScaledScratch;          // In m_scratch; NULL runs at full size.
+    DWORD                       m_dwScale;                  // MFT_GRAYSCALE_SCALE.
+    IMAGE_TRANSFORM_FN          m_pColorFn;                 // Colour edges of the format; NULL if it has none.
+    BYTE                        *m_pColorScratch;           // In m_scratch; NULL sketches the luma.
+    CSketchScratchArena         m_scratch;                  // Per-format buffers, freed with the MFT.
+
+    // Band-parallel processing. NULL when running serially.
+    CSketchThreadPool           *m_pThreadPool;
+
+    // Counters of the last frame, published by GetAttributes.
+    FRAME_COUNTERS              m_counters;
+
+    // Temporal change detection. NULL when every frame is transformed whole.
+    CSketchTemporal             *m_pTemporal;
+
+    // Asynchronous mode. NULL when samples are transformed in ProcessOutput.
+    CSketchFrameQueue           *m_pFrameQueue;
+    FRAME_JOB                   *m_pJobs;                   // The queue's depth of jobs.
+    FRAME_JOB                   *m_pFreeJobs;               // Those it does not hold.
+    IMFVideoSampleAllocatorEx   *m_pSampleAllocator;        // Output samples; NULL in place.
+    BOOL                        m_bDraining;                // Refuse input until the queue is empty.
+
+    // In-place mode: the input sample is transformed and returned.
+    BOOL                        m_bInPlace;
 	BOOL						m_bBlackFigure;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+// Locating frames in locked media buffers.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchBuffer.h"
+
+// |lPitch|, which does not fit a LONG for the most negative pitch.
+static inline DWORD PitchBytes(LONG lPitch)
+{
+	return (lPitch < 0) ? 0u - (DWORD)lPitch : (DWORD)lPitch;
+}
+
+BYTE* GetSketchScanline0(BYTE* pBuffer, LONG lStride, DWORD cLines)
+{
+	if (lStride < 0 && cLines > 0)
+	{
+		return pBuffer + (size_t)(cLines - 1) * PitchBytes(lStride);
+	}
+	return pBuffer;
+}
+
+bool IsSketchFrameInBuffer(const BYTE* pScanline0, LONG lPitch, DWORD cbLine, DWORD cLines,
+	const BYTE* pBuffer, size_t cbBuffer)
+{
+	if (cLines == 0 || cbLine == 0)
+	{
+		return true;
+	}
+
+	const size_t cbPitch = PitchBytes(lPitch);
+	if (cLines > 1 && cbPitch < cbLine)
+	{
+		return false;
+	}
+
+	// Offsets from the start of the buffer, of line 0 and of the line
+	// lowest in memory.
+	const size_t cbSpan = (size_t)(cLines - 1) * cbPitch;
+	if ((uintptr_t)pScanline0 < (uintptr_t)pBuffer)
+	{
+		return false;
+	}
+	size_t cbFirst = (size_t)((uintptr_t)pScanline0 - (uintptr_t)pBuffer);
+	if (lPitch < 0)
+	{
+		if (cbFirst < cbSpan)
+		{
+			return false;
+		}
+		cbFirst -= cbSpan;
+	}
+
+	return cbSpan + cbLine <= cbBuffer && cbFirst <= cbBuffer - (cbSpan + cbLine);
+}
@@ -0,0 +1,36 @@
+// Locating frames in locked media buffers.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHBUFFER_H
+#define SKETCHBUFFER_H
+
+#include "SketchPlatform.h"
+
+#include <stddef.h>
+
+//
+// The kernels take a frame as its line 0 and the signed distance from one
+// line to the next, and walk it line by line, so a buffer is used where it
+// lies: a 2D buffer's scanline 0 and pitch as the buffer gives them, with
+// no copy into a contiguous one first. A negative pitch is a bottom-up
+// buffer, whose line 0 is the last in memory.
+//
+// cLines counts every line of the frame: the luma, then for NV12 the
+// chroma lines that follow it at the same pitch.
+//
+
+// Line 0 of a frame in a buffer locked as one block of bytes, with lines
+// lStride bytes apart: the start of the buffer, or for a negative stride
+// the last of the cLines lines.
+BYTE* GetSketchScanline0(BYTE* pBuffer, LONG lStride, DWORD cLines);
+
+// True if cLines lines of cbLine bytes, from pScanline0 lPitch bytes
+// apart, all lie within the cbBuffer bytes at pBuffer without overlapping.
+bool IsSketchFrameInBuffer(const BYTE* pScanline0, LONG lPitch, DWORD cbLine, DWORD cLines,
+    const BYTE* pBuffer, size_t cbBuffer);
+
+#endif
@@ -0,0 +1,228 @@
+// Instruction set selection for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchCpu.h"
+#include "SketchRows.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SKETCH_CPU_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+static const char* const g_rgszTierNames[SKETCH_TIER_COUNT] =
+{
+	"auto", "scalar", "sse2", "ssse3", "avx2", "avx512", "neon"
+};
+
+static const SKETCH_ROW_FNS* const g_rgpTierRows[SKETCH_TIER_COUNT] =
+{
+	NULL,
+	&g_SketchRowsScalar,
+	&g_SketchRowsSSE2,
+	&g_SketchRowsSSSE3,
+	&g_SketchRowsAVX2,
+	&g_SketchRowsAVX512,
+	&g_SketchRowsNEON
+};
+
+#if defined(SKETCH_CPU_X86)
+
+static void CpuId(DWORD dwLeaf, DWORD rgdw[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex((int*)rgdw, (int)dwLeaf, 0);
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(dwLeaf, 0, a, b, c, d);
+	rgdw[0] = a; rgdw[1] = b; rgdw[2] = c; rgdw[3] = d;
+#endif
+}
+
+// Register state the OS saves on a context switch (XCR0).
+static UINT64 GetEnabledXState()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned int a = 0, d = 0;
+	__asm__ __volatile__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((UINT64)d << 32) | a;
+#endif
+}
+
+#endif
+
+// Tiers the CPU has, one bit per SKETCH_CPU_TIER.
+static DWORD ProbeCpuTiers()
+{
+	DWORD dwTiers = 1u << SKETCH_TIER_SCALAR;
+
+#if defined(SKETCH_CPU_X86)
+	DWORD rgdw[4];
+	CpuId(0, rgdw);
+	const DWORD dwMaxLeaf = rgdw[0];
+
+	CpuId(1, rgdw);
+	const DWORD dwEcx1 = rgdw[2], dwEdx1 = rgdw[3];
+	if (dwEdx1 & (1u << 26))
+	{
+		dwTiers |= 1u << SKETCH_TIER_SSE2;
+	}
+	if ((dwTiers & (1u << SKETCH_TIER_SSE2)) && (dwEcx1 & (1u << 9)))
+	{
+		dwTiers |= 1u << SKETCH_TIER_SSSE3;
+	}
+
+	// AVX needs the OS to save the YMM registers (OSXSAVE, then XCR0), and
+	// AVX-512 the opmask and ZMM registers as well.
+	if ((dwEcx1 & (1u << 27)) && (dwEcx1 & (1u << 28)) && dwMaxLeaf >= 7)
+	{
+		const UINT64 xcr0 = GetEnabledXState();
+		CpuId(7, rgdw);
+		const DWORD dwEbx7 = rgdw[1];
+
+		if ((xcr0 & 0x06) == 0x06 && (dwEbx7 & (1u << 5)))
+		{
+			dwTiers |= 1u << SKETCH_TIER_AVX2;
+		}
+		if ((xcr0 & 0xE6) == 0xE6 && (dwEbx7 & (1u << 16)) && (dwEbx7 & (1u << 30)) &&
+			(dwTiers & (1u << SKETCH_TIER_AVX2)))
+		{
+			dwTiers |= 1u << SKETCH_TIER_AVX512;
+		}
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM) || defined(_M_ARM64)
+	// Only built with NEON where the target has it.
+	dwTiers |= 1u << SKETCH_TIER_NEON;
+#endif
+
+	return dwTiers;
+}
+
+// Tiers both built and on the CPU.
+static DWORD GetSupportedTiers()
+{
+	static const DWORD s_dwTiers = ProbeCpuTiers();
+
+	DWORD dwSupported = 0;
+	for (DWORD t = SKETCH_TIER_SCALAR; t < SKETCH_TIER_COUNT; t++)
+	{
+		if ((s_dwTiers & (1u << t)) && g_rgpTierRows[t]->pfnMedianRow3x3 != NULL)
+		{
+			dwSupported |= 1u << t;
+		}
+	}
+	return dwSupported;
+}
+
+static SKETCH_CPU_TIER GetDefaultTier()
+{
+	const DWORD dwSupported = GetSupportedTiers();
+
+	// AVX-512 has to be asked for: on the machines measured the 64-byte
+	// rows ran slower than AVX2, and wide vectors cost clock speed on
+	// many parts. NEON is never on the same CPU as the x86 tiers.
+	for (DWORD t = SKETCH_TIER_COUNT - 1; t > SKETCH_TIER_SCALAR; t--)
+	{
+		if (t != SKETCH_TIER_AVX512 && (dwSupported & (1u << t)))
+		{
+			return (SKETCH_CPU_TIER)t;
+		}
+	}
+	return SKETCH_TIER_SCALAR;
+}
+
+static SKETCH_CPU_TIER GetInitialTier()
+{
+	SKETCH_CPU_TIER tier = SKETCH_TIER_AUTO;
+
+#if defined(_MSC_VER)
+	char szName[16];
+	DWORD cch = GetEnvironmentVariableA("SKETCH_CPU_TIER", szName, sizeof(szName));
+	if (cch > 0 && cch < sizeof(szName))
+	{
+		tier = FindSketchTier(szName);
+	}
+#else
+	const char* pszName = getenv("SKETCH_CPU_TIER");
+	if (pszName != NULL)
+	{
+		tier = FindSketchTier(pszName);
+	}
+#endif
+
+	// An unknown or unsupported name is ignored.
+	return IsSketchTierSupported(tier) ? tier : GetDefaultTier();
+}
+
+// The tier SKETCH_TIER_AUTO stands for: the one the environment forced,
+// read once, or the default.
+static SKETCH_CPU_TIER GetAutoTier()
+{
+	static const SKETCH_CPU_TIER s_tier = GetInitialTier();
+	return s_tier;
+}
+
+static std::atomic<int>& CurrentTier()
+{
+	static std::atomic<int> s_tier(GetAutoTier());
+	return s_tier;
+}
+
+SKETCH_CPU_TIER GetSketchTier()
+{
+	return (SKETCH_CPU_TIER)CurrentTier().load(std::memory_order_relaxed);
+}
+
+bool SetSketchTier(SKETCH_CPU_TIER tier)
+{
+	if (tier == SKETCH_TIER_AUTO)
+	{
+		tier = GetAutoTier();
+	}
+	if (!IsSketchTierSupported(tier))
+	{
+		return false;
+	}
+	CurrentTier().store(tier, std::memory_order_relaxed);
+	return true;
+}
+
+bool IsSketchTierSupported(SKETCH_CPU_TIER tier)
+{
+	return tier > SKETCH_TIER_AUTO && tier < SKETCH_TIER_COUNT && (GetSupportedTiers() & (1u << tier)) != 0;
+}
+
+const char* GetSketchTierName(SKETCH_CPU_TIER tier)
+{
+	return (tier >= SKETCH_TIER_AUTO && tier < SKETCH_TIER_COUNT) ? g_rgszTierNames[tier] : "";
+}
+
+SKETCH_CPU_TIER FindSketchTier(const char* pszName)
+{
+	for (DWORD t = 0; t < SKETCH_TIER_COUNT; t++)
+	{
+		if (strcmp(pszName, g_rgszTierNames[t]) == 0)
+		{
+			return (SKETCH_CPU_TIER)t;
+		}
+	}
+	return SKETCH_TIER_COUNT;
+}
+
+const SKETCH_ROW_FNS* GetSketchRows()
+{
+	return g_rgpTierRows[GetSketchTier()];
+}
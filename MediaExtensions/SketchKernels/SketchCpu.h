@@ -0,0 +1,58 @@
+// Instruction set selection for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHCPU_H
+#define SKETCHCPU_H
+
+#include "SketchPlatform.h"
+
+//
+// The row kernels under the median filters and edge detectors are built
+// once per instruction set tier, each in its own translation unit with its
+// own compiler flags. The CPU is probed on first use and every kernel then
+// runs on the widest tier both the build and the CPU support, short of
+// AVX-512, which is only used when asked for. All tiers produce the same
+// output.
+//
+// The tier can be forced for benchmarking, either by setting the
+// environment variable SKETCH_CPU_TIER to one of the names
+// GetSketchTierName returns (read once, on first use) or by calling
+// SetSketchTier. The choice is process-wide.
+//
+
+enum SKETCH_CPU_TIER
+{
+    SKETCH_TIER_AUTO = 0,       // The default: widest supported, up to AVX2.
+    SKETCH_TIER_SCALAR,
+    SKETCH_TIER_SSE2,
+    SKETCH_TIER_SSSE3,
+    SKETCH_TIER_AVX2,
+    SKETCH_TIER_AVX512,         // AVX-512 F and BW.
+    SKETCH_TIER_NEON,
+    SKETCH_TIER_COUNT
+};
+
+// The tier the kernels run on. Never SKETCH_TIER_AUTO.
+SKETCH_CPU_TIER GetSketchTier();
+
+// Runs the kernels on the given tier from now on; SKETCH_TIER_AUTO goes back
+// to the tier SKETCH_CPU_TIER names, if it names a supported one, and
+// otherwise to the default. Returns false, and keeps the current tier, if the tier was
+// not built or the CPU does not have it. Frames already running may finish
+// on the old tier.
+bool SetSketchTier(SKETCH_CPU_TIER tier);
+
+// True if the tier was built and the CPU has it.
+bool IsSketchTierSupported(SKETCH_CPU_TIER tier);
+
+// "auto", "scalar", "sse2", "ssse3", "avx2", "avx512" or "neon".
+const char* GetSketchTierName(SKETCH_CPU_TIER tier);
+
+// The tier with the given name, or SKETCH_TIER_COUNT if there is none.
+SKETCH_CPU_TIER FindSketchTier(const char* pszName);
+
+#endif
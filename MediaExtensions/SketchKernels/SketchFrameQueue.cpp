@@ -0,0 +1,141 @@
+// Pipelined frame processing for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchFrameQueue.h"
+
+CSketchFrameQueue::CSketchFrameQueue(DWORD dwDepth, SKETCH_JOB_FN pfnProcess) :
+	m_dwDepth((dwDepth == 0) ? 1 : dwDepth), m_pfnProcess(pfnProcess), m_bRunning(false),
+	m_iFirst(0), m_cJobs(0), m_cDone(0), m_bBusy(false), m_bExit(false)
+{
+	try
+	{
+		m_jobs.resize(m_dwDepth, NULL);
+		m_worker = std::thread(&CSketchFrameQueue::WorkerThread, this);
+		m_bRunning = true;
+	}
+	catch (...)
+	{
+	}
+}
+
+CSketchFrameQueue::~CSketchFrameQueue()
+{
+	if (m_bRunning)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_bExit = true;
+		}
+		m_cvWork.notify_one();
+		m_worker.join();
+	}
+}
+
+DWORD CSketchFrameQueue::GetCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return (DWORD)m_cJobs;
+}
+
+bool CSketchFrameQueue::Submit(void* pJob)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (!m_bRunning || m_cJobs >= m_dwDepth)
+		{
+			return false;
+		}
+		Job(m_cJobs++) = pJob;
+	}
+	m_cvWork.notify_one();
+	return true;
+}
+
+bool CSketchFrameQueue::IsCompletedReady()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_cDone > 0;
+}
+
+void* CSketchFrameQueue::PopCompleted(bool bWait)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	while (bWait && m_cDone == 0 && m_cJobs > 0)
+	{
+		m_cvDone.wait(lock);
+	}
+	if (m_cDone == 0)
+	{
+		return NULL;
+	}
+
+	void* pJob = Job(0);
+	m_iFirst = (m_iFirst + 1) % m_jobs.size();
+	m_cJobs--;
+	m_cDone--;
+	return pJob;
+}
+
+void CSketchFrameQueue::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	while (m_cDone < m_cJobs)
+	{
+		m_cvDone.wait(lock);
+	}
+}
+
+void CSketchFrameQueue::Flush(std::vector<void*>* pJobs)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	// The running job cannot be taken away from the worker; let it finish.
+	// Holding the lock from here on keeps the worker off the next one.
+	while (m_bBusy)
+	{
+		m_cvDone.wait(lock);
+	}
+
+	for (size_t i = 0; i < m_cJobs; i++)
+	{
+		pJobs->push_back(Job(i));
+	}
+	m_iFirst = 0;
+	m_cJobs = 0;
+	m_cDone = 0;
+}
+
+void CSketchFrameQueue::WorkerThread()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+
+	for (;;)
+	{
+		while (!m_bExit && m_cDone == m_cJobs)
+		{
+			m_cvWork.wait(lock);
+		}
+		if (m_bExit)
+		{
+			return;
+		}
+
+		// Jobs run one at a time, oldest first, so job m_cDone is next.
+		void* pJob = Job(m_cDone);
+		m_bBusy = true;
+
+		lock.unlock();
+		(*m_pfnProcess)(pJob);
+		lock.lock();
+
+		m_bBusy = false;
+		m_cDone++;
+		m_cvDone.notify_all();
+	}
+}
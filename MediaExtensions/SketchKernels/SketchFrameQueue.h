@@ -0,0 +1,96 @@
+// Pipelined frame processing for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHFRAMEQUEUE_H
+#define SKETCHFRAMEQUEUE_H
+
+#include "SketchPlatform.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Function pointer for the function that processes one queued job.
+typedef void (*SKETCH_JOB_FN)(void* pJob);
+
+//
+// CSketchFrameQueue runs frames through a worker thread so that producing
+// the next frame, transforming this one and consuming the last one can
+// overlap. Jobs are opaque to the queue; the caller allocates them, the
+// worker passes each to the job function in submission order, and
+// PopCompleted hands them back in the same order once done.
+//
+// At most dwDepth jobs are held at a time, counting the queued, the
+// running and the finished ones not yet popped, so a slow consumer pushes
+// back on the producer instead of growing the queue. Room for them is
+// allocated up front, so submitting and popping never allocate.
+//
+// All members may be called from any thread except the job function.
+//
+class CSketchFrameQueue
+{
+public:
+    CSketchFrameQueue(DWORD dwDepth, SKETCH_JOB_FN pfnProcess);
+
+    // Waits for the running job. Jobs still held are not processed or
+    // returned; Flush first to get them back.
+    ~CSketchFrameQueue();
+
+    // False if the worker thread or the room for the jobs could not be
+    // set up; nothing is then accepted.
+    bool IsRunning() const { return m_bRunning; }
+
+    DWORD GetDepth() const { return m_dwDepth; }
+
+    // Jobs held: queued, running, or done and not yet popped.
+    DWORD GetCount();
+
+    // Queues a job. Returns false if the queue is full (or not running).
+    bool Submit(void* pJob);
+
+    // True if the oldest job is done and PopCompleted will return it.
+    bool IsCompletedReady();
+
+    // Removes and returns the oldest job once it is done. Without bWait,
+    // returns NULL if it is not done yet; with bWait, waits for it.
+    // Returns NULL if the queue is empty.
+    void* PopCompleted(bool bWait);
+
+    // Waits until every held job is done.
+    void WaitIdle();
+
+    // Waits for the running job, then removes every held job, done or not,
+    // and appends it to *pJobs for the caller to release.
+    void Flush(std::vector<void*>* pJobs);
+
+private:
+    CSketchFrameQueue(const CSketchFrameQueue&);
+    CSketchFrameQueue& operator=(const CSketchFrameQueue&);
+
+    void WorkerThread();
+
+    // The ith held job, oldest first.
+    void*& Job(size_t i) { return m_jobs[(m_iFirst + i) % m_jobs.size()]; }
+
+    const DWORD                 m_dwDepth;
+    const SKETCH_JOB_FN         m_pfnProcess;
+    bool                        m_bRunning;
+    std::thread                 m_worker;
+
+    std::mutex                  m_lock;
+    std::condition_variable     m_cvWork;           // The worker waits for jobs.
+    std::condition_variable     m_cvDone;           // Callers wait for results.
+    std::vector<void*>          m_jobs;             // Ring of m_dwDepth slots.
+    size_t                      m_iFirst;           // Slot of the oldest job.
+    size_t                      m_cJobs;            // Jobs held.
+    size_t                      m_cDone;            // The first m_cDone jobs are done.
+    bool                        m_bBusy;            // Job m_cDone is running.
+    bool                        m_bExit;
+};
+
+#endif
@@ -0,0 +1,1400 @@
+// Portable sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchKernels.h"
+#include "SketchMedian.h"
+#include "SketchRoberts.h"
+#include "SketchPipeline.h"
+#include "SketchRegions.h"
+#include "SketchRows.h"
+#include "SketchScratch.h"
+#include "SketchThreadPool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+/*
+This code adds sketch effect to video stream by applying edge detection to the Y component of raw video data.   
+*/
+
+//-------------------------------------------------------------------
+// Functions to get median value of input 9 parameters.
+//------------------------------------------------------------------
+
+///
+///get median value
+///
+BYTE GetMedian(BYTE _11, BYTE _12, BYTE _13,
+			   BYTE _21, BYTE _22, BYTE _23,
+			   BYTE _31, BYTE _32, BYTE _33)
+{
+	DWORD L = 9;
+	BYTE data[9] = {_11, _12, _13, 
+					_21, _22, _23,
+					_31, _32, _33}; 
+	/*DWORD L = 5;
+	BYTE data[5] = { _12, _21, _22, _23, _32};*/
+
+#if 0
+	//bubble
+	bool sorted;
+	for (DWORD i=0; i<L-1; i++)
+	{
+		sorted = true;
+		for (DWORD j=0; j<L-i-1; j++)
+		{
+			if (data[j] > data[j+1] )
+			{
+				BYTE tmp = data[j+1];
+				data[j+1] = data[j];
+				data[j] = tmp;
+				sorted = false;
+			}
+		}
+		if (sorted)
+			break;
+	}
+	return data[L>>1];
+#else
+	//quick sort
+	//int partition(int data[], int p, int r)
+	DWORD p, r;
+	DWORD M = (L+1)>>1;
+	p = 0;
+	r = L-1;
+
+	while (true)
+	{
+		DWORD i,j;
+		BYTE pivot = data[p];
+
+		i = p;
+		j = r;
+		while(i<j)
+		{
+			while(i<j && data[j]>=pivot) --j;
+			data[i] = data[j];
+			while(i<j && data[i]<=pivot) ++i;
+			data[j] = data[i];
+		}
+		data[i] = pivot;
+		if (i+1 == M)
+		{
+			return data[i];
+		}
+		else if(i+1 < M)
+		{
+			p = i+1;
+		}
+		else
+		{
+			r = i-1;
+		}
+	}
+	return data[0];
+#endif
+}
+
+//-------------------------------------------------------------------
+// Functions to do median filtering on Y component of YUV images.
+//
+// Three YUV formats which have difference pixel layout in memory
+// are supported here, each described by a layout (SketchLayout.h):
+// YUY2:	Y0 U0 Y1 V1 Y2 U1 ... 
+// UYVY:	U0 Y0 V0 Y1 U1 Y2 ...
+// NV12:	YYYYYYYY
+//			YYYYYYYY
+//			YYYYYYYY
+//			YYYYYYYY
+//			UVUVUVUV
+//			UVUVUVUV
+//
+// The filtering functions take the following parameters:
+//
+// pDest             Pointer to the destination buffer, sizeof which
+//					 is imagewidth*imageheight in bytes.
+// pSrc              Pointer to the source buffer.
+// lSrcStride        Stride of the source buffer, in bytes.
+// lDestStride       Stride of the destination buffer, in bytes.
+// dwWidthInPixels   Frame width in pixels.
+// dwHeightInPixels  Frame height, in pixels.
+// pScratch          GetSketchScratchSize(dwWidthInPixels) bytes, or NULL.
+//                   With it, packed luma may take the planar path (see
+//                   SetSketchPackedLuma).
+//
+// The interior of each row goes through MedianRow3x3 (SketchMedian.h),
+// which matches GetMedian bit for bit.
+//-------------------------------------------------------------------
+
+static std::atomic<int> g_packedLuma(SKETCH_PACKED_LUMA_AUTO);
+
+void SetSketchPackedLuma(SKETCH_PACKED_LUMA mode)
+{
+	g_packedLuma.store(mode, std::memory_order_relaxed);
+}
+
+//
+// Whether to read the luma of a packed layout from lines deinterleaved into
+// dense rows (CSketchLumaRing::RawRow) rather than at a stride of two. The
+// deinterleave is one more pass over each line, which only pays once the
+// dense loads save more than that.
+//
+template <class LAYOUT>
+static inline bool UsePlanarLuma(DWORD dwWidthInPixels, const BYTE *pScratch)
+{
+	if (LAYOUT::BytesPerPixel == 1 || pScratch == NULL)
+	{
+		return false;
+	}
+
+	switch (g_packedLuma.load(std::memory_order_relaxed))
+	{
+	case SKETCH_PACKED_LUMA_STRIDED:
+		return false;
+	case SKETCH_PACKED_LUMA_PLANAR:
+		return true;
+	default:
+		return dwWidthInPixels >= SKETCH_PLANAR_MIN_WIDTH;
+	}
+}
+
+//
+// Copy the luma of one line into the dense plane.
+//
+template <class LAYOUT>
+static inline void CopyLumaLine(BYTE *pDest, const BYTE *pSrc, LONG lDestStride, DWORD dwWidthInPixels)
+{
+	if (LAYOUT::FullStrideCopies)
+	{
+		// A bottom-up plane's lines are as long as its stride is negative.
+		memcpy(pDest, pSrc, ((lDestStride < 0) ? 0u - (DWORD)lDestStride : (DWORD)lDestStride)*sizeof(BYTE));
+		return;
+	}
+
+	for (DWORD x=0; x<dwWidthInPixels; x++)
+	{
+		pDest[x] = pSrc[x*LAYOUT::BytesPerPixel + LAYOUT::LumaOffset];
+	}
+}
+
+///
+///Median filter
+///
+template <class LAYOUT>
+void MedianFilter(
+    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
+    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+	_In_ LONG lSrcStride, 
+	_In_ LONG lDestStride,		//width
+    _In_ DWORD dwWidthInPixels, 
+    _In_ DWORD dwHeightInPixels,
+	_In_ BYTE *pScratch)
+{
+	const DWORD dwStep = LAYOUT::BytesPerPixel;
+	DWORD y = 0;
+
+	if (UsePlanarLuma<LAYOUT>(dwWidthInPixels, pScratch))
+	{
+		// The ring filters dense rows exactly as below, borders included.
+		const SKETCH_COLUMNS whole = { 0, dwWidthInPixels };
+		CSketchLumaRing filtered(pSrc + LAYOUT::LumaOffset, lSrcStride, dwStep, dwWidthInPixels, dwHeightInPixels, &whole, 1,
+			SKETCH_PREFILTER_MEDIAN3, 0, pScratch, false);
+
+		for (y = 0; y < dwHeightInPixels; y++)
+		{
+			memcpy(pDest + (LONG)y * lDestStride, filtered.Row(y), dwWidthInPixels);
+		}
+		return;
+	}
+
+	//1st line
+	CopyLumaLine<LAYOUT>(pDest, pSrc, lDestStride, dwWidthInPixels);
+	pSrc	+= lSrcStride;
+	pDest	+= lDestStride;
+
+    for ( y=1; y < dwHeightInPixels-1; y++)
+    {
+        const BYTE *pSrc_Pixel = pSrc + LAYOUT::LumaOffset;
+		BYTE *pDest_Pixel= pDest;
+		const DWORD p = dwWidthInPixels - 1;
+
+		//1st column
+		pDest_Pixel[0] = pSrc_Pixel[0];
+		
+		//Columns from the first to the last 
+		MedianRow3x3(pDest_Pixel + 1, pSrc_Pixel + dwStep - lSrcStride, pSrc_Pixel + dwStep, pSrc_Pixel + dwStep + lSrcStride, dwStep, dwWidthInPixels - 2);
+
+		//Last column
+		pDest_Pixel[p] = pSrc_Pixel[p * dwStep];
+
+        pDest += lDestStride;
+        pSrc += lSrcStride;
+	}
+
+	//Last line
+	CopyLumaLine<LAYOUT>(pDest, pSrc, lDestStride, dwWidthInPixels);
+}
+
+///
+///Median filter of a given radius
+///
+template <class LAYOUT>
+void MedianFilterRadius(
+    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest,
+    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+	_In_ LONG lSrcStride,
+	_In_ LONG lDestStride,
+    _In_ DWORD dwWidthInPixels,
+    _In_ DWORD dwHeightInPixels,
+	_In_ DWORD dwRadius,
+	_In_ BYTE *pScratch)
+{
+	// The ring filters dense rows exactly as MedianFilter does.
+	const SKETCH_COLUMNS whole = { 0, dwWidthInPixels };
+	CSketchLumaRing filtered(pSrc + LAYOUT::LumaOffset, lSrcStride, LAYOUT::BytesPerPixel, dwWidthInPixels, dwHeightInPixels,
+		&whole, 1, SKETCH_PREFILTER_MEDIAN_RADIUS, dwRadius, pScratch, false);
+
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		memcpy(pDest + (LONG)y * lDestStride, filtered.Row(y), dwWidthInPixels);
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Functions to do image detection.
+//
+// Each detector has a band form (EdgeDectectionBand, SKETCH_BAND_FN)
+// which writes output lines [yBegin, yEnd) of a frame, and takes the
+// following parameters:
+//
+// frame             Source and destination buffers, strides, frame size
+//                   and destination rectangle or regions (see
+//                   SketchKernels.h).
+// yBegin, yEnd      Output lines to write.
+// pScratch          Scratch for the luma rows, GetSketchScratchSize(
+//                   dwWidthInPixels) bytes (see SketchPipeline.h): the
+//                   pre-filtered rows of the F variants, and the
+//                   deinterleaved rows of the others on the planar path.
+//                   Those may also be given NULL.
+//
+// An output line only depends on the source, so the bands of a frame can
+// run in any order, or at the same time, and still produce exactly what
+// one call over [0, dwHeightInPixels) does. The frame form (EdgeDectection,
+// SKETCH_TRANSFORM_FN) is that one call. Both are templates on the layout
+// (SketchLayout.h).
+//
+// Only the destination regions (the rectangle, for a frame without any),
+// clipped to the frame, are detected. Each pixel in them gets the value
+// the effect over the whole frame, with its region's parameters, gives it:
+// the first line of the frame is copied, the last is copied with neutral
+// chroma, the first and last columns between them keep their luma (with
+// neutral chroma) and the rest get edges. An inverted region then has its
+// luma inverted. Everything outside the regions is copied from the source,
+// whole lines and the pieces between spans at a time; for NV12 that
+// includes the chroma of the pixels outside them.
+//-------------------------------------------------------------------
+
+// Copies pixels [xBegin, xEnd) of a line. In place there is nothing to copy.
+template <class LAYOUT>
+static inline void CopySpan(BYTE *pDest_Line, const BYTE *pSrc_Line, DWORD xBegin, DWORD xEnd)
+{
+	if (xBegin < xEnd && pDest_Line != pSrc_Line)
+	{
+		memcpy(pDest_Line + xBegin * LAYOUT::BytesPerPixel, pSrc_Line + xBegin * LAYOUT::BytesPerPixel,
+			(xEnd - xBegin) * LAYOUT::BytesPerPixel);
+	}
+}
+
+//
+// NV12 U/V component: chroma line cy covers luma lines 2cy and 2cy+1 and
+// is written by the band holding line 2cy. The U V pairs under the
+// regions on either line get 128, the rest is copied. Only bytes
+// [xBegin, xEnd) are written, the pairs of pixels [xBegin, xEnd).
+//
+static void ChromaLines(const SKETCH_FRAME& frame, const CSketchSpans& spans, DWORD xBegin, DWORD xEnd, DWORD yBegin,
+	DWORD yEnd)
+{
+	const DWORD dwHeight = frame.dwHeightInPixels;
+	const DWORD cyEnd = ((yEnd + 1) >> 1 < (dwHeight >> 1)) ? (yEnd + 1) >> 1 : dwHeight >> 1;
+	SKETCH_COLUMNS rgColumns[SKETCH_MAX_REGIONS];
+
+	for (DWORD cy = (yBegin + 1) >> 1; cy < cyEnd; cy++)
+	{
+		const BYTE *pSrc_Line = frame.pSrc + (LONG)(dwHeight + cy) * frame.lSrcStride;
+		BYTE *pDest_Line = frame.pDest + (LONG)(dwHeight + cy) * frame.lDestStride;
+		const DWORD cColumns = spans.GetColumns(2 * cy, 2 * cy + 2, 0, 0, rgColumns);
+		DWORD cbDone = xBegin;
+
+		for (DWORD i = 0; i < cColumns; i++)
+		{
+			// Bytes of the pairs under the columns.
+			DWORD cbLeft = rgColumns[i].xBegin & ~1u;
+			DWORD cbRight = (rgColumns[i].xEnd + 1) & ~1u;
+
+			cbLeft = (cbLeft > cbDone) ? cbLeft : cbDone;
+			cbRight = (cbRight < xEnd) ? cbRight : xEnd;
+			if (cbLeft >= cbRight)
+			{
+				continue;
+			}
+
+			if (pDest_Line != pSrc_Line)
+			{
+				memcpy(pDest_Line + cbDone, pSrc_Line + cbDone, cbLeft - cbDone);
+			}
+			memset(pDest_Line + cbLeft, 128, cbRight - cbLeft);
+			cbDone = cbRight;
+		}
+		if (pDest_Line != pSrc_Line)
+		{
+			memcpy(pDest_Line + cbDone, pSrc_Line + cbDone, xEnd - cbDone);
+		}
+	}
+}
+
+// Where RobertsRow puts the edges of a line of the layout.
+template <class LAYOUT>
+static inline ROBERTS_DEST GetRobertsDest()
+{
+	if (LAYOUT::BytesPerPixel == 1)
+	{
+		return ROBERTS_DEST_LUMA;
+	}
+	return (LAYOUT::LumaOffset == 0) ? ROBERTS_DEST_YUY2 : ROBERTS_DEST_UYVY;
+}
+
+// Sets pixel x of a destination line to bLuma, with neutral chroma in
+// packed layouts.
+template <class LAYOUT>
+static inline void SetEdgePixel(BYTE *pDest_Line, DWORD x, BYTE bLuma)
+{
+	BYTE *pDest_Pixel = pDest_Line + x * LAYOUT::BytesPerPixel;
+
+	pDest_Pixel[LAYOUT::LumaOffset] = bLuma;
+	if (LAYOUT::BytesPerPixel == 2)
+	{
+		pDest_Pixel[1 - LAYOUT::LumaOffset] = 128;	//u, v
+	}
+}
+
+//
+// Columns [xBegin, xEnd) of an edge line: the first and last column of the
+// frame get bFirst and bLast, the columns between them the edges over pRow
+// and pNext, which point at the luma of column 0 in this line and the line
+// below, for a flat area of grey level bLevel. A 3x3 detector takes its
+// edges over the dense rows rgp3x3 instead: the line above, this line and
+// the line below. pFloor, if not NULL, holds the chroma gradients of the
+// line by column.
+//
+template <class LAYOUT>
+static inline void EdgeSpan(BYTE *pDest_Line, DWORD xBegin, DWORD xEnd, BYTE bFirst, const BYTE *pRow, const BYTE *pNext,
+	DWORD dwSrcStep, BYTE bLast, DWORD dwWidthInPixels, BYTE bLevel, const BYTE *pFloor, SKETCH_DETECTOR detector,
+	const BYTE *const rgp3x3[3])
+{
+	//Pixel in the fist column
+	if (xBegin == 0)
+	{
+		SetEdgePixel<LAYOUT>(pDest_Line, 0, bFirst);
+		xBegin = 1;
+	}
+
+	//Pixel in the last column
+	if (xEnd == dwWidthInPixels)
+	{
+		SetEdgePixel<LAYOUT>(pDest_Line, dwWidthInPixels - 1, bLast);
+		xEnd = dwWidthInPixels - 1;
+	}
+
+	//Columns from the first to the last 
+	if (xBegin < xEnd && detector != SKETCH_DETECTOR_ROBERTS)
+	{
+		GetSketchRows()->pfnEdgeRow3x3(pDest_Line + xBegin * LAYOUT::BytesPerPixel, GetRobertsDest<LAYOUT>(), detector,
+			rgp3x3[0] + xBegin, rgp3x3[1] + xBegin, rgp3x3[2] + xBegin, xEnd - xBegin, bLevel,
+			(pFloor != NULL) ? pFloor + xBegin : NULL);
+	}
+	else if (xBegin < xEnd)
+	{
+		RobertsRow(pDest_Line + xBegin * LAYOUT::BytesPerPixel, GetRobertsDest<LAYOUT>(), pRow + xBegin * dwSrcStep,
+			pNext + xBegin * dwSrcStep, dwSrcStep, xEnd - xBegin, bLevel, (pFloor != NULL) ? pFloor + xBegin : NULL);
+	}
+}
+
+//
+// The chroma gradients (see SKETCH_REGION) of the pairs of pixels [xBegin,
+// xEnd) of edge line y, into pGradients by column. Packed chroma is on this
+// line and the next, NV12's on the chroma lines of this line and the one
+// two below.
+//
+template <class LAYOUT>
+static void ChromaEdgeSpan(const SKETCH_FRAME& frame, DWORD y, DWORD xBegin, DWORD xEnd, BYTE *pGradients)
+{
+	const DWORD dwHeight = frame.dwHeightInPixels;
+	const DWORD dwStep = LAYOUT::BytesPerPixel;
+	const BYTE *pRow = NULL;
+	const BYTE *pNext = NULL;
+
+	if (LAYOUT::ChromaPlane)
+	{
+		const DWORD cy = y >> 1;
+		const DWORD cyNext = (cy + 1 < (dwHeight >> 1)) ? cy + 1 : cy;
+		pRow = frame.pSrc + (LONG)(dwHeight + cy) * frame.lSrcStride;
+		pNext = frame.pSrc + (LONG)(dwHeight + cyNext) * frame.lSrcStride;
+	}
+	else
+	{
+		pRow = frame.pSrc + (LONG)y * frame.lSrcStride + 1 - LAYOUT::LumaOffset;
+		pNext = pRow + frame.lSrcStride;
+	}
+
+	// Only whole pairs count, and the last has no pair to its right.
+	const DWORD cPairs = frame.dwWidthInPixels >> 1;
+	const DWORD jBegin = xBegin >> 1;
+	const DWORD jAll = (xEnd + 1) >> 1;
+	const DWORD jEnd = std::max(jBegin, std::min(jAll, (cPairs > 0) ? cPairs - 1 : 0));
+
+	if (jBegin < jEnd)
+	{
+		GetSketchRows()->pfnChromaEdgeRow(pGradients + 2 * jBegin, pRow + 2 * jBegin * dwStep, pNext + 2 * jBegin * dwStep,
+			dwStep, jEnd - jBegin);
+	}
+	if (jEnd < jAll)
+	{
+		memset(pGradients + 2 * jEnd, 0, 2 * (jAll - jEnd));
+	}
+}
+
+// Columns [xBegin, xEnd) of the last line of the frame: a copy, with
+// neutral chroma.
+template <class LAYOUT>
+static inline void LastLineSpan(BYTE *pDest_Line, const BYTE *pSrc_Line, DWORD xBegin, DWORD xEnd)
+{
+	CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xBegin, xEnd);
+	if (LAYOUT::BytesPerPixel == 2)
+	{
+		for (DWORD x=xBegin; x<xEnd; x++)
+		{
+			pDest_Line[(x<<1) + 1 - LAYOUT::LumaOffset] = 128;		//u, v
+		}
+	}
+}
+
+// Inverts the luma of pixels [xBegin, xEnd) of a destination line, eight
+// bytes at a time: the span starts on a pixel, so the luma bytes of every
+// word are at the same offsets.
+template <class LAYOUT>
+static inline void InvertSpan(BYTE *pDest_Line, DWORD xBegin, DWORD xEnd)
+{
+	BYTE rgMask[sizeof(UINT64)];
+	for (DWORD i=0; i<sizeof(rgMask); i++)
+	{
+		rgMask[i] = (i % LAYOUT::BytesPerPixel == LAYOUT::LumaOffset) ? 0xFF : 0;
+	}
+	UINT64 mask;
+	memcpy(&mask, rgMask, sizeof(mask));
+
+	BYTE *p = pDest_Line + xBegin * LAYOUT::BytesPerPixel;
+	const size_t cb = (xEnd - xBegin) * LAYOUT::BytesPerPixel;
+	size_t i = 0;
+
+	for ( ; i + sizeof(UINT64) <= cb; i += sizeof(UINT64))
+	{
+		UINT64 word;
+		memcpy(&word, p + i, sizeof(word));
+		word ^= mask;
+		memcpy(p + i, &word, sizeof(word));
+	}
+	for ( ; i < cb; i++)
+	{
+		p[i] ^= rgMask[i % sizeof(UINT64)];
+	}
+}
+
+//
+// Both detectors: FILTERED takes the edges over the luma pre-filtered as
+// the frame says, with the rows and columns the layout's Filtered* traits
+// say. Writes columns [xBegin, xEnd) of lines [yBegin, yEnd); the band
+// forms pass the whole width.
+//
+template <class LAYOUT, bool FILTERED>
+static void EdgeTile(const SKETCH_FRAME& frame, DWORD xBegin, DWORD xEnd, DWORD yBegin, DWORD yEnd, BYTE *pScratch)
+{
+	const DWORD dwWidthInPixels = frame.dwWidthInPixels;
+	const DWORD dwHeightInPixels = frame.dwHeightInPixels;
+	const DWORD dwStep = LAYOUT::BytesPerPixel;
+	const LONG lSrcStride = frame.lSrcStride;
+	CSketchSpans spans(frame);
+
+	// The 3x3 detectors read their rows through the ring, so only run with
+	// scratch.
+	const bool b3x3 = (pScratch != NULL) && spans.HasDetector3x3();
+
+	// The pre-filtered luma of the F variants, or packed luma
+	// deinterleaved on the planar path, a line at a time. Only the columns
+	// of the regions in the tile and the one after each (and before each,
+	// for the 3x3 detectors) are read, and each column is filtered once
+	// however many regions overlap it.
+	SKETCH_COLUMNS rgColumns[SKETCH_MAX_REGIONS];
+	const DWORD cAll = spans.GetColumns(0, dwHeightInPixels, b3x3 ? 1 : 0, 1, rgColumns);
+	const DWORD xReadBegin = (b3x3 && xBegin > 0) ? xBegin - 1 : xBegin;
+	const DWORD xRead = (xEnd < dwWidthInPixels) ? xEnd + 1 : dwWidthInPixels;
+	DWORD cColumns = 0;
+
+	for (DWORD i = 0; i < cAll; i++)
+	{
+		const DWORD xLeft = (rgColumns[i].xBegin > xReadBegin) ? rgColumns[i].xBegin : xReadBegin;
+		const DWORD xRight = (rgColumns[i].xEnd < xRead) ? rgColumns[i].xEnd : xRead;
+
+		if (xLeft < xRight)
+		{
+			rgColumns[cColumns].xBegin = xLeft;
+			rgColumns[cColumns].xEnd = xRight;
+			cColumns++;
+		}
+	}
+
+	// In place, the lines above the one being written are already output,
+	// so the ring keeps its own copy of every luma row it reads. The rows
+	// read straight from the source are this line and the next.
+	const bool bInPlace = (frame.pDest == frame.pSrc);
+	const bool bPlanar = FILTERED || b3x3 || UsePlanarLuma<LAYOUT>(dwWidthInPixels, pScratch);
+	CSketchLumaRing luma(frame.pSrc + LAYOUT::LumaOffset, lSrcStride, dwStep, dwWidthInPixels, dwHeightInPixels,
+		rgColumns, cColumns, FILTERED ? frame.prefilter : SKETCH_PREFILTER_NONE, frame.dwMedianRadius, bPlanar ? pScratch : NULL,
+		bInPlace && bPlanar);
+
+	for (DWORD y = yBegin; y < yEnd; y++)
+	{
+		const BYTE *pSrc_Line = frame.pSrc + (LONG)y * lSrcStride;
+		BYTE *pDest_Line = frame.pDest + (LONG)y * frame.lDestStride;
+		const SKETCH_SPAN *pSpans = NULL;
+		const DWORD cSpans = spans.GetSpans(y, &pSpans);
+
+		if (cSpans == 0)
+		{
+			// Lines outside the destination regions.
+			CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xBegin, xEnd);
+			continue;
+		}
+
+		// The three dense rows of the 3x3 detectors, fetched before the
+		// Roberts rows, which are among them, so the ring sees increasing
+		// rows; raw rows from the one below, as the ring's own filter does.
+		const BYTE *rgp3x3[3] = { NULL, NULL, NULL };
+		if (b3x3 && y > 0 && y < dwHeightInPixels - 1)
+		{
+			if (FILTERED)
+			{
+				rgp3x3[0] = luma.Row(y-1);
+				rgp3x3[1] = luma.Row(y);
+				rgp3x3[2] = luma.Row(y+1);
+			}
+			else
+			{
+				rgp3x3[2] = luma.RawRow(y+1);
+				rgp3x3[1] = luma.RawRow(y);
+				rgp3x3[0] = luma.RawRow(y-1);
+			}
+		}
+
+		// The two luma rows the edges are taken over, from column 0. The
+		// first and last column are only read by the tiles that hold them.
+		const BYTE *pSrc_Pixel = NULL;
+		const BYTE *pNext_Pixel = NULL;
+		DWORD dwSrcStep = 1;
+		BYTE bFirst = 0, bLast = 0;
+
+		if (y == 0 || y == dwHeightInPixels - 1)
+		{
+			// Copied, not detected.
+		}
+		else if (FILTERED)
+		{
+			const DWORD yFiltered = LAYOUT::FilteredLag ? y - 1 : y;
+			pSrc_Pixel = luma.Row(yFiltered);
+			pNext_Pixel = luma.Row(yFiltered+1);
+			bFirst = (xBegin == 0) ? pSrc_Pixel[LAYOUT::FilteredFirstColumn] : 0;
+			bLast = (xEnd == dwWidthInPixels) ? pSrc_Pixel[dwWidthInPixels-1] : 0;
+		}
+		else if (bPlanar)
+		{
+			pNext_Pixel = luma.RawRow(y+1);
+			pSrc_Pixel = luma.RawRow(y);
+			bFirst = (xBegin == 0) ? pSrc_Pixel[0] : 0;
+			bLast = (xEnd == dwWidthInPixels) ? pSrc_Pixel[dwWidthInPixels-1] : 0;
+		}
+		else
+		{
+			pSrc_Pixel = pSrc_Line + LAYOUT::LumaOffset;
+			pNext_Pixel = pSrc_Pixel + lSrcStride;
+			dwSrcStep = dwStep;
+			bFirst = pSrc_Pixel[0];
+			bLast = pSrc_Pixel[(dwWidthInPixels-1) * dwStep];
+		}
+
+		// The chroma gradients under the chroma-aware spans, all taken
+		// before the line is written, which in place overwrites chroma.
+		BYTE *pGradients = NULL;
+		for (DWORD i = 0; pSrc_Pixel != NULL && pScratch != NULL && i < cSpans; i++)
+		{
+			const DWORD xLeft = (pSpans[i].xBegin > xBegin) ? pSpans[i].xBegin : xBegin;
+			const DWORD xRight = (pSpans[i].xEnd < xEnd) ? pSpans[i].xEnd : xEnd;
+
+			if (pSpans[i].pRegion->bChroma && xLeft < xRight)
+			{
+				pGradients = GetSketchChromaRow(pScratch, dwWidthInPixels);
+				ChromaEdgeSpan<LAYOUT>(frame, y, xLeft, xRight, pGradients);
+			}
+		}
+
+		DWORD xDone = xBegin;
+		for (DWORD i = 0; i < cSpans; i++)
+		{
+			const DWORD xLeft = (pSpans[i].xBegin > xBegin) ? pSpans[i].xBegin : xBegin;
+			const DWORD xRight = (pSpans[i].xEnd < xEnd) ? pSpans[i].xEnd : xEnd;
+			const SKETCH_REGION *pRegion = pSpans[i].pRegion;
+
+			if (xLeft >= xRight)
+			{
+				continue;
+			}
+
+			// Pixels between the spans.
+			CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xDone, xLeft);
+			xDone = xRight;
+
+			if (y == 0)
+			{
+				CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xLeft, xRight);
+			}
+			else if (y == dwHeightInPixels - 1)
+			{
+				LastLineSpan<LAYOUT>(pDest_Line, pSrc_Line, xLeft, xRight);
+			}
+			else
+			{
+				const SKETCH_DETECTOR detector = (b3x3 && IsSketchDetector3x3(*pRegion)) ?
+					(SKETCH_DETECTOR)pRegion->bDetector : SKETCH_DETECTOR_ROBERTS;
+
+				EdgeSpan<LAYOUT>(pDest_Line, xLeft, xRight, bFirst, pSrc_Pixel, pNext_Pixel, dwSrcStep,
+					bLast, dwWidthInPixels, (BYTE)(255 - pRegion->bThreshold), pRegion->bChroma ? pGradients : NULL,
+					detector, rgp3x3);
+			}
+
+			if (pRegion->bInvert)
+			{
+				InvertSpan<LAYOUT>(pDest_Line, xLeft, xRight);
+			}
+		}
+		CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xDone, xEnd);
+	}
+
+	if (LAYOUT::ChromaPlane)
+	{
+		ChromaLines(frame, spans, xBegin, xEnd, yBegin, yEnd);
+	}
+}
+
+///
+///Edge detection
+///
+template <class LAYOUT>
+void EdgeDectectionBand(
+_In_ const SKETCH_FRAME& frame,
+_In_ DWORD yBegin,
+_In_ DWORD yEnd,
+_In_ BYTE *pScratch)
+{
+	EdgeTile<LAYOUT, false>(frame, 0, frame.dwWidthInPixels, yBegin, yEnd, pScratch);
+}
+
+///
+///Edge detection with filter
+///
+template <class LAYOUT>
+void EdgeDectectionFBand(
+_In_ const SKETCH_FRAME& frame,
+_In_ DWORD yBegin,
+_In_ DWORD yEnd,
+_In_ BYTE *pScratch)
+{
+	EdgeTile<LAYOUT, true>(frame, 0, frame.dwWidthInPixels, yBegin, yEnd, pScratch);
+}
+
+template <class LAYOUT>
+void EdgeDectectionTile(
+_In_ const SKETCH_FRAME& frame,
+_In_ DWORD xBegin,
+_In_ DWORD xEnd,
+_In_ DWORD yBegin,
+_In_ DWORD yEnd,
+_In_ BYTE *pScratch)
+{
+	EdgeTile<LAYOUT, false>(frame, xBegin, xEnd, yBegin, yEnd, pScratch);
+}
+
+template <class LAYOUT>
+void EdgeDectectionFTile(
+_In_ const SKETCH_FRAME& frame,
+_In_ DWORD xBegin,
+_In_ DWORD xEnd,
+_In_ DWORD yBegin,
+_In_ DWORD yEnd,
+_In_ BYTE *pScratch)
+{
+	EdgeTile<LAYOUT, true>(frame, xBegin, xEnd, yBegin, yEnd, pScratch);
+}
+
+//
+// The frame forms run the band form over the whole frame.
+//
+
+template <class LAYOUT>
+void EdgeDectection(
+const SKETCH_RECT& rcDest,
+_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
+_In_ LONG lDestStride, 
+_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+_In_ LONG lSrcStride, 
+_In_ DWORD dwWidthInPixels, 
+_In_ DWORD dwHeightInPixels,
+_In_ BYTE *pScratch)
+{
+	const SKETCH_FRAME frame = { rcDest, pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels, dwHeightInPixels, NULL, 0,
+		SKETCH_PREFILTER_MEDIAN3, 0 };
+
+	EdgeDectectionBand<LAYOUT>(frame, 0, dwHeightInPixels, pScratch);
+}
+
+template <class LAYOUT>
+void EdgeDectectionF(
+const SKETCH_RECT& rcDest,
+_Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
+_In_ LONG lDestStride, 
+_In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+_In_ LONG lSrcStride, 
+_In_ DWORD dwWidthInPixels, 
+_In_ DWORD dwHeightInPixels,
+_In_ BYTE *pScratch)
+{
+	const SKETCH_FRAME frame = { rcDest, pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels, dwHeightInPixels, NULL, 0,
+		SKETCH_PREFILTER_MEDIAN3, 0 };
+
+	EdgeDectectionFBand<LAYOUT>(frame, 0, dwHeightInPixels, pScratch);
+}
+
+//-------------------------------------------------------------------
+// Edge detection at reduced resolution.
+//
+// The reduced frame is ceil(width/scale) by ceil(height/scale) pixels. Its
+// luma is the rounded box average of the block of the source each pixel
+// covers; its edge map is what the F detector makes of that luma, without
+// the NV12 lag: the luma on the first and last line and column, edges over
+// the pre-filtered luma elsewhere. Each region is scaled down with its
+// threshold and grown by a pixel all round, the reach of the upsampling,
+// and the edge map is only computed under those; the rest of it is 0.
+//
+// The passes only share the planes, and each writes its lines from ones the
+// pass before finished, so with a pool they run in bands; the other
+// buffers are per band.
+//
+// The map then goes back up in 2x steps. Each output pixel of a step is
+// a quarter of an input pixel from the nearest one: it blends that pixel
+// and its neighbour on the far side 3:1, along the row first
+// (pfnUpsampleRow2x) and then across lines (pfnLerpRow), rounding after
+// each; edge pixels blend with themselves. The last step writes straight
+// into the spans of the destination, with neutral chroma and the region's
+// inversion.
+//-------------------------------------------------------------------
+
+// The scaled path's buffers within its scratch.
+struct SCALED_BUFFERS
+{
+	DWORD   dwLowWidth;     // Of the reduced frame.
+	DWORD   dwLowHeight;
+	BYTE   *pLuma;          // Reduced luma, dwLowWidth per line.
+	BYTE   *pEdges;         // Reduced edge map, the same size.
+	BYTE   *pHalf;          // SKETCH_SCALE_4X: the map after the first 2x step.
+
+	// The band's own: one set after the planes, and one in each pool
+	// thread's scratch.
+	BYTE   *pRing;          // GetSketchScratchSize(dwLowWidth, ...) for the frame's pre-filter.
+	WORD   *pSums;          // Column pair sums of a block of lines.
+	BYTE   *pRows;          // Three rows of the plane being upsampled, doubled.
+	BYTE   *pPadded;        // A row of that plane with its end pixels repeated.
+};
+
+static inline DWORD ScaledPitch(DWORD cb)
+{
+	return (cb + SKETCH_SCRATCH_ALIGNMENT - 1) & ~(DWORD)(SKETCH_SCRATCH_ALIGNMENT - 1);
+}
+
+// Lays the buffers out from pScratch, which may be NULL to just size them.
+// Returns the bytes they take.
+static DWORD LayOutBuffers(const DWORD rgcb[], DWORD cBuffers, BYTE *pScratch, BYTE *rgp[])
+{
+	DWORD cb = 0;
+
+	for (DWORD i = 0; i < cBuffers; i++)
+	{
+		rgp[i] = (pScratch != NULL) ? pScratch + cb : NULL;
+		cb += rgcb[i];
+	}
+	return cb;
+}
+
+// The band's buffers.
+static DWORD GetScaledBandBuffers(DWORD dwWidthInPixels, DWORD dwLowWidth, DWORD dwScale, SKETCH_PREFILTER prefilter,
+	DWORD dwMedianRadius, BYTE *pScratch, SCALED_BUFFERS *pBuffers)
+{
+	// The plane the last step doubles is half the upsampled width.
+	const DWORD dwLastWidth = dwLowWidth * dwScale / 2;
+
+	const DWORD rgcb[] =
+	{
+		GetSketchScratchSize(dwLowWidth, prefilter, dwMedianRadius),
+		ScaledPitch((dwWidthInPixels + 1) / 2 * sizeof(WORD)),
+		3 * ScaledPitch(2 * dwLastWidth),
+		ScaledPitch(dwLastWidth + 2)
+	};
+	BYTE *rgp[sizeof(rgcb) / sizeof(rgcb[0])];
+	const DWORD cb = LayOutBuffers(rgcb, sizeof(rgcb) / sizeof(rgcb[0]), pScratch, rgp);
+
+	if (pBuffers != NULL)
+	{
+		pBuffers->pRing = rgp[0];
+		pBuffers->pSums = (WORD*)rgp[1];
+		pBuffers->pRows = rgp[2];
+		pBuffers->pPadded = rgp[3];
+	}
+	return cb;
+}
+
+// The planes, then one set of band buffers.
+static DWORD GetScaledBuffers(DWORD dwWidthInPixels, DWORD dwHeightInPixels, DWORD dwScale, SKETCH_PREFILTER prefilter,
+	DWORD dwMedianRadius, BYTE *pScratch, SCALED_BUFFERS *pBuffers)
+{
+	const DWORD dwLowWidth = (dwWidthInPixels + dwScale - 1) / dwScale;
+	const DWORD dwLowHeight = (dwHeightInPixels + dwScale - 1) / dwScale;
+	const DWORD cbPlane = ScaledPitch(dwLowWidth * dwLowHeight);
+
+	const DWORD rgcb[] =
+	{
+		cbPlane,
+		cbPlane,
+		(dwScale == SKETCH_SCALE_4X) ? 4 * cbPlane : 0
+	};
+	BYTE *rgp[sizeof(rgcb) / sizeof(rgcb[0])];
+	const DWORD cb = LayOutBuffers(rgcb, sizeof(rgcb) / sizeof(rgcb[0]), pScratch, rgp);
+
+	if (pBuffers != NULL)
+	{
+		pBuffers->dwLowWidth = dwLowWidth;
+		pBuffers->dwLowHeight = dwLowHeight;
+		pBuffers->pLuma = rgp[0];
+		pBuffers->pEdges = rgp[1];
+		pBuffers->pHalf = rgp[2];
+	}
+	return cb + GetScaledBandBuffers(dwWidthInPixels, dwLowWidth, dwScale, prefilter, dwMedianRadius,
+		(pScratch != NULL) ? pScratch + cb : NULL, pBuffers);
+}
+
+DWORD GetSketchScaledScratchSize(DWORD dwWidthInPixels, DWORD dwHeightInPixels, DWORD dwScale, SKETCH_PREFILTER prefilter,
+	DWORD dwMedianRadius)
+{
+	return GetScaledBuffers(dwWidthInPixels, dwHeightInPixels, dwScale, prefilter, dwMedianRadius, NULL, NULL);
+}
+
+// Box-averages the frame's luma into lines [lyBegin, lyEnd) of the reduced
+// plane. Pairs of columns are summed down each block first; 4x then adds
+// two pairs.
+template <class LAYOUT>
+static void BoxDownsample(const SKETCH_FRAME& frame, DWORD dwScale, const SCALED_BUFFERS& buffers, DWORD lyBegin,
+	DWORD lyEnd)
+{
+	const DWORD dwWidthInPixels = frame.dwWidthInPixels;
+	const DWORD dwHeightInPixels = frame.dwHeightInPixels;
+	const DWORD dwLowWidth = buffers.dwLowWidth;
+	const DWORD cPairs = (dwWidthInPixels + 1) / 2;
+	const SKETCH_ROW_FNS *pRows = GetSketchRows();
+	WORD *pSums = buffers.pSums;
+
+	for (DWORD ly = lyBegin; ly < lyEnd; ly++)
+	{
+		const DWORD yBegin = ly * dwScale;
+		const DWORD cLines = (yBegin + dwScale <= dwHeightInPixels) ? dwScale : dwHeightInPixels - yBegin;
+		BYTE *pLow = buffers.pLuma + ly * dwLowWidth;
+
+		memset(pSums, 0, cPairs * sizeof(WORD));
+		for (DWORD y = yBegin; y < yBegin + cLines; y++)
+		{
+			pRows->pfnSumPairs(pSums, frame.pSrc + (LONG)y * frame.lSrcStride + LAYOUT::LumaOffset, LAYOUT::BytesPerPixel,
+				dwWidthInPixels);
+		}
+
+		// Whole blocks divide by a power of two.
+		const DWORD cWhole = (cLines == dwScale) ? dwWidthInPixels / dwScale : 0;
+		if (dwScale == SKETCH_SCALE_4X)
+		{
+			for (DWORD lx = 0; lx < cWhole; lx++)
+			{
+				pLow[lx] = (BYTE)((pSums[2 * lx] + pSums[2 * lx + 1] + 8) >> 4);
+			}
+		}
+		else
+		{
+			for (DWORD lx = 0; lx < cWhole; lx++)
+			{
+				pLow[lx] = (BYTE)((pSums[lx] + 2) >> 2);
+			}
+		}
+
+		// The blocks the frame cuts off.
+		for (DWORD lx = cWhole; lx < dwLowWidth; lx++)
+		{
+			const DWORD xBegin = lx * dwScale;
+			const DWORD cPixels = cLines * ((xBegin + dwScale <= dwWidthInPixels) ? dwScale : dwWidthInPixels - xBegin);
+			DWORD dwSum = pSums[xBegin / 2];
+
+			if (dwScale == SKETCH_SCALE_4X && xBegin / 2 + 1 < cPairs)
+			{
+				dwSum += pSums[xBegin / 2 + 1];
+			}
+			pLow[lx] = (BYTE)((dwSum + cPixels / 2) / cPixels);
+		}
+	}
+}
+
+// Lines [lyBegin, lyEnd) of the edge map of the reduced frame, under the
+// regions grown as above.
+static void ScaledEdges(const SKETCH_FRAME& frame, DWORD dwScale, const SCALED_BUFFERS& buffers, DWORD lyBegin,
+	DWORD lyEnd)
+{
+	const DWORD dwLowWidth = buffers.dwLowWidth;
+	const DWORD dwLowHeight = buffers.dwLowHeight;
+
+	// A frame without regions sketches rcDest with the defaults.
+	const SKETCH_REGION rgDefault[1] = { { frame.rcDest, SKETCH_THRESHOLD_DEFAULT, 0, 0, 0 } };
+	const SKETCH_REGION *pRegions = (frame.pRegions != NULL) ? frame.pRegions : rgDefault;
+	const DWORD cRegions = (frame.pRegions != NULL) ? std::min<DWORD>(frame.cRegions, SKETCH_MAX_REGIONS) : 1;
+	SKETCH_REGION rgLow[SKETCH_MAX_REGIONS];
+	DWORD cLow = 0;
+
+	for (DWORD i = 0; i < cRegions; i++)
+	{
+		SKETCH_RECT rc = pRegions[i].rc;
+
+		rc.right = std::min<DWORD>(rc.right, frame.dwWidthInPixels);
+		rc.bottom = std::min<DWORD>(rc.bottom, frame.dwHeightInPixels);
+		if (rc.left >= rc.right || rc.top >= rc.bottom)
+		{
+			continue;
+		}
+
+		// CSketchSpans clips the far edges to the reduced frame.
+		rgLow[cLow] = pRegions[i];
+		rgLow[cLow].rc.left = (rc.left >= dwScale) ? rc.left / dwScale - 1 : 0;
+		rgLow[cLow].rc.top = (rc.top >= dwScale) ? rc.top / dwScale - 1 : 0;
+		rgLow[cLow].rc.right = (rc.right + dwScale - 1) / dwScale + 1;
+		rgLow[cLow].rc.bottom = (rc.bottom + dwScale - 1) / dwScale + 1;
+		cLow++;
+	}
+
+	const SKETCH_FRAME low = { frame.rcDest, buffers.pEdges, (LONG)dwLowWidth, buffers.pLuma, (LONG)dwLowWidth,
+		dwLowWidth, dwLowHeight, rgLow, cLow, frame.prefilter, frame.dwMedianRadius };
+	CSketchSpans spans(low);
+	SKETCH_COLUMNS rgColumns[SKETCH_MAX_REGIONS];
+	const DWORD cColumns = spans.GetColumns(0, dwLowHeight, 0, 1, rgColumns);
+	CSketchLumaRing luma(buffers.pLuma, (LONG)dwLowWidth, 1, dwLowWidth, dwLowHeight, rgColumns, cColumns, frame.prefilter,
+		frame.dwMedianRadius, buffers.pRing, false);
+
+	memset(buffers.pEdges + lyBegin * dwLowWidth, 0, (lyEnd - lyBegin) * dwLowWidth);
+	for (DWORD ly = lyBegin; ly < lyEnd; ly++)
+	{
+		const BYTE *pLuma_Line = buffers.pLuma + ly * dwLowWidth;
+		BYTE *pEdge_Line = buffers.pEdges + ly * dwLowWidth;
+		const SKETCH_SPAN *pSpans = NULL;
+		const DWORD cSpans = spans.GetSpans(ly, &pSpans);
+
+		if (cSpans == 0)
+		{
+			continue;
+		}
+
+		if (ly == 0 || ly == dwLowHeight - 1)
+		{
+			for (DWORD i = 0; i < cSpans; i++)
+			{
+				CopySpan<SKETCH_LAYOUT_NV12>(pEdge_Line, pLuma_Line, pSpans[i].xBegin, pSpans[i].xEnd);
+			}
+			continue;
+		}
+
+		const BYTE *pRow = luma.Row(ly);
+		const BYTE *pNext = luma.Row(ly + 1);
+		for (DWORD i = 0; i < cSpans; i++)
+		{
+			EdgeSpan<SKETCH_LAYOUT_NV12>(pEdge_Line, pSpans[i].xBegin, pSpans[i].xEnd, pRow[0], pRow, pNext, 1,
+				pRow[dwLowWidth - 1], dwLowWidth, (BYTE)(255 - pSpans[i].pRegion->bThreshold), NULL, SKETCH_DETECTOR_ROBERTS, NULL);
+		}
+	}
+}
+
+//
+// A plane doubled along its rows, three rows at a time: each line of the
+// 2x step blends two consecutive ones, and the step moves down the plane.
+//
+#define NO_LINE     0xFFFFFFFF
+
+struct UPSAMPLE_ROWS
+{
+	const BYTE *pPlane;
+	DWORD       dwWidth;        // Of the plane, which is dense.
+	DWORD       dwHeight;
+	BYTE       *pRows;          // Three rows of 2*dwWidth.
+	BYTE       *pPadded;        // dwWidth + 2.
+	DWORD       rgLine[3];      // Plane line in each row, or NO_LINE.
+};
+
+static void InitUpsampleRows(UPSAMPLE_ROWS *pRows, const BYTE *pPlane, DWORD dwWidth, DWORD dwHeight,
+	const SCALED_BUFFERS& buffers)
+{
+	pRows->pPlane = pPlane;
+	pRows->dwWidth = dwWidth;
+	pRows->dwHeight = dwHeight;
+	pRows->pRows = buffers.pRows;
+	pRows->pPadded = buffers.pPadded;
+	pRows->rgLine[0] = pRows->rgLine[1] = pRows->rgLine[2] = NO_LINE;
+}
+
+static const BYTE* UpsampledRow(UPSAMPLE_ROWS *pRows, DWORD j)
+{
+	BYTE *pRow = pRows->pRows + (j % 3) * ScaledPitch(2 * pRows->dwWidth);
+
+	if (pRows->rgLine[j % 3] != j)
+	{
+		const BYTE *pLine = pRows->pPlane + j * pRows->dwWidth;
+
+		pRows->pPadded[0] = pLine[0];
+		memcpy(pRows->pPadded + 1, pLine, pRows->dwWidth);
+		pRows->pPadded[pRows->dwWidth + 1] = pLine[pRows->dwWidth - 1];
+		GetSketchRows()->pfnUpsampleRow2x(pRow, pRows->pPadded + 1, pRows->dwWidth);
+		pRows->rgLine[j % 3] = j;
+	}
+	return pRow;
+}
+
+// The two doubled rows line y of the 2x step blends, and the weight of
+// the second.
+static BYTE UpsampledLines(UPSAMPLE_ROWS *pRows, DWORD y, const BYTE **ppA, const BYTE **ppB)
+{
+	const DWORD j = y >> 1;
+
+	if (y & 1)
+	{
+		*ppA = UpsampledRow(pRows, j);
+		*ppB = UpsampledRow(pRows, (j + 1 < pRows->dwHeight) ? j + 1 : j);
+		return 64;
+	}
+	*ppA = UpsampledRow(pRows, (j > 0) ? j - 1 : 0);
+	*ppB = UpsampledRow(pRows, j);
+	return 192;
+}
+
+// SKETCH_SCALE_4X: lines [yBegin, yEnd) of the first 2x step, into the
+// dense plane pHalf.
+static void UpsampleHalf(const SCALED_BUFFERS& buffers, DWORD yBegin, DWORD yEnd)
+{
+	const DWORD dwPlaneWidth = buffers.dwLowWidth;
+	const SKETCH_ROW_FNS *pRows = GetSketchRows();
+	UPSAMPLE_ROWS rows;
+
+	InitUpsampleRows(&rows, buffers.pEdges, dwPlaneWidth, buffers.dwLowHeight, buffers);
+	for (DWORD y = yBegin; y < yEnd; y++)
+	{
+		const BYTE *pA = NULL;
+		const BYTE *pB = NULL;
+		const BYTE bWeight = UpsampledLines(&rows, y, &pA, &pB);
+
+		pRows->pfnLerpRow(buffers.pHalf + y * 2 * dwPlaneWidth, ROBERTS_DEST_LUMA, pA, pB, bWeight, 2 * dwPlaneWidth);
+	}
+}
+
+// Lines [yBegin, yEnd) of the last step, into the regions.
+template <class LAYOUT>
+static void UpsampleRegions(const SKETCH_FRAME& frame, DWORD dwScale, const SCALED_BUFFERS& buffers, DWORD yBegin,
+	DWORD yEnd)
+{
+	const DWORD dwWidthInPixels = frame.dwWidthInPixels;
+	const SKETCH_ROW_FNS *pRows = GetSketchRows();
+	const bool b4x = (dwScale == SKETCH_SCALE_4X);
+	CSketchSpans spans(frame);
+	UPSAMPLE_ROWS rows;
+
+	InitUpsampleRows(&rows, b4x ? buffers.pHalf : buffers.pEdges, b4x ? 2 * buffers.dwLowWidth : buffers.dwLowWidth,
+		b4x ? 2 * buffers.dwLowHeight : buffers.dwLowHeight, buffers);
+
+	for (DWORD y = yBegin; y < yEnd; y++)
+	{
+		const BYTE *pSrc_Line = frame.pSrc + (LONG)y * frame.lSrcStride;
+		BYTE *pDest_Line = frame.pDest + (LONG)y * frame.lDestStride;
+		const SKETCH_SPAN *pSpans = NULL;
+		const DWORD cSpans = spans.GetSpans(y, &pSpans);
+
+		if (cSpans == 0)
+		{
+			CopySpan<LAYOUT>(pDest_Line, pSrc_Line, 0, dwWidthInPixels);
+			continue;
+		}
+
+		const BYTE *pA = NULL;
+		const BYTE *pB = NULL;
+		const BYTE bWeight = UpsampledLines(&rows, y, &pA, &pB);
+		DWORD xDone = 0;
+
+		for (DWORD i = 0; i < cSpans; i++)
+		{
+			const DWORD xBegin = pSpans[i].xBegin;
+			const DWORD xEnd = pSpans[i].xEnd;
+
+			CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xDone, xBegin);
+			xDone = xEnd;
+
+			pRows->pfnLerpRow(pDest_Line + xBegin * LAYOUT::BytesPerPixel, GetRobertsDest<LAYOUT>(), pA + xBegin,
+				pB + xBegin, bWeight, xEnd - xBegin);
+			if (pSpans[i].pRegion->bInvert)
+			{
+				InvertSpan<LAYOUT>(pDest_Line, xBegin, xEnd);
+			}
+		}
+		CopySpan<LAYOUT>(pDest_Line, pSrc_Line, xDone, dwWidthInPixels);
+	}
+
+	if (LAYOUT::ChromaPlane)
+	{
+		ChromaLines(frame, spans, 0, dwWidthInPixels, yBegin, yEnd);
+	}
+}
+
+//
+// The passes as SKETCH_TASK_FNs: a pool hands each thread's scratch to
+// the band buffers.
+//
+struct SCALED_TASK
+{
+	const SKETCH_FRAME *pFrame;
+	DWORD               dwScale;
+	SCALED_BUFFERS      buffers;        // Planes only; the band buffers come from the task's scratch.
+};
+
+static SCALED_BUFFERS GetTaskBuffers(const SCALED_TASK *pTask, BYTE *pScratch)
+{
+	const SKETCH_FRAME &frame = *pTask->pFrame;
+	SCALED_BUFFERS buffers = pTask->buffers;
+
+	GetScaledBandBuffers(frame.dwWidthInPixels, buffers.dwLowWidth, pTask->dwScale, frame.prefilter, frame.dwMedianRadius,
+		pScratch, &buffers);
+	return buffers;
+}
+
+template <class LAYOUT>
+static void BoxDownsampleTask(void *pContext, DWORD yBegin, DWORD yEnd, BYTE *pScratch)
+{
+	const SCALED_TASK *pTask = (const SCALED_TASK*)pContext;
+	BoxDownsample<LAYOUT>(*pTask->pFrame, pTask->dwScale, GetTaskBuffers(pTask, pScratch), yBegin, yEnd);
+}
+
+static void ScaledEdgesTask(void *pContext, DWORD yBegin, DWORD yEnd, BYTE *pScratch)
+{
+	const SCALED_TASK *pTask = (const SCALED_TASK*)pContext;
+	ScaledEdges(*pTask->pFrame, pTask->dwScale, GetTaskBuffers(pTask, pScratch), yBegin, yEnd);
+}
+
+static void UpsampleHalfTask(void *pContext, DWORD yBegin, DWORD yEnd, BYTE *pScratch)
+{
+	const SCALED_TASK *pTask = (const SCALED_TASK*)pContext;
+	UpsampleHalf(GetTaskBuffers(pTask, pScratch), yBegin, yEnd);
+}
+
+template <class LAYOUT>
+static void UpsampleRegionsTask(void *pContext, DWORD yBegin, DWORD yEnd, BYTE *pScratch)
+{
+	const SCALED_TASK *pTask = (const SCALED_TASK*)pContext;
+	UpsampleRegions<LAYOUT>(*pTask->pFrame, pTask->dwScale, GetTaskBuffers(pTask, pScratch), yBegin, yEnd);
+}
+
+// Runs a pass over lines [0, dwHeight) on the pool, or here with the band
+// buffers of the frame's scratch if there is no pool or it cannot run.
+static void RunScaledPass(SKETCH_TASK_FN pfnTask, SCALED_TASK *pTask, DWORD dwHeight, BYTE *pBandScratch,
+	CSketchThreadPool *pPool)
+{
+	const SKETCH_FRAME &frame = *pTask->pFrame;
+	const DWORD cbBand = GetScaledBandBuffers(frame.dwWidthInPixels, pTask->buffers.dwLowWidth, pTask->dwScale, frame.prefilter,
+		frame.dwMedianRadius, NULL, NULL);
+
+	if (pPool == NULL || !pPool->RunTask(pfnTask, pTask, dwHeight, cbBand))
+	{
+		(*pfnTask)(pTask, 0, dwHeight, pBandScratch);
+	}
+}
+
+template <class LAYOUT>
+void EdgeDectectionScaled(
+_In_ const SKETCH_FRAME& frame,
+_In_ DWORD dwScale,
+_In_ BYTE *pScratch,
+_In_opt_ CSketchThreadPool *pPool)
+{
+	SCALED_TASK task;
+	task.pFrame = &frame;
+	task.dwScale = dwScale;
+	GetScaledBuffers(frame.dwWidthInPixels, frame.dwHeightInPixels, dwScale, frame.prefilter, frame.dwMedianRadius, pScratch,
+		&task.buffers);
+
+	// The frame's own band buffers start with the ring.
+	BYTE *pBandScratch = task.buffers.pRing;
+	const DWORD dwLowHeight = task.buffers.dwLowHeight;
+
+	RunScaledPass(BoxDownsampleTask<LAYOUT>, &task, dwLowHeight, pBandScratch, pPool);
+	RunScaledPass(ScaledEdgesTask, &task, dwLowHeight, pBandScratch, pPool);
+	if (dwScale == SKETCH_SCALE_4X)
+	{
+		RunScaledPass(UpsampleHalfTask, &task, 2 * dwLowHeight, pBandScratch, pPool);
+	}
+	RunScaledPass(UpsampleRegionsTask<LAYOUT>, &task, frame.dwHeightInPixels, pBandScratch, pPool);
+}
+
+//
+// The layouts the kernels are built for. Adding a layout adds a line.
+//
+#define SKETCH_INSTANTIATE_KERNELS(LAYOUT) \
+	template void MedianFilter<LAYOUT>(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, BYTE*); \
+	template void MedianFilterRadius<LAYOUT>(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, DWORD, BYTE*); \
+	template void EdgeDectection<LAYOUT>(const SKETCH_RECT&, BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionF<LAYOUT>(const SKETCH_RECT&, BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionBand<LAYOUT>(const SKETCH_FRAME&, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionFBand<LAYOUT>(const SKETCH_FRAME&, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionTile<LAYOUT>(const SKETCH_FRAME&, DWORD, DWORD, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionFTile<LAYOUT>(const SKETCH_FRAME&, DWORD, DWORD, DWORD, DWORD, BYTE*); \
+	template void EdgeDectectionScaled<LAYOUT>(const SKETCH_FRAME&, DWORD, BYTE*, CSketchThreadPool*);
+
+SKETCH_INSTANTIATE_KERNELS(SKETCH_LAYOUT_YUY2)
+SKETCH_INSTANTIATE_KERNELS(SKETCH_LAYOUT_UYVY)
+SKETCH_INSTANTIATE_KERNELS(SKETCH_LAYOUT_NV12)
+
+///
+///Convert YUY2 data to RGB pixels
+///
+void YUY2toRGB(
+    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
+    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+	_In_ LONG lSrcStride, 
+	_In_ LONG lDestStride,		//width
+    _In_ DWORD dwWidthInPixels, 
+    _In_ DWORD dwHeightInPixels)
+{
+	const SKETCH_ROW_FNS *pRows = GetSketchRows();
+	const DWORD cbPlane = dwWidthInPixels * dwHeightInPixels;
+
+    for (DWORD y = 0; y < dwHeightInPixels; y++)
+    {
+		pRows->pfnYuy2ToRgbRow(pDest, pDest + cbPlane, pDest + 2 * cbPlane, pSrc, dwWidthInPixels);
+
+        pDest += lDestStride;
+        pSrc += lSrcStride;
+    }
+}
+
+DWORD GetSketchRGBScratchSize(DWORD dwWidthInPixels)
+{
+	// Two rows of the three planes.
+	return dwWidthInPixels * 3 * 2;
+}
+
+///
+///Do edge detection on RGB data
+///
+void EdgeDectection_YUY2RGB(
+    const SKETCH_RECT& rcDest,
+    _Inout_updates_(_Inexpressible_(lDestStride * dwHeightInPixels)) BYTE *pDest, 
+    _In_ LONG lDestStride, 
+    _In_reads_(_Inexpressible_(lSrcStride * dwHeightInPixels)) const BYTE* pSrc,
+    _In_ LONG lSrcStride, 
+    _In_ DWORD dwWidthInPixels, 
+    _In_ DWORD dwHeightInPixels,
+    _Out_writes_(_Inexpressible_(6 * dwWidthInPixels)) BYTE *pScratch)
+{
+	const SKETCH_ROW_FNS *pRows = GetSketchRows();
+	const DWORD dwWidth = dwWidthInPixels;
+
+	// Lines [yBegin, yEnd) get edges: the destination rectangle without its
+	// first and last line, which are copied with the rest.
+	const DWORD y0 = (rcDest.bottom < dwHeightInPixels) ? rcDest.bottom : dwHeightInPixels;
+	const DWORD yBegin = rcDest.top + 1;
+	const DWORD yEnd = (y0 > 0) ? y0 - 1 : 0;
+	const DWORD xBegin = (rcDest.left < dwWidth) ? rcDest.left : dwWidth;
+	const DWORD xEnd = (rcDest.right < dwWidth) ? rcDest.right : dwWidth;
+
+	// The edges of a line come from it and the line below in RGB. Each line
+	// is converted once, into the slot of a two-row ring its parity picks,
+	// from the pair holding column xBegin to the pixel after xEnd.
+	BYTE *rgpRing[2] = { pScratch, pScratch + 3 * dwWidth };
+	const DWORD xConvert = xBegin & ~1u;
+	const DWORD cConvert = ((xEnd < dwWidth) ? xEnd + 1 : dwWidth) - xConvert;
+
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		const BYTE *pSrc_Line = pSrc + (LONG)y * lSrcStride;
+		BYTE *pDest_Line = pDest + (LONG)y * lDestStride;
+
+		if (y < yBegin || y >= yEnd || xBegin >= xEnd)
+		{
+			CopySpan<SKETCH_LAYOUT_YUY2>(pDest_Line, pSrc_Line, 0, dwWidth);
+			continue;
+		}
+
+		// Convert the line below, and this one if it was not the line below
+		// the one before. Both are read before the line is written, so this
+		// works in place.
+		for (DWORD yConvert = (y == yBegin) ? y : y + 1; yConvert <= y + 1; yConvert++)
+		{
+			BYTE *pR = rgpRing[yConvert & 1];
+			pRows->pfnYuy2ToRgbRow(pR + xConvert, pR + dwWidth + xConvert, pR + 2 * dwWidth + xConvert,
+				pSrc + (LONG)yConvert * lSrcStride + 2 * xConvert, cConvert);
+		}
+		const BYTE *pRow = rgpRing[y & 1];
+		const BYTE *pNext = rgpRing[(y + 1) & 1];
+
+		DWORD x = xBegin;
+		DWORD xLast = xEnd;
+
+		CopySpan<SKETCH_LAYOUT_YUY2>(pDest_Line, pSrc_Line, 0, x);
+
+		//Pixel in the fist column
+		if (x == 0)
+		{
+			SetEdgePixel<SKETCH_LAYOUT_YUY2>(pDest_Line, 0, pSrc_Line[0]);
+			x = 1;
+		}
+
+		//Pixel in the last column
+		if (xLast == dwWidth)
+		{
+			SetEdgePixel<SKETCH_LAYOUT_YUY2>(pDest_Line, dwWidth - 1, pSrc_Line[2 * (dwWidth - 1)]);
+			xLast = dwWidth - 1;
+		}
+
+		//Columns from the first to the last 
+		if (x < xLast)
+		{
+			pRows->pfnRgbRobertsRow(pDest_Line + 2 * x, pRow + x, pNext + x, dwWidth, xLast - x);
+		}
+
+		CopySpan<SKETCH_LAYOUT_YUY2>(pDest_Line, pSrc_Line, xEnd, dwWidth);
+	}
+}
@@ -0,0 +1,278 @@
+// Portable sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHKERNELS_H
+#define SKETCHKERNELS_H
+
+#include "SketchPlatform.h"
+#include "SketchPipeline.h"
+#include "SketchLayout.h"
+
+//
+// The median filters and edge detectors behind the sketch effect. They only
+// deal in plain buffers (pointer, stride in bytes, size in pixels), so they
+// build and run without Media Foundation; CGrayscale is one caller.
+//
+
+// Destination rectangle, in pixels. Same layout as D2D_RECT_U.
+struct SKETCH_RECT
+{
+    UINT32  left;
+    UINT32  top;
+    UINT32  right;
+    UINT32  bottom;
+};
+
+//
+// A region of the frame to sketch, with its own parameters. A frame may
+// have up to SKETCH_MAX_REGIONS of them; where regions overlap, the later
+// one in the list wins, and each pixel is still only computed once.
+//
+#define SKETCH_MAX_REGIONS          16
+
+// Default of bThreshold: the 26 the original edge loops added.
+#define SKETCH_THRESHOLD_DEFAULT    26
+
+struct SKETCH_REGION
+{
+    SKETCH_RECT             rc;              // Pixels to sketch, clipped to the frame.
+    BYTE                    bThreshold;      // Added to the squared gradient; flat areas are 255 - bThreshold.
+    BYTE                    bInvert;         // Nonzero for light lines on dark (255 - luma).
+    BYTE                    bChroma;         // Nonzero to also draw edges between colours (see below).
+    BYTE                    bDetector;       // SKETCH_DETECTOR; 0 is Roberts.
+};
+
+//
+// The gradient detector of a region. Each gives a gradient g per pixel,
+// scaled so a step of height h across it comes to about h, which the
+// threshold then maps to 255 - bThreshold - g*g as for Roberts:
+//
+//  Roberts     The 2x2 cross between the pixel and the ones right, below
+//              and diagonally, with the quirks of the original edge loops
+//              (see SketchRoberts.h).
+//  Sobel       (|Gx| + |Gy|) / 4 over the 3x3 block around the pixel, with
+//              the weights 1 2 1 across each direction.
+//  Scharr      (|Gx| + |Gy|) / 16, with the weights 3 10 3; closer to
+//              rotation invariant than Sobel.
+//  Laplacian   |sum of the 8 neighbours - 8 * pixel| / 4. It responds to
+//              thin lines and to both sides of a step (3h/4 each) rather
+//              than to a slope.
+//
+// Gradients above 255 saturate. The 3x3 detectors take the block centred
+// on the pixel in the rows the F variants filter, without the NV12 lag;
+// the first and last line and column of the frame are kept as for
+// Roberts. They read three rows through the edge detectors' scratch, so
+// without scratch, and in EdgeDectectionScaled, every region uses Roberts,
+// as does a region with a detector not listed here.
+//
+enum SKETCH_DETECTOR
+{
+    SKETCH_DETECTOR_ROBERTS,
+    SKETCH_DETECTOR_SOBEL,
+    SKETCH_DETECTOR_SCHARR,
+    SKETCH_DETECTOR_LAPLACIAN,
+    SKETCH_DETECTOR_COUNT
+};
+
+//
+// A chroma-aware region also draws the edges between areas of the same
+// brightness and different colour, which the luma alone cannot see. The
+// Roberts cross is taken over U and V as they are stored, at chroma
+// resolution: between each pixel pair and the next, on this line's chroma
+// and the next line's (NV12: the chroma lines of this luma line and of the
+// one two below, the last chroma line standing in for the line past it).
+// The largest of the U and V differences is the pair's chroma gradient,
+// which both pixels of the pair take, and an edge pixel's gradient is the
+// larger of that and its luma gradient; the last pair of a line has no
+// chroma gradient. The gradients take a row of the edge detectors'
+// scratch, so a detector given NULL scratch, and EdgeDectectionScaled,
+// detect on the luma alone.
+//
+
+// Function pointer for the function that transforms the image.
+typedef void (*SKETCH_TRANSFORM_FN)(
+    const SKETCH_RECT&      rcDest,          // Destination rectangle for the transformation.
+    BYTE*                   pDest,           // Destination buffer.
+    LONG                    lDestStride,     // Destination stride.
+    const BYTE*             pSrc,            // Source buffer.
+    LONG                    lSrcStride,      // Source stride.
+    DWORD                   dwWidthInPixels, // Image width in pixels.
+    DWORD                   dwHeightInPixels, // Image height in pixels.
+    BYTE*                   pScratch         // GetSketchScratchSize(dwWidthInPixels) bytes of scratch.
+    );
+
+// One frame, as handed to the band form of a kernel.
+//
+// pDest may be pSrc, with the same stride, to transform the frame in place.
+// Only the edge detectors' frame and scaled forms, and their band forms
+// called once over the whole frame, support that: output lines are written
+// top to bottom behind the source lines they read, which bands, tiles and
+// the pool cannot promise.
+struct SKETCH_FRAME
+{
+    SKETCH_RECT             rcDest;          // Destination rectangle for the transformation.
+    BYTE*                   pDest;           // Destination buffer.
+    LONG                    lDestStride;     // Destination stride.
+    const BYTE*             pSrc;            // Source buffer.
+    LONG                    lSrcStride;      // Source stride.
+    DWORD                   dwWidthInPixels; // Image width in pixels.
+    DWORD                   dwHeightInPixels; // Image height in pixels.
+    const SKETCH_REGION*    pRegions;        // Regions to sketch, or NULL for rcDest with the defaults.
+    DWORD                   cRegions;        // Number of regions, at most SKETCH_MAX_REGIONS.
+    SKETCH_PREFILTER        prefilter;       // Of the F variants and EdgeDectectionScaled (SketchPipeline.h).
+    DWORD                   dwMedianRadius;  // Of SKETCH_PREFILTER_MEDIAN_RADIUS.
+};
+
+// Function pointer for the function that transforms output lines
+// [yBegin, yEnd) of a frame. Bands of one frame may run concurrently, each
+// with its own scratch, and together write what SKETCH_TRANSFORM_FN does.
+typedef void (*SKETCH_BAND_FN)(
+    const SKETCH_FRAME&     frame,           // The frame.
+    DWORD                   yBegin,          // First output line.
+    DWORD                   yEnd,            // One past the last output line.
+    BYTE*                   pScratch         // GetSketchScratchSize(dwWidthInPixels) bytes of scratch.
+    );
+
+// Function pointer for the function that transforms columns [xBegin, xEnd)
+// of output lines [yBegin, yEnd), and writes nothing else. For NV12 xBegin
+// is even, and so is xEnd unless it is the width; the tile then owns the
+// chroma of its columns. Tiles of one frame may run concurrently, each with
+// its own scratch.
+typedef void (*SKETCH_TILE_FN)(
+    const SKETCH_FRAME&     frame,           // The frame.
+    DWORD                   xBegin,          // First output column.
+    DWORD                   xEnd,            // One past the last output column.
+    DWORD                   yBegin,          // First output line.
+    DWORD                   yEnd,            // One past the last output line.
+    BYTE*                   pScratch         // GetSketchScratchSize(dwWidthInPixels) bytes of scratch.
+    );
+
+class CSketchThreadPool;
+
+// Function pointer for the function that transforms a frame at reduced
+// resolution (EdgeDectectionScaled).
+typedef void (*SKETCH_SCALED_FN)(
+    const SKETCH_FRAME&     frame,           // The frame.
+    DWORD                   dwScale,         // SKETCH_SCALE_2X or SKETCH_SCALE_4X.
+    BYTE*                   pScratch,        // GetSketchScaledScratchSize bytes of scratch.
+    CSketchThreadPool*      pPool            // Runs the passes in bands; NULL runs them on the calling thread.
+    );
+
+// Median of nine values.
+BYTE GetMedian(BYTE _11, BYTE _12, BYTE _13,
+               BYTE _21, BYTE _22, BYTE _23,
+               BYTE _31, BYTE _32, BYTE _33);
+
+//
+// Packed 4:2:2 luma sits at every other byte. MedianFilter and the
+// unfiltered detectors can read it in place, or, given scratch, deinterleave
+// each line once into a dense row and run the luma-plane (NV12) row kernels
+// on that, re-interleaving neutral chroma on the way out. The F detectors
+// always do the latter. Both give the same output; which is faster depends
+// on the width, and SKETCH_PLANAR_MIN_WIDTH is where the planar path starts
+// to win on the machines measured (see bench/SketchBenchSuite.cpp,
+// --packed-luma). Process-wide.
+//
+enum SKETCH_PACKED_LUMA
+{
+    SKETCH_PACKED_LUMA_AUTO,        // Planar from SKETCH_PLANAR_MIN_WIDTH up.
+    SKETCH_PACKED_LUMA_STRIDED,
+    SKETCH_PACKED_LUMA_PLANAR
+};
+
+#define SKETCH_PLANAR_MIN_WIDTH     640
+
+void SetSketchPackedLuma(SKETCH_PACKED_LUMA mode);
+
+//
+// The per-format kernels are templates on a layout (SketchLayout.h). They
+// are instantiated in SketchKernels.cpp for SKETCH_LAYOUT_YUY2,
+// SKETCH_LAYOUT_UYVY and SKETCH_LAYOUT_NV12; a new layout is one more
+// traits struct and one more line in that list.
+//
+
+// Median filtering of the Y component into a dense plane (see SketchKernels.cpp).
+// pScratch is GetSketchScratchSize(dwWidthInPixels) bytes, or NULL.
+template <class LAYOUT>
+void MedianFilter(BYTE *pDest, const BYTE* pSrc, LONG lSrcStride, LONG lDestStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels, BYTE *pScratch);
+
+// The same over the (2*dwRadius+1)^2 window around each pixel, for noisy
+// low-light cameras the 3x3 median leaves speckled: the rows of the
+// SKETCH_PREFILTER_MEDIAN_RADIUS pre-filter (SketchPipeline.h). Radius 1
+// runs the 3x3 median and 2 the 5x5 one; from 3 up the histogram median
+// costs about ten times the 5x5 one per pixel, but no more at larger
+// radii. A radius above SKETCH_MEDIAN_MAX_RADIUS is clamped to it. Pixels
+// within dwRadius of the border keep their luma, as for MedianFilter, but
+// only dwWidthInPixels bytes of each line are written. pScratch is
+// GetSketchScratchSize(dwWidthInPixels, SKETCH_PREFILTER_MEDIAN_RADIUS,
+// dwRadius) bytes.
+template <class LAYOUT>
+void MedianFilterRadius(BYTE *pDest, const BYTE* pSrc, LONG lSrcStride, LONG lDestStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels,
+    DWORD dwRadius, BYTE *pScratch);
+
+// Edge detection on the raw luma (SKETCH_TRANSFORM_FN).
+template <class LAYOUT>
+void EdgeDectection(const SKETCH_RECT& rcDest, BYTE *pDest, LONG lDestStride, const BYTE* pSrc, LONG lSrcStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels, BYTE *pScratch);
+
+// Edge detection on the median-filtered luma (SKETCH_TRANSFORM_FN).
+template <class LAYOUT>
+void EdgeDectectionF(const SKETCH_RECT& rcDest, BYTE *pDest, LONG lDestStride, const BYTE* pSrc, LONG lSrcStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels, BYTE *pScratch);
+
+// The same detectors, one band at a time (SKETCH_BAND_FN).
+template <class LAYOUT>
+void EdgeDectectionBand(const SKETCH_FRAME& frame, DWORD yBegin, DWORD yEnd, BYTE *pScratch);
+template <class LAYOUT>
+void EdgeDectectionFBand(const SKETCH_FRAME& frame, DWORD yBegin, DWORD yEnd, BYTE *pScratch);
+
+// And one tile at a time (SKETCH_TILE_FN).
+template <class LAYOUT>
+void EdgeDectectionTile(const SKETCH_FRAME& frame, DWORD xBegin, DWORD xEnd, DWORD yBegin, DWORD yEnd, BYTE *pScratch);
+template <class LAYOUT>
+void EdgeDectectionFTile(const SKETCH_FRAME& frame, DWORD xBegin, DWORD xEnd, DWORD yBegin, DWORD yEnd, BYTE *pScratch);
+
+//
+// Edge detection at reduced resolution, for devices where the full-size
+// detector costs too much. The luma is box-averaged down by dwScale in each
+// direction (edge blocks average the pixels they have), pre-filtered and
+// run through the Roberts detector at that size, and the edge map is
+// bilinearly upsampled back into the regions, one 2x step per factor of two.
+// Lines come out dwScale times as thick and soft-edged. Regions, thresholds
+// and inversion work as for EdgeDectectionF, the threshold applied at the
+// reduced size; the border of the reduced frame keeps its averaged luma as
+// the F detector's border keeps the source's, there is no NV12 lag, and
+// packed chroma in the regions is neutral on every line, and the radius of
+// SKETCH_PREFILTER_MEDIAN_RADIUS counts reduced pixels. Frame form only;
+// pScratch holds GetSketchScaledScratchSize(dwWidthInPixels,
+// dwHeightInPixels, dwScale, prefilter, dwMedianRadius) bytes, for the
+// frame's pre-filter. With a pool, each pass (downsampling, edges, each
+// upsampling step) runs in bands on its threads, with the same output; if
+// the pool cannot run, the pass runs on the calling thread.
+//
+#define SKETCH_SCALE_2X     2
+#define SKETCH_SCALE_4X     4
+
+template <class LAYOUT>
+void EdgeDectectionScaled(const SKETCH_FRAME& frame, DWORD dwScale, BYTE *pScratch, CSketchThreadPool *pPool);
+DWORD GetSketchScaledScratchSize(DWORD dwWidthInPixels, DWORD dwHeightInPixels, DWORD dwScale, SKETCH_PREFILTER prefilter,
+    DWORD dwMedianRadius);
+
+//
+// YUY2 to planar RGB (three width*height planes), and the colour sketch:
+// EdgeDectection_YUY2RGB sums the Roberts gradients of R, G and B and
+// writes them as bright lines on black, with neutral chroma (an
+// SKETCH_TRANSFORM_FN, YUY2 only). Inside rcDest it detects edges on every
+// line but the rectangle's first and last and the frame's first; the first
+// and last column of the frame keep their luma. The rest is copied, and
+// the regions and thresholds of SKETCH_FRAME do not apply. It converts two
+// lines at a time into pScratch, which holds
+// GetSketchRGBScratchSize(dwWidthInPixels) bytes, and works in place.
+//
+void YUY2toRGB(BYTE *pDest, const BYTE* pSrc, LONG lSrcStride, LONG lDestStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels);
+DWORD GetSketchRGBScratchSize(DWORD dwWidthInPixels);
+void EdgeDectection_YUY2RGB(const SKETCH_RECT& rcDest, BYTE *pDest, LONG lDestStride, const BYTE* pSrc, LONG lSrcStride, DWORD dwWidthInPixels, DWORD dwHeightInPixels, BYTE *pScratch);
+
+#endif
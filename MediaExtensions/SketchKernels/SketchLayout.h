@@ -0,0 +1,78 @@
+// Pixel layouts of the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHLAYOUT_H
+#define SKETCHLAYOUT_H
+
+#include "SketchPlatform.h"
+
+//
+// The median filters and edge detectors are templates on one of these
+// traits types, which say where a frame keeps its luma and chroma. Every
+// member is a compile-time constant, so each instantiation is a loop
+// written for that one layout.
+//
+// Layout:
+//
+//  BytesPerPixel   Bytes per pixel in a luma line: 1 for a luma plane, 2
+//                  for packed 4:2:2.
+//  LumaOffset      Offset of a pixel's luma within those bytes. In packed
+//                  layouts the other byte is chroma.
+//  ChromaPlane     Chroma is in a plane of its own below the luma (4:2:0)
+//                  rather than interleaved with it.
+//
+// The detectors have never treated the three formats quite alike, and
+// the output of the existing formats must not change (tests/golden), so
+// the traits also carry those differences. A new format should set them
+// the way the unfiltered detectors behave: FilteredLag false,
+// FilteredFirstColumn 0 and FullStrideCopies false.
+//
+//  FilteredLag         F variants take the gradient over filtered lines
+//                      y-1 and y rather than y and y+1.
+//  FilteredFirstColumn Filtered pixel the F variants copy to column 0.
+//  FullStrideCopies    Whole-line copies of the median's first and last
+//                      lines take a destination stride of bytes rather
+//                      than one line.
+//
+
+// Y0 U0 Y1 V0 ...
+struct SKETCH_LAYOUT_YUY2
+{
+    static const DWORD  BytesPerPixel = 2;
+    static const DWORD  LumaOffset = 0;
+    static const bool   ChromaPlane = false;
+
+    static const bool   FilteredLag = false;
+    static const DWORD  FilteredFirstColumn = 0;
+    static const bool   FullStrideCopies = false;
+};
+
+// U0 Y0 V0 Y1 ...
+struct SKETCH_LAYOUT_UYVY
+{
+    static const DWORD  BytesPerPixel = 2;
+    static const DWORD  LumaOffset = 1;
+    static const bool   ChromaPlane = false;
+
+    static const bool   FilteredLag = false;
+    static const DWORD  FilteredFirstColumn = 1;
+    static const bool   FullStrideCopies = false;
+};
+
+// Y plane, then an interleaved U V plane of half the height.
+struct SKETCH_LAYOUT_NV12
+{
+    static const DWORD  BytesPerPixel = 1;
+    static const DWORD  LumaOffset = 0;
+    static const bool   ChromaPlane = true;
+
+    static const bool   FilteredLag = true;
+    static const DWORD  FilteredFirstColumn = 0;
+    static const bool   FullStrideCopies = true;
+};
+
+#endif
@@ -0,0 +1,278 @@
+// Vectorized 3x3 median, and the constant-time median for larger windows.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchMedian.h"
+#include "SketchRows.h"
+#include "SketchSimd.h"
+
+#include <string.h>
+
+// The kernel itself is in SketchRowsImpl.h, built once per instruction set.
+void MedianRow3x3(
+	_Out_writes_(dwCount) BYTE* pDest,
+	_In_ const BYTE* pAbove,
+	_In_ const BYTE* pRow,
+	_In_ const BYTE* pBelow,
+	_In_ DWORD dwStep,
+	_In_ DWORD dwCount)
+{
+	GetSketchRows()->pfnMedianRow3x3(pDest, pAbove, pRow, pBelow, dwStep, dwCount);
+}
+
+//-------------------------------------------------------------------
+// Constant-time median.
+//
+// Column x's histogram is MEDIAN_COLUMN bytes at x*MEDIAN_COLUMN: its
+// coarse bins, then for each coarse bin k the 16 fine bins under it. A
+// column holds at most 2*SKETCH_MEDIAN_MAX_RADIUS+1 samples, so its counts
+// fit in bytes; the window's, up to (2*SKETCH_MEDIAN_MAX_RADIUS+1)^2, are
+// WORDs. A set of 16 bins is one 128-bit vector of bytes, widened to two
+// of words, on the baseline instruction set: the wider tiers would have
+// nothing more to put in a vector.
+//-------------------------------------------------------------------
+
+#define MEDIAN_BINS         16
+#define MEDIAN_COLUMN       (MEDIAN_BINS + MEDIAN_BINS * MEDIAN_BINS)
+
+// Pixels MedianHistogramRow takes at a time.
+#define MEDIAN_BLOCK        64
+
+// Fine bins of a coarse bin that are not up to date for any column.
+#define MEDIAN_STALE        0xFFFFFFFF
+
+// pTo += pIn - pOut, bin by bin: the window moving one column along.
+// pOut may be NULL.
+static inline void SlideBins(WORD* pTo, const BYTE* pIn, const BYTE* pOut)
+{
+#if defined(SKETCH_SIMD_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i in = _mm_loadu_si128((const __m128i*)pIn);
+	__m128i lo = _mm_add_epi16(_mm_loadu_si128((const __m128i*)pTo), _mm_unpacklo_epi8(in, zero));
+	__m128i hi = _mm_add_epi16(_mm_loadu_si128((const __m128i*)(pTo + 8)), _mm_unpackhi_epi8(in, zero));
+	if (pOut != NULL)
+	{
+		const __m128i out = _mm_loadu_si128((const __m128i*)pOut);
+		lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(out, zero));
+		hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(out, zero));
+	}
+	_mm_storeu_si128((__m128i*)pTo, lo);
+	_mm_storeu_si128((__m128i*)(pTo + 8), hi);
+#elif defined(SKETCH_SIMD_NEON)
+	const uint8x16_t in = vld1q_u8(pIn);
+	uint16x8_t lo = vaddw_u8(vld1q_u16(pTo), vget_low_u8(in));
+	uint16x8_t hi = vaddw_u8(vld1q_u16(pTo + 8), vget_high_u8(in));
+	if (pOut != NULL)
+	{
+		const uint8x16_t out = vld1q_u8(pOut);
+		lo = vsubw_u8(lo, vget_low_u8(out));
+		hi = vsubw_u8(hi, vget_high_u8(out));
+	}
+	vst1q_u16(pTo, lo);
+	vst1q_u16(pTo + 8, hi);
+#else
+	for (DWORD i = 0; i < MEDIAN_BINS; i++)
+	{
+		pTo[i] = (WORD)(pTo[i] + pIn[i] - ((pOut != NULL) ? pOut[i] : 0));
+	}
+#endif
+}
+
+// The bin of pBins that holds rank dwRank, counting *pdwBelow before the
+// first bin, which the counts before it are added to. Without branches on
+// the counts: on noise, where the median lands moves from pixel to pixel,
+// and a scan would mispredict its exit at nearly every one. The running
+// sums are at most (2*SKETCH_MEDIAN_MAX_RADIUS+1)^2, which signed words
+// hold.
+static inline DWORD FindBin(const WORD* pBins, DWORD dwRank, DWORD* pdwBelow)
+{
+#if defined(SKETCH_SIMD_SSE2) || defined(SKETCH_SIMD_NEON)
+	// The running sums, after the count below: rgSums[i] is below bin i.
+	WORD rgSums[MEDIAN_BINS + 1];
+	rgSums[0] = 0;
+#endif
+#if defined(SKETCH_SIMD_SSE2)
+	__m128i lo = _mm_loadu_si128((const __m128i*)pBins);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(pBins + 8));
+	lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+	hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+	lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+	hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+	lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+	hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+	hi = _mm_add_epi16(hi, _mm_shuffle_epi32(_mm_shufflehi_epi16(lo, 0xFF), 0xFF));
+	_mm_storeu_si128((__m128i*)(rgSums + 1), lo);
+	_mm_storeu_si128((__m128i*)(rgSums + 9), hi);
+
+	// The bin is the number of sums up to the rank.
+	const __m128i rank = _mm_set1_epi16((short)(dwRank - *pdwBelow));
+	const __m128i above = _mm_add_epi16(_mm_srli_epi16(_mm_cmpgt_epi16(lo, rank), 15),
+		_mm_srli_epi16(_mm_cmpgt_epi16(hi, rank), 15));
+	const __m128i count = _mm_sad_epu8(above, _mm_setzero_si128());
+	const DWORD k = MEDIAN_BINS - (DWORD)(_mm_cvtsi128_si32(count) + _mm_cvtsi128_si32(_mm_srli_si128(count, 8)));
+#elif defined(SKETCH_SIMD_NEON)
+	const uint16x8_t zero = vdupq_n_u16(0);
+	uint16x8_t lo = vld1q_u16(pBins);
+	uint16x8_t hi = vld1q_u16(pBins + 8);
+	lo = vaddq_u16(lo, vextq_u16(zero, lo, 7));
+	hi = vaddq_u16(hi, vextq_u16(zero, hi, 7));
+	lo = vaddq_u16(lo, vextq_u16(zero, lo, 6));
+	hi = vaddq_u16(hi, vextq_u16(zero, hi, 6));
+	lo = vaddq_u16(lo, vextq_u16(zero, lo, 4));
+	hi = vaddq_u16(hi, vextq_u16(zero, hi, 4));
+	hi = vaddq_u16(hi, vdupq_n_u16(vgetq_lane_u16(lo, 7)));
+	vst1q_u16(rgSums + 1, lo);
+	vst1q_u16(rgSums + 9, hi);
+
+	const uint16x8_t rank = vdupq_n_u16((uint16_t)(dwRank - *pdwBelow));
+	const uint16x8_t above = vaddq_u16(vshrq_n_u16(vcgtq_u16(lo, rank), 15), vshrq_n_u16(vcgtq_u16(hi, rank), 15));
+	const uint64x2_t count = vpaddlq_u32(vpaddlq_u16(above));
+	const DWORD k = MEDIAN_BINS - (DWORD)(vgetq_lane_u64(count, 0) + vgetq_lane_u64(count, 1));
+#endif
+#if defined(SKETCH_SIMD_SSE2) || defined(SKETCH_SIMD_NEON)
+	*pdwBelow += rgSums[k];
+	return k;
+#else
+	DWORD k = 0;
+	while (*pdwBelow + pBins[k] <= dwRank)
+	{
+		*pdwBelow += pBins[k];
+		k++;
+	}
+	return k;
+#endif
+}
+
+DWORD GetSketchMedianHistogramSize(DWORD dwWidthInPixels)
+{
+	return dwWidthInPixels * MEDIAN_COLUMN;
+}
+
+void MedianColumnsClear(
+	_Inout_ BYTE* pHistograms,
+	_In_ DWORD xBegin,
+	_In_ DWORD xEnd)
+{
+	if (xBegin < xEnd)
+	{
+		memset(pHistograms + xBegin * MEDIAN_COLUMN, 0, (xEnd - xBegin) * MEDIAN_COLUMN);
+	}
+}
+
+void MedianColumnsUpdate(
+	_Inout_ BYTE* pHistograms,
+	_In_ const BYTE* pIn,
+	_In_opt_ const BYTE* pOut,
+	_In_ DWORD xBegin,
+	_In_ DWORD xEnd)
+{
+	BYTE* pColumn = pHistograms + xBegin * MEDIAN_COLUMN;
+
+	if (pOut == NULL)
+	{
+		for (DWORD x = xBegin; x < xEnd; x++, pColumn += MEDIAN_COLUMN)
+		{
+			pColumn[pIn[x] >> 4]++;
+			pColumn[MEDIAN_BINS + pIn[x]]++;
+		}
+		return;
+	}
+
+	for (DWORD x = xBegin; x < xEnd; x++, pColumn += MEDIAN_COLUMN)
+	{
+		pColumn[pIn[x] >> 4]++;
+		pColumn[MEDIAN_BINS + pIn[x]]++;
+		pColumn[pOut[x] >> 4]--;
+		pColumn[MEDIAN_BINS + pOut[x]]--;
+	}
+}
+
+void MedianHistogramRow(
+	_Out_writes_(xEnd) BYTE* pDest,
+	_In_ const BYTE* pHistograms,
+	_In_ DWORD dwRadius,
+	_In_ DWORD xBegin,
+	_In_ DWORD xEnd)
+{
+	const DWORD r = dwRadius;
+	const DWORD n = 2 * r + 1;
+
+	// Rank of the median in the window.
+	const DWORD dwRank = n * n / 2;
+
+	if (xBegin >= xEnd)
+	{
+		return;
+	}
+
+	// The window's coarse bins over the columns around xBegin, and none of
+	// its fine bins yet.
+	WORD rgCoarse[MEDIAN_BINS];
+	WORD rgFine[MEDIAN_BINS][MEDIAN_BINS];
+	DWORD rgFineColumn[MEDIAN_BINS];
+	memset(rgCoarse, 0, sizeof(rgCoarse));
+	for (DWORD j = xBegin - r; j <= xBegin + r; j++)
+	{
+		SlideBins(rgCoarse, pHistograms + j * MEDIAN_COLUMN, NULL);
+	}
+	for (DWORD k = 0; k < MEDIAN_BINS; k++)
+	{
+		rgFineColumn[k] = MEDIAN_STALE;
+	}
+
+	// A block of pixels at a time: first where each one's median is among
+	// the coarse bins, then among the fine ones. The second pass reads k
+	// from memory rather than waiting on the first pass's scan, so the
+	// pixels of a block overlap instead of queueing one behind another.
+	BYTE rgBin[MEDIAN_BLOCK];
+	WORD rgBelow[MEDIAN_BLOCK];
+	for (DWORD xBlock = xBegin; xBlock < xEnd; xBlock += MEDIAN_BLOCK)
+	{
+		const DWORD cPixels = (xEnd - xBlock < MEDIAN_BLOCK) ? xEnd - xBlock : MEDIAN_BLOCK;
+
+		for (DWORD i = 0; i < cPixels; i++)
+		{
+			const DWORD x = xBlock + i;
+			if (x > xBegin)
+			{
+				SlideBins(rgCoarse, pHistograms + (x + r) * MEDIAN_COLUMN, pHistograms + (x - r - 1) * MEDIAN_COLUMN);
+			}
+			DWORD dwBelow = 0;
+			rgBin[i] = (BYTE)FindBin(rgCoarse, dwRank, &dwBelow);
+			rgBelow[i] = (WORD)dwBelow;
+		}
+
+		for (DWORD i = 0; i < cPixels; i++)
+		{
+			const DWORD x = xBlock + i;
+			const DWORD k = rgBin[i];
+
+			// Bring the fine bins of k to this column: move them along from
+			// the column they were last used at, or sum them afresh when
+			// that is as far away as the window is wide.
+			const BYTE* pFineK = pHistograms + MEDIAN_BINS + k * MEDIAN_BINS;
+			if (rgFineColumn[k] == MEDIAN_STALE || x - rgFineColumn[k] >= n)
+			{
+				memset(rgFine[k], 0, sizeof(rgFine[k]));
+				for (DWORD j = x - r; j <= x + r; j++)
+				{
+					SlideBins(rgFine[k], pFineK + j * MEDIAN_COLUMN, NULL);
+				}
+			}
+			else
+			{
+				for (DWORD j = rgFineColumn[k] + 1; j <= x; j++)
+				{
+					SlideBins(rgFine[k], pFineK + (j + r) * MEDIAN_COLUMN, pFineK + (j - r - 1) * MEDIAN_COLUMN);
+				}
+			}
+			rgFineColumn[k] = x;
+
+			DWORD dwBelow = rgBelow[i];
+			pDest[x] = (BYTE)(k * MEDIAN_BINS + FindBin(rgFine[k], dwRank, &dwBelow));
+		}
+	}
+}
@@ -0,0 +1,274 @@
+// Line-pipelined median + edge detection.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchPipeline.h"
+#include "SketchMedian.h"
+#include "SketchRows.h"
+
+#include <string.h>
+
+// Ring slots start on cache lines.
+static inline DWORD RingPitch(DWORD dwWidthInPixels)
+{
+	return (dwWidthInPixels + 63) & ~63u;
+}
+
+DWORD GetSketchScratchSize(DWORD dwWidthInPixels)
+{
+	// Five raw rows, three filtered rows and the chroma gradients.
+	return 9 * RingPitch(dwWidthInPixels);
+}
+
+BYTE* GetSketchChromaRow(BYTE* pScratch, DWORD dwWidthInPixels)
+{
+	return pScratch + 8 * RingPitch(dwWidthInPixels);
+}
+
+// The pre-filter a ring runs for prefilter at dwMedianRadius: the radius
+// median below radius 3 is one of the sorting networks' (or None), and an
+// unknown pre-filter is Median3.
+static SKETCH_PREFILTER ResolvePrefilter(SKETCH_PREFILTER prefilter, DWORD dwMedianRadius)
+{
+	if ((DWORD)prefilter >= SKETCH_PREFILTER_COUNT)
+	{
+		return SKETCH_PREFILTER_MEDIAN3;
+	}
+	if (prefilter != SKETCH_PREFILTER_MEDIAN_RADIUS || dwMedianRadius >= 3)
+	{
+		return prefilter;
+	}
+
+	static const SKETCH_PREFILTER rgSmall[3] = { SKETCH_PREFILTER_NONE, SKETCH_PREFILTER_MEDIAN3, SKETCH_PREFILTER_MEDIAN5 };
+	return rgSmall[dwMedianRadius];
+}
+
+DWORD GetSketchScratchSize(DWORD dwWidthInPixels, SKETCH_PREFILTER prefilter, DWORD dwMedianRadius)
+{
+	if (ResolvePrefilter(prefilter, dwMedianRadius) != SKETCH_PREFILTER_MEDIAN_RADIUS)
+	{
+		return GetSketchScratchSize(dwWidthInPixels);
+	}
+
+	// Then the radius median's 2r+2 raw rows and its histograms.
+	const DWORD r = GetSketchPrefilterReach(prefilter, dwMedianRadius);
+	return GetSketchScratchSize(dwWidthInPixels) + (2 * r + 2) * RingPitch(dwWidthInPixels) +
+		GetSketchMedianHistogramSize(dwWidthInPixels);
+}
+
+DWORD GetSketchPrefilterReach(SKETCH_PREFILTER prefilter, DWORD dwMedianRadius)
+{
+	switch (ResolvePrefilter(prefilter, dwMedianRadius))
+	{
+	case SKETCH_PREFILTER_NONE:
+		return 0;
+	case SKETCH_PREFILTER_MEDIAN5:
+		return 2;
+	case SKETCH_PREFILTER_MEDIAN_RADIUS:
+		return (dwMedianRadius < SKETCH_MEDIAN_MAX_RADIUS) ? dwMedianRadius : SKETCH_MEDIAN_MAX_RADIUS;
+	default:
+		return 1;
+	}
+}
+
+CSketchLumaRing::CSketchLumaRing(
+	const BYTE* pSrc,
+	LONG        lSrcStride,
+	DWORD       dwStep,
+	DWORD       dwWidthInPixels,
+	DWORD       dwHeightInPixels,
+	const SKETCH_COLUMNS* pColumns,
+	DWORD       cColumns,
+	SKETCH_PREFILTER prefilter,
+	DWORD       dwMedianRadius,
+	BYTE*       pScratch,
+	bool        bCopyRows) :
+	m_pSrc(pSrc), m_lSrcStride(lSrcStride), m_dwStep(dwStep),
+	m_dwWidth(dwWidthInPixels), m_dwHeight(dwHeightInPixels), m_dwPitch(RingPitch(dwWidthInPixels)),
+	m_pColumns(pColumns), m_cColumns(cColumns),
+	m_prefilter(ResolvePrefilter(prefilter, dwMedianRadius)),
+	m_pRaw(pScratch), m_bCopyRows(bCopyRows), m_pFiltered((pScratch != NULL) ? pScratch + 5 * RingPitch(dwWidthInPixels) : NULL),
+	m_dwRawNext(0), m_dwFilteredNext(0), m_pHistograms(NULL), m_dwHistogramRow(0)
+{
+	m_dwReach = GetSketchPrefilterReach(prefilter, dwMedianRadius);
+	m_dwMargin = (m_dwReach > 1) ? m_dwReach : 1;
+	m_cRawSlots = (m_dwReach > 1) ? 2 * m_dwReach + 1 : 3;
+
+	if (m_prefilter == SKETCH_PREFILTER_MEDIAN_RADIUS && pScratch != NULL)
+	{
+		// Past the chroma row: one more raw slot, for the line leaving the
+		// histograms, and the histograms.
+		m_cRawSlots = 2 * m_dwReach + 2;
+		m_pRaw = pScratch + 9 * m_dwPitch;
+		m_pHistograms = m_pRaw + m_cRawSlots * m_dwPitch;
+	}
+}
+
+void CSketchLumaRing::MoveHistograms(DWORD y)
+{
+	const DWORD r = m_dwReach;
+
+	if (m_dwHistogramRow == 0 || y - m_dwHistogramRow > 2 * r)
+	{
+		// Nothing of the lines held is wanted: fill them afresh.
+		for (DWORD j = y - r; j <= y + r; j++)
+		{
+			const BYTE* pIn = RawRow(j);
+			DWORD xDone = 0;
+			for (DWORD i = 0; i < m_cColumns; i++)
+			{
+				// Each window and the reach either side of it, once.
+				const DWORD xBegin = (m_pColumns[i].xBegin > xDone + r) ? m_pColumns[i].xBegin - r : xDone;
+				const DWORD xEnd = (m_dwWidth - m_pColumns[i].xEnd > r) ? m_pColumns[i].xEnd + r : m_dwWidth;
+				if (j == y - r)
+				{
+					MedianColumnsClear(m_pHistograms, xBegin, xEnd);
+				}
+				MedianColumnsUpdate(m_pHistograms, pIn, NULL, xBegin, xEnd);
+				xDone = (xEnd > xDone) ? xEnd : xDone;
+			}
+		}
+		m_dwHistogramRow = y;
+		return;
+	}
+
+	for (DWORD j = m_dwHistogramRow + 1; j <= y; j++)
+	{
+		// The slot of the line leaving is not reused until the one after
+		// the line coming in.
+		const BYTE* pIn = RawRow(j + r);
+		const BYTE* pOut = RawRow(j - r - 1);
+		DWORD xDone = 0;
+		for (DWORD i = 0; i < m_cColumns; i++)
+		{
+			const DWORD xBegin = (m_pColumns[i].xBegin > xDone + r) ? m_pColumns[i].xBegin - r : xDone;
+			const DWORD xEnd = (m_dwWidth - m_pColumns[i].xEnd > r) ? m_pColumns[i].xEnd + r : m_dwWidth;
+			MedianColumnsUpdate(m_pHistograms, pIn, pOut, xBegin, xEnd);
+			xDone = (xEnd > xDone) ? xEnd : xDone;
+		}
+	}
+	m_dwHistogramRow = y;
+}
+
+const BYTE* CSketchLumaRing::RawRow(DWORD y)
+{
+	const BYTE* pSrcRow = m_pSrc + (LONG)y * m_lSrcStride;
+
+	if (m_dwStep == 1 && !m_bCopyRows)
+	{
+		// Luma plane: read the source row in place.
+		return pSrcRow;
+	}
+
+	BYTE* pSlot = m_pRaw + (y % m_cRawSlots) * m_dwPitch;
+	if (m_dwRawNext + m_cRawSlots <= y)
+	{
+		// Starting mid-frame: only the last few rows survive anyway.
+		m_dwRawNext = y - (m_cRawSlots - 1);
+	}
+	for ( ; m_dwRawNext <= y; m_dwRawNext++)
+	{
+		BYTE* pRaw = m_pRaw + (m_dwRawNext % m_cRawSlots) * m_dwPitch;
+		const BYTE* pSrcRaw = m_pSrc + (LONG)m_dwRawNext * m_lSrcStride;
+
+		// Each window and the margin either side of it.
+		for (DWORD i = 0; i < m_cColumns; i++)
+		{
+			const DWORD xBegin = (m_pColumns[i].xBegin > m_dwMargin) ? m_pColumns[i].xBegin - m_dwMargin : 0;
+			const DWORD xEnd = (m_dwWidth - m_pColumns[i].xEnd > m_dwMargin) ? m_pColumns[i].xEnd + m_dwMargin : m_dwWidth;
+
+			if (m_dwStep == 1)
+			{
+				memcpy(pRaw + xBegin, pSrcRaw + xBegin, xEnd - xBegin);
+			}
+			else
+			{
+				GetSketchRows()->pfnDeinterleaveLuma(pRaw + xBegin, pSrcRaw + 2 * xBegin, xEnd - xBegin);
+			}
+		}
+	}
+	return pSlot;
+}
+
+const BYTE* CSketchLumaRing::Row(DWORD y)
+{
+	if (m_prefilter == SKETCH_PREFILTER_NONE)
+	{
+		// Nothing to filter.
+		return RawRow(y);
+	}
+
+	BYTE* pOut = m_pFiltered + (y % 3) * m_dwPitch;
+
+	if (y < m_dwFilteredNext)
+	{
+		// Already in the ring.
+		return pOut;
+	}
+	m_dwFilteredNext = y + 1;
+
+	const DWORD dwReach = m_dwReach;
+	if (y < dwReach || m_dwHeight - y <= dwReach)
+	{
+		// The lines within reach of the first and last are not filtered.
+		const BYTE* pRaw = RawRow(y);
+		for (DWORD i = 0; i < m_cColumns; i++)
+		{
+			memcpy(pOut + m_pColumns[i].xBegin, pRaw + m_pColumns[i].xBegin, m_pColumns[i].xEnd - m_pColumns[i].xBegin);
+		}
+		return pOut;
+	}
+
+	// Pull in the row furthest below first: for packed formats that may
+	// recycle the ring slot of the row above the ones filtered over, never
+	// one of y-dwReach..y+dwReach.
+	const BYTE* rgpRows[5] = { NULL, NULL, NULL, NULL, NULL };
+	if (m_pHistograms != NULL)
+	{
+		MoveHistograms(y);
+		rgpRows[2] = RawRow(y);
+	}
+	else
+	{
+		rgpRows[2 + dwReach] = RawRow(y + dwReach);
+		for (DWORD i = 2 - dwReach; i < 2 + dwReach; i++)
+		{
+			rgpRows[i] = RawRow(y + i - 2);
+		}
+	}
+	const BYTE* pRow = rgpRows[2];
+	const DWORD xLast = (m_dwWidth > dwReach) ? m_dwWidth - dwReach : 0;
+
+	for (DWORD i = 0; i < m_cColumns; i++)
+	{
+		// The columns within reach of the first and last keep the raw
+		// luma, and the ones between them are filtered.
+		const DWORD xBegin = m_pColumns[i].xBegin;
+		const DWORD xEnd = m_pColumns[i].xEnd;
+		const DWORD xFilterBegin = (xBegin > dwReach) ? xBegin : ((dwReach < xEnd) ? dwReach : xEnd);
+		const DWORD xFilterEnd = (xEnd < xLast) ? xEnd : ((xLast > xFilterBegin) ? xLast : xFilterBegin);
+
+		memcpy(pOut + xBegin, pRow + xBegin, xFilterBegin - xBegin);
+
+		if (xFilterBegin < xFilterEnd && m_pHistograms != NULL)
+		{
+			MedianHistogramRow(pOut, m_pHistograms, dwReach, xFilterBegin, xFilterEnd);
+		}
+		else if (xFilterBegin < xFilterEnd)
+		{
+			const BYTE* rgpFrom[5];
+			for (DWORD j = 0; j < 5; j++)
+			{
+				rgpFrom[j] = (rgpRows[j] != NULL) ? rgpRows[j] + xFilterBegin : NULL;
+			}
+			GetSketchRows()->pfnPrefilterRow(pOut + xFilterBegin, m_prefilter, rgpFrom, xFilterEnd - xFilterBegin);
+		}
+
+		memcpy(pOut + xFilterEnd, pRow + xFilterEnd, xEnd - xFilterEnd);
+	}
+
+	return pOut;
+}
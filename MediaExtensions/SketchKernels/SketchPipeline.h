@@ -0,0 +1,183 @@
+// Line-pipelined median + edge detection.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHPIPELINE_H
+#define SKETCHPIPELINE_H
+
+#include "SketchPlatform.h"
+
+//
+// The filtered edge detectors (EdgeDectectionF_*) used to median-filter the
+// whole luma plane into a width*height scratch plane and then run Roberts
+// over it in a second pass. CSketchLumaRing produces the filtered rows on
+// demand instead, keeping only
+//
+//  - the last three raw luma rows, five for Median5 and 2r+2 for the
+//    radius median (deinterleaved, for packed formats; NV12 rows are read
+//    in place),
+//  - for the radius median from radius 3 up, a histogram of the 2r+1
+//    lines around the current one for each column (SketchMedian.h), and
+//  - the last three filtered rows, for the 3x3 detectors,
+//
+// so an output row is emitted as soon as the filtered rows below it are
+// done and the frame streams through memory once. Rows must be requested in
+// increasing order; each raw and filtered row is produced at most once. The
+// first request may be any row, so a band of a frame starts its own ring
+// and only recomputes the rows of the halo above it.
+//
+// Filtered row r is the ring's pre-filter (SKETCH_PREFILTER) of the raw
+// rows, through pfnPrefilterRow, or MedianHistogramRow for the radius
+// median. A band's ring fills the histograms from the 2r+1 lines around
+// its first filtered row, and moves them down a line at a time after
+// that. The rows and columns within the filter's reach of the border keep
+// their raw luma: row r is the raw row for r == 0 and r == height-1, and
+// otherwise keeps the raw first and last column, for the 3x3 filters, so
+// Median3 is what MedianFilter_* produce for the same row. With SKETCH_PREFILTER_NONE the filtered rows are the raw ones.
+//
+// A ring may be limited to windows of columns, for destination regions
+// narrower than the frame: only those columns of the filtered rows are
+// produced, and only the raw columns they read (the filter's reach, and at
+// least one, more on either side) are deinterleaved.
+//
+// A frame transformed in place has its source lines overwritten as soon as
+// the output lines are written, while the ring still needs up to three
+// lines above, 2r+1 for the radius median. A ring that copies rows takes
+// NV12 rows into the raw slots too, as the packed ones are, so every raw
+// row is read from the source once, in order, and before the output line
+// over it is written.
+//
+
+//
+// The smoothing the F variants, and EdgeDectectionScaled, take the edges
+// over (SKETCH_FRAME::prefilter). Each keeps sensor noise from drawing
+// specks, at its own cost per pixel:
+//
+//  Median3     The 3x3 median, which keeps steps sharp; what MedianFilter_*
+//              produce. The default, and what the frame forms use.
+//  None        The luma itself: the F variants then cost about what the
+//              others do.
+//  Median5     The 5x5 median. Steadier on noisy sensors, at about four
+//              times the cost of Median3.
+//  Binomial3   The weights 1 2 1 down the columns and then along the row,
+//              each pass rounded: (a + 2b + c + 2) / 4. The cheapest
+//              smoothing, which softens steps along with the noise.
+//  Box3        The mean of the 3x3 block, (sum + 4) / 9. Blurs more than
+//              Binomial3, and costs about what Median3 does.
+//  MedianRadius
+//              The median of the (2r+1)x(2r+1) block, r being
+//              SKETCH_FRAME::dwMedianRadius, for low-light noise that
+//              Median5 leaves speckled. Radius 0 is None, 1 Median3 and 2
+//              Median5; from 3 up it is the constant-time histogram median
+//              (SketchMedian.h), which costs about ten times Median5 but
+//              no more at larger radii. Radii above
+//              SKETCH_MEDIAN_MAX_RADIUS are clamped to it.
+//
+// A filtered line keeps the luma within the filter's reach of the border of
+// the frame: the first and last line and column for the 3x3 filters, two
+// of each for Median5, r for the radius median. An unknown pre-filter is
+// Median3.
+//
+enum SKETCH_PREFILTER
+{
+    SKETCH_PREFILTER_MEDIAN3,
+    SKETCH_PREFILTER_NONE,
+    SKETCH_PREFILTER_MEDIAN5,
+    SKETCH_PREFILTER_BINOMIAL3,
+    SKETCH_PREFILTER_BOX3,
+    SKETCH_PREFILTER_MEDIAN_RADIUS,
+    SKETCH_PREFILTER_COUNT
+};
+
+// Largest radius of SKETCH_PREFILTER_MEDIAN_RADIUS.
+#define SKETCH_MEDIAN_MAX_RADIUS    32
+
+// Columns [xBegin, xEnd) of a line.
+struct SKETCH_COLUMNS
+{
+    DWORD   xBegin;
+    DWORD   xEnd;
+};
+
+// Bytes of scratch CSketchLumaRing needs for a frame of the given width,
+// with any pre-filter but the radius median from radius 3 up, and one row
+// more that the edge detectors keep the chroma gradients of a line in
+// (GetSketchChromaRow). The second form is for a given pre-filter, and
+// more than the first for that one.
+DWORD GetSketchScratchSize(DWORD dwWidthInPixels);
+DWORD GetSketchScratchSize(DWORD dwWidthInPixels, SKETCH_PREFILTER prefilter, DWORD dwMedianRadius);
+
+// That row, indexed by column, within GetSketchScratchSize(dwWidthInPixels)
+// bytes at pScratch. Holds dwWidthInPixels bytes, rounded up to even.
+BYTE* GetSketchChromaRow(BYTE* pScratch, DWORD dwWidthInPixels);
+
+// Rows and columns on either side of a pixel that the pre-filter reads: 0
+// for SKETCH_PREFILTER_NONE, 2 for Median5, the radius (at most
+// SKETCH_MEDIAN_MAX_RADIUS) for the radius median and 1 for the others.
+DWORD GetSketchPrefilterReach(SKETCH_PREFILTER prefilter, DWORD dwMedianRadius);
+
+class CSketchLumaRing
+{
+public:
+    // pSrc points at the first luma sample of the frame; dwStep is 1 for a
+    // luma plane and 2 for packed 4:2:2. pColumns holds the windows,
+    // disjoint and in increasing x, and must outlive the ring; one window
+    // of [0, dwWidthInPixels) for whole rows. prefilter, at dwMedianRadius
+    // for the radius median, makes the filtered rows. pScratch holds at
+    // least GetSketchScratchSize(dwWidthInPixels, prefilter, dwMedianRadius)
+    // bytes, or is NULL for a ring that is never read. bCopyRows copies
+    // luma-plane rows as well, and needs pScratch.
+    CSketchLumaRing(
+        const BYTE* pSrc,
+        LONG        lSrcStride,
+        DWORD       dwStep,
+        DWORD       dwWidthInPixels,
+        DWORD       dwHeightInPixels,
+        const SKETCH_COLUMNS* pColumns,
+        DWORD       cColumns,
+        SKETCH_PREFILTER prefilter,
+        DWORD       dwMedianRadius,
+        BYTE*       pScratch,
+        bool        bCopyRows);
+
+    // Filtered luma row y, indexed by column; only the windows are valid.
+    // Valid until row y+3 is requested.
+    const BYTE* Row(DWORD y);
+
+    // Unfiltered luma row y, indexed by column: deinterleaved into the ring
+    // for packed formats, the source row for a luma plane unless the ring
+    // copies rows. Only the windows and one column either side of them (the
+    // pre-filter's reach, if more) are valid in the ring. Valid until row
+    // y+3 is requested. A ring serves either Row or RawRow, not both.
+    const BYTE* RawRow(DWORD y);
+
+private:
+    // Brings the column histograms to lines y-m_dwReach to y+m_dwReach.
+    void MoveHistograms(DWORD y);
+
+    const BYTE* m_pSrc;
+    LONG        m_lSrcStride;
+    DWORD       m_dwStep;
+    DWORD       m_dwWidth;
+    DWORD       m_dwHeight;
+    DWORD       m_dwPitch;          // Bytes between ring slots.
+    const SKETCH_COLUMNS* m_pColumns; // Windows of the filtered rows.
+    DWORD       m_cColumns;
+    SKETCH_PREFILTER m_prefilter;   // The radius median only from radius 3 up.
+    DWORD       m_dwReach;          // GetSketchPrefilterReach, which is the radius for the radius median.
+    DWORD       m_dwMargin;         // Raw columns either side of the windows.
+
+    BYTE*       m_pRaw;             // m_cRawSlots slots, packed formats or copied rows only.
+    DWORD       m_cRawSlots;        // 3, 5 for Median5, or 2r+2 for the radius median.
+    bool        m_bCopyRows;
+    BYTE*       m_pFiltered;        // 3 slots.
+    DWORD       m_dwRawNext;        // First raw row not yet deinterleaved.
+    DWORD       m_dwFilteredNext;   // First filtered row not yet produced.
+    BYTE*       m_pHistograms;      // Column histograms of the radius median; NULL for the other pre-filters.
+    DWORD       m_dwHistogramRow;   // Line they are centred on; 0 while they are empty.
+};
+
+#endif
@@ -0,0 +1,60 @@
+// Platform shims for the portable sketch kernel library.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHPLATFORM_H
+#define SKETCHPLATFORM_H
+
+//
+// The kernels are written against the Windows SDK integer types and SAL
+// annotations. On Windows they come from the SDK headers; everywhere else
+// the types map onto fixed-width integers and the annotations compile away.
+//
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+#else
+
+#include <stdint.h>
+
+typedef uint8_t     BYTE;
+typedef int16_t     SHORT;
+typedef uint16_t    WORD;
+typedef int32_t     LONG;
+typedef uint32_t    DWORD;
+typedef uint32_t    UINT32;
+typedef uint64_t    UINT64;
+
+#endif
+
+#ifndef _In_
+#define _In_
+#endif
+#ifndef _In_opt_
+#define _In_opt_
+#endif
+#ifndef _Out_
+#define _Out_
+#endif
+#ifndef _Inout_
+#define _Inout_
+#endif
+#ifndef _In_reads_
+#define _In_reads_(size)
+#endif
+#ifndef _Out_writes_
+#define _Out_writes_(size)
+#endif
+#ifndef _Inout_updates_
+#define _Inout_updates_(size)
+#endif
+#ifndef _Inexpressible_
+#define _Inexpressible_(size)
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+// Regions of a frame for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchRegions.h"
+
+#include <stddef.h>
+
+static inline DWORD MinDword(DWORD a, DWORD b)
+{
+	return (a < b) ? a : b;
+}
+
+CSketchSpans::CSketchSpans(const SKETCH_FRAME& frame) :
+	m_dwWidth(frame.dwWidthInPixels), m_dwHeight(frame.dwHeightInPixels), m_cRegions(0),
+	m_cSpans(0), m_yFirst(0), m_yEnd(0)
+{
+	// A frame without regions sketches rcDest with the defaults.
+	SKETCH_REGION rgDefault[1] = { { frame.rcDest, SKETCH_THRESHOLD_DEFAULT, 0, 0, 0 } };
+	const SKETCH_REGION *pRegions = (frame.pRegions != NULL) ? frame.pRegions : rgDefault;
+	const DWORD cRegions = (frame.pRegions != NULL) ? MinDword(frame.cRegions, SKETCH_MAX_REGIONS) : 1;
+
+	for (DWORD i = 0; i < cRegions; i++)
+	{
+		SKETCH_REGION region = pRegions[i];
+
+		region.rc.right = MinDword(region.rc.right, m_dwWidth);
+		region.rc.bottom = MinDword(region.rc.bottom, m_dwHeight);
+		if (region.rc.left < region.rc.right && region.rc.top < region.rc.bottom)
+		{
+			m_rgRegions[m_cRegions++] = region;
+		}
+	}
+}
+
+DWORD CSketchSpans::GetSpans(DWORD y, const SKETCH_SPAN** ppSpans)
+{
+	if (y < m_yFirst || y >= m_yEnd)
+	{
+		ComputeSpans(y);
+	}
+	*ppSpans = m_rgSpans;
+	return m_cSpans;
+}
+
+void CSketchSpans::ComputeSpans(DWORD y)
+{
+	DWORD rgx[2 * SKETCH_MAX_REGIONS];
+	DWORD cx = 0;
+
+	// The spans hold from the last region edge at or above y to the next
+	// one below it.
+	m_yFirst = 0;
+	m_yEnd = m_dwHeight;
+	for (DWORD i = 0; i < m_cRegions; i++)
+	{
+		const SKETCH_RECT& rc = m_rgRegions[i].rc;
+		const DWORD rgEdges[2] = { rc.top, rc.bottom };
+
+		for (DWORD e = 0; e < 2; e++)
+		{
+			if (rgEdges[e] <= y && rgEdges[e] > m_yFirst)
+			{
+				m_yFirst = rgEdges[e];
+			}
+			else if (rgEdges[e] > y && rgEdges[e] < m_yEnd)
+			{
+				m_yEnd = rgEdges[e];
+			}
+		}
+
+		if (rc.top <= y && y < rc.bottom)
+		{
+			rgx[cx++] = rc.left;
+			rgx[cx++] = rc.right;
+		}
+	}
+
+	// Sort the left and right edges of the regions on the line.
+	for (DWORD i = 1; i < cx; i++)
+	{
+		const DWORD x = rgx[i];
+		DWORD j = i;
+		for ( ; j > 0 && rgx[j - 1] > x; j--)
+		{
+			rgx[j] = rgx[j - 1];
+		}
+		rgx[j] = x;
+	}
+
+	// Each piece between two edges goes to the last region covering it.
+	m_cSpans = 0;
+	for (DWORD i = 0; i + 1 < cx; i++)
+	{
+		const DWORD x0 = rgx[i], x1 = rgx[i + 1];
+		const SKETCH_REGION *pOwner = NULL;
+
+		for (DWORD r = m_cRegions; x0 < x1 && r > 0 && pOwner == NULL; r--)
+		{
+			const SKETCH_RECT& rc = m_rgRegions[r - 1].rc;
+			if (rc.top <= y && y < rc.bottom && rc.left <= x0 && x1 <= rc.right)
+			{
+				pOwner = &m_rgRegions[r - 1];
+			}
+		}
+		if (pOwner == NULL)
+		{
+			continue;
+		}
+
+		SKETCH_SPAN *pLast = (m_cSpans > 0) ? &m_rgSpans[m_cSpans - 1] : NULL;
+		if (pLast != NULL && pLast->pRegion == pOwner && pLast->xEnd == x0)
+		{
+			pLast->xEnd = x1;
+		}
+		else
+		{
+			SKETCH_SPAN span = { x0, x1, pOwner };
+			m_rgSpans[m_cSpans++] = span;
+		}
+	}
+}
+
+DWORD CSketchSpans::GetColumns(DWORD yBegin, DWORD yEnd, DWORD dwGrowLeft, DWORD dwGrowRight,
+	SKETCH_COLUMNS rgColumns[SKETCH_MAX_REGIONS]) const
+{
+	DWORD cColumns = 0;
+
+	// Insert each region's columns in order of their first column.
+	for (DWORD i = 0; i < m_cRegions; i++)
+	{
+		const SKETCH_RECT& rc = m_rgRegions[i].rc;
+		if (rc.top >= yEnd || rc.bottom <= yBegin)
+		{
+			continue;
+		}
+
+		SKETCH_COLUMNS columns = { (rc.left > dwGrowLeft) ? rc.left - dwGrowLeft : 0, MinDword(rc.right + dwGrowRight, m_dwWidth) };
+		DWORD j = cColumns++;
+		for ( ; j > 0 && rgColumns[j - 1].xBegin > columns.xBegin; j--)
+		{
+			rgColumns[j] = rgColumns[j - 1];
+		}
+		rgColumns[j] = columns;
+	}
+
+	// Merge the ones that meet.
+	DWORD cMerged = 0;
+	for (DWORD i = 0; i < cColumns; i++)
+	{
+		if (cMerged > 0 && rgColumns[i].xBegin <= rgColumns[cMerged - 1].xEnd)
+		{
+			if (rgColumns[i].xEnd > rgColumns[cMerged - 1].xEnd)
+			{
+				rgColumns[cMerged - 1].xEnd = rgColumns[i].xEnd;
+			}
+		}
+		else
+		{
+			rgColumns[cMerged++] = rgColumns[i];
+		}
+	}
+	return cMerged;
+}
+
+bool CSketchSpans::HasDetector3x3() const
+{
+	for (DWORD i = 0; i < m_cRegions; i++)
+	{
+		if (IsSketchDetector3x3(m_rgRegions[i]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,76 @@
+// Regions of a frame for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHREGIONS_H
+#define SKETCHREGIONS_H
+
+#include "SketchKernels.h"
+
+//
+// The edge detectors work through a frame a line at a time and only touch
+// the pixels its regions cover on that line. CSketchSpans turns the
+// regions (or rcDest, for a frame without any) into those pixels as spans:
+// disjoint, in increasing x, each with the one region whose parameters
+// apply to it. Where regions overlap the span goes to the later region, so
+// no pixel is computed twice; adjacent pieces of one region are one span.
+//
+// The spans of a line only change where a region starts or ends, and are
+// only recomputed there.
+//
+
+// Pixels [xBegin, xEnd) of a line, and the region they belong to.
+struct SKETCH_SPAN
+{
+    DWORD                   xBegin;
+    DWORD                   xEnd;
+    const SKETCH_REGION*    pRegion;
+};
+
+// Whether a region takes one of the 3x3 detectors, which also read the line
+// above and the column left of each pixel. Unknown detectors are Roberts.
+inline bool IsSketchDetector3x3(const SKETCH_REGION& region)
+{
+    return region.bDetector > SKETCH_DETECTOR_ROBERTS && region.bDetector < SKETCH_DETECTOR_COUNT;
+}
+
+// Most spans a line can have.
+#define SKETCH_MAX_SPANS    (2 * SKETCH_MAX_REGIONS)
+
+class CSketchSpans
+{
+public:
+    // Takes a copy of the frame's regions, clipped to the frame.
+    explicit CSketchSpans(const SKETCH_FRAME& frame);
+
+    // The spans of line y. Valid until the next call.
+    DWORD GetSpans(DWORD y, const SKETCH_SPAN** ppSpans);
+
+    // Columns covered by any region on any of lines [yBegin, yEnd), each
+    // region's extended by dwGrowLeft and dwGrowRight columns (within the
+    // frame), merged where they meet. In increasing x; returns how many
+    // there are.
+    DWORD GetColumns(DWORD yBegin, DWORD yEnd, DWORD dwGrowLeft, DWORD dwGrowRight,
+        SKETCH_COLUMNS rgColumns[SKETCH_MAX_REGIONS]) const;
+
+    // Whether any region takes a 3x3 detector.
+    bool HasDetector3x3() const;
+
+private:
+    void ComputeSpans(DWORD y);
+
+    DWORD           m_dwWidth;
+    DWORD           m_dwHeight;
+    SKETCH_REGION   m_rgRegions[SKETCH_MAX_REGIONS];    // Clipped; empty ones dropped.
+    DWORD           m_cRegions;
+
+    SKETCH_SPAN     m_rgSpans[SKETCH_MAX_SPANS];
+    DWORD           m_cSpans;
+    DWORD           m_yFirst;       // Lines the spans hold for.
+    DWORD           m_yEnd;
+};
+
+#endif
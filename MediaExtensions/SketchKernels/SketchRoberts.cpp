@@ -0,0 +1,23 @@
+// Vectorized Roberts cross edge detector.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchRoberts.h"
+#include "SketchRows.h"
+
+// The kernel itself is in SketchRowsImpl.h, built once per instruction set.
+void RobertsRow(
+	_Out_ BYTE* pDest,
+	_In_ ROBERTS_DEST dest,
+	_In_ const BYTE* pRow,
+	_In_ const BYTE* pNext,
+	_In_ DWORD dwSrcStep,
+	_In_ DWORD dwCount,
+	_In_ BYTE bLevel,
+	_In_opt_ const BYTE* pFloor)
+{
+	GetSketchRows()->pfnRobertsRow(pDest, dest, pRow, pNext, dwSrcStep, dwCount, bLevel, pFloor);
+}
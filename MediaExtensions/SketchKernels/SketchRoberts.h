@@ -0,0 +1,62 @@
+// Vectorized Roberts cross edge detector.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHROBERTS_H
+#define SKETCHROBERTS_H
+
+#include "SketchPlatform.h"
+
+// 255 - 26: the grey level of a flat area, see RobertsRow.
+#define ROBERTS_LEVEL 229
+
+// Where RobertsRow writes its results.
+enum ROBERTS_DEST
+{
+    ROBERTS_DEST_LUMA,      // Luma plane (NV12): one byte per pixel.
+    ROBERTS_DEST_YUY2,      // Packed Y C Y C ...: luma then chroma 128.
+    ROBERTS_DEST_UYVY       // Packed C Y C Y ...: chroma 128 then luma.
+};
+
+//
+// RobertsRow runs the Roberts cross detector over dwCount consecutive
+// pixels of a row and maps each gradient to the sketch grey level.
+//
+//  P1  P2
+//  P3  P4
+//
+// pRow, pNext  Luma sample of the first output pixel (P1) in this row and
+//              the row below.
+// dwSrcStep    Distance in bytes between horizontally adjacent luma
+//              samples: 1 for a luma plane, 2 for packed 4:2:2.
+// pDest        First output pixel: its luma byte for ROBERTS_DEST_LUMA and
+//              ROBERTS_DEST_YUY2, its chroma byte for ROBERTS_DEST_UYVY.
+// bLevel       Grey level of a flat area; ROBERTS_LEVEL for the sketch.
+// pFloor       NULL, or dwCount gradients, one per output pixel, that the
+//              luma gradients are raised to before the mapping: the
+//              chroma gradients of a chroma-aware region.
+//
+// The result is bit-exact with the scalar edge loops this replaces. Those
+// combined the two differences through an unparenthesized abs() macro,
+// which expands to
+//
+//   g = (P1 > P4) ? P1 - P4 : |P2 - P3|
+//
+// rather than the sum of both, and then mapped g to 255 - (g*g + 26)
+// saturated at 255, i.e. 229 - g*g saturated at 0. Both steps are kept as they are here, with
+// bLevel in place of 229.
+//
+void RobertsRow(
+    _Out_ BYTE* pDest,
+    _In_ ROBERTS_DEST dest,
+    _In_ const BYTE* pRow,
+    _In_ const BYTE* pNext,
+    _In_ DWORD dwSrcStep,
+    _In_ DWORD dwCount,
+    _In_ BYTE bLevel,
+    _In_opt_ const BYTE* pFloor);
+
+#endif
@@ -0,0 +1,95 @@
+// Per-tier row kernels of the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHROWS_H
+#define SKETCHROWS_H
+
+#include "SketchKernels.h"
+#include "SketchRoberts.h"
+
+//
+// One table of row kernels per instruction set tier. Each table is defined
+// in SketchRows<Tier>.cpp, which is compiled for that tier; a build whose
+// compiler cannot target the tier leaves the table's entries NULL.
+// MedianRow3x3, RobertsRow, the ring's luma deinterleave and pre-filters,
+// the temporal tile comparison, the scaled path's resampling, the RGB
+// path, the chroma gradients and the 3x3 detectors call through
+// GetSketchRows(), which returns the table of the tier in use.
+//
+
+struct SKETCH_ROW_FNS
+{
+    void (*pfnMedianRow3x3)(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD dwStep, DWORD dwCount);
+    void (*pfnRobertsRow)(BYTE* pDest, ROBERTS_DEST dest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD dwCount, BYTE bLevel,
+        const BYTE* pFloor);
+
+    // Copies the luma of dwCount pixels of a packed 4:2:2 row into a dense
+    // row.
+    void (*pfnDeinterleaveLuma)(BYTE* pDest, const BYTE* pSrc, DWORD dwCount);
+
+    // Sum of the absolute differences of cb bytes.
+    UINT64 (*pfnSumAbsDiff)(const BYTE* pA, const BYTE* pB, DWORD cb);
+
+    // Blends two dense rows, (pA*(256-bWeight) + pB*bWeight + 128) >> 8 per
+    // pixel, and stores dwCount pixels as RobertsRow does.
+    void (*pfnLerpRow)(BYTE* pDest, ROBERTS_DEST dest, const BYTE* pA, const BYTE* pB, BYTE bWeight, DWORD dwCount);
+
+    // Doubles a dense row: pDest[2x] blends pSrc[x-1] and pSrc[x] 1:3 and
+    // pDest[2x+1] blends pSrc[x] and pSrc[x+1] 3:1, for x in [0, dwCount).
+    // Reads pSrc[-1] and pSrc[dwCount].
+    void (*pfnUpsampleRow2x)(BYTE* pDest, const BYTE* pSrc, DWORD dwCount);
+
+    // Adds the luma of pixels 2i and 2i+1 of a row to pSums[i], for the
+    // (dwCount+1)/2 pairs; an odd last pixel is added alone. dwSrcStep is
+    // as for RobertsRow.
+    void (*pfnSumPairs)(WORD* pSums, const BYTE* pSrc, DWORD dwSrcStep, DWORD dwCount);
+
+    // Converts dwCount pixels of a YUY2 row, from its first pixel, to dense
+    // R, G and B rows as YUY2toRGB does.
+    void (*pfnYuy2ToRgbRow)(BYTE* pR, BYTE* pG, BYTE* pB, const BYTE* pSrc, DWORD dwCount);
+
+    // The colour Roberts detector of EdgeDectection_YUY2RGB over dwCount
+    // pixels, stored as RobertsRow does for ROBERTS_DEST_YUY2. pRow and
+    // pNext point at the R of the first output pixel in this row and the
+    // row below, with G and B cbPlane and 2*cbPlane bytes on; reads dwCount
+    // + 1 pixels of each.
+    void (*pfnRgbRobertsRow)(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD cbPlane, DWORD dwCount);
+
+    // The chroma gradients of cPairs pixel pairs (see SKETCH_REGION), both
+    // bytes of pDest[2j], pDest[2j+1] for pair j. pRow and pNext point at
+    // the U of the first pair in this chroma row and the next, its V
+    // dwSrcStep bytes on and each pair 2*dwSrcStep bytes after the last;
+    // dwSrcStep is 1 for an NV12 chroma row and 2 for packed 4:2:2. Reads
+    // cPairs + 1 pairs of each.
+    void (*pfnChromaEdgeRow)(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD cPairs);
+
+    // One of the 3x3 detectors (see SKETCH_DETECTOR) over dwCount pixels of
+    // dense rows, stored as RobertsRow does. pAbove, pRow and pBelow point
+    // at the first output pixel in the rows above, at and below it; reads
+    // pixels -1 to dwCount of each. pFloor is as for RobertsRow.
+    void (*pfnEdgeRow3x3)(BYTE* pDest, ROBERTS_DEST dest, SKETCH_DETECTOR detector, const BYTE* pAbove, const BYTE* pRow,
+        const BYTE* pBelow, DWORD dwCount, BYTE bLevel, const BYTE* pFloor);
+
+    // One of the pre-filters (see SKETCH_PREFILTER) over dwCount pixels of
+    // dense rows, into pDest. rgpRows[i] points at the first output pixel
+    // in row i-2 from it; the 3x3 filters read rgpRows[1] to rgpRows[3],
+    // pixels -1 to dwCount of each, and Median5 all five, pixels -2 to
+    // dwCount+1. SKETCH_PREFILTER_NONE copies the middle row.
+    void (*pfnPrefilterRow)(BYTE* pDest, SKETCH_PREFILTER prefilter, const BYTE* const rgpRows[5], DWORD dwCount);
+};
+
+extern const SKETCH_ROW_FNS g_SketchRowsScalar;
+extern const SKETCH_ROW_FNS g_SketchRowsSSE2;
+extern const SKETCH_ROW_FNS g_SketchRowsSSSE3;
+extern const SKETCH_ROW_FNS g_SketchRowsAVX2;
+extern const SKETCH_ROW_FNS g_SketchRowsAVX512;
+extern const SKETCH_ROW_FNS g_SketchRowsNEON;
+
+// The table of the tier in use (see SketchCpu.h).
+const SKETCH_ROW_FNS* GetSketchRows();
+
+#endif
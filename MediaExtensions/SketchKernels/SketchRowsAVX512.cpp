@@ -0,0 +1,14 @@
+// Row kernels of the sketch kernels: AVX-512.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchRowsImpl.h"
+
+#if defined(SKETCH_SIMD_AVX512)
+extern const SKETCH_ROW_FNS g_SketchRowsAVX512 = SKETCH_ROW_FNS_OF(SimdAVX512);
+#else
+extern const SKETCH_ROW_FNS g_SketchRowsAVX512 = SKETCH_ROW_FNS_NONE;
+#endif
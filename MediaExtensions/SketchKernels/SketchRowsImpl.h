@@ -0,0 +1,963 @@
+// Row kernels of the sketch kernels, for one instruction set.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHROWSIMPL_H
+#define SKETCHROWSIMPL_H
+
+#include "SketchRows.h"
+#include "SketchSimd.h"
+
+#include <stddef.h>
+#include <string.h>
+
+//
+// Included only by the SketchRows<Tier>.cpp files, which instantiate the
+// kernels on their tier's Simd* struct and export them through
+// SKETCH_ROW_FNS_OF. Everything is in an unnamed namespace, as SketchSimd.h
+// is: each tier compiles it with different flags, and the linker must not
+// pick one tier's copy of a shared helper for another.
+//
+
+namespace
+{
+
+template <class S, DWORD STEP>
+inline typename S::V LoadLuma(const BYTE* p)
+{
+	return (STEP == 1) ? S::Load(p) : S::LoadEven(p);
+}
+
+//-------------------------------------------------------------------
+// 3x3 median.
+//
+// The median of nine is taken from sorted columns. Each 3-pixel column is
+// sorted once (three exchanges) and the median of a 3x3 window is
+//
+//   med3(max of the column minima, med3 of the column medians,
+//        min of the column maxima)
+//
+// Adjacent windows share two of their three columns, so a row only sorts
+// every column once: the sorted columns for a vector of outputs are kept
+// and shifted by one lane (AlignPrev/AlignNext) to get the left and right
+// neighbours of the next vector. Everything is min/max, so there are no
+// data-dependent branches and each lane gets the exact median, the value
+// the quickselect in GetMedian returns.
+//-------------------------------------------------------------------
+
+template <class S>
+struct SortedColumns
+{
+	typename S::V lo, mid, hi;
+};
+
+template <class S>
+inline void SortPair(typename S::V& a, typename S::V& b)
+{
+	typename S::V t = S::Min(a, b);
+	b = S::Max(a, b);
+	a = t;
+}
+
+template <class S>
+inline typename S::V Median3(typename S::V a, typename S::V b, typename S::V c)
+{
+	return S::Max(S::Min(a, b), S::Min(S::Max(a, b), c));
+}
+
+template <class S, DWORD STEP>
+inline SortedColumns<S> SortColumns(const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow)
+{
+	SortedColumns<S> c;
+	c.lo  = LoadLuma<S, STEP>(pAbove);
+	c.mid = LoadLuma<S, STEP>(pRow);
+	c.hi  = LoadLuma<S, STEP>(pBelow);
+
+	SortPair<S>(c.lo, c.mid);
+	SortPair<S>(c.mid, c.hi);
+	SortPair<S>(c.lo, c.mid);
+	return c;
+}
+
+template <class S>
+inline typename S::V MergeColumns(const SortedColumns<S>& l, const SortedColumns<S>& c, const SortedColumns<S>& r)
+{
+	typename S::V lo  = S::Max(S::Max(l.lo, c.lo), r.lo);
+	typename S::V hi  = S::Min(S::Min(l.hi, c.hi), r.hi);
+	typename S::V mid = Median3<S>(l.mid, c.mid, r.mid);
+	return Median3<S>(lo, mid, hi);
+}
+
+template <class S>
+inline SortedColumns<S> AlignNext(const SortedColumns<S>& cur, const SortedColumns<S>& next)
+{
+	SortedColumns<S> r;
+	r.lo  = S::AlignNext(cur.lo, next.lo);
+	r.mid = S::AlignNext(cur.mid, next.mid);
+	r.hi  = S::AlignNext(cur.hi, next.hi);
+	return r;
+}
+
+template <class S>
+inline SortedColumns<S> AlignPrev(const SortedColumns<S>& prev, const SortedColumns<S>& cur)
+{
+	SortedColumns<S> r;
+	r.lo  = S::AlignPrev(prev.lo, cur.lo);
+	r.mid = S::AlignPrev(prev.mid, cur.mid);
+	r.hi  = S::AlignPrev(prev.hi, cur.hi);
+	return r;
+}
+
+template <class S, DWORD STEP>
+DWORD MedianRowT(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD x, DWORD dwCount)
+{
+	// For packed rows a vector LoadEven reads one byte past the last luma
+	// sample, so keep one extra pixel of margin there.
+	const DWORD dwMargin = (S::Lanes > 1) ? STEP - 1 : 0;
+
+	if (x + S::Lanes + dwMargin > dwCount)
+	{
+		return x;
+	}
+
+	// Columns x-1.. and x.. for the first vector.
+	SortedColumns<S> left = SortColumns<S, STEP>(pAbove + x * STEP - STEP, pRow + x * STEP - STEP, pBelow + x * STEP - STEP);
+	SortedColumns<S> cur  = SortColumns<S, STEP>(pAbove + x * STEP, pRow + x * STEP, pBelow + x * STEP);
+
+	for (;;)
+	{
+		const DWORD xNext = x + S::Lanes;
+		SortedColumns<S> next, right;
+
+		if (xNext + S::Lanes + dwMargin <= dwCount)
+		{
+			// The next vector is loaded anyway; the right neighbours are its
+			// columns shifted in by one lane.
+			next  = SortColumns<S, STEP>(pAbove + xNext * STEP, pRow + xNext * STEP, pBelow + xNext * STEP);
+			right = AlignNext<S>(cur, next);
+		}
+		else
+		{
+			right = SortColumns<S, STEP>(pAbove + x * STEP + STEP, pRow + x * STEP + STEP, pBelow + x * STEP + STEP);
+		}
+
+		S::Store(pDest + x, MergeColumns<S>(left, cur, right));
+
+		x = xNext;
+		if (x + S::Lanes + dwMargin > dwCount)
+		{
+			break;
+		}
+		left = AlignPrev<S>(cur, next);
+		cur  = next;
+	}
+	return x;
+}
+
+template <class S, DWORD STEP>
+void MedianRow(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD dwCount)
+{
+	DWORD x = MedianRowT<S, STEP>(pDest, pAbove, pRow, pBelow, 0, dwCount);
+
+	// Remaining pixels, one lane at a time through the same code.
+	MedianRowT<SimdScalar, STEP>(pDest, pAbove, pRow, pBelow, x, dwCount);
+}
+
+template <class S>
+void MedianRowTier(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD dwStep, DWORD dwCount)
+{
+	if (dwStep == 1)
+	{
+		MedianRow<S, 1>(pDest, pAbove, pRow, pBelow, dwCount);
+	}
+	else
+	{
+		MedianRow<S, 2>(pDest, pAbove, pRow, pBelow, dwCount);
+	}
+}
+
+//-------------------------------------------------------------------
+// Roberts cross.
+//-------------------------------------------------------------------
+
+// FLOOR raises each gradient to pFloor[x] first.
+template <class S, ROBERTS_DEST DEST, DWORD STEP, bool FLOOR>
+DWORD RobertsRowT(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD x, DWORD dwCount, BYTE bLevel, const BYTE* pFloor)
+{
+	// A vector LoadEven reads one byte past the last luma sample.
+	const DWORD dwMargin = (S::Lanes > 1) ? STEP - 1 : 0;
+
+	for ( ; x + S::Lanes + dwMargin <= dwCount; x += S::Lanes)
+	{
+		const DWORD o = x * STEP;
+
+		typename S::V p1 = LoadLuma<S, STEP>(pRow + o);
+		typename S::V p2 = LoadLuma<S, STEP>(pRow + o + STEP);
+		typename S::V p3 = LoadLuma<S, STEP>(pNext + o);
+		typename S::V p4 = LoadLuma<S, STEP>(pNext + o + STEP);
+
+		// P1 - P4 where P1 > P4, otherwise |P2 - P3|.
+		typename S::V d14 = S::SubSat(p1, p4);
+		typename S::V d23 = S::Or(S::SubSat(p2, p3), S::SubSat(p3, p2));
+		typename S::V g   = S::Or(d14, S::And(S::IsZero(d14), d23));
+
+		if (FLOOR)
+		{
+			g = S::Max(g, S::Load(pFloor + x));
+		}
+
+		typename S::V v = S::SubSquareSat(bLevel, g);
+
+		if (DEST == ROBERTS_DEST_LUMA)
+		{
+			S::Store(pDest + x, v);
+		}
+		else if (DEST == ROBERTS_DEST_YUY2)
+		{
+			S::StoreEven(pDest + 2 * x, v, 128);
+		}
+		else
+		{
+			S::StoreOdd(pDest + 2 * x, v, 128);
+		}
+	}
+	return x;
+}
+
+template <class S, ROBERTS_DEST DEST, DWORD STEP, bool FLOOR>
+void RobertsRowDispatch(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwCount, BYTE bLevel, const BYTE* pFloor)
+{
+	DWORD x = RobertsRowT<S, DEST, STEP, FLOOR>(pDest, pRow, pNext, 0, dwCount, bLevel, pFloor);
+	RobertsRowT<SimdScalar, DEST, STEP, FLOOR>(pDest, pRow, pNext, x, dwCount, bLevel, pFloor);
+}
+
+template <class S, ROBERTS_DEST DEST, DWORD STEP>
+void RobertsRowFloor(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwCount, BYTE bLevel, const BYTE* pFloor)
+{
+	if (pFloor == NULL)
+	{
+		RobertsRowDispatch<S, DEST, STEP, false>(pDest, pRow, pNext, dwCount, bLevel, NULL);
+	}
+	else
+	{
+		RobertsRowDispatch<S, DEST, STEP, true>(pDest, pRow, pNext, dwCount, bLevel, pFloor);
+	}
+}
+
+template <class S, ROBERTS_DEST DEST>
+void RobertsRowDest(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD dwCount, BYTE bLevel,
+	const BYTE* pFloor)
+{
+	if (dwSrcStep == 1)
+	{
+		RobertsRowFloor<S, DEST, 1>(pDest, pRow, pNext, dwCount, bLevel, pFloor);
+	}
+	else
+	{
+		RobertsRowFloor<S, DEST, 2>(pDest, pRow, pNext, dwCount, bLevel, pFloor);
+	}
+}
+
+template <class S>
+void RobertsRowTier(BYTE* pDest, ROBERTS_DEST dest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD dwCount,
+	BYTE bLevel, const BYTE* pFloor)
+{
+	switch (dest)
+	{
+	case ROBERTS_DEST_LUMA:
+		RobertsRowDest<S, ROBERTS_DEST_LUMA>(pDest, pRow, pNext, dwSrcStep, dwCount, bLevel, pFloor);
+		break;
+
+	case ROBERTS_DEST_YUY2:
+		RobertsRowDest<S, ROBERTS_DEST_YUY2>(pDest, pRow, pNext, dwSrcStep, dwCount, bLevel, pFloor);
+		break;
+
+	case ROBERTS_DEST_UYVY:
+		RobertsRowDest<S, ROBERTS_DEST_UYVY>(pDest, pRow, pNext, dwSrcStep, dwCount, bLevel, pFloor);
+		break;
+	}
+}
+
+//-------------------------------------------------------------------
+// Luma deinterleave.
+//-------------------------------------------------------------------
+
+template <class S>
+DWORD DeinterleaveLumaT(BYTE* pDest, const BYTE* pSrc, DWORD x, DWORD dwCount)
+{
+	// LoadEven reads one byte past its last sample; keep a pixel of margin.
+	const DWORD dwMargin = (S::Lanes > 1) ? 1 : 0;
+
+	for ( ; x + S::Lanes + dwMargin <= dwCount; x += S::Lanes)
+	{
+		S::Store(pDest + x, S::LoadEven(pSrc + 2 * x));
+	}
+	return x;
+}
+
+template <class S>
+void DeinterleaveLumaTier(BYTE* pDest, const BYTE* pSrc, DWORD dwCount)
+{
+	DWORD x = DeinterleaveLumaT<S>(pDest, pSrc, 0, dwCount);
+	DeinterleaveLumaT<SimdScalar>(pDest, pSrc, x, dwCount);
+}
+
+//-------------------------------------------------------------------
+// Sum of absolute differences.
+//-------------------------------------------------------------------
+
+template <class S>
+UINT64 SumAbsDiffTier(const BYTE* pA, const BYTE* pB, DWORD cb)
+{
+	UINT64 ullSum = 0;
+	DWORD i = 0;
+
+	for ( ; i + S::Lanes <= cb; i += S::Lanes)
+	{
+		ullSum += S::SumAbsDiff(S::Load(pA + i), S::Load(pB + i));
+	}
+	for ( ; i < cb; i++)
+	{
+		ullSum += SimdScalar::SumAbsDiff(pA[i], pB[i]);
+	}
+	return ullSum;
+}
+
+//-------------------------------------------------------------------
+// Bilinear upsampling.
+//-------------------------------------------------------------------
+
+template <class S, ROBERTS_DEST DEST>
+DWORD LerpRowT(BYTE* pDest, const BYTE* pA, const BYTE* pB, BYTE bWeight, DWORD x, DWORD dwCount)
+{
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V v = S::Lerp(S::Load(pA + x), S::Load(pB + x), bWeight);
+
+		if (DEST == ROBERTS_DEST_LUMA)
+		{
+			S::Store(pDest + x, v);
+		}
+		else if (DEST == ROBERTS_DEST_YUY2)
+		{
+			S::StoreEven(pDest + 2 * x, v, 128);
+		}
+		else
+		{
+			S::StoreOdd(pDest + 2 * x, v, 128);
+		}
+	}
+	return x;
+}
+
+template <class S, ROBERTS_DEST DEST>
+void LerpRowDest(BYTE* pDest, const BYTE* pA, const BYTE* pB, BYTE bWeight, DWORD dwCount)
+{
+	DWORD x = LerpRowT<S, DEST>(pDest, pA, pB, bWeight, 0, dwCount);
+	LerpRowT<SimdScalar, DEST>(pDest, pA, pB, bWeight, x, dwCount);
+}
+
+template <class S>
+void LerpRowTier(BYTE* pDest, ROBERTS_DEST dest, const BYTE* pA, const BYTE* pB, BYTE bWeight, DWORD dwCount)
+{
+	switch (dest)
+	{
+	case ROBERTS_DEST_LUMA:
+		LerpRowDest<S, ROBERTS_DEST_LUMA>(pDest, pA, pB, bWeight, dwCount);
+		break;
+
+	case ROBERTS_DEST_YUY2:
+		LerpRowDest<S, ROBERTS_DEST_YUY2>(pDest, pA, pB, bWeight, dwCount);
+		break;
+
+	case ROBERTS_DEST_UYVY:
+		LerpRowDest<S, ROBERTS_DEST_UYVY>(pDest, pA, pB, bWeight, dwCount);
+		break;
+	}
+}
+
+template <class S>
+DWORD UpsampleRow2xT(BYTE* pDest, const BYTE* pSrc, DWORD x, DWORD dwCount)
+{
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V prev = S::Load(pSrc + x - 1);
+		typename S::V cur  = S::Load(pSrc + x);
+		typename S::V next = S::Load(pSrc + x + 1);
+
+		// Output pixels 2x and 2x+1 sit a quarter of a source pixel either
+		// side of source pixel x.
+		S::StoreZip(pDest + 2 * x, S::Lerp(prev, cur, 192), S::Lerp(cur, next, 64));
+	}
+	return x;
+}
+
+template <class S>
+void UpsampleRow2xTier(BYTE* pDest, const BYTE* pSrc, DWORD dwCount)
+{
+	DWORD x = UpsampleRow2xT<S>(pDest, pSrc, 0, dwCount);
+	UpsampleRow2xT<SimdScalar>(pDest, pSrc, x, dwCount);
+}
+
+//-------------------------------------------------------------------
+// Box downsampling.
+//-------------------------------------------------------------------
+
+template <class S, DWORD STEP>
+DWORD SumPairsT(WORD* pSums, const BYTE* pSrc, DWORD x, DWORD dwCount)
+{
+	// A vector LoadEven reads one byte past the last luma sample.
+	const DWORD dwMargin = (S::Lanes > 1) ? STEP - 1 : 0;
+
+	for ( ; x + 2 * S::Lanes + dwMargin <= dwCount; x += 2 * S::Lanes)
+	{
+		S::AccumulatePairs(pSums + x / 2, LoadLuma<S, STEP>(pSrc + x * STEP), LoadLuma<S, STEP>(pSrc + (x + S::Lanes) * STEP));
+	}
+	return x;
+}
+
+template <class S, DWORD STEP>
+void SumPairs(WORD* pSums, const BYTE* pSrc, DWORD dwCount)
+{
+	DWORD x = SumPairsT<S, STEP>(pSums, pSrc, 0, dwCount);
+	x = SumPairsT<SimdScalar, STEP>(pSums, pSrc, x, dwCount);
+
+	// An odd last pixel has no partner.
+	if (x < dwCount)
+	{
+		pSums[x / 2] = (WORD)(pSums[x / 2] + pSrc[x * STEP]);
+	}
+}
+
+template <class S>
+void SumPairsTier(WORD* pSums, const BYTE* pSrc, DWORD dwSrcStep, DWORD dwCount)
+{
+	if (dwSrcStep == 1)
+	{
+		SumPairs<S, 1>(pSums, pSrc, dwCount);
+	}
+	else
+	{
+		SumPairs<S, 2>(pSums, pSrc, dwCount);
+	}
+}
+
+//-------------------------------------------------------------------
+// YUY2 to RGB.
+//
+// Only the first pixel of each pair gets the pair's chroma; the second
+// keeps its luma in all three colours. A sum below 0 ends up above 255
+// (the kernel kept it in a DWORD), so both saturate to 255.
+//-------------------------------------------------------------------
+
+inline BYTE RgbSaturate(int val)
+{
+	return (val < 0 || val > 255) ? 255 : (BYTE)val;
+}
+
+inline void Yuy2ToRgbPixels(BYTE* pR, BYTE* pG, BYTE* pB, const BYTE* pSrc, DWORD x, DWORD dwCount)
+{
+	for ( ; x < dwCount; x++)
+	{
+		int rdif = 0, invdif = 0, bdif = 0;
+		if ((x & 1) == 0)
+		{
+			const int U = pSrc[2 * x + 1] - 128;
+			const int V = pSrc[2 * x + 3] - 128;
+			rdif = V + ((V * 103) >> 8);
+			invdif = ((U * 88) >> 8) + ((V * 183) >> 8);
+			bdif = U + ((U * 198) >> 8);
+		}
+
+		const int Y = pSrc[2 * x];
+		pR[x] = RgbSaturate(Y + rdif);
+		pG[x] = RgbSaturate(Y - invdif);
+		pB[x] = RgbSaturate(Y + bdif);
+	}
+}
+
+template <class S>
+DWORD Yuy2ToRgbRowT(BYTE* pR, BYTE* pG, BYTE* pB, const BYTE* pSrc, DWORD x, DWORD dwCount)
+{
+	// Lanes is even, so every vector starts a pair.
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V r, g, b;
+		S::Yuy2ToRgb(pSrc + 2 * x, r, g, b);
+		S::Store(pR + x, r);
+		S::Store(pG + x, g);
+		S::Store(pB + x, b);
+	}
+	return x;
+}
+
+template <class S>
+void Yuy2ToRgbRowTier(BYTE* pR, BYTE* pG, BYTE* pB, const BYTE* pSrc, DWORD dwCount)
+{
+	DWORD x = Yuy2ToRgbRowT<S>(pR, pG, pB, pSrc, 0, dwCount);
+	Yuy2ToRgbPixels(pR, pG, pB, pSrc, x, dwCount);
+}
+
+// SimdScalar has no Yuy2ToRgb. Inline, so the tiers that do not use it do
+// not warn.
+template <>
+inline void Yuy2ToRgbRowTier<SimdScalar>(BYTE* pR, BYTE* pG, BYTE* pB, const BYTE* pSrc, DWORD dwCount)
+{
+	Yuy2ToRgbPixels(pR, pG, pB, pSrc, 0, dwCount);
+}
+
+//-------------------------------------------------------------------
+// Colour Roberts cross.
+//
+// Each colour adds |P1 - P4| + |P2 - P3| as the kernel wrote it, through
+// the unparenthesized abs() macro: P1 - P4 where P1 > P4, |P2 - P3| where
+// they are equal, and the signed P2 - P3 where P1 < P4. The term is split
+// into a positive and a negative byte so the three colours can be summed
+// at 16 bits; a sum outside [0, 255] gives 255.
+//-------------------------------------------------------------------
+
+template <class S>
+DWORD RgbRobertsRowT(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD cbPlane, DWORD x, DWORD dwCount)
+{
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V pos[3], neg[3];
+
+		for (DWORD c = 0; c < 3; c++)
+		{
+			const BYTE* pC = pRow + c * cbPlane + x;
+			const BYTE* pN = pNext + c * cbPlane + x;
+
+			typename S::V p1 = S::Load(pC);
+			typename S::V p2 = S::Load(pC + 1);
+			typename S::V p3 = S::Load(pN);
+			typename S::V p4 = S::Load(pN + 1);
+
+			typename S::V d14 = S::SubSat(p1, p4);
+			typename S::V d23 = S::SubSat(p2, p3);
+			typename S::V d32 = S::SubSat(p3, p2);
+			typename S::V z41 = S::IsZero(S::SubSat(p4, p1));
+
+			pos[c] = S::Or(d14, S::And(S::IsZero(d14), S::Or(d23, S::And(z41, d32))));
+			neg[c] = S::SubSat(d32, z41);
+		}
+		S::StoreEven(pDest + 2 * x, S::SumDiff3(pos, neg), 128);
+	}
+	return x;
+}
+
+template <class S>
+void RgbRobertsRowTier(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD cbPlane, DWORD dwCount)
+{
+	DWORD x = RgbRobertsRowT<S>(pDest, pRow, pNext, cbPlane, 0, dwCount);
+	RgbRobertsRowT<SimdScalar>(pDest, pRow, pNext, cbPlane, x, dwCount);
+}
+
+//-------------------------------------------------------------------
+// Chroma gradients.
+//
+// The chroma samples of a row, U V U V ..., are taken as one sequence c;
+// d[k] = max(|c[k] - c'[k+2]|, |c[k+2] - c'[k]|) over this row c and the
+// next c' is the Roberts cross of the component of sample k, and a pair's
+// gradient is the larger of its U's and its V's. Vectors start on a pair,
+// so SwapPairs lines each U up with its V.
+//-------------------------------------------------------------------
+
+inline BYTE ChromaAbsDiff(BYTE a, BYTE b)
+{
+	return (a > b) ? (BYTE)(a - b) : (BYTE)(b - a);
+}
+
+inline void ChromaEdgePairs(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD j, DWORD cPairs)
+{
+	for ( ; j < cPairs; j++)
+	{
+		BYTE g = 0;
+		for (DWORD k = 2 * j; k < 2 * j + 2; k++)
+		{
+			const BYTE d14 = ChromaAbsDiff(pRow[k * dwSrcStep], pNext[(k + 2) * dwSrcStep]);
+			const BYTE d23 = ChromaAbsDiff(pRow[(k + 2) * dwSrcStep], pNext[k * dwSrcStep]);
+			g = (d14 > g) ? d14 : g;
+			g = (d23 > g) ? d23 : g;
+		}
+		pDest[2 * j] = g;
+		pDest[2 * j + 1] = g;
+	}
+}
+
+template <class S, DWORD STEP>
+DWORD ChromaEdgeRowT(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD cPairs)
+{
+	// k counts samples, two per pair. A vector LoadEven reads one byte past
+	// its last sample.
+	const DWORD cSamples = 2 * cPairs;
+	const DWORD dwMargin = STEP - 1;
+	DWORD k = 0;
+
+	for ( ; k + S::Lanes + dwMargin <= cSamples; k += S::Lanes)
+	{
+		typename S::V p1 = LoadLuma<S, STEP>(pRow + k * STEP);
+		typename S::V p2 = LoadLuma<S, STEP>(pRow + (k + 2) * STEP);
+		typename S::V p3 = LoadLuma<S, STEP>(pNext + k * STEP);
+		typename S::V p4 = LoadLuma<S, STEP>(pNext + (k + 2) * STEP);
+
+		typename S::V d = S::Max(S::Or(S::SubSat(p1, p4), S::SubSat(p4, p1)), S::Or(S::SubSat(p2, p3), S::SubSat(p3, p2)));
+		S::Store(pDest + k, S::Max(d, S::SwapPairs(d)));
+	}
+	return k / 2;
+}
+
+template <class S>
+void ChromaEdgeRowTier(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD cPairs)
+{
+	const DWORD j = (dwSrcStep == 1) ? ChromaEdgeRowT<S, 1>(pDest, pRow, pNext, cPairs) : ChromaEdgeRowT<S, 2>(pDest, pRow, pNext, cPairs);
+	ChromaEdgePairs(pDest, pRow, pNext, dwSrcStep, j, cPairs);
+}
+
+// SimdScalar has no SwapPairs.
+template <>
+inline void ChromaEdgeRowTier<SimdScalar>(BYTE* pDest, const BYTE* pRow, const BYTE* pNext, DWORD dwSrcStep, DWORD cPairs)
+{
+	ChromaEdgePairs(pDest, pRow, pNext, dwSrcStep, 0, cPairs);
+}
+
+//-------------------------------------------------------------------
+// 3x3 detectors.
+//
+// The nine neighbours of a vector of pixels are three unaligned loads from
+// each of the dense rows; the gradients are taken at 16 bits and then
+// mapped as Roberts' are.
+//-------------------------------------------------------------------
+
+template <class S, SKETCH_DETECTOR DETECTOR>
+inline typename S::V Gradient3x3(const typename S::V* p)
+{
+	if (DETECTOR == SKETCH_DETECTOR_SOBEL)
+	{
+		return S::template Derivative3x3<1, 2, 2>(p);
+	}
+	else if (DETECTOR == SKETCH_DETECTOR_SCHARR)
+	{
+		return S::template Derivative3x3<3, 10, 4>(p);
+	}
+	return S::Laplacian3x3(p);
+}
+
+template <class S, ROBERTS_DEST DEST, SKETCH_DETECTOR DETECTOR, bool FLOOR>
+DWORD EdgeRow3x3T(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD x, DWORD dwCount, BYTE bLevel,
+	const BYTE* pFloor)
+{
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V p[9];
+		for (DWORD i = 0; i < 3; i++)
+		{
+			p[i]     = S::Load(pAbove + x + i - 1);
+			p[i + 3] = S::Load(pRow + x + i - 1);
+			p[i + 6] = S::Load(pBelow + x + i - 1);
+		}
+
+		typename S::V g = Gradient3x3<S, DETECTOR>(p);
+
+		if (FLOOR)
+		{
+			g = S::Max(g, S::Load(pFloor + x));
+		}
+
+		typename S::V v = S::SubSquareSat(bLevel, g);
+
+		if (DEST == ROBERTS_DEST_LUMA)
+		{
+			S::Store(pDest + x, v);
+		}
+		else if (DEST == ROBERTS_DEST_YUY2)
+		{
+			S::StoreEven(pDest + 2 * x, v, 128);
+		}
+		else
+		{
+			S::StoreOdd(pDest + 2 * x, v, 128);
+		}
+	}
+	return x;
+}
+
+template <class S, ROBERTS_DEST DEST, SKETCH_DETECTOR DETECTOR>
+void EdgeRow3x3Floor(BYTE* pDest, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, DWORD dwCount, BYTE bLevel,
+	const BYTE* pFloor)
+{
+	if (pFloor == NULL)
+	{
+		DWORD x = EdgeRow3x3T<S, DEST, DETECTOR, false>(pDest, pAbove, pRow, pBelow, 0, dwCount, bLevel, NULL);
+		EdgeRow3x3T<SimdScalar, DEST, DETECTOR, false>(pDest, pAbove, pRow, pBelow, x, dwCount, bLevel, NULL);
+	}
+	else
+	{
+		DWORD x = EdgeRow3x3T<S, DEST, DETECTOR, true>(pDest, pAbove, pRow, pBelow, 0, dwCount, bLevel, pFloor);
+		EdgeRow3x3T<SimdScalar, DEST, DETECTOR, true>(pDest, pAbove, pRow, pBelow, x, dwCount, bLevel, pFloor);
+	}
+}
+
+template <class S, ROBERTS_DEST DEST>
+void EdgeRow3x3Dest(BYTE* pDest, SKETCH_DETECTOR detector, const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow,
+	DWORD dwCount, BYTE bLevel, const BYTE* pFloor)
+{
+	switch (detector)
+	{
+	case SKETCH_DETECTOR_SOBEL:
+		EdgeRow3x3Floor<S, DEST, SKETCH_DETECTOR_SOBEL>(pDest, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+
+	case SKETCH_DETECTOR_SCHARR:
+		EdgeRow3x3Floor<S, DEST, SKETCH_DETECTOR_SCHARR>(pDest, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+
+	default:
+		EdgeRow3x3Floor<S, DEST, SKETCH_DETECTOR_LAPLACIAN>(pDest, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+	}
+}
+
+template <class S>
+void EdgeRow3x3Tier(BYTE* pDest, ROBERTS_DEST dest, SKETCH_DETECTOR detector, const BYTE* pAbove, const BYTE* pRow,
+	const BYTE* pBelow, DWORD dwCount, BYTE bLevel, const BYTE* pFloor)
+{
+	switch (dest)
+	{
+	case ROBERTS_DEST_LUMA:
+		EdgeRow3x3Dest<S, ROBERTS_DEST_LUMA>(pDest, detector, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+
+	case ROBERTS_DEST_YUY2:
+		EdgeRow3x3Dest<S, ROBERTS_DEST_YUY2>(pDest, detector, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+
+	case ROBERTS_DEST_UYVY:
+		EdgeRow3x3Dest<S, ROBERTS_DEST_UYVY>(pDest, detector, pAbove, pRow, pBelow, dwCount, bLevel, pFloor);
+		break;
+	}
+}
+
+//-------------------------------------------------------------------
+// Pre-filters.
+//
+// Binomial3 is separable: each column of a vector is filtered down the
+// three rows once, and the pass along the row takes the columns either
+// side from the vectors before and after it (AlignPrev/AlignNext), as the
+// median's sorted columns are. Box3x3 does the same with the sums of the
+// columns, which take two bytes each: Sum3 keeps them as a vector of low
+// bytes and one of high bytes, which move along the row as the pixels do,
+// and Box3 adds the three of each pixel at 16 bits.
+//
+// Median5 loads the 25 samples of each lane and runs them through a fixed
+// selection network of 99 exchanges (Median25). Like the 3x3 median it is
+// all min/max, exact in every lane.
+//-------------------------------------------------------------------
+
+// The columns from pAbove, pRow and pBelow on, filtered down the rows.
+template <class S>
+inline typename S::V BinomialColumns(const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow)
+{
+	return S::Binomial3(S::Load(pAbove), S::Load(pRow), S::Load(pBelow));
+}
+
+template <class S>
+DWORD BinomialRowT(BYTE* pDest, const BYTE* const rgpRows[5], DWORD x, DWORD dwCount)
+{
+	const BYTE* pAbove = rgpRows[1];
+	const BYTE* pRow   = rgpRows[2];
+	const BYTE* pBelow = rgpRows[3];
+
+	if (x + S::Lanes > dwCount)
+	{
+		return x;
+	}
+
+	// Columns x-1.. and x.. for the first vector.
+	typename S::V left = BinomialColumns<S>(pAbove + x - 1, pRow + x - 1, pBelow + x - 1);
+	typename S::V cur  = BinomialColumns<S>(pAbove + x, pRow + x, pBelow + x);
+
+	for (;;)
+	{
+		const DWORD xNext = x + S::Lanes;
+		typename S::V next, right;
+
+		if (xNext + S::Lanes <= dwCount)
+		{
+			next  = BinomialColumns<S>(pAbove + xNext, pRow + xNext, pBelow + xNext);
+			right = S::AlignNext(cur, next);
+		}
+		else
+		{
+			right = BinomialColumns<S>(pAbove + x + 1, pRow + x + 1, pBelow + x + 1);
+		}
+
+		S::Store(pDest + x, S::Binomial3(left, cur, right));
+
+		x = xNext;
+		if (x + S::Lanes > dwCount)
+		{
+			break;
+		}
+		left = S::AlignPrev(cur, next);
+		cur  = next;
+	}
+	return x;
+}
+
+// The sums of the columns from pAbove, pRow and pBelow on, as low and high
+// bytes.
+template <class S>
+inline void BoxColumns(const BYTE* pAbove, const BYTE* pRow, const BYTE* pBelow, typename S::V& lo, typename S::V& hi)
+{
+	S::Sum3(S::Load(pAbove), S::Load(pRow), S::Load(pBelow), lo, hi);
+}
+
+template <class S>
+DWORD BoxRowT(BYTE* pDest, const BYTE* const rgpRows[5], DWORD x, DWORD dwCount)
+{
+	const BYTE* pAbove = rgpRows[1];
+	const BYTE* pRow   = rgpRows[2];
+	const BYTE* pBelow = rgpRows[3];
+
+	if (x + S::Lanes > dwCount)
+	{
+		return x;
+	}
+
+	// Left, centre and right column sums of the vector at x.
+	typename S::V lo[3], hi[3];
+	BoxColumns<S>(pAbove + x - 1, pRow + x - 1, pBelow + x - 1, lo[0], hi[0]);
+	BoxColumns<S>(pAbove + x, pRow + x, pBelow + x, lo[1], hi[1]);
+
+	for (;;)
+	{
+		const DWORD xNext = x + S::Lanes;
+		typename S::V nextLo, nextHi;
+
+		if (xNext + S::Lanes <= dwCount)
+		{
+			BoxColumns<S>(pAbove + xNext, pRow + xNext, pBelow + xNext, nextLo, nextHi);
+			lo[2] = S::AlignNext(lo[1], nextLo);
+			hi[2] = S::AlignNext(hi[1], nextHi);
+		}
+		else
+		{
+			BoxColumns<S>(pAbove + x + 1, pRow + x + 1, pBelow + x + 1, lo[2], hi[2]);
+		}
+
+		S::Store(pDest + x, S::Box3(lo, hi));
+
+		x = xNext;
+		if (x + S::Lanes > dwCount)
+		{
+			break;
+		}
+		lo[0] = S::AlignPrev(lo[1], nextLo);
+		hi[0] = S::AlignPrev(hi[1], nextHi);
+		lo[1] = nextLo;
+		hi[1] = nextHi;
+	}
+	return x;
+}
+
+// Median of the 25 samples of p, which it scrambles: a fixed network of 99
+// exchanges (Devillard's opt_med25), most of them independent of each
+// other. The compiler drops the half of each whose result is never read.
+template <class S>
+inline typename S::V Median25(typename S::V* p)
+{
+	SortPair<S>(p[0], p[1]); SortPair<S>(p[3], p[4]); SortPair<S>(p[2], p[4]); SortPair<S>(p[2], p[3]);
+	SortPair<S>(p[6], p[7]); SortPair<S>(p[5], p[7]); SortPair<S>(p[5], p[6]); SortPair<S>(p[9], p[10]);
+	SortPair<S>(p[8], p[10]); SortPair<S>(p[8], p[9]); SortPair<S>(p[12], p[13]); SortPair<S>(p[11], p[13]);
+	SortPair<S>(p[11], p[12]); SortPair<S>(p[15], p[16]); SortPair<S>(p[14], p[16]); SortPair<S>(p[14], p[15]);
+	SortPair<S>(p[18], p[19]); SortPair<S>(p[17], p[19]); SortPair<S>(p[17], p[18]); SortPair<S>(p[21], p[22]);
+	SortPair<S>(p[20], p[22]); SortPair<S>(p[20], p[21]); SortPair<S>(p[23], p[24]); SortPair<S>(p[2], p[5]);
+	SortPair<S>(p[3], p[6]); SortPair<S>(p[0], p[6]); SortPair<S>(p[0], p[3]); SortPair<S>(p[4], p[7]);
+	SortPair<S>(p[1], p[7]); SortPair<S>(p[1], p[4]); SortPair<S>(p[11], p[14]); SortPair<S>(p[8], p[14]);
+	SortPair<S>(p[8], p[11]); SortPair<S>(p[12], p[15]); SortPair<S>(p[9], p[15]); SortPair<S>(p[9], p[12]);
+	SortPair<S>(p[13], p[16]); SortPair<S>(p[10], p[16]); SortPair<S>(p[10], p[13]); SortPair<S>(p[20], p[23]);
+	SortPair<S>(p[17], p[23]); SortPair<S>(p[17], p[20]); SortPair<S>(p[21], p[24]); SortPair<S>(p[18], p[24]);
+	SortPair<S>(p[18], p[21]); SortPair<S>(p[19], p[22]); SortPair<S>(p[8], p[17]); SortPair<S>(p[9], p[18]);
+	SortPair<S>(p[0], p[18]); SortPair<S>(p[0], p[9]); SortPair<S>(p[10], p[19]); SortPair<S>(p[1], p[19]);
+	SortPair<S>(p[1], p[10]); SortPair<S>(p[11], p[20]); SortPair<S>(p[2], p[20]); SortPair<S>(p[2], p[11]);
+	SortPair<S>(p[12], p[21]); SortPair<S>(p[3], p[21]); SortPair<S>(p[3], p[12]); SortPair<S>(p[13], p[22]);
+	SortPair<S>(p[4], p[22]); SortPair<S>(p[4], p[13]); SortPair<S>(p[14], p[23]); SortPair<S>(p[5], p[23]);
+	SortPair<S>(p[5], p[14]); SortPair<S>(p[15], p[24]); SortPair<S>(p[6], p[24]); SortPair<S>(p[6], p[15]);
+	SortPair<S>(p[7], p[16]); SortPair<S>(p[7], p[19]); SortPair<S>(p[13], p[21]); SortPair<S>(p[15], p[23]);
+	SortPair<S>(p[7], p[13]); SortPair<S>(p[7], p[15]); SortPair<S>(p[1], p[9]); SortPair<S>(p[3], p[11]);
+	SortPair<S>(p[5], p[17]); SortPair<S>(p[11], p[17]); SortPair<S>(p[9], p[17]); SortPair<S>(p[4], p[10]);
+	SortPair<S>(p[6], p[12]); SortPair<S>(p[7], p[14]); SortPair<S>(p[4], p[6]); SortPair<S>(p[4], p[7]);
+	SortPair<S>(p[12], p[14]); SortPair<S>(p[10], p[14]); SortPair<S>(p[6], p[7]); SortPair<S>(p[10], p[12]);
+	SortPair<S>(p[6], p[10]); SortPair<S>(p[6], p[17]); SortPair<S>(p[12], p[17]); SortPair<S>(p[7], p[17]);
+	SortPair<S>(p[7], p[10]); SortPair<S>(p[12], p[18]); SortPair<S>(p[7], p[12]); SortPair<S>(p[10], p[18]);
+	SortPair<S>(p[12], p[20]); SortPair<S>(p[10], p[20]); SortPair<S>(p[10], p[12]);
+	return p[12];
+}
+
+template <class S>
+DWORD Median5RowT(BYTE* pDest, const BYTE* const rgpRows[5], DWORD x, DWORD dwCount)
+{
+	for ( ; x + S::Lanes <= dwCount; x += S::Lanes)
+	{
+		typename S::V p[25];
+		for (DWORD i = 0; i < 5; i++)
+		{
+			const BYTE* pFrom = rgpRows[i] + x;
+			p[5 * i]     = S::Load(pFrom - 2);
+			p[5 * i + 1] = S::Load(pFrom - 1);
+			p[5 * i + 2] = S::Load(pFrom);
+			p[5 * i + 3] = S::Load(pFrom + 1);
+			p[5 * i + 4] = S::Load(pFrom + 2);
+		}
+		S::Store(pDest + x, Median25<S>(p));
+	}
+	return x;
+}
+
+template <class S>
+void PrefilterRowTier(BYTE* pDest, SKETCH_PREFILTER prefilter, const BYTE* const rgpRows[5], DWORD dwCount)
+{
+	DWORD x = 0;
+
+	switch (prefilter)
+	{
+	case SKETCH_PREFILTER_NONE:
+		memcpy(pDest, rgpRows[2], dwCount);
+		break;
+
+	case SKETCH_PREFILTER_MEDIAN5:
+		x = Median5RowT<S>(pDest, rgpRows, 0, dwCount);
+		Median5RowT<SimdScalar>(pDest, rgpRows, x, dwCount);
+		break;
+
+	case SKETCH_PREFILTER_BINOMIAL3:
+		x = BinomialRowT<S>(pDest, rgpRows, 0, dwCount);
+		BinomialRowT<SimdScalar>(pDest, rgpRows, x, dwCount);
+		break;
+
+	case SKETCH_PREFILTER_BOX3:
+		x = BoxRowT<S>(pDest, rgpRows, 0, dwCount);
+		BoxRowT<SimdScalar>(pDest, rgpRows, x, dwCount);
+		break;
+
+	default:
+		MedianRow<S, 1>(pDest, rgpRows[1], rgpRows[2], rgpRows[3], dwCount);
+		break;
+	}
+}
+
+}
+
+// Initializer for the SKETCH_ROW_FNS of the Simd* struct S.
+#define SKETCH_ROW_FNS_OF(S) { MedianRowTier<S>, RobertsRowTier<S>, DeinterleaveLumaTier<S>, SumAbsDiffTier<S>, \
+	LerpRowTier<S>, UpsampleRow2xTier<S>, SumPairsTier<S>, Yuy2ToRgbRowTier<S>, RgbRobertsRowTier<S>, ChromaEdgeRowTier<S>, \
+	EdgeRow3x3Tier<S>, PrefilterRowTier<S> }
+
+// Initializer for a tier the compiler cannot target.
+#define SKETCH_ROW_FNS_NONE { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL }
+
+#endif
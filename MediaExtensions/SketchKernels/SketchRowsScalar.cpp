@@ -0,0 +1,10 @@
+// Row kernels of the sketch kernels: one pixel at a time.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchRowsImpl.h"
+
+extern const SKETCH_ROW_FNS g_SketchRowsScalar = SKETCH_ROW_FNS_OF(SimdScalar);
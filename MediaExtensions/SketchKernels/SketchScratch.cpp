@@ -0,0 +1,75 @@
+// Scratch memory for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchScratch.h"
+
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+BYTE* SketchAlignedAlloc(size_t cb)
+{
+#if defined(_WIN32)
+	return (BYTE*)_aligned_malloc(cb, SKETCH_SCRATCH_ALIGNMENT);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, SKETCH_SCRATCH_ALIGNMENT, cb) != 0)
+	{
+		return NULL;
+	}
+	return (BYTE*)p;
+#endif
+}
+
+void SketchAlignedFree(BYTE* p)
+{
+#if defined(_WIN32)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+CSketchScratchArena::CSketchScratchArena()
+{
+	for (DWORD i = 0; i < SKETCH_SCRATCH_SLOTS; i++)
+	{
+		m_pSlots[i] = NULL;
+		m_cbSlots[i] = 0;
+	}
+}
+
+CSketchScratchArena::~CSketchScratchArena()
+{
+	Release();
+}
+
+BYTE* CSketchScratchArena::Reserve(DWORD dwSlot, size_t cb)
+{
+	if (cb <= m_cbSlots[dwSlot] && m_pSlots[dwSlot] != NULL)
+	{
+		return m_pSlots[dwSlot];
+	}
+
+	// Nothing in a scratch buffer outlives a frame, so there is nothing
+	// to copy across.
+	SketchAlignedFree(m_pSlots[dwSlot]);
+	m_pSlots[dwSlot] = SketchAlignedAlloc(cb);
+	m_cbSlots[dwSlot] = (m_pSlots[dwSlot] != NULL) ? cb : 0;
+	return m_pSlots[dwSlot];
+}
+
+void CSketchScratchArena::Release()
+{
+	for (DWORD i = 0; i < SKETCH_SCRATCH_SLOTS; i++)
+	{
+		SketchAlignedFree(m_pSlots[i]);
+		m_pSlots[i] = NULL;
+		m_cbSlots[i] = 0;
+	}
+}
@@ -0,0 +1,63 @@
+// Scratch memory for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHSCRATCH_H
+#define SKETCHSCRATCH_H
+
+#include "SketchPlatform.h"
+
+#include <stddef.h>
+
+// Alignment of every scratch buffer: a cache line, and enough for any
+// vector load the kernels do.
+#define SKETCH_SCRATCH_ALIGNMENT    64
+
+// Slots of a CSketchScratchArena.
+enum SKETCH_SCRATCH_SLOT
+{
+    SKETCH_SCRATCH_FILTERED,        // Filtered luma ring (GetSketchScratchSize).
+    SKETCH_SCRATCH_RGB,             // RGB rows of the YUY2RGB path (GetSketchRGBScratchSize).
+    SKETCH_SCRATCH_SCALED,          // Reduced planes of the scaled path (GetSketchScaledScratchSize).
+    SKETCH_SCRATCH_SLOTS
+};
+
+//
+// CSketchScratchArena keeps one aligned buffer per slot for the life of a
+// transform. A buffer is sized from the current format, only reallocated
+// when a larger size is asked for, and freed by Release or the destructor,
+// so once the largest format has been seen no frame allocates scratch.
+//
+class CSketchScratchArena
+{
+public:
+    CSketchScratchArena();
+    ~CSketchScratchArena();
+
+    // Buffer for the slot with room for at least cb bytes, or NULL if it
+    // could not be allocated. Growing does not keep the old contents, and
+    // invalidates the pointer returned before.
+    BYTE* Reserve(DWORD dwSlot, size_t cb);
+
+    // The slot's buffer as last reserved; NULL if none.
+    BYTE* Get(DWORD dwSlot) const { return m_pSlots[dwSlot]; }
+
+    // Frees every buffer.
+    void Release();
+
+private:
+    CSketchScratchArena(const CSketchScratchArena&);
+    CSketchScratchArena& operator=(const CSketchScratchArena&);
+
+    BYTE*       m_pSlots[SKETCH_SCRATCH_SLOTS];
+    size_t      m_cbSlots[SKETCH_SCRATCH_SLOTS];
+};
+
+// SKETCH_SCRATCH_ALIGNMENT-aligned allocation; free with SketchAlignedFree.
+BYTE* SketchAlignedAlloc(size_t cb);
+void SketchAlignedFree(BYTE* p);
+
+#endif
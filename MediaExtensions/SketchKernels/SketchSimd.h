@@ -0,0 +1,988 @@
+// Minimal SIMD abstraction for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHSIMD_H
+#define SKETCHSIMD_H
+
+#include "SketchPlatform.h"
+
+//
+// Each Simd* struct wraps one instruction set behind the same static
+// interface, so a kernel is written once as a template on the struct and
+// instantiated per target. V is the vector type and Lanes the number of
+// bytes it holds. SimdScalar has a single lane; kernels use it for the
+// tail of a row and as the fallback on targets without vector support.
+//
+//  Load(p)       Lanes bytes from p (unaligned).
+//  LoadEven(p)   Bytes p[0], p[2], ... p[2*(Lanes-1)]: the luma samples
+//                of a packed 4:2:2 row. Reads 2*Lanes bytes.
+//  Store(p, v)   Lanes bytes to p (unaligned).
+//  Min/Max       Per-byte unsigned minimum/maximum.
+//  AlignNext(a, b)  Lanes 1.. of the concatenation a:b, i.e. a shifted
+//                   down one lane with b[0] shifted in at the top.
+//  AlignPrev(a, b)  a[Lanes-1] followed by b[0..Lanes-2].
+//  SubSat(a, b)  Per-byte a - b, saturated at 0.
+//  Or/And        Bitwise.
+//  IsZero(a)     0xFF in lanes where a is 0, 0 elsewhere.
+//  SubSquareSat(level, a)
+//                Per-byte level - a*a, saturated at 0 (a*a taken at
+//                16 bits, so it never wraps).
+//  StoreEven(p, v, c)  2*Lanes bytes to p: v at even offsets, c at odd
+//                      offsets. StoreOdd puts v at the odd offsets.
+//  StoreZip(p, a, b)   2*Lanes bytes to p: a at even offsets, b at odd
+//                      offsets.
+//  Lerp(a, b, w) Per-byte (a*(256-w) + b*w + 128) >> 8.
+//  AccumulatePairs(p, a, b)
+//                Adds the sums of adjacent byte pairs of a:b, 2*Lanes
+//                bytes, to the Lanes words at p.
+//  Yuy2ToRgb(p, r, g, b)
+//                The Lanes pixels of a YUY2 row at p, which starts a pixel
+//                pair, converted as YUY2toRGB does. Reads 2*Lanes bytes.
+//                Not in SimdScalar, which cannot tell the pixels of a pair
+//                apart.
+//  SumDiff3(pos, neg)
+//                Per-byte pos[0] + pos[1] + pos[2] - neg[0] - neg[1] -
+//                neg[2], taken at 16 bits; 255 where that is below 0 or
+//                above 255.
+//  SwapPairs(a)  Bytes 2i and 2i+1 exchanged: each U with its V in a row
+//                of chroma pairs. Not in SimdScalar.
+//  Derivative3x3<EDGE, MID, SHIFT>(p)
+//                Per-byte (|Gx| + |Gy|) >> SHIFT, saturated at 255, over
+//                the 3x3 neighbourhood p[0..8], the row above left to
+//                right, then this row and the one below:
+//                Gx = EDGE*(p2 - p0 + p8 - p6) + MID*(p5 - p3) and Gy the
+//                same down the columns. Taken at 16 bits, which hold it
+//                for weights up to Scharr's.
+//  Laplacian3x3(p)
+//                Per-byte |p0 + p1 + p2 + p3 + p5 + p6 + p7 + p8 - 8*p4|
+//                >> 2, saturated at 255.
+//  Binomial3(a, b, c)
+//                Per-byte (a + 2*b + c + 2) >> 2.
+//  Sum3(a, b, c, lo, hi)
+//                Per-byte a + b + c, split into its low byte (lo) and its
+//                high byte (hi), so the sums of a row of columns can be
+//                moved along it with AlignNext/AlignPrev.
+//  Box3(lo, hi)  Per-byte (s0 + s1 + s2 + 4) / 9 of the three sums
+//                lo[i] + 256*hi[i] Sum3 made: the 3x3 box over the column
+//                sums left of, at and right of each pixel.
+//
+
+//
+// Which structs exist depends on what the translation unit is compiled for:
+// each SketchRows<Tier>.cpp is built with its tier's flags and uses only its
+// own struct (see SketchRows.h). MSVC allows SSSE3 intrinsics without a
+// flag, so SimdSSSE3 is always there on x86 with MSVC.
+//
+// Everything is in an unnamed namespace: the same inline functions are
+// compiled with different flags per tier, and the linker must not pick a
+// copy built for a wider tier than the one calling it.
+//
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+#define SKETCH_SIMD_AVX512 1
+#endif
+#if defined(__AVX2__)
+#define SKETCH_SIMD_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKETCH_SIMD_SSE2 1
+#endif
+#if defined(__SSSE3__) || (defined(_MSC_VER) && defined(SKETCH_SIMD_SSE2))
+#define SKETCH_SIMD_SSSE3 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM) || defined(_M_ARM64)
+#define SKETCH_SIMD_NEON 1
+#endif
+
+#if defined(SKETCH_SIMD_SSE2)
+#include <immintrin.h>
+#elif defined(SKETCH_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+
+struct SimdScalar
+{
+    typedef BYTE V;
+    enum { Lanes = 1 };
+
+    static inline V Load(const BYTE* p) { return *p; }
+    static inline V LoadEven(const BYTE* p) { return *p; }
+    static inline void Store(BYTE* p, V v) { *p = v; }
+    static inline V Min(V a, V b) { return (a < b) ? a : b; }
+    static inline V Max(V a, V b) { return (a > b) ? a : b; }
+    static inline V AlignNext(V /*a*/, V b) { return b; }
+    static inline V AlignPrev(V a, V /*b*/) { return a; }
+    static inline V SubSat(V a, V b) { return (a > b) ? (BYTE)(a - b) : 0; }
+    static inline V Or(V a, V b) { return a | b; }
+    static inline V And(V a, V b) { return a & b; }
+    static inline V IsZero(V a) { return (a == 0) ? 0xFF : 0; }
+    static inline V SubSquareSat(BYTE level, V a)
+    {
+        DWORD sq = (DWORD)a * a;
+        return (sq < level) ? (BYTE)(level - sq) : 0;
+    }
+    static inline void StoreEven(BYTE* p, V v, BYTE c) { p[0] = v; p[1] = c; }
+    static inline void StoreOdd(BYTE* p, V v, BYTE c) { p[0] = c; p[1] = v; }
+    static inline void StoreZip(BYTE* p, V a, V b) { p[0] = a; p[1] = b; }
+    static inline V Lerp(V a, V b, BYTE w) { return (BYTE)(((DWORD)a * (256 - w) + (DWORD)b * w + 128) >> 8); }
+    static inline void AccumulatePairs(WORD* p, V a, V b) { p[0] = (WORD)(p[0] + a + b); }
+    static inline DWORD SumAbsDiff(V a, V b) { return (a > b) ? a - b : b - a; }
+    static inline V SumDiff3(const V* pos, const V* neg)
+    {
+        const int sum = pos[0] + pos[1] + pos[2] - neg[0] - neg[1] - neg[2];
+        return (sum < 0 || sum > 255) ? 255 : (BYTE)sum;
+    }
+    template <int EDGE, int MID, int SHIFT>
+    static inline V Derivative3x3(const V* p)
+    {
+        const int gx = EDGE * (p[2] - p[0] + p[8] - p[6]) + MID * (p[5] - p[3]);
+        const int gy = EDGE * (p[6] - p[0] + p[8] - p[2]) + MID * (p[7] - p[1]);
+        const int g = (((gx < 0) ? -gx : gx) + ((gy < 0) ? -gy : gy)) >> SHIFT;
+        return (g > 255) ? 255 : (BYTE)g;
+    }
+    static inline V Laplacian3x3(const V* p)
+    {
+        const int l = p[0] + p[1] + p[2] + p[3] + p[5] + p[6] + p[7] + p[8] - 8 * p[4];
+        const int g = ((l < 0) ? -l : l) >> 2;
+        return (g > 255) ? 255 : (BYTE)g;
+    }
+    static inline V Binomial3(V a, V b, V c) { return (BYTE)((a + 2 * b + c + 2) >> 2); }
+    static inline void Sum3(V a, V b, V c, V& lo, V& hi)
+    {
+        const DWORD s = (DWORD)a + b + c;
+        lo = (BYTE)s;
+        hi = (BYTE)(s >> 8);
+    }
+    static inline V Box3(const V* lo, const V* hi)
+    {
+        return (BYTE)((lo[0] + lo[1] + lo[2] + 256 * (hi[0] + hi[1] + hi[2]) + 4) / 9);
+    }
+};
+
+#if defined(SKETCH_SIMD_SSE2)
+
+struct SimdSSE2
+{
+    typedef __m128i V;
+    enum { Lanes = 16 };
+
+    static inline V Load(const BYTE* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static inline V LoadEven(const BYTE* p)
+    {
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)p), mask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 16)), mask);
+        return _mm_packus_epi16(a, b);
+    }
+    static inline void Store(BYTE* p, V v) { _mm_storeu_si128((__m128i*)p, v); }
+    static inline V Min(V a, V b) { return _mm_min_epu8(a, b); }
+    static inline V Max(V a, V b) { return _mm_max_epu8(a, b); }
+    static inline V AlignNext(V a, V b) { return _mm_or_si128(_mm_srli_si128(a, 1), _mm_slli_si128(b, 15)); }
+    static inline V AlignPrev(V a, V b) { return _mm_or_si128(_mm_srli_si128(a, 15), _mm_slli_si128(b, 1)); }
+    static inline V SubSat(V a, V b) { return _mm_subs_epu8(a, b); }
+    static inline V Or(V a, V b) { return _mm_or_si128(a, b); }
+    static inline V And(V a, V b) { return _mm_and_si128(a, b); }
+    static inline V IsZero(V a) { return _mm_cmpeq_epi8(a, _mm_setzero_si128()); }
+    static inline V SubSquareSat(BYTE level, V a)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i l = _mm_set1_epi16(level);
+        __m128i lo = _mm_unpacklo_epi8(a, zero);
+        __m128i hi = _mm_unpackhi_epi8(a, zero);
+        lo = _mm_subs_epu16(l, _mm_mullo_epi16(lo, lo));
+        hi = _mm_subs_epu16(l, _mm_mullo_epi16(hi, hi));
+        return _mm_packus_epi16(lo, hi);
+    }
+    static inline void StoreEven(BYTE* p, V v, BYTE c)
+    {
+        const __m128i cc = _mm_set1_epi8((char)c);
+        _mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi8(v, cc));
+        _mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi8(v, cc));
+    }
+    static inline void StoreOdd(BYTE* p, V v, BYTE c)
+    {
+        const __m128i cc = _mm_set1_epi8((char)c);
+        _mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi8(cc, v));
+        _mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi8(cc, v));
+    }
+    static inline void StoreZip(BYTE* p, V a, V b)
+    {
+        _mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i*)(p + 16), _mm_unpackhi_epi8(a, b));
+    }
+    static inline V Lerp(V a, V b, BYTE w)
+    {
+        // a*(256-w) + b*w + 128 is at most 255*256 + 128: 16 bits hold it.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wa = _mm_set1_epi16((short)(256 - w));
+        const __m128i wb = _mm_set1_epi16(w);
+        const __m128i round = _mm_set1_epi16(128);
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), wa), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 8);
+        return _mm_packus_epi16(lo, hi);
+    }
+    static inline void AccumulatePairs(WORD* p, V a, V b)
+    {
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        const __m128i sa = _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8));
+        const __m128i sb = _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i*)p, _mm_add_epi16(_mm_loadu_si128((const __m128i*)p), sa));
+        _mm_storeu_si128((__m128i*)(p + 8), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(p + 8)), sb));
+    }
+    static inline DWORD SumAbsDiff(V a, V b)
+    {
+        const __m128i sad = _mm_sad_epu8(a, b);
+        return (DWORD)_mm_cvtsi128_si32(sad) + (DWORD)_mm_extract_epi16(sad, 4);
+    }
+    static inline void Yuy2ToRgb(const BYTE* p, V& r, V& g, V& b)
+    {
+        __m128i rlo, glo, blo, rhi, ghi, bhi;
+        Yuy2ToRgbWords(_mm_loadu_si128((const __m128i*)p), rlo, glo, blo);
+        Yuy2ToRgbWords(_mm_loadu_si128((const __m128i*)(p + 16)), rhi, ghi, bhi);
+        r = _mm_packus_epi16(rlo, rhi);
+        g = _mm_packus_epi16(glo, ghi);
+        b = _mm_packus_epi16(blo, bhi);
+    }
+    static inline V SumDiff3(const V* pos, const V* neg)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_unpacklo_epi8(pos[0], zero);
+        __m128i hi = _mm_unpackhi_epi8(pos[0], zero);
+        for (int i = 1; i < 3; i++)
+        {
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(pos[i], zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(pos[i], zero));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(neg[i], zero));
+            hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(neg[i], zero));
+        }
+        return _mm_packus_epi16(Min255(lo), Min255(hi));
+    }
+    static inline V SwapPairs(V a) { return _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8)); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline V Derivative3x3(const V* p)
+    {
+        __m128i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm_packus_epi16(DerivativeWords<EDGE, MID, SHIFT>(lo), DerivativeWords<EDGE, MID, SHIFT>(hi));
+    }
+    static inline V Laplacian3x3(const V* p)
+    {
+        __m128i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm_packus_epi16(LaplacianWords(lo), LaplacianWords(hi));
+    }
+    static inline V Binomial3(V a, V b, V c)
+    {
+        // The average of a and c rounded down, then with b rounded up,
+        // is the sum rounded once.
+        const __m128i ac = _mm_sub_epi8(_mm_avg_epu8(a, c), _mm_and_si128(_mm_xor_si128(a, c), _mm_set1_epi8(1)));
+        return _mm_avg_epu8(ac, b);
+    }
+    static inline void Sum3(V a, V b, V c, V& lo, V& hi)
+    {
+        // A byte add carried where the saturated sum differs from the
+        // wrapped one; cmpeq leaves -1 where it did not.
+        const __m128i ab = _mm_add_epi8(a, b);
+        lo = _mm_add_epi8(ab, c);
+        hi = _mm_add_epi8(_mm_add_epi8(_mm_cmpeq_epi8(_mm_adds_epu8(a, b), ab), _mm_cmpeq_epi8(_mm_adds_epu8(ab, c), lo)),
+            _mm_set1_epi8(2));
+    }
+    static inline V Box3(const V* lo, const V* hi)
+    {
+        __m128i wlo[3], whi[3];
+        for (int i = 0; i < 3; i++)
+        {
+            wlo[i] = _mm_unpacklo_epi8(lo[i], hi[i]);
+            whi[i] = _mm_unpackhi_epi8(lo[i], hi[i]);
+        }
+        return _mm_packus_epi16(BoxWords(wlo), BoxWords(whi));
+    }
+
+private:
+    // Unsigned minimum of each word and 255: a negative word is above it.
+    static inline __m128i Min255(__m128i w) { return _mm_sub_epi16(w, _mm_subs_epu16(w, _mm_set1_epi16(255))); }
+
+    // The low and high 8 bytes of each of the 9 vectors, as words.
+    static inline void Widen9(const V* p, __m128i* lo, __m128i* hi)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        for (int i = 0; i < 9; i++)
+        {
+            lo[i] = _mm_unpacklo_epi8(p[i], zero);
+            hi[i] = _mm_unpackhi_epi8(p[i], zero);
+        }
+    }
+    template <int K>
+    static inline __m128i MulWords(__m128i w) { return (K == 1) ? w : _mm_mullo_epi16(w, _mm_set1_epi16(K)); }
+    static inline __m128i AbsWords(__m128i w) { return _mm_max_epi16(w, _mm_sub_epi16(_mm_setzero_si128(), w)); }
+
+    // Derivative3x3 and Laplacian3x3 of 8 pixels, one word per pixel.
+    template <int EDGE, int MID, int SHIFT>
+    static inline __m128i DerivativeWords(const __m128i* w)
+    {
+        const __m128i gx = _mm_add_epi16(MulWords<EDGE>(_mm_add_epi16(_mm_sub_epi16(w[2], w[0]), _mm_sub_epi16(w[8], w[6]))),
+            MulWords<MID>(_mm_sub_epi16(w[5], w[3])));
+        const __m128i gy = _mm_add_epi16(MulWords<EDGE>(_mm_add_epi16(_mm_sub_epi16(w[6], w[0]), _mm_sub_epi16(w[8], w[2]))),
+            MulWords<MID>(_mm_sub_epi16(w[7], w[1])));
+        return _mm_srli_epi16(_mm_add_epi16(AbsWords(gx), AbsWords(gy)), SHIFT);
+    }
+    static inline __m128i LaplacianWords(const __m128i* w)
+    {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(w[0], w[1]), _mm_add_epi16(w[2], w[3]));
+        sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_add_epi16(w[5], w[6]), _mm_add_epi16(w[7], w[8])));
+        return _mm_srli_epi16(AbsWords(_mm_sub_epi16(sum, _mm_slli_epi16(w[4], 3))), 2);
+    }
+
+    // Box3 of 8 pixels: the sum of the column sums plus 4, times 65536/9
+    // rounded up, which is exact for sums up to 9*255 + 4.
+    static inline __m128i BoxWords(const __m128i* w)
+    {
+        const __m128i sum = _mm_add_epi16(_mm_add_epi16(w[0], w[1]), w[2]);
+        return _mm_mulhi_epu16(_mm_add_epi16(sum, _mm_set1_epi16(4)), _mm_set1_epi16(7282));
+    }
+
+    // Yuy2ToRgb for the 8 pixels of 16 bytes, one word per pixel.
+    static inline void Yuy2ToRgbWords(__m128i w, __m128i& r, __m128i& g, __m128i& b)
+    {
+        const __m128i y = _mm_and_si128(w, _mm_set1_epi16(0x00FF));
+        const __m128i c = _mm_sub_epi16(_mm_srli_epi16(w, 8), _mm_set1_epi16(128));
+
+        // Each pair's U and V in the word of its first pixel; the second
+        // pixel gets no chroma.
+        const __m128i u = _mm_and_si128(c, _mm_set1_epi32(0xFFFF));
+        const __m128i v = _mm_srli_epi32(c, 16);
+
+        const __m128i rdif = _mm_add_epi16(v, _mm_srai_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(103)), 8));
+        const __m128i invdif = _mm_add_epi16(_mm_srai_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(88)), 8),
+            _mm_srai_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(183)), 8));
+        const __m128i bdif = _mm_add_epi16(u, _mm_srai_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(198)), 8));
+
+        r = Min255(_mm_add_epi16(y, rdif));
+        g = Min255(_mm_sub_epi16(y, invdif));
+        b = Min255(_mm_add_epi16(y, bdif));
+    }
+};
+
+#endif
+
+#if defined(SKETCH_SIMD_SSSE3)
+
+// SSE2 with the byte shuffles SSSE3 adds.
+struct SimdSSSE3 : SimdSSE2
+{
+    static inline V LoadEven(const BYTE* p)
+    {
+        const __m128i even = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p), even);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), even);
+        return _mm_unpacklo_epi64(a, b);
+    }
+    static inline V AlignNext(V a, V b) { return _mm_alignr_epi8(b, a, 1); }
+    static inline V AlignPrev(V a, V b) { return _mm_alignr_epi8(b, a, 15); }
+};
+
+#endif
+
+#if defined(SKETCH_SIMD_AVX2)
+
+struct SimdAVX2
+{
+    typedef __m256i V;
+    enum { Lanes = 32 };
+
+    static inline V Load(const BYTE* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static inline V LoadEven(const BYTE* p)
+    {
+        const __m256i mask = _mm256_set1_epi16(0x00FF);
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)p), mask);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(p + 32)), mask);
+
+        // packus works per 128-bit lane; restore the element order.
+        return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+    }
+    static inline void Store(BYTE* p, V v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static inline V Min(V a, V b) { return _mm256_min_epu8(a, b); }
+    static inline V Max(V a, V b) { return _mm256_max_epu8(a, b); }
+
+    // alignr works per 128-bit lane, so first pair each half with its
+    // neighbouring half.
+    static inline V AlignNext(V a, V b) { return _mm256_alignr_epi8(_mm256_permute2x128_si256(a, b, 0x21), a, 1); }
+    static inline V AlignPrev(V a, V b) { return _mm256_alignr_epi8(b, _mm256_permute2x128_si256(a, b, 0x21), 15); }
+    static inline V SubSat(V a, V b) { return _mm256_subs_epu8(a, b); }
+    static inline V Or(V a, V b) { return _mm256_or_si256(a, b); }
+    static inline V And(V a, V b) { return _mm256_and_si256(a, b); }
+    static inline V IsZero(V a) { return _mm256_cmpeq_epi8(a, _mm256_setzero_si256()); }
+    static inline V SubSquareSat(BYTE level, V a)
+    {
+        // unpack/pack both stay within 128-bit lanes, so the order holds.
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i l = _mm256_set1_epi16(level);
+        __m256i lo = _mm256_unpacklo_epi8(a, zero);
+        __m256i hi = _mm256_unpackhi_epi8(a, zero);
+        lo = _mm256_subs_epu16(l, _mm256_mullo_epi16(lo, lo));
+        hi = _mm256_subs_epu16(l, _mm256_mullo_epi16(hi, hi));
+        return _mm256_packus_epi16(lo, hi);
+    }
+    static inline void StoreEven(BYTE* p, V v, BYTE c)
+    {
+        const __m256i cc = _mm256_set1_epi8((char)c);
+        __m256i lo = _mm256_unpacklo_epi8(v, cc);
+        __m256i hi = _mm256_unpackhi_epi8(v, cc);
+        _mm256_storeu_si256((__m256i*)p, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(p + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    static inline void StoreOdd(BYTE* p, V v, BYTE c)
+    {
+        const __m256i cc = _mm256_set1_epi8((char)c);
+        __m256i lo = _mm256_unpacklo_epi8(cc, v);
+        __m256i hi = _mm256_unpackhi_epi8(cc, v);
+        _mm256_storeu_si256((__m256i*)p, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(p + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    static inline void StoreZip(BYTE* p, V a, V b)
+    {
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256((__m256i*)p, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(p + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    static inline V Lerp(V a, V b, BYTE w)
+    {
+        // As for SSE2; unpack and pack stay within 128-bit lanes.
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i wa = _mm256_set1_epi16((short)(256 - w));
+        const __m256i wb = _mm256_set1_epi16(w);
+        const __m256i round = _mm256_set1_epi16(128);
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), wa), _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), wb));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), wa), _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), wb));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, round), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, round), 8);
+        return _mm256_packus_epi16(lo, hi);
+    }
+    static inline void AccumulatePairs(WORD* p, V a, V b)
+    {
+        const __m256i mask = _mm256_set1_epi16(0x00FF);
+        const __m256i sa = _mm256_add_epi16(_mm256_and_si256(a, mask), _mm256_srli_epi16(a, 8));
+        const __m256i sb = _mm256_add_epi16(_mm256_and_si256(b, mask), _mm256_srli_epi16(b, 8));
+        _mm256_storeu_si256((__m256i*)p, _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)p), sa));
+        _mm256_storeu_si256((__m256i*)(p + 16), _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(p + 16)), sb));
+    }
+    static inline DWORD SumAbsDiff(V a, V b)
+    {
+        const __m256i sad = _mm256_sad_epu8(a, b);
+        const __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+        return (DWORD)_mm_cvtsi128_si32(sum) + (DWORD)_mm_extract_epi16(sum, 4);
+    }
+    static inline void Yuy2ToRgb(const BYTE* p, V& r, V& g, V& b)
+    {
+        // As for LoadEven, packus leaves the 8-byte quarters out of order.
+        __m256i rlo, glo, blo, rhi, ghi, bhi;
+        Yuy2ToRgbWords(_mm256_loadu_si256((const __m256i*)p), rlo, glo, blo);
+        Yuy2ToRgbWords(_mm256_loadu_si256((const __m256i*)(p + 32)), rhi, ghi, bhi);
+        r = _mm256_permute4x64_epi64(_mm256_packus_epi16(rlo, rhi), 0xD8);
+        g = _mm256_permute4x64_epi64(_mm256_packus_epi16(glo, ghi), 0xD8);
+        b = _mm256_permute4x64_epi64(_mm256_packus_epi16(blo, bhi), 0xD8);
+    }
+    static inline V SumDiff3(const V* pos, const V* neg)
+    {
+        // unpack/pack both stay within 128-bit lanes, so the order holds.
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i max = _mm256_set1_epi16(255);
+        __m256i lo = _mm256_unpacklo_epi8(pos[0], zero);
+        __m256i hi = _mm256_unpackhi_epi8(pos[0], zero);
+        for (int i = 1; i < 3; i++)
+        {
+            lo = _mm256_add_epi16(lo, _mm256_unpacklo_epi8(pos[i], zero));
+            hi = _mm256_add_epi16(hi, _mm256_unpackhi_epi8(pos[i], zero));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            lo = _mm256_sub_epi16(lo, _mm256_unpacklo_epi8(neg[i], zero));
+            hi = _mm256_sub_epi16(hi, _mm256_unpackhi_epi8(neg[i], zero));
+        }
+        return _mm256_packus_epi16(_mm256_min_epu16(lo, max), _mm256_min_epu16(hi, max));
+    }
+    static inline V SwapPairs(V a) { return _mm256_or_si256(_mm256_slli_epi16(a, 8), _mm256_srli_epi16(a, 8)); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline V Derivative3x3(const V* p)
+    {
+        // unpack/pack both stay within 128-bit lanes, so the order holds.
+        __m256i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm256_packus_epi16(DerivativeWords<EDGE, MID, SHIFT>(lo), DerivativeWords<EDGE, MID, SHIFT>(hi));
+    }
+    static inline V Laplacian3x3(const V* p)
+    {
+        __m256i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm256_packus_epi16(LaplacianWords(lo), LaplacianWords(hi));
+    }
+    static inline V Binomial3(V a, V b, V c)
+    {
+        const __m256i ac = _mm256_sub_epi8(_mm256_avg_epu8(a, c), _mm256_and_si256(_mm256_xor_si256(a, c), _mm256_set1_epi8(1)));
+        return _mm256_avg_epu8(ac, b);
+    }
+    static inline void Sum3(V a, V b, V c, V& lo, V& hi)
+    {
+        const __m256i ab = _mm256_add_epi8(a, b);
+        lo = _mm256_add_epi8(ab, c);
+        hi = _mm256_add_epi8(_mm256_add_epi8(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), ab),
+            _mm256_cmpeq_epi8(_mm256_adds_epu8(ab, c), lo)), _mm256_set1_epi8(2));
+    }
+    static inline V Box3(const V* lo, const V* hi)
+    {
+        __m256i wlo[3], whi[3];
+        for (int i = 0; i < 3; i++)
+        {
+            wlo[i] = _mm256_unpacklo_epi8(lo[i], hi[i]);
+            whi[i] = _mm256_unpackhi_epi8(lo[i], hi[i]);
+        }
+        return _mm256_packus_epi16(BoxWords(wlo), BoxWords(whi));
+    }
+
+private:
+    // The bytes of each 128-bit lane of the 9 vectors as words, low half
+    // and high half; see SimdSSE2.
+    static inline void Widen9(const V* p, __m256i* lo, __m256i* hi)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        for (int i = 0; i < 9; i++)
+        {
+            lo[i] = _mm256_unpacklo_epi8(p[i], zero);
+            hi[i] = _mm256_unpackhi_epi8(p[i], zero);
+        }
+    }
+    template <int K>
+    static inline __m256i MulWords(__m256i w) { return (K == 1) ? w : _mm256_mullo_epi16(w, _mm256_set1_epi16(K)); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline __m256i DerivativeWords(const __m256i* w)
+    {
+        const __m256i gx = _mm256_add_epi16(MulWords<EDGE>(_mm256_add_epi16(_mm256_sub_epi16(w[2], w[0]), _mm256_sub_epi16(w[8], w[6]))),
+            MulWords<MID>(_mm256_sub_epi16(w[5], w[3])));
+        const __m256i gy = _mm256_add_epi16(MulWords<EDGE>(_mm256_add_epi16(_mm256_sub_epi16(w[6], w[0]), _mm256_sub_epi16(w[8], w[2]))),
+            MulWords<MID>(_mm256_sub_epi16(w[7], w[1])));
+        return _mm256_srli_epi16(_mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy)), SHIFT);
+    }
+    static inline __m256i LaplacianWords(const __m256i* w)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(w[0], w[1]), _mm256_add_epi16(w[2], w[3]));
+        sum = _mm256_add_epi16(sum, _mm256_add_epi16(_mm256_add_epi16(w[5], w[6]), _mm256_add_epi16(w[7], w[8])));
+        return _mm256_srli_epi16(_mm256_abs_epi16(_mm256_sub_epi16(sum, _mm256_slli_epi16(w[4], 3))), 2);
+    }
+    static inline __m256i BoxWords(const __m256i* w)
+    {
+        const __m256i sum = _mm256_add_epi16(_mm256_add_epi16(w[0], w[1]), w[2]);
+        return _mm256_mulhi_epu16(_mm256_add_epi16(sum, _mm256_set1_epi16(4)), _mm256_set1_epi16(7282));
+    }
+
+    // Yuy2ToRgb for the 16 pixels of 32 bytes, one word per pixel; see
+    // SimdSSE2.
+    static inline void Yuy2ToRgbWords(__m256i w, __m256i& r, __m256i& g, __m256i& b)
+    {
+        const __m256i max = _mm256_set1_epi16(255);
+        const __m256i y = _mm256_and_si256(w, _mm256_set1_epi16(0x00FF));
+        const __m256i c = _mm256_sub_epi16(_mm256_srli_epi16(w, 8), _mm256_set1_epi16(128));
+        const __m256i u = _mm256_and_si256(c, _mm256_set1_epi32(0xFFFF));
+        const __m256i v = _mm256_srli_epi32(c, 16);
+
+        const __m256i rdif = _mm256_add_epi16(v, _mm256_srai_epi16(_mm256_mullo_epi16(v, _mm256_set1_epi16(103)), 8));
+        const __m256i invdif = _mm256_add_epi16(_mm256_srai_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(88)), 8),
+            _mm256_srai_epi16(_mm256_mullo_epi16(v, _mm256_set1_epi16(183)), 8));
+        const __m256i bdif = _mm256_add_epi16(u, _mm256_srai_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(198)), 8));
+
+        r = _mm256_min_epu16(_mm256_add_epi16(y, rdif), max);
+        g = _mm256_min_epu16(_mm256_sub_epi16(y, invdif), max);
+        b = _mm256_min_epu16(_mm256_add_epi16(y, bdif), max);
+    }
+};
+
+#endif
+
+#if defined(SKETCH_SIMD_AVX512)
+
+struct SimdAVX512
+{
+    typedef __m512i V;
+    enum { Lanes = 64 };
+
+    static inline V Load(const BYTE* p) { return _mm512_loadu_si512((const void*)p); }
+    static inline V LoadEven(const BYTE* p)
+    {
+        const __m512i mask = _mm512_set1_epi16(0x00FF);
+        __m512i a = _mm512_and_si512(_mm512_loadu_si512((const void*)p), mask);
+        __m512i b = _mm512_and_si512(_mm512_loadu_si512((const void*)(p + 64)), mask);
+
+        // packus works per 128-bit lane, leaving the 8-byte halves of a and
+        // b alternating; gather a's halves, then b's.
+        return _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), _mm512_packus_epi16(a, b));
+    }
+    static inline void Store(BYTE* p, V v) { _mm512_storeu_si512((void*)p, v); }
+    static inline V Min(V a, V b) { return _mm512_min_epu8(a, b); }
+    static inline V Max(V a, V b) { return _mm512_max_epu8(a, b); }
+
+    // As for AVX2: alignr works per 128-bit lane, so pair each lane of a
+    // with the lane after it (or before it, from b) first.
+    static inline V AlignNext(V a, V b) { return _mm512_alignr_epi8(_mm512_alignr_epi32(b, a, 4), a, 1); }
+    static inline V AlignPrev(V a, V b) { return _mm512_alignr_epi8(b, _mm512_alignr_epi32(b, a, 12), 15); }
+    static inline V SubSat(V a, V b) { return _mm512_subs_epu8(a, b); }
+    static inline V Or(V a, V b) { return _mm512_or_si512(a, b); }
+    static inline V And(V a, V b) { return _mm512_and_si512(a, b); }
+    static inline V IsZero(V a) { return _mm512_movm_epi8(_mm512_cmpeq_epi8_mask(a, _mm512_setzero_si512())); }
+    static inline V SubSquareSat(BYTE level, V a)
+    {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i l = _mm512_set1_epi16(level);
+        __m512i lo = _mm512_unpacklo_epi8(a, zero);
+        __m512i hi = _mm512_unpackhi_epi8(a, zero);
+        lo = _mm512_subs_epu16(l, _mm512_mullo_epi16(lo, lo));
+        hi = _mm512_subs_epu16(l, _mm512_mullo_epi16(hi, hi));
+        return _mm512_packus_epi16(lo, hi);
+    }
+    static inline void StoreEven(BYTE* p, V v, BYTE c)
+    {
+        const __m512i cc = _mm512_set1_epi8((char)c);
+        Store2(p, _mm512_unpacklo_epi8(v, cc), _mm512_unpackhi_epi8(v, cc));
+    }
+    static inline void StoreOdd(BYTE* p, V v, BYTE c)
+    {
+        const __m512i cc = _mm512_set1_epi8((char)c);
+        Store2(p, _mm512_unpacklo_epi8(cc, v), _mm512_unpackhi_epi8(cc, v));
+    }
+    static inline void StoreZip(BYTE* p, V a, V b) { Store2(p, _mm512_unpacklo_epi8(a, b), _mm512_unpackhi_epi8(a, b)); }
+    static inline V Lerp(V a, V b, BYTE w)
+    {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i wa = _mm512_set1_epi16((short)(256 - w));
+        const __m512i wb = _mm512_set1_epi16(w);
+        const __m512i round = _mm512_set1_epi16(128);
+        __m512i lo = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpacklo_epi8(a, zero), wa), _mm512_mullo_epi16(_mm512_unpacklo_epi8(b, zero), wb));
+        __m512i hi = _mm512_add_epi16(_mm512_mullo_epi16(_mm512_unpackhi_epi8(a, zero), wa), _mm512_mullo_epi16(_mm512_unpackhi_epi8(b, zero), wb));
+        lo = _mm512_srli_epi16(_mm512_add_epi16(lo, round), 8);
+        hi = _mm512_srli_epi16(_mm512_add_epi16(hi, round), 8);
+        return _mm512_packus_epi16(lo, hi);
+    }
+    static inline void AccumulatePairs(WORD* p, V a, V b)
+    {
+        const __m512i mask = _mm512_set1_epi16(0x00FF);
+        const __m512i sa = _mm512_add_epi16(_mm512_and_si512(a, mask), _mm512_srli_epi16(a, 8));
+        const __m512i sb = _mm512_add_epi16(_mm512_and_si512(b, mask), _mm512_srli_epi16(b, 8));
+        _mm512_storeu_si512((void*)p, _mm512_add_epi16(_mm512_loadu_si512((const void*)p), sa));
+        _mm512_storeu_si512((void*)(p + 32), _mm512_add_epi16(_mm512_loadu_si512((const void*)(p + 32)), sb));
+    }
+    static inline DWORD SumAbsDiff(V a, V b) { return (DWORD)_mm512_reduce_add_epi64(_mm512_sad_epu8(a, b)); }
+    static inline void Yuy2ToRgb(const BYTE* p, V& r, V& g, V& b)
+    {
+        // As for LoadEven, gather the 8-byte halves packus leaves alternating.
+        const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+        __m512i rlo, glo, blo, rhi, ghi, bhi;
+        Yuy2ToRgbWords(_mm512_loadu_si512((const void*)p), rlo, glo, blo);
+        Yuy2ToRgbWords(_mm512_loadu_si512((const void*)(p + 64)), rhi, ghi, bhi);
+        r = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(rlo, rhi));
+        g = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(glo, ghi));
+        b = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(blo, bhi));
+    }
+    static inline V SumDiff3(const V* pos, const V* neg)
+    {
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i max = _mm512_set1_epi16(255);
+        __m512i lo = _mm512_unpacklo_epi8(pos[0], zero);
+        __m512i hi = _mm512_unpackhi_epi8(pos[0], zero);
+        for (int i = 1; i < 3; i++)
+        {
+            lo = _mm512_add_epi16(lo, _mm512_unpacklo_epi8(pos[i], zero));
+            hi = _mm512_add_epi16(hi, _mm512_unpackhi_epi8(pos[i], zero));
+        }
+        for (int i = 0; i < 3; i++)
+        {
+            lo = _mm512_sub_epi16(lo, _mm512_unpacklo_epi8(neg[i], zero));
+            hi = _mm512_sub_epi16(hi, _mm512_unpackhi_epi8(neg[i], zero));
+        }
+        return _mm512_packus_epi16(_mm512_min_epu16(lo, max), _mm512_min_epu16(hi, max));
+    }
+    static inline V SwapPairs(V a) { return _mm512_or_si512(_mm512_slli_epi16(a, 8), _mm512_srli_epi16(a, 8)); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline V Derivative3x3(const V* p)
+    {
+        __m512i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm512_packus_epi16(DerivativeWords<EDGE, MID, SHIFT>(lo), DerivativeWords<EDGE, MID, SHIFT>(hi));
+    }
+    static inline V Laplacian3x3(const V* p)
+    {
+        __m512i lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return _mm512_packus_epi16(LaplacianWords(lo), LaplacianWords(hi));
+    }
+    static inline V Binomial3(V a, V b, V c)
+    {
+        const __m512i ac = _mm512_sub_epi8(_mm512_avg_epu8(a, c), _mm512_and_si512(_mm512_xor_si512(a, c), _mm512_set1_epi8(1)));
+        return _mm512_avg_epu8(ac, b);
+    }
+    static inline void Sum3(V a, V b, V c, V& lo, V& hi)
+    {
+        const __m512i one = _mm512_set1_epi8(1);
+        const __m512i ab = _mm512_add_epi8(a, b);
+        lo = _mm512_add_epi8(ab, c);
+        hi = _mm512_add_epi8(_mm512_maskz_mov_epi8(_mm512_cmpneq_epu8_mask(_mm512_adds_epu8(a, b), ab), one),
+            _mm512_maskz_mov_epi8(_mm512_cmpneq_epu8_mask(_mm512_adds_epu8(ab, c), lo), one));
+    }
+    static inline V Box3(const V* lo, const V* hi)
+    {
+        __m512i wlo[3], whi[3];
+        for (int i = 0; i < 3; i++)
+        {
+            wlo[i] = _mm512_unpacklo_epi8(lo[i], hi[i]);
+            whi[i] = _mm512_unpackhi_epi8(lo[i], hi[i]);
+        }
+        return _mm512_packus_epi16(BoxWords(wlo), BoxWords(whi));
+    }
+
+private:
+    // As for SimdAVX2, per 128-bit lane.
+    static inline void Widen9(const V* p, __m512i* lo, __m512i* hi)
+    {
+        const __m512i zero = _mm512_setzero_si512();
+        for (int i = 0; i < 9; i++)
+        {
+            lo[i] = _mm512_unpacklo_epi8(p[i], zero);
+            hi[i] = _mm512_unpackhi_epi8(p[i], zero);
+        }
+    }
+    template <int K>
+    static inline __m512i MulWords(__m512i w) { return (K == 1) ? w : _mm512_mullo_epi16(w, _mm512_set1_epi16(K)); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline __m512i DerivativeWords(const __m512i* w)
+    {
+        const __m512i gx = _mm512_add_epi16(MulWords<EDGE>(_mm512_add_epi16(_mm512_sub_epi16(w[2], w[0]), _mm512_sub_epi16(w[8], w[6]))),
+            MulWords<MID>(_mm512_sub_epi16(w[5], w[3])));
+        const __m512i gy = _mm512_add_epi16(MulWords<EDGE>(_mm512_add_epi16(_mm512_sub_epi16(w[6], w[0]), _mm512_sub_epi16(w[8], w[2]))),
+            MulWords<MID>(_mm512_sub_epi16(w[7], w[1])));
+        return _mm512_srli_epi16(_mm512_add_epi16(_mm512_abs_epi16(gx), _mm512_abs_epi16(gy)), SHIFT);
+    }
+    static inline __m512i LaplacianWords(const __m512i* w)
+    {
+        __m512i sum = _mm512_add_epi16(_mm512_add_epi16(w[0], w[1]), _mm512_add_epi16(w[2], w[3]));
+        sum = _mm512_add_epi16(sum, _mm512_add_epi16(_mm512_add_epi16(w[5], w[6]), _mm512_add_epi16(w[7], w[8])));
+        return _mm512_srli_epi16(_mm512_abs_epi16(_mm512_sub_epi16(sum, _mm512_slli_epi16(w[4], 3))), 2);
+    }
+    static inline __m512i BoxWords(const __m512i* w)
+    {
+        const __m512i sum = _mm512_add_epi16(_mm512_add_epi16(w[0], w[1]), w[2]);
+        return _mm512_mulhi_epu16(_mm512_add_epi16(sum, _mm512_set1_epi16(4)), _mm512_set1_epi16(7282));
+    }
+
+    // Yuy2ToRgb for the 32 pixels of 64 bytes, one word per pixel; see
+    // SimdSSE2.
+    static inline void Yuy2ToRgbWords(__m512i w, __m512i& r, __m512i& g, __m512i& b)
+    {
+        const __m512i max = _mm512_set1_epi16(255);
+        const __m512i y = _mm512_and_si512(w, _mm512_set1_epi16(0x00FF));
+        const __m512i c = _mm512_sub_epi16(_mm512_srli_epi16(w, 8), _mm512_set1_epi16(128));
+        const __m512i u = _mm512_and_si512(c, _mm512_set1_epi32(0xFFFF));
+        const __m512i v = _mm512_srli_epi32(c, 16);
+
+        const __m512i rdif = _mm512_add_epi16(v, _mm512_srai_epi16(_mm512_mullo_epi16(v, _mm512_set1_epi16(103)), 8));
+        const __m512i invdif = _mm512_add_epi16(_mm512_srai_epi16(_mm512_mullo_epi16(u, _mm512_set1_epi16(88)), 8),
+            _mm512_srai_epi16(_mm512_mullo_epi16(v, _mm512_set1_epi16(183)), 8));
+        const __m512i bdif = _mm512_add_epi16(u, _mm512_srai_epi16(_mm512_mullo_epi16(u, _mm512_set1_epi16(198)), 8));
+
+        r = _mm512_min_epu16(_mm512_add_epi16(y, rdif), max);
+        g = _mm512_min_epu16(_mm512_sub_epi16(y, invdif), max);
+        b = _mm512_min_epu16(_mm512_add_epi16(y, bdif), max);
+    }
+
+    // Stores the 128-bit lanes lo0 hi0 lo1 hi1 ... lo3 hi3.
+    static inline void Store2(BYTE* p, V lo, V hi)
+    {
+        _mm512_storeu_si512((void*)p, _mm512_permutex2var_epi64(lo, _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11), hi));
+        _mm512_storeu_si512((void*)(p + 64), _mm512_permutex2var_epi64(lo, _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15), hi));
+    }
+};
+
+#endif
+
+#if defined(SKETCH_SIMD_NEON)
+
+struct SimdNEON
+{
+    typedef uint8x16_t V;
+    enum { Lanes = 16 };
+
+    static inline V Load(const BYTE* p) { return vld1q_u8(p); }
+    static inline V LoadEven(const BYTE* p) { return vld2q_u8(p).val[0]; }
+    static inline void Store(BYTE* p, V v) { vst1q_u8(p, v); }
+    static inline V Min(V a, V b) { return vminq_u8(a, b); }
+    static inline V Max(V a, V b) { return vmaxq_u8(a, b); }
+    static inline V AlignNext(V a, V b) { return vextq_u8(a, b, 1); }
+    static inline V AlignPrev(V a, V b) { return vextq_u8(a, b, 15); }
+    static inline V SubSat(V a, V b) { return vqsubq_u8(a, b); }
+    static inline V Or(V a, V b) { return vorrq_u8(a, b); }
+    static inline V And(V a, V b) { return vandq_u8(a, b); }
+    static inline V IsZero(V a) { return vceqq_u8(a, vdupq_n_u8(0)); }
+    static inline V SubSquareSat(BYTE level, V a)
+    {
+        const uint16x8_t l = vdupq_n_u16(level);
+        uint16x8_t lo = vqsubq_u16(l, vmull_u8(vget_low_u8(a), vget_low_u8(a)));
+        uint16x8_t hi = vqsubq_u16(l, vmull_u8(vget_high_u8(a), vget_high_u8(a)));
+        return vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi));
+    }
+    static inline void StoreEven(BYTE* p, V v, BYTE c)
+    {
+        uint8x16x2_t t = { { v, vdupq_n_u8(c) } };
+        vst2q_u8(p, t);
+    }
+    static inline void StoreOdd(BYTE* p, V v, BYTE c)
+    {
+        uint8x16x2_t t = { { vdupq_n_u8(c), v } };
+        vst2q_u8(p, t);
+    }
+    static inline void StoreZip(BYTE* p, V a, V b)
+    {
+        uint8x16x2_t t = { { a, b } };
+        vst2q_u8(p, t);
+    }
+    static inline V Lerp(V a, V b, BYTE w)
+    {
+        // 256 - w need not fit a byte: take a*(256-w) as (a << 8) - a*w.
+        const uint8x8_t vw = vdup_n_u8(w);
+        uint16x8_t lo = vsubq_u16(vshll_n_u8(vget_low_u8(a), 8), vmull_u8(vget_low_u8(a), vw));
+        uint16x8_t hi = vsubq_u16(vshll_n_u8(vget_high_u8(a), 8), vmull_u8(vget_high_u8(a), vw));
+        lo = vmlal_u8(lo, vget_low_u8(b), vw);
+        hi = vmlal_u8(hi, vget_high_u8(b), vw);
+        return vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+    }
+    static inline void AccumulatePairs(WORD* p, V a, V b)
+    {
+        vst1q_u16(p, vpadalq_u8(vld1q_u16(p), a));
+        vst1q_u16(p + 8, vpadalq_u8(vld1q_u16(p + 8), b));
+    }
+    static inline DWORD SumAbsDiff(V a, V b)
+    {
+        const uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vabdq_u8(a, b))));
+        return (DWORD)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+    }
+    static inline void Yuy2ToRgb(const BYTE* p, V& r, V& g, V& b)
+    {
+        // Y0 U Y1 V of 8 pairs. Only the first pixel of a pair gets chroma;
+        // the second keeps its luma in all three.
+        const uint8x8x4_t t = vld4_u8(p);
+        const int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(t.val[0]));
+        const int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(t.val[1])), vdupq_n_s16(128));
+        const int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(t.val[3])), vdupq_n_s16(128));
+
+        const int16x8_t rdif = vaddq_s16(v, vshrq_n_s16(vmulq_n_s16(v, 103), 8));
+        const int16x8_t invdif = vaddq_s16(vshrq_n_s16(vmulq_n_s16(u, 88), 8), vshrq_n_s16(vmulq_n_s16(v, 183), 8));
+        const int16x8_t bdif = vaddq_s16(u, vshrq_n_s16(vmulq_n_s16(u, 198), 8));
+
+        const uint8x8x2_t rr = vzip_u8(Min255(vaddq_s16(y, rdif)), t.val[2]);
+        const uint8x8x2_t gg = vzip_u8(Min255(vsubq_s16(y, invdif)), t.val[2]);
+        const uint8x8x2_t bb = vzip_u8(Min255(vaddq_s16(y, bdif)), t.val[2]);
+        r = vcombine_u8(rr.val[0], rr.val[1]);
+        g = vcombine_u8(gg.val[0], gg.val[1]);
+        b = vcombine_u8(bb.val[0], bb.val[1]);
+    }
+    static inline V SumDiff3(const V* pos, const V* neg)
+    {
+        int16x8_t lo = vreinterpretq_s16_u16(vaddl_u8(vget_low_u8(pos[0]), vget_low_u8(pos[1])));
+        int16x8_t hi = vreinterpretq_s16_u16(vaddl_u8(vget_high_u8(pos[0]), vget_high_u8(pos[1])));
+        lo = vreinterpretq_s16_u16(vaddw_u8(vreinterpretq_u16_s16(lo), vget_low_u8(pos[2])));
+        hi = vreinterpretq_s16_u16(vaddw_u8(vreinterpretq_u16_s16(hi), vget_high_u8(pos[2])));
+        for (int i = 0; i < 3; i++)
+        {
+            lo = vreinterpretq_s16_u16(vsubw_u8(vreinterpretq_u16_s16(lo), vget_low_u8(neg[i])));
+            hi = vreinterpretq_s16_u16(vsubw_u8(vreinterpretq_u16_s16(hi), vget_high_u8(neg[i])));
+        }
+        return vcombine_u8(Min255(lo), Min255(hi));
+    }
+    static inline V SwapPairs(V a) { return vrev16q_u8(a); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline V Derivative3x3(const V* p)
+    {
+        int16x8_t lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return vcombine_u8(vqmovun_s16(DerivativeWords<EDGE, MID, SHIFT>(lo)), vqmovun_s16(DerivativeWords<EDGE, MID, SHIFT>(hi)));
+    }
+    static inline V Laplacian3x3(const V* p)
+    {
+        int16x8_t lo[9], hi[9];
+        Widen9(p, lo, hi);
+        return vcombine_u8(vqmovun_s16(LaplacianWords(lo)), vqmovun_s16(LaplacianWords(hi)));
+    }
+    static inline V Binomial3(V a, V b, V c) { return vrhaddq_u8(vhaddq_u8(a, c), b); }
+    static inline void Sum3(V a, V b, V c, V& lo, V& hi)
+    {
+        const uint16x8_t slo = vaddw_u8(vaddl_u8(vget_low_u8(a), vget_low_u8(b)), vget_low_u8(c));
+        const uint16x8_t shi = vaddw_u8(vaddl_u8(vget_high_u8(a), vget_high_u8(b)), vget_high_u8(c));
+        lo = vcombine_u8(vmovn_u16(slo), vmovn_u16(shi));
+        hi = vcombine_u8(vshrn_n_u16(slo, 8), vshrn_n_u16(shi, 8));
+    }
+    static inline V Box3(const V* lo, const V* hi)
+    {
+        int16x8_t wlo[3], whi[3];
+        for (int i = 0; i < 3; i++)
+        {
+            const uint8x16x2_t w = vzipq_u8(lo[i], hi[i]);
+            wlo[i] = vreinterpretq_s16_u8(w.val[0]);
+            whi[i] = vreinterpretq_s16_u8(w.val[1]);
+        }
+        return vcombine_u8(vqmovun_s16(BoxWords(wlo)), vqmovun_s16(BoxWords(whi)));
+    }
+
+private:
+    // The unsigned minimum of each word and 255, narrowed: a negative word
+    // is above it.
+    static inline uint8x8_t Min255(int16x8_t w) { return vmovn_u16(vminq_u16(vreinterpretq_u16_s16(w), vdupq_n_u16(255))); }
+
+    // The low and high 8 bytes of each of the 9 vectors, as words.
+    static inline void Widen9(const V* p, int16x8_t* lo, int16x8_t* hi)
+    {
+        for (int i = 0; i < 9; i++)
+        {
+            lo[i] = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(p[i])));
+            hi[i] = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(p[i])));
+        }
+    }
+    template <int K>
+    static inline int16x8_t MulWords(int16x8_t w) { return (K == 1) ? w : vmulq_n_s16(w, K); }
+    template <int EDGE, int MID, int SHIFT>
+    static inline int16x8_t DerivativeWords(const int16x8_t* w)
+    {
+        const int16x8_t gx = vaddq_s16(MulWords<EDGE>(vaddq_s16(vsubq_s16(w[2], w[0]), vsubq_s16(w[8], w[6]))),
+            MulWords<MID>(vsubq_s16(w[5], w[3])));
+        const int16x8_t gy = vaddq_s16(MulWords<EDGE>(vaddq_s16(vsubq_s16(w[6], w[0]), vsubq_s16(w[8], w[2]))),
+            MulWords<MID>(vsubq_s16(w[7], w[1])));
+        return vshrq_n_s16(vaddq_s16(vabsq_s16(gx), vabsq_s16(gy)), SHIFT);
+    }
+    static inline int16x8_t LaplacianWords(const int16x8_t* w)
+    {
+        int16x8_t sum = vaddq_s16(vaddq_s16(w[0], w[1]), vaddq_s16(w[2], w[3]));
+        sum = vaddq_s16(sum, vaddq_s16(vaddq_s16(w[5], w[6]), vaddq_s16(w[7], w[8])));
+        return vshrq_n_s16(vabsq_s16(vsubq_s16(sum, vshlq_n_s16(w[4], 3))), 2);
+    }
+
+    // Box3 of 8 pixels; (2*sum*3641) >> 16 is the multiply SimdSSE2
+    // takes the high word of.
+    static inline int16x8_t BoxWords(const int16x8_t* w)
+    {
+        const int16x8_t sum = vaddq_s16(vaddq_s16(w[0], w[1]), w[2]);
+        return vqdmulhq_n_s16(vaddq_s16(sum, vdupq_n_s16(4)), 3641);
+    }
+};
+
+#endif
+
+}
+
+#endif
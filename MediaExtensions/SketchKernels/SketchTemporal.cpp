@@ -0,0 +1,372 @@
+// Temporal change detection for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchTemporal.h"
+#include "SketchRegions.h"
+#include "SketchRows.h"
+#include "SketchScratch.h"
+
+#include <string.h>
+
+// Lines above and below, and columns left and right, of a tile that its
+// output is computed from.
+#define TEMPORAL_HALO_ROWS      2
+#define TEMPORAL_HALO_LEFT      1
+#define TEMPORAL_HALO_RIGHT     2
+
+// Columns right of a tile that the chroma gradients of chroma-aware regions
+// read: the pair after the last pixel's.
+#define TEMPORAL_HALO_RIGHT_CHROMA  3
+
+// Columns left of a tile that the 3x3 detectors read, over filtered luma.
+#define TEMPORAL_HALO_LEFT_3X3      2
+
+// The halos above are for the 3x3 pre-filters; one that reaches further
+// widens each of them by as much.
+
+CSketchTemporal::CSketchTemporal(DWORD dwTolerance, DWORD dwTileWidth, DWORD dwTileRows) :
+	m_dwTolerance(dwTolerance), m_dwWidth(0), m_dwHeight(0), m_cRegions(0), m_prefilter(SKETCH_PREFILTER_MEDIAN3),
+	m_dwMedianRadius(0), m_bChromaEdges(false), m_bDetector3x3(false), m_dwExtraReach(0),
+	m_bValid(false), m_pPrevSrc(NULL), m_pPrevDest(NULL), m_cbLine(0), m_cLines(0), m_cbAllocated(0),
+	m_cTilesX(0), m_cTilesY(0), m_pFrame(NULL)
+{
+	// Rounded up to even sizes.
+	m_dwTileWidth = (dwTileWidth == 0) ? SKETCH_TEMPORAL_TILE_WIDTH : (dwTileWidth + 1) & ~1u;
+	m_dwTileRows = (dwTileRows == 0) ? SKETCH_TEMPORAL_TILE_ROWS : (dwTileRows + 1) & ~1u;
+
+	memset(&m_kernel, 0, sizeof(m_kernel));
+	memset(&m_rcDest, 0, sizeof(m_rcDest));
+	memset(m_rgRegions, 0, sizeof(m_rgRegions));
+	memset(&m_counters, 0, sizeof(m_counters));
+}
+
+CSketchTemporal::~CSketchTemporal()
+{
+	SketchAlignedFree(m_pPrevSrc);
+	SketchAlignedFree(m_pPrevDest);
+}
+
+void CSketchTemporal::Reset()
+{
+	m_bValid = false;
+}
+
+//
+// Takes note of what the frame is made with, and drops the previous frame
+// if any of it changed. Returns false if the previous frame could not be
+// allocated.
+//
+bool CSketchTemporal::Prepare(const SKETCH_TILE_KERNEL& kernel, const SKETCH_FRAME& frame)
+{
+	const DWORD cRegions = (frame.pRegions == NULL) ? 0 :
+		((frame.cRegions < SKETCH_MAX_REGIONS) ? frame.cRegions : SKETCH_MAX_REGIONS);
+
+	if (kernel.pfnTile != m_kernel.pfnTile || kernel.dwBytesPerPixel != m_kernel.dwBytesPerPixel ||
+		kernel.bChromaPlane != m_kernel.bChromaPlane ||
+		frame.dwWidthInPixels != m_dwWidth || frame.dwHeightInPixels != m_dwHeight ||
+		memcmp(&frame.rcDest, &m_rcDest, sizeof(m_rcDest)) != 0 || frame.prefilter != m_prefilter ||
+		frame.dwMedianRadius != m_dwMedianRadius ||
+		cRegions != m_cRegions || (cRegions > 0 && memcmp(frame.pRegions, m_rgRegions, cRegions * sizeof(SKETCH_REGION)) != 0))
+	{
+		m_bValid = false;
+		m_kernel = kernel;
+		m_dwWidth = frame.dwWidthInPixels;
+		m_dwHeight = frame.dwHeightInPixels;
+		m_rcDest = frame.rcDest;
+		m_cRegions = cRegions;
+		m_prefilter = frame.prefilter;
+		m_dwMedianRadius = frame.dwMedianRadius;
+		const DWORD dwReach = GetSketchPrefilterReach(frame.prefilter, frame.dwMedianRadius);
+		m_dwExtraReach = (dwReach > 1) ? dwReach - 1 : 0;
+		m_bChromaEdges = false;
+		m_bDetector3x3 = false;
+		for (DWORD i = 0; i < cRegions; i++)
+		{
+			m_rgRegions[i] = frame.pRegions[i];
+			m_bChromaEdges = m_bChromaEdges || (frame.pRegions[i].bChroma != 0);
+			m_bDetector3x3 = m_bDetector3x3 || IsSketchDetector3x3(frame.pRegions[i]);
+		}
+	}
+	if (m_bValid)
+	{
+		return true;
+	}
+
+	m_cbLine = m_dwWidth * kernel.dwBytesPerPixel;
+	m_cLines = m_dwHeight + (kernel.bChromaPlane ? m_dwHeight / 2 : 0);
+	m_cTilesX = (m_dwWidth + m_dwTileWidth - 1) / m_dwTileWidth;
+	m_cTilesY = (m_dwHeight + m_dwTileRows - 1) / m_dwTileRows;
+
+	const size_t cb = (size_t)m_cbLine * m_cLines;
+	if (cb > m_cbAllocated)
+	{
+		SketchAlignedFree(m_pPrevSrc);
+		SketchAlignedFree(m_pPrevDest);
+		m_pPrevSrc = SketchAlignedAlloc(cb);
+		m_pPrevDest = SketchAlignedAlloc(cb);
+		m_cbAllocated = (m_pPrevSrc != NULL && m_pPrevDest != NULL) ? cb : 0;
+		if (m_cbAllocated == 0)
+		{
+			return false;
+		}
+	}
+
+	// No tile can be skipped.
+	m_changed.assign((size_t)m_cTilesX * m_cTilesY, 1);
+	return true;
+}
+
+bool CSketchTemporal::Run(const SKETCH_TILE_KERNEL& kernel, const SKETCH_FRAME& frame, CSketchThreadPool* pPool,
+	BYTE* pScratch)
+{
+	if (!Prepare(kernel, frame))
+	{
+		return false;
+	}
+	m_pFrame = &frame;
+
+	// Which tiles changed, against the previous frame as it was: a tile's
+	// state is only brought up to date once every tile is compared.
+	if (m_bValid && !RunPass(CompareTask, pPool, pScratch))
+	{
+		m_pFrame = NULL;
+		return false;
+	}
+
+	DWORD cChanged = 0;
+	for (size_t i = 0; i < m_changed.size(); i++)
+	{
+		cChanged += m_changed[i];
+	}
+
+	// A pool that fails here ran nothing, and the previous frame is intact.
+	if (!RunPass(ApplyTask, pPool, pScratch))
+	{
+		m_pFrame = NULL;
+		return false;
+	}
+	m_pFrame = NULL;
+	m_bValid = true;
+
+	m_counters.ullFrames++;
+	m_counters.ullTilesComputed += cChanged;
+	m_counters.ullTilesSkipped += m_changed.size() - cChanged;
+	return true;
+}
+
+bool CSketchTemporal::RunPass(SKETCH_TASK_FN pfnTask, CSketchThreadPool* pPool, BYTE* pScratch)
+{
+	if (pPool != NULL)
+	{
+		return pPool->RunTask(pfnTask, this, m_dwHeight, GetSketchScratchSize(m_dwWidth, m_prefilter, m_dwMedianRadius));
+	}
+	pfnTask(this, 0, m_dwHeight, pScratch);
+	return true;
+}
+
+void CSketchTemporal::GetTile(DWORD tx, DWORD ty, DWORD* pxBegin, DWORD* pxEnd, DWORD* pyBegin, DWORD* pyEnd) const
+{
+	*pxBegin = tx * m_dwTileWidth;
+	*pxEnd = (m_dwWidth - *pxBegin > m_dwTileWidth) ? *pxBegin + m_dwTileWidth : m_dwWidth;
+	*pyBegin = ty * m_dwTileRows;
+	*pyEnd = (m_dwHeight - *pyBegin > m_dwTileRows) ? *pyBegin + m_dwTileRows : m_dwHeight;
+}
+
+// NV12 chroma lines of luma lines [yBegin, yEnd), as the kernels assign them.
+static inline void GetChromaLines(DWORD yBegin, DWORD yEnd, DWORD dwHeight, DWORD* pcyBegin, DWORD* pcyEnd)
+{
+	*pcyBegin = (yBegin + 1) >> 1;
+	*pcyEnd = ((yEnd + 1) >> 1 < (dwHeight >> 1)) ? (yEnd + 1) >> 1 : dwHeight >> 1;
+}
+
+//
+// Compares what tile (tx, ty) is computed from with the previous frame,
+// line by line, and stops at the first line that settles it.
+//
+bool CSketchTemporal::IsTileChanged(DWORD tx, DWORD ty) const
+{
+	const SKETCH_FRAME& frame = *m_pFrame;
+	const DWORD dwStep = m_kernel.dwBytesPerPixel;
+	DWORD xBegin, xEnd, yBegin, yEnd;
+
+	GetTile(tx, ty, &xBegin, &xEnd, &yBegin, &yEnd);
+
+	const DWORD dwHaloRows = TEMPORAL_HALO_ROWS + m_dwExtraReach;
+	const DWORD yFirst = (yBegin > dwHaloRows) ? yBegin - dwHaloRows : 0;
+	const DWORD yLast = (m_dwHeight - yEnd > dwHaloRows) ? yEnd + dwHaloRows : m_dwHeight;
+	const DWORD dwHaloLuma = TEMPORAL_HALO_RIGHT + m_dwExtraReach;
+	const DWORD dwHaloRight = (m_bChromaEdges && !m_kernel.bChromaPlane && TEMPORAL_HALO_RIGHT_CHROMA > dwHaloLuma) ?
+		TEMPORAL_HALO_RIGHT_CHROMA : dwHaloLuma;
+	const DWORD dwHaloLeft = (m_bDetector3x3 ? TEMPORAL_HALO_LEFT_3X3 : TEMPORAL_HALO_LEFT) + m_dwExtraReach;
+	const DWORD xFirst = (xBegin > dwHaloLeft) ? xBegin - dwHaloLeft : 0;
+	const DWORD xLast = (m_dwWidth - xEnd > dwHaloRight) ? xEnd + dwHaloRight : m_dwWidth;
+	const DWORD cb = (xLast - xFirst) * dwStep;
+	const UINT64 ullLimit = (UINT64)m_dwTolerance * (xLast - xFirst) * (yLast - yFirst);
+	const SKETCH_ROW_FNS* pRows = GetSketchRows();
+	UINT64 ullSad = 0;
+
+	for (DWORD y = yFirst; y < yLast; y++)
+	{
+		const BYTE* pSrc = frame.pSrc + (LONG)y * frame.lSrcStride + xFirst * dwStep;
+		const BYTE* pPrev = m_pPrevSrc + (size_t)y * m_cbLine + xFirst * dwStep;
+
+		if (m_dwTolerance == 0)
+		{
+			if (memcmp(pSrc, pPrev, cb) != 0)
+			{
+				return true;
+			}
+		}
+		else
+		{
+			ullSad += pRows->pfnSumAbsDiff(pSrc, pPrev, cb);
+			if (ullSad > ullLimit)
+			{
+				return true;
+			}
+		}
+	}
+
+	// The chroma pairs of the tile's own pixels are all its output reads,
+	// unless chroma gradients also read the pair after them, on the chroma
+	// lines of the tile's lines and the one below those.
+	if (m_kernel.bChromaPlane)
+	{
+		DWORD cyBegin, cyEnd;
+		DWORD cbEnd = xEnd;
+		GetChromaLines(yBegin, yEnd, m_dwHeight, &cyBegin, &cyEnd);
+
+		if (m_bChromaEdges)
+		{
+			cyBegin = yBegin >> 1;
+			cyEnd = (((yEnd - 1) >> 1) + 2 < (m_dwHeight >> 1)) ? ((yEnd - 1) >> 1) + 2 : m_dwHeight >> 1;
+			cbEnd = (m_dwWidth - xEnd > TEMPORAL_HALO_RIGHT_CHROMA) ? xEnd + TEMPORAL_HALO_RIGHT_CHROMA : m_dwWidth;
+		}
+
+		for (DWORD cy = cyBegin; cy < cyEnd; cy++)
+		{
+			const BYTE* pSrc = frame.pSrc + (LONG)(m_dwHeight + cy) * frame.lSrcStride + xBegin;
+			const BYTE* pPrev = m_pPrevSrc + (size_t)(m_dwHeight + cy) * m_cbLine + xBegin;
+
+			if (m_dwTolerance == 0)
+			{
+				if (memcmp(pSrc, pPrev, cbEnd - xBegin) != 0)
+				{
+					return true;
+				}
+			}
+			else
+			{
+				ullSad += pRows->pfnSumAbsDiff(pSrc, pPrev, cbEnd - xBegin);
+				if (ullSad > ullLimit)
+				{
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Copies the bytes of tile (tx, ty), luma and NV12 chroma, between two
+// buffers laid out like the frame.
+void CSketchTemporal::CopyTile(BYTE* pDest, LONG lDestStride, const BYTE* pSrc, LONG lSrcStride, DWORD tx, DWORD ty) const
+{
+	const DWORD dwStep = m_kernel.dwBytesPerPixel;
+	DWORD xBegin, xEnd, yBegin, yEnd;
+
+	GetTile(tx, ty, &xBegin, &xEnd, &yBegin, &yEnd);
+
+	for (DWORD y = yBegin; y < yEnd; y++)
+	{
+		memcpy(pDest + (LONG)y * lDestStride + xBegin * dwStep, pSrc + (LONG)y * lSrcStride + xBegin * dwStep,
+			(xEnd - xBegin) * dwStep);
+	}
+
+	if (m_kernel.bChromaPlane)
+	{
+		DWORD cyBegin, cyEnd;
+		GetChromaLines(yBegin, yEnd, m_dwHeight, &cyBegin, &cyEnd);
+
+		for (DWORD cy = cyBegin; cy < cyEnd; cy++)
+		{
+			const LONG y = (LONG)(m_dwHeight + cy);
+			memcpy(pDest + y * lDestStride + xBegin, pSrc + y * lSrcStride + xBegin, xEnd - xBegin);
+		}
+	}
+}
+
+// Tile rows run by the task over lines [yBegin, yEnd): those starting in it.
+#define FOR_EACH_TILE_ROW(ty, yBegin, yEnd) \
+	for (DWORD ty = ((yBegin) + m_dwTileRows - 1) / m_dwTileRows; ty < m_cTilesY && ty * m_dwTileRows < (yEnd); ty++)
+
+void CSketchTemporal::CompareRows(DWORD yBegin, DWORD yEnd)
+{
+	FOR_EACH_TILE_ROW(ty, yBegin, yEnd)
+	{
+		for (DWORD tx = 0; tx < m_cTilesX; tx++)
+		{
+			m_changed[(size_t)ty * m_cTilesX + tx] = IsTileChanged(tx, ty) ? 1 : 0;
+		}
+	}
+}
+
+//
+// Runs the kernel over each run of changed tiles in a row at once, and
+// keeps their source and output for the next frame; the other tiles get
+// the previous output.
+//
+void CSketchTemporal::ApplyRows(DWORD yBegin, DWORD yEnd, BYTE* pScratch)
+{
+	const SKETCH_FRAME& frame = *m_pFrame;
+	const LONG lLine = (LONG)m_cbLine;
+
+	FOR_EACH_TILE_ROW(ty, yBegin, yEnd)
+	{
+		const BYTE* pChanged = &m_changed[(size_t)ty * m_cTilesX];
+		DWORD tx = 0;
+
+		while (tx < m_cTilesX)
+		{
+			if (!pChanged[tx])
+			{
+				CopyTile(frame.pDest, frame.lDestStride, m_pPrevDest, lLine, tx, ty);
+				tx++;
+				continue;
+			}
+
+			DWORD txEnd = tx + 1;
+			while (txEnd < m_cTilesX && pChanged[txEnd])
+			{
+				txEnd++;
+			}
+
+			DWORD xBegin, xEnd, yTileBegin, yTileEnd, xUnused;
+			GetTile(tx, ty, &xBegin, &xUnused, &yTileBegin, &yTileEnd);
+			GetTile(txEnd - 1, ty, &xUnused, &xEnd, &yTileBegin, &yTileEnd);
+			m_kernel.pfnTile(frame, xBegin, xEnd, yTileBegin, yTileEnd, pScratch);
+
+			for ( ; tx < txEnd; tx++)
+			{
+				CopyTile(m_pPrevDest, lLine, frame.pDest, frame.lDestStride, tx, ty);
+				CopyTile(m_pPrevSrc, lLine, frame.pSrc, frame.lSrcStride, tx, ty);
+			}
+		}
+	}
+}
+
+#undef FOR_EACH_TILE_ROW
+
+void CSketchTemporal::CompareTask(void* pContext, DWORD yBegin, DWORD yEnd, BYTE* /*pScratch*/)
+{
+	((CSketchTemporal*)pContext)->CompareRows(yBegin, yEnd);
+}
+
+void CSketchTemporal::ApplyTask(void* pContext, DWORD yBegin, DWORD yEnd, BYTE* pScratch)
+{
+	((CSketchTemporal*)pContext)->ApplyRows(yBegin, yEnd, pScratch);
+}
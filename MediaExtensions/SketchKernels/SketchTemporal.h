@@ -0,0 +1,140 @@
+// Temporal change detection for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHTEMPORAL_H
+#define SKETCHTEMPORAL_H
+
+#include "SketchKernels.h"
+#include "SketchThreadPool.h"
+
+#include <vector>
+
+//
+// Most of a webcam frame is usually the same as in the frame before it.
+// CSketchTemporal keeps the last source frame and the output made from it,
+// cuts each new frame into tiles, and only runs the kernel over the tiles
+// whose source changed; the others get the previous output copied back.
+//
+// A tile counts as changed when anything its output is computed from
+// changed: its pixels, two lines above and below them and a column to the
+// left and two to the right (the reach of the filtered detectors), and for
+// NV12 the chroma of its pixels. Chroma-aware regions also read the
+// chroma of the pixel pair after the tile's last, and for NV12 of the
+// chroma line below; the 3x3 detectors a second column to the left, and
+// the Median5 pre-filter a line and a column more on every side. With a
+// tolerance of 0 a tile is changed when any of those bytes differs, and
+// the output is bit-identical to running the kernel over the whole frame.
+// A larger tolerance lets a tile through while the sum of absolute
+// differences over those bytes stays within tolerance per pixel, which
+// keeps sensor noise from recomputing a still scene at the cost of
+// exactness; the comparison is always against the source the tile's
+// output was last computed from, so slow drift still adds up to a
+// recompute.
+//
+// The first frame, and any frame after Reset or with a different size,
+// kernel, rectangle, regions or pre-filter than the one before, is computed
+// whole.
+//
+// Run must not be called from two threads at once, and the pool, if any,
+// is used for the whole frame.
+//
+
+// Default tile size: 128 pixels by 32 lines. Both must be even, for the
+// NV12 chroma pairs and lines.
+#define SKETCH_TEMPORAL_TILE_WIDTH  128
+#define SKETCH_TEMPORAL_TILE_ROWS   32
+
+// The tile form of a kernel and the layout it works on.
+struct SKETCH_TILE_KERNEL
+{
+    SKETCH_TILE_FN      pfnTile;
+    DWORD               dwBytesPerPixel;    // Of the luma lines.
+    bool                bChromaPlane;       // NV12: height/2 chroma lines follow the luma.
+};
+
+// Running totals since the object was created.
+struct SKETCH_TEMPORAL_COUNTERS
+{
+    UINT64      ullFrames;          // Frames run.
+    UINT64      ullTilesSkipped;    // Tiles copied from the previous output.
+    UINT64      ullTilesComputed;   // Tiles the kernel ran over.
+};
+
+class CSketchTemporal
+{
+public:
+    explicit CSketchTemporal(DWORD dwTolerance, DWORD dwTileWidth = SKETCH_TEMPORAL_TILE_WIDTH,
+        DWORD dwTileRows = SKETCH_TEMPORAL_TILE_ROWS);
+    ~CSketchTemporal();
+
+    DWORD GetTolerance() const { return m_dwTolerance; }
+
+    // Computes the next frame whole.
+    void Reset();
+
+    // Transforms the frame, on the pool if there is one and otherwise on
+    // the calling thread with pScratch (GetSketchScratchSize bytes for the
+    // frame's pre-filter).
+    // Returns false, without touching the frame, if the previous frame
+    // could not be allocated or the pool could not run.
+    bool Run(const SKETCH_TILE_KERNEL& kernel, const SKETCH_FRAME& frame, CSketchThreadPool* pPool, BYTE* pScratch);
+
+    const SKETCH_TEMPORAL_COUNTERS& GetCounters() const { return m_counters; }
+
+private:
+    CSketchTemporal(const CSketchTemporal&);
+    CSketchTemporal& operator=(const CSketchTemporal&);
+
+    bool Prepare(const SKETCH_TILE_KERNEL& kernel, const SKETCH_FRAME& frame);
+    bool RunPass(SKETCH_TASK_FN pfnTask, CSketchThreadPool* pPool, BYTE* pScratch);
+    void GetTile(DWORD tx, DWORD ty, DWORD* pxBegin, DWORD* pxEnd, DWORD* pyBegin, DWORD* pyEnd) const;
+    bool IsTileChanged(DWORD tx, DWORD ty) const;
+    void CopyTile(BYTE* pDest, LONG lDestStride, const BYTE* pSrc, LONG lSrcStride, DWORD tx, DWORD ty) const;
+    void CompareRows(DWORD yBegin, DWORD yEnd);
+    void ApplyRows(DWORD yBegin, DWORD yEnd, BYTE* pScratch);
+
+    static void CompareTask(void* pContext, DWORD yBegin, DWORD yEnd, BYTE* pScratch);
+    static void ApplyTask(void* pContext, DWORD yBegin, DWORD yEnd, BYTE* pScratch);
+
+    DWORD           m_dwTolerance;
+    DWORD           m_dwTileWidth;
+    DWORD           m_dwTileRows;
+
+    // What the previous frame was made with; a frame that differs in any
+    // of it is computed whole.
+    SKETCH_TILE_KERNEL  m_kernel;
+    DWORD           m_dwWidth;
+    DWORD           m_dwHeight;
+    SKETCH_RECT     m_rcDest;
+    SKETCH_REGION   m_rgRegions[SKETCH_MAX_REGIONS];
+    DWORD           m_cRegions;
+    SKETCH_PREFILTER m_prefilter;
+    DWORD           m_dwMedianRadius;
+    bool            m_bChromaEdges;     // A region is chroma-aware, which widens the reach.
+    bool            m_bDetector3x3;     // A region takes a 3x3 detector, which widens it too.
+    DWORD           m_dwExtraReach;     // Of the pre-filter, past the 3x3 ones'.
+    bool            m_bValid;           // The previous frame is in m_pPrevSrc and m_pPrevDest.
+
+    // The previous source and output, dense: the frame's lines (luma, then
+    // NV12 chroma) at m_cbLine bytes each.
+    BYTE*           m_pPrevSrc;
+    BYTE*           m_pPrevDest;
+    DWORD           m_cbLine;
+    DWORD           m_cLines;
+    size_t          m_cbAllocated;      // Of each.
+
+    DWORD           m_cTilesX;
+    DWORD           m_cTilesY;
+    std::vector<BYTE>   m_changed;      // Per tile, row by row.
+
+    // The frame being run.
+    const SKETCH_FRAME* m_pFrame;
+
+    SKETCH_TEMPORAL_COUNTERS    m_counters;
+};
+
+#endif
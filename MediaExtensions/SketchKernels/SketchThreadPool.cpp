@@ -0,0 +1,305 @@
+// Band-parallel execution of the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchThreadPool.h"
+#include "SketchScratch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+
+CSketchThreadPool::CSketchThreadPool(DWORD dwThreads, DWORD dwTileRows) :
+	m_dwThreads(1), m_dwTileRows(SKETCH_DEFAULT_TILE_ROWS), m_pQueues(NULL), m_cbScratch(0),
+	m_dwGeneration(0), m_dwPending(0), m_bExit(false), m_pfnTask(NULL), m_pContext(NULL)
+{
+	SetTileRows(dwTileRows);
+
+	if (dwThreads == 0)
+	{
+		dwThreads = std::thread::hardware_concurrency();
+	}
+	if (dwThreads == 0)
+	{
+		dwThreads = 1;
+	}
+	if (dwThreads > SKETCH_MAX_THREADS)
+	{
+		dwThreads = SKETCH_MAX_THREADS;
+	}
+
+	// The queues must exist before the first worker looks at them. Only
+	// the first m_dwThreads are used if some workers fail to start. If
+	// they, or the room for the per-thread state, cannot be allocated, the
+	// pool starts no threads and IsRunning returns false.
+	m_pQueues = new (std::nothrow) TILE_QUEUE[dwThreads];
+	if (m_pQueues == NULL)
+	{
+		return;
+	}
+	for (DWORD i = 0; i < dwThreads; i++)
+	{
+		m_pQueues[i].dwBegin = m_pQueues[i].dwEnd = 0;
+	}
+
+	try
+	{
+		m_workers.reserve(dwThreads - 1);
+		m_scratch.reserve(dwThreads);
+		m_counters.reserve(dwThreads);
+	}
+	catch (...)
+	{
+		delete [] m_pQueues;
+		m_pQueues = NULL;
+		return;
+	}
+
+	// Thread 0 is the caller of Run.
+	for (DWORD i = 1; i < dwThreads; i++)
+	{
+		try
+		{
+			m_workers.push_back(std::thread(&CSketchThreadPool::WorkerThread, this, i));
+		}
+		catch (...)
+		{
+			break;
+		}
+		m_dwThreads++;
+	}
+
+	m_scratch.resize(m_dwThreads, (BYTE*)NULL);
+	m_counters.resize(m_dwThreads);
+	ResetThreadCounters();
+}
+
+CSketchThreadPool::~CSketchThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_bExit = true;
+	}
+	m_cvStart.notify_all();
+
+	for (size_t i = 0; i < m_workers.size(); i++)
+	{
+		m_workers[i].join();
+	}
+	for (size_t i = 0; i < m_scratch.size(); i++)
+	{
+		SketchAlignedFree(m_scratch[i]);
+	}
+	delete [] m_pQueues;
+}
+
+void CSketchThreadPool::SetTileRows(DWORD dwTileRows)
+{
+	m_dwTileRows = (dwTileRows == 0) ? SKETCH_DEFAULT_TILE_ROWS : dwTileRows;
+}
+
+void CSketchThreadPool::ResetThreadCounters()
+{
+	if (m_counters.empty())
+	{
+		return;
+	}
+	memset(&m_counters[0], 0, m_counters.size() * sizeof(SKETCH_THREAD_COUNTERS));
+}
+
+bool CSketchThreadPool::ReserveTiles(DWORD dwHeight)
+{
+	const DWORD dwTiles = (DWORD)(((UINT64)dwHeight + m_dwTileRows - 1) / m_dwTileRows);
+
+	// Once the capacity is there, resizing the list within it never
+	// allocates or throws.
+	try
+	{
+		m_timings.reserve(dwTiles);
+	}
+	catch (...)
+	{
+		return false;
+	}
+	return true;
+}
+
+bool CSketchThreadPool::ReserveScratch(DWORD cbScratch)
+{
+	if (cbScratch <= m_cbScratch)
+	{
+		return true;
+	}
+
+	// Each thread's scratch starts on its own cache line, so the rings of
+	// neighbouring threads never share one. The old contents are not kept.
+	for (size_t i = 0; i < m_scratch.size(); i++)
+	{
+		SketchAlignedFree(m_scratch[i]);
+		m_scratch[i] = SketchAlignedAlloc(cbScratch);
+		if (m_scratch[i] == NULL)
+		{
+			m_cbScratch = 0;
+			return false;
+		}
+	}
+	m_cbScratch = cbScratch;
+	return true;
+}
+
+// Takes the next tile from the thread's own queue, or else steals the last
+// tile of the next non-empty queue. Returns false when all are empty; no
+// tiles are added during a frame, so the thread is then done.
+bool CSketchThreadPool::TakeTile(DWORD dwThread, DWORD* pdwTile, bool* pbStolen)
+{
+	{
+		TILE_QUEUE& own = m_pQueues[dwThread];
+		std::lock_guard<std::mutex> lock(own.lock);
+		if (own.dwBegin < own.dwEnd)
+		{
+			*pdwTile = own.dwBegin++;
+			*pbStolen = false;
+			return true;
+		}
+	}
+
+	for (DWORD i = 1; i < m_dwThreads; i++)
+	{
+		TILE_QUEUE& victim = m_pQueues[(dwThread + i) % m_dwThreads];
+		std::lock_guard<std::mutex> lock(victim.lock);
+		if (victim.dwBegin < victim.dwEnd)
+		{
+			*pdwTile = --victim.dwEnd;
+			*pbStolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void CSketchThreadPool::RunTiles(DWORD dwThread)
+{
+	SKETCH_THREAD_COUNTERS& counters = m_counters[dwThread];
+	DWORD dwTile;
+	bool bStolen;
+
+	while (TakeTile(dwThread, &dwTile, &bStolen))
+	{
+		SKETCH_TILE_TIMING& timing = m_timings[dwTile];
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		(*m_pfnTask)(m_pContext, timing.yBegin, timing.yEnd, m_scratch[dwThread]);
+		std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+
+		timing.dwThread = dwThread;
+		timing.bStolen = bStolen;
+		timing.ullNanoseconds = (UINT64)elapsed.count();
+
+		counters.ullTiles++;
+		counters.ullStolen += bStolen ? 1 : 0;
+		counters.ullBusyNanoseconds += timing.ullNanoseconds;
+	}
+}
+
+void CSketchThreadPool::WorkerThread(DWORD dwThread)
+{
+	DWORD dwGeneration = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			while (!m_bExit && m_dwGeneration == dwGeneration)
+			{
+				m_cvStart.wait(lock);
+			}
+			if (m_bExit)
+			{
+				return;
+			}
+			dwGeneration = m_dwGeneration;
+		}
+
+		RunTiles(dwThread);
+
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			if (--m_dwPending == 0)
+			{
+				m_cvDone.notify_one();
+			}
+		}
+	}
+}
+
+// Run's task: a band function over one frame.
+struct BAND_TASK
+{
+	SKETCH_BAND_FN      pfnBand;
+	const SKETCH_FRAME* pFrame;
+};
+
+static void RunBand(void* pContext, DWORD yBegin, DWORD yEnd, BYTE* pScratch)
+{
+	const BAND_TASK* pTask = (const BAND_TASK*)pContext;
+	(*pTask->pfnBand)(*pTask->pFrame, yBegin, yEnd, pScratch);
+}
+
+bool CSketchThreadPool::Run(SKETCH_BAND_FN pfnBand, const SKETCH_FRAME& frame)
+{
+	BAND_TASK task = { pfnBand, &frame };
+	return RunTask(RunBand, &task, frame.dwHeightInPixels, GetSketchScratchSize(frame.dwWidthInPixels, frame.prefilter, frame.dwMedianRadius));
+}
+
+bool CSketchThreadPool::RunTask(SKETCH_TASK_FN pfnTask, void* pContext, DWORD dwHeight, DWORD cbScratch)
+{
+	if (!IsRunning() || !ReserveScratch(cbScratch) || !ReserveTiles(dwHeight))
+	{
+		return false;
+	}
+
+	// Cut the lines into tiles and deal them out in contiguous runs, so
+	// each thread starts on neighbouring lines.
+	const DWORD dwTiles = (DWORD)(((UINT64)dwHeight + m_dwTileRows - 1) / m_dwTileRows);
+
+	m_timings.resize(dwTiles);
+	for (DWORD i = 0; i < dwTiles; i++)
+	{
+		SKETCH_TILE_TIMING& timing = m_timings[i];
+		timing.yBegin = i * m_dwTileRows;
+		timing.yEnd = (dwHeight - timing.yBegin > m_dwTileRows) ? timing.yBegin + m_dwTileRows : dwHeight;
+		timing.dwThread = 0;
+		timing.bStolen = false;
+		timing.ullNanoseconds = 0;
+	}
+	for (DWORD i = 0; i < m_dwThreads; i++)
+	{
+		m_pQueues[i].dwBegin = (DWORD)((UINT64)dwTiles * i / m_dwThreads);
+		m_pQueues[i].dwEnd = (DWORD)((UINT64)dwTiles * (i + 1) / m_dwThreads);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_pfnTask = pfnTask;
+		m_pContext = pContext;
+		m_dwPending = m_dwThreads - 1;
+		m_dwGeneration++;
+	}
+	m_cvStart.notify_all();
+
+	RunTiles(0);
+
+	{
+		std::unique_lock<std::mutex> lock(m_lock);
+		while (m_dwPending != 0)
+		{
+			m_cvDone.wait(lock);
+		}
+		m_pContext = NULL;
+	}
+	return true;
+}
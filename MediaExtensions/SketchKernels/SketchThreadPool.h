@@ -0,0 +1,151 @@
+// Band-parallel execution of the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHTHREADPOOL_H
+#define SKETCHTHREADPOOL_H
+
+#include "SketchKernels.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Default tile height, in lines.
+#define SKETCH_DEFAULT_TILE_ROWS    64
+
+// Most threads a pool runs, the caller included.
+#define SKETCH_MAX_THREADS          64
+
+// Function pointer for work other than a band function, over lines
+// [yBegin, yEnd) of something dwHeight lines tall (see RunTask).
+typedef void (*SKETCH_TASK_FN)(
+    void*       pContext,           // As passed to RunTask.
+    DWORD       yBegin,             // First line.
+    DWORD       yEnd,               // One past the last line.
+    BYTE*       pScratch            // The thread's scratch, cbScratch bytes.
+    );
+
+// Where and how long one tile of the last frame ran.
+struct SKETCH_TILE_TIMING
+{
+    DWORD       yBegin;             // First line of the tile.
+    DWORD       yEnd;               // One past its last line.
+    DWORD       dwThread;           // Thread that ran it; 0 is the caller of Run.
+    bool        bStolen;            // Taken from another thread's queue.
+    UINT64      ullNanoseconds;     // Time spent in the band or task function.
+};
+
+// Running totals for one thread since the pool was created or reset.
+struct SKETCH_THREAD_COUNTERS
+{
+    UINT64      ullTiles;           // Tiles run.
+    UINT64      ullStolen;          // Of which taken from another queue.
+    UINT64      ullBusyNanoseconds; // Time spent in the band or task function.
+};
+
+//
+// CSketchThreadPool cuts a frame into tiles of whole lines and runs a
+// SKETCH_BAND_FN over them. The worker threads are started once and sleep
+// between frames; the calling thread works as thread 0.
+//
+// Each thread starts with a contiguous run of tiles in its own queue and
+// takes from its front. A thread whose queue is empty steals from the back
+// of another queue, so a slow core (an efficiency core on a hybrid part,
+// or one interrupted by something else) hands its remaining tiles to
+// faster ones instead of holding up the frame.
+//
+// Tiles never share output lines and only read the source, and a kernel's
+// band form recomputes the one-line halo it needs from the neighbouring
+// tile (see SketchPipeline.h), so the result is bit-identical to the
+// serial SKETCH_TRANSFORM_FN whatever the thread count or tile height.
+//
+// Run must not be called from two threads at once, nor concurrently with
+// the other members.
+//
+class CSketchThreadPool
+{
+public:
+    // dwThreads counts the calling thread; 0 means one per hardware thread.
+    // At most SKETCH_MAX_THREADS are started, and fewer than asked for if
+    // the system refuses.
+    explicit CSketchThreadPool(DWORD dwThreads, DWORD dwTileRows = SKETCH_DEFAULT_TILE_ROWS);
+    ~CSketchThreadPool();
+
+    // False if the pool could not be set up; Run and RunTask then fail.
+    bool IsRunning() const { return m_pQueues != NULL; }
+
+    DWORD GetThreadCount() const { return m_dwThreads; }
+
+    DWORD GetTileRows() const { return m_dwTileRows; }
+    void SetTileRows(DWORD dwTileRows);
+
+    // Makes room for the tiles of a frame up to dwHeight lines tall at the
+    // current tile height, so that Run and RunTask need not allocate for
+    // them. Returns false if the room could not be allocated; they then
+    // try again, and fail if it still cannot be.
+    bool ReserveTiles(DWORD dwHeight);
+
+    // Transforms the frame tile by tile and returns when every tile is
+    // done. Returns false, without touching the frame, if the pool is not
+    // running or the per-thread scratch or the tile list could not be
+    // allocated.
+    bool Run(SKETCH_BAND_FN pfnBand, const SKETCH_FRAME& frame);
+
+    // The same for any task: lines [0, dwHeight) are cut into tiles and
+    // pfnTask runs once per tile, with cbScratch bytes of scratch. Returns
+    // false, without running anything, if the pool is not running or the
+    // scratch or the tile list could not be allocated.
+    bool RunTask(SKETCH_TASK_FN pfnTask, void* pContext, DWORD dwHeight, DWORD cbScratch);
+
+    // Tiles of the last frame, top to bottom.
+    const std::vector<SKETCH_TILE_TIMING>& GetTileTimings() const { return m_timings; }
+
+    // Totals per thread, indexed like SKETCH_TILE_TIMING::dwThread.
+    const SKETCH_THREAD_COUNTERS& GetThreadCounters(DWORD dwThread) const { return m_counters[dwThread]; }
+    void ResetThreadCounters();
+
+private:
+    CSketchThreadPool(const CSketchThreadPool&);
+    CSketchThreadPool& operator=(const CSketchThreadPool&);
+
+    // Tiles [dwBegin, dwEnd) not yet taken. The owner takes from the
+    // front, other threads from the back.
+    struct TILE_QUEUE
+    {
+        std::mutex  lock;
+        DWORD       dwBegin;
+        DWORD       dwEnd;
+    };
+
+    bool ReserveScratch(DWORD cbScratch);
+    bool TakeTile(DWORD dwThread, DWORD* pdwTile, bool* pbStolen);
+    void RunTiles(DWORD dwThread);
+    void WorkerThread(DWORD dwThread);
+
+    DWORD                       m_dwThreads;
+    DWORD                       m_dwTileRows;
+    std::vector<std::thread>    m_workers;
+    TILE_QUEUE                  *m_pQueues;         // One per thread.
+    std::vector<BYTE*>          m_scratch;          // One per thread, aligned.
+    DWORD                       m_cbScratch;        // Size of each.
+    std::vector<SKETCH_TILE_TIMING>     m_timings;
+    std::vector<SKETCH_THREAD_COUNTERS> m_counters;
+
+    std::mutex                  m_lock;
+    std::condition_variable     m_cvStart;          // Workers wait for a frame.
+    std::condition_variable     m_cvDone;           // Run waits for the workers.
+    DWORD                       m_dwGeneration;     // Bumped for every frame.
+    DWORD                       m_dwPending;        // Workers still running.
+    bool                        m_bExit;
+
+    // The task being run.
+    SKETCH_TASK_FN              m_pfnTask;
+    void*                       m_pContext;
+};
+
+#endif
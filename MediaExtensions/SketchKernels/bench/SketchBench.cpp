@@ -0,0 +1,185 @@
+// Benchmark for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+//
+// Times the vectorized median filters against the per-pixel GetMedian loop
+// they replaced, after checking that both produce the same plane. Then
+// times the filtered edge detectors serially against CSketchThreadPool,
+// after checking that the tiles reproduce the serial frame, and shows how
+// evenly the tiles spread over the threads.
+//
+// Usage: SketchBench [width height [iterations [threads [tilerows]]]]
+//
+
+#include "SketchKernels.h"
+#include "SketchThreadPool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+typedef void (*MEDIAN_FN)(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, BYTE*);
+
+// The GetMedian loop MedianFilter_* used before the vectorized rows.
+// dwStep/dwOffset locate the luma samples in a row (1/0 for NV12,
+// 2/0 for YUY2, 2/1 for UYVY).
+static void MedianFilter_GetMedian(BYTE* pDest, const BYTE* pSrc, LONG lSrcStride, DWORD dwStep, DWORD dwOffset,
+	DWORD dwWidthInPixels, DWORD dwHeightInPixels)
+{
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		const BYTE* pRow = pSrc + y * lSrcStride + dwOffset;
+		BYTE* pOut = pDest + y * dwWidthInPixels;
+
+		for (DWORD x = 0; x < dwWidthInPixels; x++)
+		{
+			const LONG o = (LONG)(x * dwStep);
+			const LONG s = (LONG)dwStep;
+
+			if (y == 0 || y == dwHeightInPixels - 1 || x == 0 || x == dwWidthInPixels - 1)
+			{
+				pOut[x] = pRow[o];
+				continue;
+			}
+			pOut[x] = GetMedian(pRow[o-s-lSrcStride], pRow[o-lSrcStride], pRow[o+s-lSrcStride],
+								pRow[o-s],            pRow[o],            pRow[o+s],
+								pRow[o-s+lSrcStride], pRow[o+lSrcStride], pRow[o+s+lSrcStride]);
+		}
+	}
+}
+
+template <class FN>
+static double TimeIt(DWORD dwIterations, FN fn)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (DWORD i = 0; i < dwIterations; i++)
+	{
+		fn();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / dwIterations;
+}
+
+int main(int argc, char** argv)
+{
+	DWORD dwWidth = 1920, dwHeight = 1080, dwIterations = 20, dwThreads = 0, dwTileRows = SKETCH_DEFAULT_TILE_ROWS;
+	if (argc >= 3)
+	{
+		dwWidth = (DWORD)atoi(argv[1]);
+		dwHeight = (DWORD)atoi(argv[2]);
+	}
+	if (argc >= 4)
+	{
+		dwIterations = (DWORD)atoi(argv[3]);
+	}
+	if (argc >= 5)
+	{
+		dwThreads = (DWORD)atoi(argv[4]);
+	}
+	if (argc >= 6)
+	{
+		dwTileRows = (DWORD)atoi(argv[5]);
+	}
+	if (dwWidth < 3 || dwHeight < 3 || dwIterations == 0)
+	{
+		fprintf(stderr, "usage: %s [width height [iterations [threads [tilerows]]]]\n", argv[0]);
+		return 2;
+	}
+
+	struct FORMAT
+	{
+		const char* pszName;
+		DWORD       dwStep;
+		DWORD       dwOffset;
+		MEDIAN_FN   pfn;
+		SKETCH_TRANSFORM_FN pfnEdge;
+		SKETCH_BAND_FN pfnEdgeBand;
+	};
+	const FORMAT formats[] =
+	{
+		{ "NV12", 1, 0, MedianFilter<SKETCH_LAYOUT_NV12>, EdgeDectectionF<SKETCH_LAYOUT_NV12>, EdgeDectectionFBand<SKETCH_LAYOUT_NV12> },
+		{ "YUY2", 2, 0, MedianFilter<SKETCH_LAYOUT_YUY2>, EdgeDectectionF<SKETCH_LAYOUT_YUY2>, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2> },
+		{ "UYVY", 2, 1, MedianFilter<SKETCH_LAYOUT_UYVY>, EdgeDectectionF<SKETCH_LAYOUT_UYVY>, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY> },
+	};
+
+	CSketchThreadPool pool(dwThreads, dwTileRows);
+
+	int result = 0;
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+	{
+		const FORMAT& fmt = formats[f];
+		const LONG lSrcStride = (LONG)(dwWidth * fmt.dwStep);
+
+		// Noisy content so the quickselect sees realistic, varied input.
+		std::vector<BYTE> src(lSrcStride * dwHeight);
+		unsigned int seed = 12345;
+		for (size_t i = 0; i < src.size(); i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			src[i] = (BYTE)(((i % lSrcStride) * 255 / lSrcStride + ((seed >> 16) & 63)) & 0xFF);
+		}
+
+		std::vector<BYTE> ref(dwWidth * dwHeight), out(dwWidth * dwHeight), scratch(GetSketchScratchSize(dwWidth));
+		MedianFilter_GetMedian(&ref[0], &src[0], lSrcStride, fmt.dwStep, fmt.dwOffset, dwWidth, dwHeight);
+		fmt.pfn(&out[0], &src[0], lSrcStride, dwWidth, dwWidth, dwHeight, &scratch[0]);
+		if (ref != out)
+		{
+			fprintf(stderr, "%s: MedianFilter output differs from GetMedian\n", fmt.pszName);
+			result = 1;
+			continue;
+		}
+
+		double nsRef = TimeIt(dwIterations, [&]() {
+			MedianFilter_GetMedian(&ref[0], &src[0], lSrcStride, fmt.dwStep, fmt.dwOffset, dwWidth, dwHeight);
+		});
+		double nsNew = TimeIt(dwIterations, [&]() {
+			fmt.pfn(&out[0], &src[0], lSrcStride, dwWidth, dwWidth, dwHeight, &scratch[0]);
+		});
+
+		printf("%s %ux%u  GetMedian %10.0f ns/frame  MedianFilter %10.0f ns/frame  x%.1f\n",
+			fmt.pszName, dwWidth, dwHeight, nsRef, nsNew, nsRef / nsNew);
+
+		// NV12 output carries the chroma plane below the luma.
+		const size_t cbFrame = lSrcStride * dwHeight + ((fmt.dwStep == 1) ? lSrcStride * (dwHeight / 2) : 0);
+		std::vector<BYTE> serial(cbFrame), banded(cbFrame);
+		const SKETCH_RECT rcDest = { 0, 0, dwWidth, dwHeight };
+		const SKETCH_FRAME frame = { rcDest, &banded[0], lSrcStride, &src[0], lSrcStride, dwWidth, dwHeight, NULL, 0,
+			SKETCH_PREFILTER_MEDIAN3, 0 };
+
+		fmt.pfnEdge(rcDest, &serial[0], lSrcStride, &src[0], lSrcStride, dwWidth, dwHeight, &scratch[0]);
+		if (!pool.Run(fmt.pfnEdgeBand, frame) || serial != banded)
+		{
+			fprintf(stderr, "%s: tiled EdgeDectectionF output differs from serial\n", fmt.pszName);
+			result = 1;
+			continue;
+		}
+
+		double nsSerial = TimeIt(dwIterations, [&]() {
+			fmt.pfnEdge(rcDest, &serial[0], lSrcStride, &src[0], lSrcStride, dwWidth, dwHeight, &scratch[0]);
+		});
+		pool.ResetThreadCounters();
+		double nsBanded = TimeIt(dwIterations, [&]() {
+			pool.Run(fmt.pfnEdgeBand, frame);
+		});
+
+		printf("%s %ux%u  EdgeDectectionF %10.0f ns/frame  %u threads %10.0f ns/frame  x%.1f\n",
+			fmt.pszName, dwWidth, dwHeight, nsSerial, pool.GetThreadCount(), nsBanded, nsSerial / nsBanded);
+
+		// Per-thread share of the work; a thread far below the others
+		// was starved or slow.
+		for (DWORD t = 0; t < pool.GetThreadCount(); t++)
+		{
+			const SKETCH_THREAD_COUNTERS& counters = pool.GetThreadCounters(t);
+			printf("    thread %u  %6llu tiles  %6llu stolen  %10.0f ns/frame busy\n", t,
+				(unsigned long long)counters.ullTiles, (unsigned long long)counters.ullStolen,
+				(double)counters.ullBusyNanoseconds / dwIterations);
+		}
+	}
+	return result;
+}
@@ -0,0 +1,735 @@
+// Benchmark suite for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+//
+// Times every kernel (median per format, edge per format with and without
+// the median, YUY2toRGB, the RGB edge path, the scaled path at 2x and
+// 4x, the filtered edges in place, the chroma-aware edges to compare
+// with the RGB path, the 3x3 detectors, the pre-filters, and the
+// median at radii 1 to 8) on one thread, at each frame size
+// and on each kind of content. Reports ns/frame, MPix/s and the bytes
+// per pixel the kernel reads from the source and writes to the destination
+// (scratch traffic is not counted). With --json the results also go to a
+// file, for tracking across changes.
+//
+// Each case is timed in batches. The batch is doubled until it lasts
+// --batch-ms, then --repetitions batches run and the median and fastest
+// are reported.
+//
+// Usage: SketchBenchSuite [--filter text] [--sizes WxH,...] [--repetitions n]
+//                         [--batch-ms ms] [--tier name] [--packed-luma mode]
+//                         [--json file] [--list]
+//
+// --tier runs the kernels on one instruction set tier (see SketchCpu.h)
+// rather than the widest the CPU has. --packed-luma strided|planar forces
+// how MedianFilter and EdgeDectection read YUY2/UYVY luma (see
+// SetSketchPackedLuma); running the suite once with each shows where the
+// planar path starts to pay.
+//
+
+#include "SketchKernels.h"
+#include "SketchScratch.h"
+#include "SketchCpu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+enum BENCH_FORMAT
+{
+	BENCH_NV12,
+	BENCH_YUY2,
+	BENCH_UYVY
+};
+
+enum BENCH_KIND
+{
+	BENCH_MEDIAN,       // MedianFilter: luma to a dense plane.
+	BENCH_EDGE,         // EdgeDectection or EdgeDectectionF.
+	BENCH_TO_RGB,       // YUY2toRGB.
+	BENCH_RGB_EDGE,     // EdgeDectection_YUY2RGB.
+	BENCH_SCALED,       // EdgeDectectionScaled.
+	BENCH_IN_PLACE,     // EdgeDectection or EdgeDectectionF over the source.
+	BENCH_REGION_EDGE,  // The band form over the frame as one region with bChroma and bDetector,
+	                    // and prefilter.
+	BENCH_MEDIAN_RADIUS // MedianFilterRadius at dwRadius.
+};
+
+enum BENCH_CONTENT
+{
+	BENCH_SCENE,        // Shapes, gradients, texture and sensor noise.
+	BENCH_NOISE,        // Uniform noise: the worst case for the median.
+	BENCH_FLAT,         // One grey level: the best case.
+	BENCH_CONTENT_COUNT
+};
+
+static const char* const g_rgszContent[BENCH_CONTENT_COUNT] = { "scene", "noise", "flat" };
+
+typedef void (*MEDIAN_FN)(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, BYTE*);
+typedef void (*MEDIAN_RADIUS_FN)(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, DWORD, BYTE*);
+
+struct BENCH_KERNEL
+{
+	std::string             strName;
+	BENCH_KIND              kind;
+	BENCH_FORMAT            format;
+	double                  cbReadPerPixel;
+	double                  cbWrittenPerPixel;
+	MEDIAN_FN               pfnMedian;
+	SKETCH_TRANSFORM_FN     pfnEdge;
+	SKETCH_SCALED_FN        pfnScaled;
+	DWORD                   dwScale;
+	SKETCH_BAND_FN          pfnBand;
+	BYTE                    bChroma;
+	BYTE                    bDetector;
+	SKETCH_PREFILTER        prefilter;
+	DWORD                   dwMedianRadius;     // Of SKETCH_PREFILTER_MEDIAN_RADIUS.
+	MEDIAN_RADIUS_FN        pfnMedianRadius;
+	DWORD                   dwRadius;
+};
+
+//
+// The kernel of each kind; what the kind does not use is left zero.
+//
+static BENCH_KERNEL Kernel(const char* pszName, BENCH_KIND kind, BENCH_FORMAT format, double cbRead, double cbWritten)
+{
+	BENCH_KERNEL kernel = BENCH_KERNEL();
+	kernel.strName = pszName;
+	kernel.kind = kind;
+	kernel.format = format;
+	kernel.cbReadPerPixel = cbRead;
+	kernel.cbWrittenPerPixel = cbWritten;
+	kernel.prefilter = SKETCH_PREFILTER_MEDIAN3;
+	return kernel;
+}
+
+static BENCH_KERNEL MedianKernel(const char* pszName, BENCH_FORMAT format, MEDIAN_FN pfnMedian, double cbRead)
+{
+	BENCH_KERNEL kernel = Kernel(pszName, BENCH_MEDIAN, format, cbRead, 1.0);
+	kernel.pfnMedian = pfnMedian;
+	return kernel;
+}
+
+static BENCH_KERNEL EdgeKernel(const char* pszName, BENCH_KIND kind, BENCH_FORMAT format, SKETCH_TRANSFORM_FN pfnEdge,
+	double cbRead, double cbWritten)
+{
+	BENCH_KERNEL kernel = Kernel(pszName, kind, format, cbRead, cbWritten);
+	kernel.pfnEdge = pfnEdge;
+	return kernel;
+}
+
+static BENCH_KERNEL ScaledKernel(const char* pszName, BENCH_FORMAT format, SKETCH_SCALED_FN pfnScaled, DWORD dwScale,
+	double cbRead, double cbWritten)
+{
+	BENCH_KERNEL kernel = Kernel(pszName, BENCH_SCALED, format, cbRead, cbWritten);
+	kernel.pfnScaled = pfnScaled;
+	kernel.dwScale = dwScale;
+	return kernel;
+}
+
+static BENCH_KERNEL RegionKernel(const char* pszName, BENCH_FORMAT format, SKETCH_BAND_FN pfnBand, double cbRead,
+	double cbWritten, BYTE bChroma, BYTE bDetector, SKETCH_PREFILTER prefilter = SKETCH_PREFILTER_MEDIAN3,
+	DWORD dwMedianRadius = 0)
+{
+	BENCH_KERNEL kernel = Kernel(pszName, BENCH_REGION_EDGE, format, cbRead, cbWritten);
+	kernel.pfnBand = pfnBand;
+	kernel.bChroma = bChroma;
+	kernel.bDetector = bDetector;
+	kernel.prefilter = prefilter;
+	kernel.dwMedianRadius = dwMedianRadius;
+	return kernel;
+}
+
+static BENCH_KERNEL MedianRadiusKernel(const char* pszName, BENCH_FORMAT format, MEDIAN_RADIUS_FN pfnMedianRadius,
+	DWORD dwRadius, double cbRead)
+{
+	BENCH_KERNEL kernel = Kernel(pszName, BENCH_MEDIAN_RADIUS, format, cbRead, 1.0);
+	kernel.pfnMedianRadius = pfnMedianRadius;
+	kernel.dwRadius = dwRadius;
+	return kernel;
+}
+
+static const BENCH_KERNEL g_rgKernels[] =
+{
+	MedianKernel("MedianFilter_NV12", BENCH_NV12, MedianFilter<SKETCH_LAYOUT_NV12>, 1.0),
+	MedianKernel("MedianFilter_YUY2", BENCH_YUY2, MedianFilter<SKETCH_LAYOUT_YUY2>, 2.0),
+	MedianKernel("MedianFilter_UYVY", BENCH_UYVY, MedianFilter<SKETCH_LAYOUT_UYVY>, 2.0),
+	EdgeKernel("EdgeDectection_NV12", BENCH_EDGE, BENCH_NV12, EdgeDectection<SKETCH_LAYOUT_NV12>, 1.0, 1.5),
+	EdgeKernel("EdgeDectection_YUY2", BENCH_EDGE, BENCH_YUY2, EdgeDectection<SKETCH_LAYOUT_YUY2>, 2.0, 2.0),
+	EdgeKernel("EdgeDectection_UYVY", BENCH_EDGE, BENCH_UYVY, EdgeDectection<SKETCH_LAYOUT_UYVY>, 2.0, 2.0),
+	EdgeKernel("EdgeDectectionF_NV12", BENCH_EDGE, BENCH_NV12, EdgeDectectionF<SKETCH_LAYOUT_NV12>, 1.0, 1.5),
+	EdgeKernel("EdgeDectectionF_YUY2", BENCH_EDGE, BENCH_YUY2, EdgeDectectionF<SKETCH_LAYOUT_YUY2>, 2.0, 2.0),
+	EdgeKernel("EdgeDectectionF_UYVY", BENCH_EDGE, BENCH_UYVY, EdgeDectectionF<SKETCH_LAYOUT_UYVY>, 2.0, 2.0),
+	Kernel("YUY2toRGB", BENCH_TO_RGB, BENCH_YUY2, 2.0, 3.0),
+	Kernel("EdgeDectection_YUY2RGB", BENCH_RGB_EDGE, BENCH_YUY2, 2.0, 2.0),
+	ScaledKernel("EdgeDectectionScaled2_NV12", BENCH_NV12, EdgeDectectionScaled<SKETCH_LAYOUT_NV12>, SKETCH_SCALE_2X, 1.0, 1.5),
+	ScaledKernel("EdgeDectectionScaled2_YUY2", BENCH_YUY2, EdgeDectectionScaled<SKETCH_LAYOUT_YUY2>, SKETCH_SCALE_2X, 2.0, 2.0),
+	ScaledKernel("EdgeDectectionScaled2_UYVY", BENCH_UYVY, EdgeDectectionScaled<SKETCH_LAYOUT_UYVY>, SKETCH_SCALE_2X, 2.0, 2.0),
+	ScaledKernel("EdgeDectectionScaled4_NV12", BENCH_NV12, EdgeDectectionScaled<SKETCH_LAYOUT_NV12>, SKETCH_SCALE_4X, 1.0, 1.5),
+	ScaledKernel("EdgeDectectionScaled4_YUY2", BENCH_YUY2, EdgeDectectionScaled<SKETCH_LAYOUT_YUY2>, SKETCH_SCALE_4X, 2.0, 2.0),
+	ScaledKernel("EdgeDectectionScaled4_UYVY", BENCH_UYVY, EdgeDectectionScaled<SKETCH_LAYOUT_UYVY>, SKETCH_SCALE_4X, 2.0, 2.0),
+	EdgeKernel("EdgeDectectionFInPlace_NV12", BENCH_IN_PLACE, BENCH_NV12, EdgeDectectionF<SKETCH_LAYOUT_NV12>, 1.0, 1.5),
+	EdgeKernel("EdgeDectectionFInPlace_YUY2", BENCH_IN_PLACE, BENCH_YUY2, EdgeDectectionF<SKETCH_LAYOUT_YUY2>, 2.0, 2.0),
+	EdgeKernel("EdgeDectectionFInPlace_UYVY", BENCH_IN_PLACE, BENCH_UYVY, EdgeDectectionF<SKETCH_LAYOUT_UYVY>, 2.0, 2.0),
+	RegionKernel("EdgeDectectionChroma_NV12", BENCH_NV12, EdgeDectectionBand<SKETCH_LAYOUT_NV12>, 1.5, 1.5, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionChroma_YUY2", BENCH_YUY2, EdgeDectectionBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionChroma_UYVY", BENCH_UYVY, EdgeDectectionBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionFChroma_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.5, 1.5, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionFChroma_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionFChroma_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 1, SKETCH_DETECTOR_ROBERTS),
+	RegionKernel("EdgeDectectionSobel_NV12", BENCH_NV12, EdgeDectectionBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionSobel_YUY2", BENCH_YUY2, EdgeDectectionBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionSobel_UYVY", BENCH_UYVY, EdgeDectectionBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionScharr_NV12", BENCH_NV12, EdgeDectectionBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionScharr_YUY2", BENCH_YUY2, EdgeDectectionBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionScharr_UYVY", BENCH_UYVY, EdgeDectectionBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionLaplacian_NV12", BENCH_NV12, EdgeDectectionBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionLaplacian_YUY2", BENCH_YUY2, EdgeDectectionBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionLaplacian_UYVY", BENCH_UYVY, EdgeDectectionBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionFSobel_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionFSobel_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionFSobel_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_SOBEL),
+	RegionKernel("EdgeDectectionFScharr_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionFScharr_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionFScharr_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_SCHARR),
+	RegionKernel("EdgeDectectionFLaplacian_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionFLaplacian_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionFLaplacian_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_LAPLACIAN),
+	RegionKernel("EdgeDectectionFNone_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_NONE),
+	RegionKernel("EdgeDectectionFNone_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_NONE),
+	RegionKernel("EdgeDectectionFNone_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_NONE),
+	RegionKernel("EdgeDectectionFMedian5_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_MEDIAN5),
+	RegionKernel("EdgeDectectionFMedian5_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_MEDIAN5),
+	RegionKernel("EdgeDectectionFMedian5_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_MEDIAN5),
+	RegionKernel("EdgeDectectionFBinomial3_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BINOMIAL3),
+	RegionKernel("EdgeDectectionFBinomial3_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BINOMIAL3),
+	RegionKernel("EdgeDectectionFBinomial3_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BINOMIAL3),
+	RegionKernel("EdgeDectectionFBox3_NV12", BENCH_NV12, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>, 1.0, 1.5, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BOX3),
+	RegionKernel("EdgeDectectionFBox3_YUY2", BENCH_YUY2, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BOX3),
+	RegionKernel("EdgeDectectionFBox3_UYVY", BENCH_UYVY, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>, 2.0, 2.0, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_BOX3),
+};
+
+// Each format's kernels for the radius sweeps below.
+struct BENCH_RADIUS_FORMAT
+{
+	const char*         pszFormat;
+	BENCH_FORMAT        format;
+	double              cbReadPerPixel;
+	double              cbWrittenPerPixel;
+	MEDIAN_RADIUS_FN    pfnMedianRadius;
+	SKETCH_BAND_FN      pfnBand;
+};
+
+static const BENCH_RADIUS_FORMAT g_rgRadiusFormats[] =
+{
+	{ "NV12", BENCH_NV12, 1.0, 1.5, MedianFilterRadius<SKETCH_LAYOUT_NV12>, EdgeDectectionFBand<SKETCH_LAYOUT_NV12> },
+	{ "YUY2", BENCH_YUY2, 2.0, 2.0, MedianFilterRadius<SKETCH_LAYOUT_YUY2>, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2> },
+	{ "UYVY", BENCH_UYVY, 2.0, 2.0, MedianFilterRadius<SKETCH_LAYOUT_UYVY>, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY> },
+};
+
+// Radii the filtered edges are timed at with SKETCH_PREFILTER_MEDIAN_RADIUS.
+static const DWORD g_rgEdgeMedianRadii[] = { 4, 8 };
+
+//
+// The table above, then MedianFilterRadius at radii 1 to 8 (1 and 2 run
+// the sorting networks) and the filtered edges at g_rgEdgeMedianRadii, for
+// each format.
+//
+static std::vector<BENCH_KERNEL> MakeKernels()
+{
+	std::vector<BENCH_KERNEL> kernels(g_rgKernels, g_rgKernels + sizeof(g_rgKernels) / sizeof(g_rgKernels[0]));
+	const DWORD cFormats = sizeof(g_rgRadiusFormats) / sizeof(g_rgRadiusFormats[0]);
+	char szName[64];
+
+	for (DWORD f = 0; f < cFormats; f++)
+	{
+		const BENCH_RADIUS_FORMAT& format = g_rgRadiusFormats[f];
+		for (DWORD r = 1; r <= 8; r++)
+		{
+			sprintf(szName, "MedianFilterRadius%u_%s", r, format.pszFormat);
+			kernels.push_back(MedianRadiusKernel(szName, format.format, format.pfnMedianRadius, r, format.cbReadPerPixel));
+		}
+	}
+	for (DWORD f = 0; f < cFormats; f++)
+	{
+		const BENCH_RADIUS_FORMAT& format = g_rgRadiusFormats[f];
+		for (DWORD i = 0; i < sizeof(g_rgEdgeMedianRadii) / sizeof(g_rgEdgeMedianRadii[0]); i++)
+		{
+			sprintf(szName, "EdgeDectectionFMedianRadius%u_%s", g_rgEdgeMedianRadii[i], format.pszFormat);
+			kernels.push_back(RegionKernel(szName, format.format, format.pfnBand, format.cbReadPerPixel,
+				format.cbWrittenPerPixel, 0, SKETCH_DETECTOR_ROBERTS, SKETCH_PREFILTER_MEDIAN_RADIUS, g_rgEdgeMedianRadii[i]));
+		}
+	}
+	return kernels;
+}
+
+struct BENCH_SIZE
+{
+	DWORD   dwWidth;
+	DWORD   dwHeight;
+};
+
+static const BENCH_SIZE g_rgDefaultSizes[] =
+{
+	{ 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }
+};
+
+struct BENCH_RESULT
+{
+	std::string     strName;
+	const BENCH_KERNEL* pKernel;
+	BENCH_SIZE      size;
+	BENCH_CONTENT   content;
+	DWORD           dwIterations;       // Per batch.
+	double          nsMedian;           // Per frame.
+	double          nsMin;
+};
+
+// Same sequence on every platform, so content is reproducible.
+static inline unsigned int NextRandom(unsigned int* pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return (*pSeed >> 16) & 0x7FFF;
+}
+
+//
+// Fills a luma plane (W x H) and a 4:2:0 chroma plane pair (W/2 x H/2
+// each) with the requested content. The scene is a lit gradient with a
+// few solid shapes, a striped patch and mild noise, so the median and the
+// edge detector see long flat runs, hard edges and fine detail.
+//
+static void MakeContent(BENCH_CONTENT content, DWORD W, DWORD H,
+	std::vector<BYTE>& luma, std::vector<BYTE>& cb, std::vector<BYTE>& cr)
+{
+	const DWORD cw = (W + 1) / 2, ch = (H + 1) / 2;
+	luma.assign(W * H, 128);
+	cb.assign(cw * ch, 128);
+	cr.assign(cw * ch, 128);
+
+	unsigned int seed = 12345;
+	if (content == BENCH_FLAT)
+	{
+		return;
+	}
+	if (content == BENCH_NOISE)
+	{
+		for (size_t i = 0; i < luma.size(); i++)
+		{
+			luma[i] = (BYTE)NextRandom(&seed);
+		}
+		for (size_t i = 0; i < cb.size(); i++)
+		{
+			cb[i] = (BYTE)NextRandom(&seed);
+			cr[i] = (BYTE)NextRandom(&seed);
+		}
+		return;
+	}
+
+	for (DWORD y = 0; y < H; y++)
+	{
+		for (DWORD x = 0; x < W; x++)
+		{
+			// Fractions of the frame, so the scene scales with the size.
+			const double fx = (double)x / W, fy = (double)y / H;
+			int v = 60 + (int)(120 * fy) + (int)(30 * fx);
+
+			const double dx = fx - 0.3, dy = fy - 0.45;
+			if (dx * dx * 1.8 + dy * dy < 0.04)
+			{
+				v = 220;                                        // Disc.
+			}
+			if (fx > 0.55 && fx < 0.85 && fy > 0.2 && fy < 0.6)
+			{
+				v = 40;                                         // Box.
+			}
+			if (fx > 0.6 && fx < 0.8 && fy > 0.7 && fy < 0.9)
+			{
+				v = ((x / 3 + y / 5) & 1) ? 200 : 90;           // Stripes.
+			}
+			v += (int)(NextRandom(&seed) % 9) - 4;              // Sensor noise.
+			luma[y * W + x] = (BYTE)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+		}
+	}
+	for (DWORD y = 0; y < ch; y++)
+	{
+		for (DWORD x = 0; x < cw; x++)
+		{
+			cb[y * cw + x] = (BYTE)(96 + (64 * x) / cw);
+			cr[y * cw + x] = (BYTE)(160 - (64 * y) / ch);
+		}
+	}
+}
+
+// Packs the planes into one frame of the format, with an unpadded stride.
+static void PackFrame(BENCH_FORMAT format, DWORD W, DWORD H, const std::vector<BYTE>& luma,
+	const std::vector<BYTE>& cb, const std::vector<BYTE>& cr, std::vector<BYTE>& frame, LONG* plStride)
+{
+	const DWORD cw = (W + 1) / 2;
+
+	if (format == BENCH_NV12)
+	{
+		*plStride = (LONG)W;
+		frame.assign(W * H + W * (H / 2), 0);
+		memcpy(&frame[0], &luma[0], W * H);
+		for (DWORD y = 0; y < H / 2; y++)
+		{
+			BYTE* pRow = &frame[W * H + y * W];
+			for (DWORD x = 0; x + 1 < W; x += 2)
+			{
+				pRow[x] = cb[y * cw + x / 2];
+				pRow[x + 1] = cr[y * cw + x / 2];
+			}
+		}
+		return;
+	}
+
+	// YUY2 is Y0 U Y1 V; UYVY is U Y0 V Y1.
+	const DWORD dwY = (format == BENCH_YUY2) ? 0 : 1;
+	const DWORD dwC = 1 - dwY;
+	*plStride = (LONG)(W * 2);
+	frame.assign(W * 2 * H, 0);
+	for (DWORD y = 0; y < H; y++)
+	{
+		BYTE* pRow = &frame[y * W * 2];
+		for (DWORD x = 0; x < W; x++)
+		{
+			pRow[x * 2 + dwY] = luma[y * W + x];
+			pRow[x * 2 + dwC] = (x & 1) ? cr[(y / 2) * cw + x / 2] : cb[(y / 2) * cw + x / 2];
+		}
+	}
+}
+
+static double NowNanoseconds()
+{
+	return std::chrono::duration<double, std::nano>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* CompilerName()
+{
+#if defined(_MSC_VER)
+	static char szName[32];
+	sprintf(szName, "MSVC %d", _MSC_VER);
+	return szName;
+#elif defined(__clang__)
+	return "clang " __clang_version__;
+#elif defined(__GNUC__)
+	return "gcc " __VERSION__;
+#else
+	return "unknown";
+#endif
+}
+
+static bool ParseSizes(const char* psz, std::vector<BENCH_SIZE>& sizes)
+{
+	sizes.clear();
+	while (*psz != '\0')
+	{
+		BENCH_SIZE size;
+		char* pEnd = NULL;
+		size.dwWidth = (DWORD)strtoul(psz, &pEnd, 10);
+		if (*pEnd != 'x')
+		{
+			return false;
+		}
+		size.dwHeight = (DWORD)strtoul(pEnd + 1, &pEnd, 10);
+		if (size.dwWidth < 4 || size.dwHeight < 4 || (*pEnd != ',' && *pEnd != '\0'))
+		{
+			return false;
+		}
+		sizes.push_back(size);
+		psz = (*pEnd == ',') ? pEnd + 1 : pEnd;
+	}
+	return !sizes.empty();
+}
+
+static void WriteJsonString(FILE* pFile, const char* psz)
+{
+	fputc('"', pFile);
+	for (; *psz != '\0'; psz++)
+	{
+		if (*psz == '"' || *psz == '\\')
+		{
+			fputc('\\', pFile);
+		}
+		fputc(*psz, pFile);
+	}
+	fputc('"', pFile);
+}
+
+static bool WriteJson(const char* pszPath, const std::vector<BENCH_RESULT>& results, DWORD dwRepetitions)
+{
+	FILE* pFile = fopen(pszPath, "w");
+	if (pFile == NULL)
+	{
+		return false;
+	}
+
+	char szDate[32];
+	time_t now = time(NULL);
+	strftime(szDate, sizeof(szDate), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	fprintf(pFile, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"simd\": \"%s\",\n    \"compiler\": ", szDate, GetSketchTierName(GetSketchTier()));
+	WriteJsonString(pFile, CompilerName());
+	fprintf(pFile, ",\n    \"repetitions\": %u\n  },\n  \"benchmarks\": [\n", dwRepetitions);
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BENCH_RESULT& r = results[i];
+		const double pixels = (double)r.size.dwWidth * r.size.dwHeight;
+		const double bytesPerPixel = r.pKernel->cbReadPerPixel + r.pKernel->cbWrittenPerPixel;
+
+		fprintf(pFile, "    {\"name\": \"%s\", \"kernel\": \"%s\", \"width\": %u, \"height\": %u, \"content\": \"%s\", "
+			"\"iterations\": %u, \"ns_per_frame\": %.1f, \"ns_per_frame_min\": %.1f, \"mpix_per_s\": %.2f, "
+			"\"bytes_per_pixel\": %.2f, \"gb_per_s\": %.3f}%s\n",
+			r.strName.c_str(), r.pKernel->strName.c_str(), r.size.dwWidth, r.size.dwHeight, g_rgszContent[r.content],
+			r.dwIterations, r.nsMedian, r.nsMin, pixels * 1e3 / r.nsMedian,
+			bytesPerPixel, pixels * bytesPerPixel / r.nsMedian, (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(pFile, "  ]\n}\n");
+	return fclose(pFile) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* pszFilter = NULL;
+	const char* pszJson = NULL;
+	DWORD dwRepetitions = 5;
+	double msBatch = 20;
+	bool bList = false;
+	std::vector<BENCH_SIZE> sizes(g_rgDefaultSizes, g_rgDefaultSizes + sizeof(g_rgDefaultSizes) / sizeof(g_rgDefaultSizes[0]));
+
+	for (int i = 1; i < argc; i++)
+	{
+		const bool bValue = (i + 1 < argc);
+		if (strcmp(argv[i], "--filter") == 0 && bValue)
+		{
+			pszFilter = argv[++i];
+		}
+		else if (strcmp(argv[i], "--json") == 0 && bValue)
+		{
+			pszJson = argv[++i];
+		}
+		else if (strcmp(argv[i], "--repetitions") == 0 && bValue)
+		{
+			dwRepetitions = (DWORD)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--batch-ms") == 0 && bValue)
+		{
+			msBatch = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--sizes") == 0 && bValue && ParseSizes(argv[i + 1], sizes))
+		{
+			i++;
+		}
+		else if (strcmp(argv[i], "--tier") == 0 && bValue)
+		{
+			if (!SetSketchTier(FindSketchTier(argv[++i])))
+			{
+				fprintf(stderr, "tier %s is not supported here\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--packed-luma") == 0 && bValue)
+		{
+			const char* pszMode = argv[++i];
+			if (strcmp(pszMode, "strided") == 0)
+			{
+				SetSketchPackedLuma(SKETCH_PACKED_LUMA_STRIDED);
+			}
+			else if (strcmp(pszMode, "planar") == 0)
+			{
+				SetSketchPackedLuma(SKETCH_PACKED_LUMA_PLANAR);
+			}
+			else
+			{
+				fprintf(stderr, "--packed-luma takes strided or planar\n");
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--list") == 0)
+		{
+			bList = true;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--filter text] [--sizes WxH,...] [--repetitions n] [--batch-ms ms] [--tier name] [--packed-luma strided|planar] [--json file] [--list]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (dwRepetitions == 0 || msBatch <= 0)
+	{
+		fprintf(stderr, "--repetitions and --batch-ms must be positive\n");
+		return 2;
+	}
+
+	printf("SketchBenchSuite  %s  %s\n", GetSketchTierName(GetSketchTier()), CompilerName());
+	printf("%-52s %12s %12s %9s %7s\n", "case", "ns/frame", "min ns", "MPix/s", "B/px");
+
+	const std::vector<BENCH_KERNEL> kernels = MakeKernels();
+	CSketchScratchArena scratch;
+	std::vector<BENCH_RESULT> results;
+	std::vector<BYTE> luma, cb, cr, src, dest, plane, rgb;
+
+	for (size_t s = 0; s < sizes.size(); s++)
+	{
+		const DWORD W = sizes[s].dwWidth, H = sizes[s].dwHeight;
+		const SKETCH_RECT rcDest = { 0, 0, W, H };
+		const SKETCH_FRAME frame = { rcDest, NULL, 0, NULL, 0, W, H, NULL, 0, SKETCH_PREFILTER_MEDIAN3, 0 };
+
+		// Enough for the radius median at any radius the sweeps take.
+		BYTE* pFiltered = scratch.Reserve(SKETCH_SCRATCH_FILTERED,
+			GetSketchScratchSize(W, SKETCH_PREFILTER_MEDIAN_RADIUS, SKETCH_MEDIAN_MAX_RADIUS));
+		BYTE* pRGB = scratch.Reserve(SKETCH_SCRATCH_RGB, GetSketchRGBScratchSize(W));
+		BYTE* pScaled = scratch.Reserve(SKETCH_SCRATCH_SCALED,
+			std::max(GetSketchScaledScratchSize(W, H, SKETCH_SCALE_2X, SKETCH_PREFILTER_MEDIAN3, 0),
+			GetSketchScaledScratchSize(W, H, SKETCH_SCALE_4X, SKETCH_PREFILTER_MEDIAN3, 0)));
+		if (pFiltered == NULL || pRGB == NULL || pScaled == NULL)
+		{
+			fprintf(stderr, "%ux%u: out of memory\n", W, H);
+			return 1;
+		}
+
+		for (DWORD c = 0; c < BENCH_CONTENT_COUNT; c++)
+		{
+			const BENCH_CONTENT content = (BENCH_CONTENT)c;
+			bool bContentMade = false;
+
+			for (size_t k = 0; k < kernels.size(); k++)
+			{
+				const BENCH_KERNEL& kernel = kernels[k];
+
+				char szName[128];
+				sprintf(szName, "%s/%ux%u/%s", kernel.strName.c_str(), W, H, g_rgszContent[c]);
+				if (pszFilter != NULL && strstr(szName, pszFilter) == NULL)
+				{
+					continue;
+				}
+				if (bList)
+				{
+					printf("%s\n", szName);
+					continue;
+				}
+
+				if (!bContentMade)
+				{
+					MakeContent(content, W, H, luma, cb, cr);
+					bContentMade = true;
+				}
+
+				LONG lStride = 0;
+				PackFrame(kernel.format, W, H, luma, cb, cr, src, &lStride);
+				dest.assign(src.size(), 0);
+				plane.assign(W * H, 0);
+				rgb.assign(3 * W * H, 0);
+
+				BYTE* pSrc = &src[0];
+				BYTE* pDest = &dest[0];
+				BYTE* pPlane = &plane[0];
+				SKETCH_FRAME scaledFrame = frame;
+				scaledFrame.pDest = pDest;
+				scaledFrame.lDestStride = lStride;
+				scaledFrame.pSrc = pSrc;
+				scaledFrame.lSrcStride = lStride;
+				const SKETCH_REGION region = { rcDest, SKETCH_THRESHOLD_DEFAULT, 0, kernel.bChroma, kernel.bDetector };
+				SKETCH_FRAME regionFrame = scaledFrame;
+				regionFrame.pRegions = &region;
+				regionFrame.cRegions = 1;
+				regionFrame.prefilter = kernel.prefilter;
+				regionFrame.dwMedianRadius = kernel.dwMedianRadius;
+				auto run = [&]()
+				{
+					switch (kernel.kind)
+					{
+					case BENCH_MEDIAN:
+						kernel.pfnMedian(pPlane, pSrc, lStride, (LONG)W, W, H, pFiltered);
+						break;
+					case BENCH_EDGE:
+						kernel.pfnEdge(rcDest, pDest, lStride, pSrc, lStride, W, H, pFiltered);
+						break;
+					case BENCH_TO_RGB:
+						YUY2toRGB(&rgb[0], pSrc, lStride, (LONG)W, W, H);
+						break;
+					case BENCH_RGB_EDGE:
+						EdgeDectection_YUY2RGB(rcDest, pDest, lStride, pSrc, lStride, W, H, pRGB);
+						break;
+					case BENCH_SCALED:
+						kernel.pfnScaled(scaledFrame, kernel.dwScale, pScaled, NULL);
+						break;
+					case BENCH_IN_PLACE:
+						// After the first run the source is the kernel's own
+						// output, which costs the same to transform.
+						kernel.pfnEdge(rcDest, pSrc, lStride, pSrc, lStride, W, H, pFiltered);
+						break;
+					case BENCH_REGION_EDGE:
+						kernel.pfnBand(regionFrame, 0, H, pFiltered);
+						break;
+					case BENCH_MEDIAN_RADIUS:
+						kernel.pfnMedianRadius(pPlane, pSrc, lStride, (LONG)W, W, H, kernel.dwRadius, pFiltered);
+						break;
+					}
+				};
+
+				// Warm the caches and the branch predictors, then size the
+				// batch.
+				run();
+				DWORD dwIterations = 1;
+				for (;;)
+				{
+					const double start = NowNanoseconds();
+					for (DWORD i = 0; i < dwIterations; i++)
+					{
+						run();
+					}
+					if (NowNanoseconds() - start >= msBatch * 1e6 || dwIterations >= (1u << 20))
+					{
+						break;
+					}
+					dwIterations *= 2;
+				}
+
+				std::vector<double> samples;
+				for (DWORD r = 0; r < dwRepetitions; r++)
+				{
+					const double start = NowNanoseconds();
+					for (DWORD i = 0; i < dwIterations; i++)
+					{
+						run();
+					}
+					samples.push_back((NowNanoseconds() - start) / dwIterations);
+				}
+				std::sort(samples.begin(), samples.end());
+
+				BENCH_RESULT result;
+				result.strName = szName;
+				result.pKernel = &kernel;
+				result.size = sizes[s];
+				result.content = content;
+				result.dwIterations = dwIterations;
+				result.nsMedian = samples[samples.size() / 2];
+				result.nsMin = samples[0];
+				results.push_back(result);
+
+				printf("%-52s %12.0f %12.0f %9.1f %7.2f\n", szName, result.nsMedian, result.nsMin,
+					(double)W * H * 1e3 / result.nsMedian, kernel.cbReadPerPixel + kernel.cbWrittenPerPixel);
+				fflush(stdout);
+			}
+		}
+	}
+
+	if (pszJson != NULL && !bList && !WriteJson(pszJson, results, dwRepetitions))
+	{
+		fprintf(stderr, "could not write %s\n", pszJson);
+		return 1;
+	}
+	return 0;
+}
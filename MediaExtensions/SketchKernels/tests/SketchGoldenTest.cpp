@@ -0,0 +1,1101 @@
+// Golden-output test for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+//
+// Runs every kernel over a corpus of synthetic frames: several kinds of
+// content, sizes and destination rectangles, with and without padded
+// strides. Each run is checked two ways:
+//
+//  - Every variant of the kernel (frame call, one band, random bands,
+//    random tiles, the thread pool, temporal change detection) is diffed
+//    pixel for pixel against the scalar reference in SketchReference.cpp,
+//    and the first mismatches are listed; the filtered edge detectors run
+//    once over each pre-filter. Most variants also run bottom-up, over the
+//    lines in reverse order with negative strides, and the whole-frame
+//    ones in place, over a copy of the source. --golden runs the variants
+//    once on every instruction set tier the CPU has, and once each with
+//    packed luma read strided and planar. The buffer helpers of
+//    SketchBuffer.h are checked on a few fixed cases.
+//  - The reference output is hashed. The hashes of each kernel, size and
+//    stride are checked against the frozen list in golden/SketchGolden.txt,
+//    so the reference itself cannot drift unnoticed.
+//
+// Destination buffers start out filled with a marker byte and are hashed
+// whole, so bytes a kernel must leave alone are checked too.
+//
+// Usage: SketchGoldenTest --golden file [--update]
+//        SketchGoldenTest --frame file NV12|YUY2|UYVY width height [stride]
+//
+// --update rewrites the golden file from the reference; only do that for a
+// deliberate change of output. --frame runs the variants over one raw
+// recorded frame and reports mismatches and the output hash.
+//
+
+#include "SketchBuffer.h"
+#include "SketchCpu.h"
+#include "SketchKernels.h"
+#include "SketchReference.h"
+#include "SketchScratch.h"
+#include "SketchTemporal.h"
+#include "SketchThreadPool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// Fill for destination bytes no kernel has written.
+#define GOLDEN_MARKER       0xA5
+
+// Second fill, to tell bytes a kernel leaves alone from bytes it writes
+// GOLDEN_MARKER to.
+#define GOLDEN_MARKER2      0x5A
+
+// Mismatches listed per variant before the rest are only counted.
+#define GOLDEN_MAX_REPORTED 8
+
+typedef void (*MEDIAN_FN)(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, BYTE*);
+typedef void (*MEDIAN_RADIUS_FN)(BYTE*, const BYTE*, LONG, LONG, DWORD, DWORD, DWORD, BYTE*);
+
+struct GOLDEN_FORMAT
+{
+	const char*         pszName;
+	SKETCH_REF_FORMAT   format;
+	MEDIAN_FN           pfnMedian;
+	MEDIAN_RADIUS_FN    pfnMedianRadius;
+	SKETCH_TRANSFORM_FN pfnEdge;
+	SKETCH_BAND_FN      pfnEdgeBand;
+	SKETCH_TRANSFORM_FN pfnEdgeF;
+	SKETCH_BAND_FN      pfnEdgeFBand;
+	SKETCH_TILE_FN      pfnEdgeTile;
+	SKETCH_TILE_FN      pfnEdgeFTile;
+	SKETCH_SCALED_FN    pfnEdgeScaled;
+};
+
+static const GOLDEN_FORMAT g_rgFormats[] =
+{
+	{ "NV12", SKETCH_REF_NV12, MedianFilter<SKETCH_LAYOUT_NV12>, MedianFilterRadius<SKETCH_LAYOUT_NV12>,
+	  EdgeDectection<SKETCH_LAYOUT_NV12>, EdgeDectectionBand<SKETCH_LAYOUT_NV12>, EdgeDectectionF<SKETCH_LAYOUT_NV12>, EdgeDectectionFBand<SKETCH_LAYOUT_NV12>,
+	  EdgeDectectionTile<SKETCH_LAYOUT_NV12>, EdgeDectectionFTile<SKETCH_LAYOUT_NV12>, EdgeDectectionScaled<SKETCH_LAYOUT_NV12> },
+	{ "YUY2", SKETCH_REF_YUY2, MedianFilter<SKETCH_LAYOUT_YUY2>, MedianFilterRadius<SKETCH_LAYOUT_YUY2>,
+	  EdgeDectection<SKETCH_LAYOUT_YUY2>, EdgeDectectionBand<SKETCH_LAYOUT_YUY2>, EdgeDectectionF<SKETCH_LAYOUT_YUY2>, EdgeDectectionFBand<SKETCH_LAYOUT_YUY2>,
+	  EdgeDectectionTile<SKETCH_LAYOUT_YUY2>, EdgeDectectionFTile<SKETCH_LAYOUT_YUY2>, EdgeDectectionScaled<SKETCH_LAYOUT_YUY2> },
+	{ "UYVY", SKETCH_REF_UYVY, MedianFilter<SKETCH_LAYOUT_UYVY>, MedianFilterRadius<SKETCH_LAYOUT_UYVY>,
+	  EdgeDectection<SKETCH_LAYOUT_UYVY>, EdgeDectectionBand<SKETCH_LAYOUT_UYVY>, EdgeDectectionF<SKETCH_LAYOUT_UYVY>, EdgeDectectionFBand<SKETCH_LAYOUT_UYVY>,
+	  EdgeDectectionTile<SKETCH_LAYOUT_UYVY>, EdgeDectectionFTile<SKETCH_LAYOUT_UYVY>, EdgeDectectionScaled<SKETCH_LAYOUT_UYVY> },
+};
+
+enum GOLDEN_CONTENT
+{
+	GOLDEN_SCENE,       // Shapes, gradients, stripes and noise.
+	GOLDEN_RAMP,        // Horizontal and vertical ramps.
+	GOLDEN_NOISE,       // Uniform noise.
+	GOLDEN_CHECKER,     // One-pixel checkerboard of 0 and 255.
+	GOLDEN_BITS,        // Random 0 and 255: saturates every gradient.
+	GOLDEN_FLAT,        // One grey level.
+	GOLDEN_CONTENT_COUNT
+};
+
+struct GOLDEN_SIZE
+{
+	DWORD   dwWidth;
+	DWORD   dwHeight;
+};
+
+// Small enough to run in a second, wide enough for the vector main loops
+// and their tails, odd heights for the NV12 chroma.
+static const GOLDEN_SIZE g_rgSizes[] =
+{
+	{ 4, 4 }, { 8, 5 }, { 18, 11 }, { 34, 18 }, { 66, 35 }, { 130, 72 }, { 322, 41 }
+};
+
+// Extra bytes at the end of each line; 0 is an unpadded buffer.
+static const DWORD g_rgPads[] = { 0, 24 };
+
+// Names of the SKETCH_PREFILTER values, for the mismatch reports.
+static const char* const g_rgszPrefilters[SKETCH_PREFILTER_COUNT] =
+{
+	"Median3", "None", "Median5", "Binomial3", "Box3", "MedianRadius"
+};
+
+// Radii the edges are checked at over SKETCH_PREFILTER_MEDIAN_RADIUS: the
+// sorting network it takes at 2, and the histograms above.
+static const DWORD g_rgMedianRadii[] = { 2, 4 };
+
+// 64-bit FNV-1a.
+static UINT64 Hash(UINT64 hash, const BYTE* p, size_t cb)
+{
+	for (size_t i = 0; i < cb; i++)
+	{
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static const UINT64 HASH_SEED = 14695981039346656037ULL;
+
+static inline unsigned int NextRandom(unsigned int* pSeed)
+{
+	*pSeed = *pSeed * 1103515245 + 12345;
+	return (*pSeed >> 16) & 0x7FFF;
+}
+
+// Fills a frame of the format: luma from the content, chroma from a
+// smooth pattern (or noise for GOLDEN_NOISE). Padding gets noise too, so
+// a kernel that reads it shows up.
+static void MakeFrame(GOLDEN_CONTENT content, SKETCH_REF_FORMAT format, DWORD W, DWORD H, LONG lStride,
+	std::vector<BYTE>& frame)
+{
+	const DWORD cRows = (format == SKETCH_REF_NV12) ? H + (H + 1) / 2 : H;
+	unsigned int seed = 7 + content * 131 + W * 17 + H;
+
+	frame.resize(lStride * cRows);
+	for (size_t i = 0; i < frame.size(); i++)
+	{
+		frame[i] = (BYTE)NextRandom(&seed);
+	}
+
+	for (DWORD y = 0; y < H; y++)
+	{
+		for (DWORD x = 0; x < W; x++)
+		{
+			int v = 128;
+			switch (content)
+			{
+			case GOLDEN_SCENE:
+				{
+					const DWORD dx = (x > W / 3) ? x - W / 3 : W / 3 - x, dy = (y > H / 2) ? y - H / 2 : H / 2 - y;
+					v = 60 + (int)((120 * y) / H) + (int)((30 * x) / W);
+					if (dx * dx * 4 + dy * dy * 9 < W * H / 4)
+					{
+						v = 220;
+					}
+					if (x > W * 3 / 5 && y > H / 5 && y < H * 3 / 5)
+					{
+						v = ((x / 2 + y / 3) & 1) ? 200 : 40;
+					}
+					v += (int)(NextRandom(&seed) % 9) - 4;
+				}
+				break;
+			case GOLDEN_RAMP:
+				v = (int)((x * 7 + y * 3) & 0xFF);
+				break;
+			case GOLDEN_NOISE:
+				v = (int)(NextRandom(&seed) & 0xFF);
+				break;
+			case GOLDEN_CHECKER:
+				v = ((x ^ y) & 1) ? 255 : 0;
+				break;
+			case GOLDEN_BITS:
+				v = (NextRandom(&seed) & 1) ? 255 : 0;
+				break;
+			default:
+				break;
+			}
+			const BYTE bLuma = (BYTE)((v < 0) ? 0 : ((v > 255) ? 255 : v));
+			const BYTE bChroma = (content == GOLDEN_NOISE) ? (BYTE)NextRandom(&seed) : (BYTE)(64 + ((x * 5 + y * 11) & 0x7F));
+
+			BYTE* pRow = &frame[y * lStride];
+			switch (format)
+			{
+			case SKETCH_REF_YUY2:
+				pRow[x * 2] = bLuma;
+				pRow[x * 2 + 1] = bChroma;
+				break;
+			case SKETCH_REF_UYVY:
+				pRow[x * 2] = bChroma;
+				pRow[x * 2 + 1] = bLuma;
+				break;
+			default:
+				pRow[x] = bLuma;
+				if (y < (H + 1) / 2)
+				{
+					frame[(H + y) * lStride + x] = bChroma;
+				}
+				break;
+			}
+		}
+	}
+}
+
+// Counts the bytes where actual differs from expected and lists the first
+// few, by line and byte offset within the line.
+static size_t Diff(const char* pszCase, const char* pszVariant, const std::vector<BYTE>& expected,
+	const std::vector<BYTE>& actual, LONG lStride, DWORD H)
+{
+	size_t cMismatches = 0;
+	for (size_t i = 0; i < expected.size(); i++)
+	{
+		if (expected[i] == actual[i])
+		{
+			continue;
+		}
+		if (cMismatches < GOLDEN_MAX_REPORTED)
+		{
+			const DWORD y = (DWORD)(i / lStride);
+			printf("  %s [%s]: line %u%s, byte %u: expected %u, got %u\n", pszCase, pszVariant,
+				(y < H) ? y : y - H, (y < H) ? "" : " of chroma", (DWORD)(i % lStride), expected[i], actual[i]);
+		}
+		cMismatches++;
+	}
+	if (cMismatches > GOLDEN_MAX_REPORTED)
+	{
+		printf("  %s [%s]: %u more mismatches\n", pszCase, pszVariant, (DWORD)(cMismatches - GOLDEN_MAX_REPORTED));
+	}
+	return cMismatches;
+}
+
+// The buffer's lines of lStride bytes in reverse order: a bottom-up copy,
+// whose line 0 is the last in memory.
+static void FlipLines(const std::vector<BYTE>& in, LONG lStride, std::vector<BYTE>& out)
+{
+	const size_t cLines = in.size() / lStride;
+	out.resize(in.size());
+	for (size_t y = 0; y < cLines; y++)
+	{
+		memcpy(&out[(cLines - 1 - y) * lStride], &in[y * lStride], lStride);
+	}
+}
+
+// What a kernel run in place over src should leave: the expected output,
+// and the source wherever a run into a buffer filled with GOLDEN_MARKER2
+// (marked) shows the kernel writes nothing.
+static void InPlaceExpected(const std::vector<BYTE>& expected, const std::vector<BYTE>& marked, const std::vector<BYTE>& src,
+	std::vector<BYTE>& out)
+{
+	out = expected;
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		if (expected[i] == GOLDEN_MARKER && marked[i] == GOLDEN_MARKER2)
+		{
+			out[i] = src[i];
+		}
+	}
+}
+
+//
+// Runs the optimized variants of one edge detector over the frame and
+// diffs each against the reference output. Returns the number of
+// variants that differ. With regions, only the band form can take them.
+//
+static DWORD CheckEdgeVariants(const char* pszCase, const GOLDEN_FORMAT& fmt, bool bFiltered, const SKETCH_RECT& rcDest,
+	const SKETCH_REGION* pRegions, DWORD cRegions, SKETCH_PREFILTER prefilter, DWORD dwMedianRadius, const std::vector<BYTE>& src,
+	LONG lStride, DWORD W, DWORD H,
+	const std::vector<BYTE>& expected, CSketchScratchArena& scratch, CSketchThreadPool* rgpPools[], DWORD cPools)
+{
+	const SKETCH_BAND_FN pfnBand = bFiltered ? fmt.pfnEdgeFBand : fmt.pfnEdgeBand;
+	const SKETCH_TILE_FN pfnTile = bFiltered ? fmt.pfnEdgeFTile : fmt.pfnEdgeTile;
+	DWORD cFailed = 0;
+	BYTE* pScratch = scratch.Reserve(SKETCH_SCRATCH_FILTERED, GetSketchScratchSize(W, prefilter, dwMedianRadius));
+	std::vector<BYTE> actual(expected.size(), GOLDEN_MARKER);
+	SKETCH_FRAME frame = { rcDest, &actual[0], lStride, &src[0], lStride, W, H, pRegions, cRegions, prefilter, dwMedianRadius };
+
+	if (pRegions == NULL)
+	{
+		(bFiltered ? fmt.pfnEdgeF : fmt.pfnEdge)(rcDest, &actual[0], lStride, &src[0], lStride, W, H, pScratch);
+		cFailed += Diff(pszCase, "frame", expected, actual, lStride, H) ? 1 : 0;
+	}
+
+	actual.assign(expected.size(), GOLDEN_MARKER);
+	pfnBand(frame, 0, H, pScratch);
+	cFailed += Diff(pszCase, "one band", expected, actual, lStride, H) ? 1 : 0;
+
+	// Bands of random height, in reverse order, each on a fresh ring.
+	actual.assign(expected.size(), GOLDEN_MARKER);
+	unsigned int seed = W * 31 + H;
+	std::vector<DWORD> cuts(1, 0);
+	while (cuts.back() < H)
+	{
+		cuts.push_back(cuts.back() + 1 + NextRandom(&seed) % 9);
+	}
+	cuts.back() = H;
+	for (size_t i = cuts.size() - 1; i > 0; i--)
+	{
+		pfnBand(frame, cuts[i - 1], cuts[i], pScratch);
+	}
+	cFailed += Diff(pszCase, "random bands", expected, actual, lStride, H) ? 1 : 0;
+
+	// Tiles of random width on the same bands, right to left; NV12 tiles
+	// start on even columns.
+	actual.assign(expected.size(), GOLDEN_MARKER);
+	std::vector<DWORD> columns(1, 0);
+	while (columns.back() < W)
+	{
+		columns.push_back(columns.back() + 2 + (NextRandom(&seed) % 11 & ~1u));
+	}
+	columns.back() = W;
+	for (size_t i = cuts.size() - 1; i > 0; i--)
+	{
+		for (size_t j = columns.size() - 1; j > 0; j--)
+		{
+			pfnTile(frame, columns[j - 1], columns[j], cuts[i - 1], cuts[i], pScratch);
+		}
+	}
+	cFailed += Diff(pszCase, "random tiles", expected, actual, lStride, H) ? 1 : 0;
+
+	for (DWORD i = 0; i < cPools; i++)
+	{
+		char szVariant[64];
+		sprintf(szVariant, "pool %u threads, %u-line tiles", rgpPools[i]->GetThreadCount(), rgpPools[i]->GetTileRows());
+		actual.assign(expected.size(), GOLDEN_MARKER);
+		if (!rgpPools[i]->Run(pfnBand, frame))
+		{
+			printf("  %s [%s]: Run failed\n", pszCase, szVariant);
+			cFailed++;
+			continue;
+		}
+		cFailed += Diff(pszCase, szVariant, expected, actual, lStride, H) ? 1 : 0;
+	}
+
+	// Temporal change detection, serial and on the first pool: a frame
+	// with a few bytes changed, then this one, which only recomputes the
+	// tiles around those bytes, then this one again, which recomputes
+	// nothing.
+	const SKETCH_TILE_KERNEL kernel = { pfnTile, (fmt.format == SKETCH_REF_NV12) ? 1u : 2u, fmt.format == SKETCH_REF_NV12 };
+	const DWORD cLines = (fmt.format == SKETCH_REF_NV12) ? H + H / 2 : H;
+	std::vector<BYTE> changed(src);
+	for (DWORD i = 0; i < 3; i++)
+	{
+		changed[(NextRandom(&seed) % cLines) * lStride + NextRandom(&seed) % (W * kernel.dwBytesPerPixel)] ^= 0x10;
+	}
+
+	for (DWORD p = 0; p < ((cPools > 0) ? 2u : 1u); p++)
+	{
+		CSketchThreadPool* pPool = (p == 0) ? NULL : rgpPools[0];
+		CSketchTemporal temporal(0, 6, 4);
+		SKETCH_FRAME previous = frame;
+		bool bRun = true;
+
+		actual.assign(expected.size(), GOLDEN_MARKER);
+		previous.pSrc = &changed[0];
+		bRun = bRun && temporal.Run(kernel, previous, pPool, pScratch);
+
+		actual.assign(expected.size(), GOLDEN_MARKER);
+		bRun = bRun && temporal.Run(kernel, frame, pPool, pScratch);
+		cFailed += (bRun && Diff(pszCase, pPool ? "temporal, pool" : "temporal", expected, actual, lStride, H)) ? 1 : 0;
+
+		const UINT64 ullComputed = temporal.GetCounters().ullTilesComputed;
+		actual.assign(expected.size(), GOLDEN_MARKER);
+		bRun = bRun && temporal.Run(kernel, frame, pPool, pScratch);
+		cFailed += (bRun && Diff(pszCase, pPool ? "temporal again, pool" : "temporal again", expected, actual, lStride, H)) ? 1 : 0;
+
+		if (!bRun || temporal.GetCounters().ullTilesComputed != ullComputed)
+		{
+			printf("  %s [temporal]: %s\n", pszCase, bRun ? "unchanged frame recomputed" : "Run failed");
+			cFailed++;
+		}
+	}
+
+	// Bottom-up: the same frame with its lines stored last first and
+	// walked with negative strides, as a 2D buffer can hand it over.
+	const DWORD cRows = (DWORD)(src.size() / lStride);
+	std::vector<BYTE> srcUp, changedUp, actualUp;
+	FlipLines(src, lStride, srcUp);
+	FlipLines(changed, lStride, changedUp);
+
+	SKETCH_FRAME frameUp = frame;
+	frameUp.pSrc = &srcUp[(cRows - 1) * lStride];
+	frameUp.lSrcStride = -lStride;
+	frameUp.lDestStride = -lStride;
+
+	static const char* const rgszUpVariants[] = { "bottom-up, frame", "bottom-up, one band", "bottom-up, pool", "bottom-up, temporal" };
+	for (DWORD v = 0; v < sizeof(rgszUpVariants) / sizeof(rgszUpVariants[0]); v++)
+	{
+		actualUp.assign(expected.size(), GOLDEN_MARKER);
+		frameUp.pDest = &actualUp[(cRows - 1) * lStride];
+
+		bool bRun = true;
+		switch (v)
+		{
+		case 0:
+			if (pRegions != NULL)
+			{
+				continue;
+			}
+			(bFiltered ? fmt.pfnEdgeF : fmt.pfnEdge)(rcDest, frameUp.pDest, -lStride, frameUp.pSrc, -lStride, W, H, pScratch);
+			break;
+		case 1:
+			pfnBand(frameUp, 0, H, pScratch);
+			break;
+		case 2:
+			if (cPools == 0)
+			{
+				continue;
+			}
+			bRun = rgpPools[0]->Run(pfnBand, frameUp);
+			break;
+		default:
+			{
+				CSketchTemporal temporal(0, 6, 4);
+				SKETCH_FRAME previous = frameUp;
+				previous.pSrc = &changedUp[(cRows - 1) * lStride];
+				bRun = temporal.Run(kernel, previous, NULL, pScratch);
+				actualUp.assign(expected.size(), GOLDEN_MARKER);
+				bRun = bRun && temporal.Run(kernel, frameUp, NULL, pScratch);
+			}
+			break;
+		}
+
+		if (!bRun)
+		{
+			printf("  %s [%s]: Run failed\n", pszCase, rgszUpVariants[v]);
+			cFailed++;
+			continue;
+		}
+		FlipLines(actualUp, lStride, actual);
+		cFailed += Diff(pszCase, rgszUpVariants[v], expected, actual, lStride, H) ? 1 : 0;
+	}
+
+	// In place, over a copy of the source: the frame form and one band
+	// over the whole frame.
+	std::vector<BYTE> expectedInPlace;
+	actual.assign(expected.size(), GOLDEN_MARKER2);
+	pfnBand(frame, 0, H, pScratch);
+	InPlaceExpected(expected, actual, src, expectedInPlace);
+
+	SKETCH_FRAME frameInPlace = frame;
+	for (DWORD v = 0; v < 2; v++)
+	{
+		if (v == 0 && pRegions != NULL)
+		{
+			continue;
+		}
+
+		actual = src;
+		frameInPlace.pSrc = frameInPlace.pDest = &actual[0];
+		if (v == 0)
+		{
+			(bFiltered ? fmt.pfnEdgeF : fmt.pfnEdge)(rcDest, &actual[0], lStride, &actual[0], lStride, W, H, pScratch);
+		}
+		else
+		{
+			pfnBand(frameInPlace, 0, H, pScratch);
+		}
+		cFailed += Diff(pszCase, (v == 0) ? "in place, frame" : "in place, one band", expectedInPlace, actual, lStride, H) ? 1 : 0;
+	}
+	return cFailed;
+}
+
+// Hash per golden key, in the order the keys were first seen.
+struct GOLDEN_HASHES
+{
+	std::vector<std::string>        keys;
+	std::map<std::string, UINT64>   hashes;
+
+	void Add(const std::string& key, const std::vector<BYTE>& output)
+	{
+		if (hashes.find(key) == hashes.end())
+		{
+			keys.push_back(key);
+			hashes[key] = HASH_SEED;
+		}
+		hashes[key] = Hash(hashes[key], &output[0], output.size());
+	}
+};
+
+//
+// Runs the whole corpus. Returns the number of failed variant runs;
+// the reference hashes are left in hashes.
+//
+static DWORD RunCorpus(GOLDEN_HASHES& hashes)
+{
+	DWORD cFailed = 0;
+	CSketchScratchArena scratch;
+	CSketchThreadPool pool1(3, 1), pool7(3, 7), pool64(2);
+	CSketchThreadPool* rgpPools[] = { &pool1, &pool7, &pool64 };
+	std::vector<BYTE> src, expected, actual;
+
+	for (size_t f = 0; f < sizeof(g_rgFormats) / sizeof(g_rgFormats[0]); f++)
+	{
+		const GOLDEN_FORMAT& fmt = g_rgFormats[f];
+		const DWORD cbPixel = (fmt.format == SKETCH_REF_NV12) ? 1 : 2;
+
+		for (size_t s = 0; s < sizeof(g_rgSizes) / sizeof(g_rgSizes[0]); s++)
+		{
+			const DWORD W = g_rgSizes[s].dwWidth, H = g_rgSizes[s].dwHeight;
+
+			for (size_t p = 0; p < sizeof(g_rgPads) / sizeof(g_rgPads[0]); p++)
+			{
+				const LONG lStride = (LONG)(W * cbPixel + g_rgPads[p]);
+				const DWORD cRows = (fmt.format == SKETCH_REF_NV12) ? H + (H + 1) / 2 : H;
+
+				// The whole frame, an inner rectangle, and one hanging off
+				// the bottom right of the frame.
+				const SKETCH_RECT rgRects[] =
+				{
+					{ 0, 0, W, H },
+					{ W / 4, H / 4, W * 3 / 4, H * 3 / 4 },
+					{ W / 2, 1, W + 8, H + 8 },
+				};
+
+				char szKey[96];
+				for (DWORD c = 0; c < GOLDEN_CONTENT_COUNT; c++)
+				{
+					MakeFrame((GOLDEN_CONTENT)c, fmt.format, W, H, lStride, src);
+
+					char szCase[128];
+					sprintf(szCase, "%s %ux%u stride %d content %u", fmt.pszName, W, H, lStride, c);
+
+					// Median into a dense plane with the same padding.
+					const LONG lPlaneStride = (LONG)(W + g_rgPads[p]);
+					expected.assign(lPlaneStride * H, GOLDEN_MARKER);
+					actual.assign(lPlaneStride * H, GOLDEN_MARKER);
+					ReferenceMedianFilter(fmt.format, &expected[0], &src[0], lStride, lPlaneStride, W, H);
+					fmt.pfnMedian(&actual[0], &src[0], lStride, lPlaneStride, W, H, scratch.Reserve(SKETCH_SCRATCH_FILTERED, GetSketchScratchSize(W)));
+					cFailed += Diff(szCase, "MedianFilter", expected, actual, lPlaneStride, H) ? 1 : 0;
+
+					// And bottom-up, from and into reversed lines.
+					std::vector<BYTE> srcUp, planeUp(lPlaneStride * H, GOLDEN_MARKER);
+					FlipLines(src, lStride, srcUp);
+					fmt.pfnMedian(&planeUp[(H - 1) * lPlaneStride], &srcUp[(cRows - 1) * lStride], -lStride, -lPlaneStride, W, H,
+						scratch.Reserve(SKETCH_SCRATCH_FILTERED, GetSketchScratchSize(W)));
+					FlipLines(planeUp, lPlaneStride, actual);
+					cFailed += Diff(szCase, "MedianFilter, bottom-up", expected, actual, lPlaneStride, H) ? 1 : 0;
+					sprintf(szKey, "MedianFilter_%s/%ux%u/pad%u", fmt.pszName, W, H, g_rgPads[p]);
+					hashes.Add(szKey, expected);
+
+					// The constant-time median the same way, at radii up to
+					// larger than the smaller frames.
+					static const DWORD rgRadii[] = { 1, 2, 3, 8 };
+					sprintf(szKey, "MedianFilterRadius_%s/%ux%u/pad%u", fmt.pszName, W, H, g_rgPads[p]);
+					for (size_t i = 0; i < sizeof(rgRadii) / sizeof(rgRadii[0]); i++)
+					{
+						char szVariant[64];
+						BYTE* pHistograms = scratch.Reserve(SKETCH_SCRATCH_FILTERED,
+							GetSketchScratchSize(W, SKETCH_PREFILTER_MEDIAN_RADIUS, rgRadii[i]));
+
+						expected.assign(lPlaneStride * H, GOLDEN_MARKER);
+						actual.assign(lPlaneStride * H, GOLDEN_MARKER);
+						ReferenceMedianFilterRadius(fmt.format, &expected[0], &src[0], lStride, lPlaneStride, W, H, rgRadii[i]);
+						fmt.pfnMedianRadius(&actual[0], &src[0], lStride, lPlaneStride, W, H, rgRadii[i], pHistograms);
+						sprintf(szVariant, "MedianFilterRadius %u", rgRadii[i]);
+						cFailed += Diff(szCase, szVariant, expected, actual, lPlaneStride, H) ? 1 : 0;
+
+						planeUp.assign(lPlaneStride * H, GOLDEN_MARKER);
+						fmt.pfnMedianRadius(&planeUp[(H - 1) * lPlaneStride], &srcUp[(cRows - 1) * lStride], -lStride, -lPlaneStride, W, H,
+							rgRadii[i], pHistograms);
+						FlipLines(planeUp, lPlaneStride, actual);
+						sprintf(szVariant, "MedianFilterRadius %u, bottom-up", rgRadii[i]);
+						cFailed += Diff(szCase, szVariant, expected, actual, lPlaneStride, H) ? 1 : 0;
+						hashes.Add(szKey, expected);
+					}
+
+					for (size_t r = 0; r < sizeof(rgRects) / sizeof(rgRects[0]); r++)
+					{
+						for (int bFiltered = 0; bFiltered < 2; bFiltered++)
+						{
+							char szEdgeCase[192];
+							sprintf(szEdgeCase, "EdgeDectection%s_%s rect %u", bFiltered ? "F" : "", szCase, (DWORD)r);
+
+							expected.assign(lStride * cRows, GOLDEN_MARKER);
+							ReferenceEdgeDetection(fmt.format, bFiltered != 0, rgRects[r], &expected[0], lStride, &src[0], lStride, W, H);
+							cFailed += CheckEdgeVariants(szEdgeCase, fmt, bFiltered != 0, rgRects[r], NULL, 0, SKETCH_PREFILTER_MEDIAN3, 0,
+								src, lStride, W, H, expected, scratch, rgpPools, 3);
+
+							sprintf(szKey, "EdgeDectection%s_%s/%ux%u/pad%u", bFiltered ? "F" : "", fmt.pszName, W, H, g_rgPads[p]);
+							hashes.Add(szKey, expected);
+						}
+					}
+
+					// Overlapping regions with their own parameters, one
+					// on line 0, one on the last line, one off the frame
+					// and one empty.
+					const SKETCH_REGION rgRegions[] =
+					{
+						{ { W / 8, 0, W / 2, H / 2 }, SKETCH_THRESHOLD_DEFAULT, 0, 0, 0 },
+						{ { W / 4, H / 4, W * 3 / 4, H * 3 / 4 }, 60, 1, 0, 0 },
+						{ { W * 5 / 8, H / 2, W + 4, H + 4 }, 0, 0, 0, 0 },
+						{ { 1, H - 2, 3, H }, 200, 1, 0, 0 },
+						{ { W / 2, H / 2, W / 2, H }, 100, 0, 0, 0 },
+					};
+					const DWORD cRegions = sizeof(rgRegions) / sizeof(rgRegions[0]);
+
+					for (int bFiltered = 0; bFiltered < 2; bFiltered++)
+					{
+						char szEdgeCase[192];
+						sprintf(szEdgeCase, "EdgeDectection%s_%s regions", bFiltered ? "F" : "", szCase);
+
+						expected.assign(lStride * cRows, GOLDEN_MARKER);
+						ReferenceEdgeDetectionRegions(fmt.format, bFiltered != 0, rgRegions, cRegions, &expected[0], lStride, &src[0], lStride, W, H,
+							SKETCH_PREFILTER_MEDIAN3, 0);
+						cFailed += CheckEdgeVariants(szEdgeCase, fmt, bFiltered != 0, rgRects[0], rgRegions, cRegions, SKETCH_PREFILTER_MEDIAN3, 0,
+							src, lStride, W, H, expected, scratch, rgpPools, 3);
+
+						sprintf(szKey, "EdgeDectection%sRegions_%s/%ux%u/pad%u", bFiltered ? "F" : "", fmt.pszName, W, H, g_rgPads[p]);
+						hashes.Add(szKey, expected);
+					}
+
+					// The same regions, all but the second chroma-aware.
+					SKETCH_REGION rgChromaRegions[cRegions];
+					for (DWORD i = 0; i < cRegions; i++)
+					{
+						rgChromaRegions[i] = rgRegions[i];
+						rgChromaRegions[i].bChroma = (i != 1) ? 1 : 0;
+					}
+
+					for (int bFiltered = 0; bFiltered < 2; bFiltered++)
+					{
+						char szEdgeCase[192];
+						sprintf(szEdgeCase, "EdgeDectection%s_%s chroma regions", bFiltered ? "F" : "", szCase);
+
+						expected.assign(lStride * cRows, GOLDEN_MARKER);
+						ReferenceEdgeDetectionRegions(fmt.format, bFiltered != 0, rgChromaRegions, cRegions, &expected[0], lStride, &src[0], lStride, W, H,
+							SKETCH_PREFILTER_MEDIAN3, 0);
+						cFailed += CheckEdgeVariants(szEdgeCase, fmt, bFiltered != 0, rgRects[0], rgChromaRegions, cRegions, SKETCH_PREFILTER_MEDIAN3, 0,
+							src, lStride, W, H, expected, scratch, rgpPools, 3);
+
+						sprintf(szKey, "EdgeDectection%sChroma_%s/%ux%u/pad%u", bFiltered ? "F" : "", fmt.pszName, W, H, g_rgPads[p]);
+						hashes.Add(szKey, expected);
+					}
+
+					// The same regions on the 3x3 detectors and Roberts in
+					// turn, the first and third also chroma-aware.
+					SKETCH_REGION rgDetectorRegions[cRegions];
+					for (DWORD i = 0; i < cRegions; i++)
+					{
+						rgDetectorRegions[i] = rgRegions[i];
+						rgDetectorRegions[i].bDetector = (BYTE)((i + 1) % SKETCH_DETECTOR_COUNT);
+						rgDetectorRegions[i].bChroma = (i == 0 || i == 2) ? 1 : 0;
+					}
+
+					for (int bFiltered = 0; bFiltered < 2; bFiltered++)
+					{
+						char szEdgeCase[192];
+						sprintf(szEdgeCase, "EdgeDectection%s_%s detector regions", bFiltered ? "F" : "", szCase);
+
+						expected.assign(lStride * cRows, GOLDEN_MARKER);
+						ReferenceEdgeDetectionRegions(fmt.format, bFiltered != 0, rgDetectorRegions, cRegions, &expected[0], lStride, &src[0], lStride, W, H,
+							SKETCH_PREFILTER_MEDIAN3, 0);
+						cFailed += CheckEdgeVariants(szEdgeCase, fmt, bFiltered != 0, rgRects[0], rgDetectorRegions, cRegions, SKETCH_PREFILTER_MEDIAN3, 0,
+							src, lStride, W, H, expected, scratch, rgpPools, 3);
+
+						sprintf(szKey, "EdgeDectection%sDetectors_%s/%ux%u/pad%u", bFiltered ? "F" : "", fmt.pszName, W, H, g_rgPads[p]);
+						hashes.Add(szKey, expected);
+					}
+
+					// The same regions over the luma of the other
+					// pre-filters, which only the F variants take. The
+					// radius median goes under a key for each radius.
+					for (DWORD f = SKETCH_PREFILTER_NONE; f < SKETCH_PREFILTER_COUNT; f++)
+					{
+						const bool bRadius = (f == SKETCH_PREFILTER_MEDIAN_RADIUS);
+						for (DWORD i = 0; i < (bRadius ? sizeof(g_rgMedianRadii) / sizeof(g_rgMedianRadii[0]) : 1); i++)
+						{
+							const DWORD dwMedianRadius = bRadius ? g_rgMedianRadii[i] : 0;
+							char szEdgeCase[192];
+							sprintf(szEdgeCase, "EdgeDectectionF_%s %s %u regions", szCase, g_rgszPrefilters[f], dwMedianRadius);
+							if (bRadius)
+							{
+								sprintf(szKey, "EdgeDectectionFMedianRadius%u_%s/%ux%u/pad%u", dwMedianRadius, fmt.pszName, W, H,
+									g_rgPads[p]);
+							}
+							else
+							{
+								sprintf(szKey, "EdgeDectectionFPrefilters_%s/%ux%u/pad%u", fmt.pszName, W, H, g_rgPads[p]);
+							}
+
+							expected.assign(lStride * cRows, GOLDEN_MARKER);
+							ReferenceEdgeDetectionRegions(fmt.format, true, rgDetectorRegions, cRegions, &expected[0], lStride, &src[0], lStride,
+								W, H, (SKETCH_PREFILTER)f, dwMedianRadius);
+							cFailed += CheckEdgeVariants(szEdgeCase, fmt, true, rgRects[0], rgDetectorRegions, cRegions, (SKETCH_PREFILTER)f,
+								dwMedianRadius, src, lStride, W, H, expected, scratch, rgpPools, 3);
+							hashes.Add(szKey, expected);
+						}
+					}
+
+					// Reduced resolution, over the rectangles and the regions.
+					const DWORD rgScales[] = { SKETCH_SCALE_2X, SKETCH_SCALE_4X };
+					for (size_t k = 0; k < sizeof(rgScales) / sizeof(rgScales[0]); k++)
+					{
+						const DWORD dwMaxMedianRadius = g_rgMedianRadii[sizeof(g_rgMedianRadii) / sizeof(g_rgMedianRadii[0]) - 1];
+						BYTE* pScaled = scratch.Reserve(SKETCH_SCRATCH_SCALED, std::max(
+							GetSketchScaledScratchSize(W, H, rgScales[k], SKETCH_PREFILTER_MEDIAN3, 0),
+							GetSketchScaledScratchSize(W, H, rgScales[k], SKETCH_PREFILTER_MEDIAN_RADIUS, dwMaxMedianRadius)));
+						char szScaledCase[192];
+						sprintf(szScaledCase, "EdgeDectectionScaled%u_%s", rgScales[k], szCase);
+						sprintf(szKey, "EdgeDectectionScaled%u_%s/%ux%u/pad%u", rgScales[k], fmt.pszName, W, H, g_rgPads[p]);
+
+						for (size_t r = 0; r <= sizeof(rgRects) / sizeof(rgRects[0]); r++)
+						{
+							// The rectangles as one-region lists, then the regions.
+							const bool bRegions = (r == sizeof(rgRects) / sizeof(rgRects[0]));
+							const SKETCH_REGION rgRect[1] = { { rgRects[bRegions ? 0 : r], SKETCH_THRESHOLD_DEFAULT, 0, 0, 0 } };
+
+							expected.assign(lStride * cRows, GOLDEN_MARKER);
+							actual.assign(lStride * cRows, GOLDEN_MARKER);
+							ReferenceEdgeDetectionScaled(fmt.format, rgScales[k], bRegions ? rgRegions : rgRect,
+								bRegions ? cRegions : 1, &expected[0], lStride, &src[0], lStride, W, H, SKETCH_PREFILTER_MEDIAN3, 0);
+
+							const SKETCH_FRAME frame = { rgRects[bRegions ? 0 : r], &actual[0], lStride, &src[0], lStride, W, H,
+								bRegions ? rgRegions : NULL, bRegions ? cRegions : 0, SKETCH_PREFILTER_MEDIAN3, 0 };
+							fmt.pfnEdgeScaled(frame, rgScales[k], pScaled, NULL);
+							cFailed += Diff(szScaledCase, "frame", expected, actual, lStride, H) ? 1 : 0;
+
+							// The passes in bands on the pools.
+							for (DWORD i = 0; i < sizeof(rgpPools) / sizeof(rgpPools[0]); i++)
+							{
+								char szVariant[96];
+								sprintf(szVariant, "frame, pool %u threads, %u-line tiles", rgpPools[i]->GetThreadCount(),
+									rgpPools[i]->GetTileRows());
+								actual.assign(lStride * cRows, GOLDEN_MARKER);
+								fmt.pfnEdgeScaled(frame, rgScales[k], pScaled, rgpPools[i]);
+								cFailed += Diff(szScaledCase, szVariant, expected, actual, lStride, H) ? 1 : 0;
+							}
+
+							std::vector<BYTE> srcUp, actualUp(lStride * cRows, GOLDEN_MARKER);
+							FlipLines(src, lStride, srcUp);
+							const SKETCH_FRAME frameUp = { frame.rcDest, &actualUp[(cRows - 1) * lStride], -lStride,
+								&srcUp[(cRows - 1) * lStride], -lStride, W, H, frame.pRegions, frame.cRegions, frame.prefilter,
+								frame.dwMedianRadius };
+							fmt.pfnEdgeScaled(frameUp, rgScales[k], pScaled, NULL);
+							FlipLines(actualUp, lStride, actual);
+							cFailed += Diff(szScaledCase, "frame, bottom-up", expected, actual, lStride, H) ? 1 : 0;
+
+							std::vector<BYTE> expectedInPlace;
+							SKETCH_FRAME frameInPlace = frame;
+							actual.assign(lStride * cRows, GOLDEN_MARKER2);
+							fmt.pfnEdgeScaled(frame, rgScales[k], pScaled, NULL);
+							InPlaceExpected(expected, actual, src, expectedInPlace);
+							actual = src;
+							frameInPlace.pSrc = frameInPlace.pDest = &actual[0];
+							fmt.pfnEdgeScaled(frameInPlace, rgScales[k], pScaled, NULL);
+							cFailed += Diff(szScaledCase, "frame, in place", expectedInPlace, actual, lStride, H) ? 1 : 0;
+
+							actual = src;
+							frameInPlace.pSrc = frameInPlace.pDest = &actual[0];
+							fmt.pfnEdgeScaled(frameInPlace, rgScales[k], pScaled, rgpPools[1]);
+							cFailed += Diff(szScaledCase, "frame, in place, pool", expectedInPlace, actual, lStride, H) ? 1 : 0;
+							hashes.Add(szKey, expected);
+						}
+
+						// The regions again over the other pre-filters, and the
+						// radius median under a key for each radius.
+						for (DWORD f = SKETCH_PREFILTER_NONE; f < SKETCH_PREFILTER_COUNT; f++)
+						{
+							const bool bRadius = (f == SKETCH_PREFILTER_MEDIAN_RADIUS);
+							for (DWORD i = 0; i < (bRadius ? sizeof(g_rgMedianRadii) / sizeof(g_rgMedianRadii[0]) : 1); i++)
+							{
+								const DWORD dwMedianRadius = bRadius ? g_rgMedianRadii[i] : 0;
+								char szVariant[64];
+								sprintf(szVariant, "%s %u", g_rgszPrefilters[f], dwMedianRadius);
+								if (bRadius)
+								{
+									sprintf(szKey, "EdgeDectectionScaled%uMedianRadius%u_%s/%ux%u/pad%u", rgScales[k], dwMedianRadius,
+										fmt.pszName, W, H, g_rgPads[p]);
+								}
+								else
+								{
+									sprintf(szKey, "EdgeDectectionScaled%uPrefilters_%s/%ux%u/pad%u", rgScales[k], fmt.pszName, W, H,
+										g_rgPads[p]);
+								}
+
+								expected.assign(lStride * cRows, GOLDEN_MARKER);
+								actual.assign(lStride * cRows, GOLDEN_MARKER);
+								ReferenceEdgeDetectionScaled(fmt.format, rgScales[k], rgRegions, cRegions, &expected[0], lStride, &src[0],
+									lStride, W, H, (SKETCH_PREFILTER)f, dwMedianRadius);
+
+								const SKETCH_FRAME frame = { rgRects[0], &actual[0], lStride, &src[0], lStride, W, H, rgRegions, cRegions,
+									(SKETCH_PREFILTER)f, dwMedianRadius };
+								fmt.pfnEdgeScaled(frame, rgScales[k], pScaled, NULL);
+								cFailed += Diff(szScaledCase, szVariant, expected, actual, lStride, H) ? 1 : 0;
+
+								actual.assign(lStride * cRows, GOLDEN_MARKER);
+								fmt.pfnEdgeScaled(frame, rgScales[k], pScaled, rgpPools[1]);
+								cFailed += Diff(szScaledCase, szVariant, expected, actual, lStride, H) ? 1 : 0;
+								hashes.Add(szKey, expected);
+							}
+						}
+					}
+
+					// The RGB path is YUY2 only.
+					if (fmt.format != SKETCH_REF_YUY2)
+					{
+						continue;
+					}
+
+					const DWORD cbRGB = 3 * W * H;
+					expected.assign(cbRGB, GOLDEN_MARKER);
+					actual.assign(cbRGB, GOLDEN_MARKER);
+					ReferenceYUY2toRGB(&expected[0], &src[0], lStride, W, H);
+					YUY2toRGB(&actual[0], &src[0], lStride, (LONG)W, W, H);
+					cFailed += Diff(szCase, "YUY2toRGB", expected, actual, (LONG)W, H) ? 1 : 0;
+					sprintf(szKey, "YUY2toRGB/%ux%u/pad%u", W, H, g_rgPads[p]);
+					hashes.Add(szKey, expected);
+
+					// The rectangles the shipped kernel handled keep their
+					// frozen hashes; the others, padded strides, bottom-up
+					// and in place are new.
+					BYTE* pRGB = scratch.Reserve(SKETCH_SCRATCH_RGB, GetSketchRGBScratchSize(W));
+					const SKETCH_RECT rgRGBRects[] = { { 0, 0, W, H }, { 0, 0, W, H / 2 + 1 }, rgRects[1], rgRects[2] };
+					for (size_t r = 0; r < sizeof(rgRGBRects) / sizeof(rgRGBRects[0]); r++)
+					{
+						const SKETCH_RECT& rc = rgRGBRects[r];
+
+						expected.assign(lStride * H, GOLDEN_MARKER);
+						actual.assign(lStride * H, GOLDEN_MARKER);
+						ReferenceEdgeDetection_YUY2RGB(rc, &expected[0], lStride, &src[0], lStride, W, H);
+						EdgeDectection_YUY2RGB(rc, &actual[0], lStride, &src[0], lStride, W, H, pRGB);
+						cFailed += Diff(szCase, "EdgeDectection_YUY2RGB", expected, actual, lStride, H) ? 1 : 0;
+
+						std::vector<BYTE> srcUp, actualUp(lStride * H, GOLDEN_MARKER);
+						FlipLines(src, lStride, srcUp);
+						EdgeDectection_YUY2RGB(rc, &actualUp[(H - 1) * lStride], -lStride, &srcUp[(H - 1) * lStride], -lStride, W, H, pRGB);
+						FlipLines(actualUp, lStride, actual);
+						cFailed += Diff(szCase, "EdgeDectection_YUY2RGB, bottom-up", expected, actual, lStride, H) ? 1 : 0;
+
+						std::vector<BYTE> expectedInPlace;
+						actual.assign(lStride * H, GOLDEN_MARKER2);
+						EdgeDectection_YUY2RGB(rc, &actual[0], lStride, &src[0], lStride, W, H, pRGB);
+						InPlaceExpected(expected, actual, src, expectedInPlace);
+						actual = src;
+						EdgeDectection_YUY2RGB(rc, &actual[0], lStride, &actual[0], lStride, W, H, pRGB);
+						cFailed += Diff(szCase, "EdgeDectection_YUY2RGB, in place", expectedInPlace, actual, lStride, H) ? 1 : 0;
+
+						if (r < 2 && g_rgPads[p] == 0)
+						{
+							sprintf(szKey, "EdgeDectection_YUY2RGB/%ux%u/pad0", W, H);
+						}
+						else
+						{
+							sprintf(szKey, "EdgeDectection_YUY2RGBRects/%ux%u/pad%u", W, H, g_rgPads[p]);
+						}
+						hashes.Add(szKey, expected);
+					}
+				}
+			}
+		}
+	}
+	return cFailed;
+}
+
+//
+// Checks where GetSketchScanline0 puts line 0 and which frames
+// IsSketchFrameInBuffer lets through, top-down and bottom-up. Returns the
+// number of cases that failed.
+//
+static DWORD CheckBufferLines()
+{
+	struct BUFFER_CASE
+	{
+		LONG    lFirst;         // Offset of line 0 in the buffer.
+		LONG    lPitch;
+		DWORD   cbLine;
+		DWORD   cLines;
+		bool    bInBuffer;
+	};
+	// A 100-byte buffer.
+	static const BUFFER_CASE rgCases[] =
+	{
+		{ 0, 20, 20, 5, true },         // Exactly fills it.
+		{ 0, 24, 20, 4, true },         // Padded lines.
+		{ 4, 24, 20, 4, true },
+		{ 12, 24, 20, 4, false },       // Last line runs over.
+		{ 80, -20, 20, 5, true },       // Bottom-up, exactly.
+		{ 72, -24, 20, 4, true },
+		{ 70, -24, 20, 4, false },      // First line in memory before the buffer.
+		{ 0, 10, 20, 2, false },        // Overlapping lines.
+		{ 0, -20, 20, 1, true },        // One line, any pitch.
+		{ 81, 20, 20, 1, false },
+		{ 0, 0, 20, 0, true },          // Nothing to hold.
+	};
+
+	BYTE rgbBuffer[100];
+	DWORD cFailed = 0;
+	for (size_t i = 0; i < sizeof(rgCases) / sizeof(rgCases[0]); i++)
+	{
+		const BUFFER_CASE& c = rgCases[i];
+		if (IsSketchFrameInBuffer(rgbBuffer + c.lFirst, c.lPitch, c.cbLine, c.cLines, rgbBuffer, sizeof(rgbBuffer)) != c.bInBuffer)
+		{
+			printf("  IsSketchFrameInBuffer case %u: expected %s\n", (DWORD)i, c.bInBuffer ? "true" : "false");
+			cFailed++;
+		}
+	}
+
+	if (GetSketchScanline0(rgbBuffer, 20, 5) != rgbBuffer || GetSketchScanline0(rgbBuffer, -20, 5) != rgbBuffer + 80 ||
+		GetSketchScanline0(rgbBuffer, -20, 0) != rgbBuffer)
+	{
+		printf("  GetSketchScanline0: wrong line 0\n");
+		cFailed++;
+	}
+	return cFailed;
+}
+
+static int CheckGolden(const char* pszGolden, bool bUpdate)
+{
+	GOLDEN_HASHES hashes;
+	DWORD cFailed = 0;
+
+	// The reference hashes come from the first run; the others only diff.
+	const SKETCH_CPU_TIER tierDefault = GetSketchTier();
+	for (DWORD t = SKETCH_TIER_SCALAR; t < SKETCH_TIER_COUNT; t++)
+	{
+		if (SetSketchTier((SKETCH_CPU_TIER)t))
+		{
+			GOLDEN_HASHES tierHashes;
+			DWORD cTierFailed = RunCorpus(hashes.keys.empty() ? hashes : tierHashes);
+			printf("tier %s: %u failures\n", GetSketchTierName((SKETCH_CPU_TIER)t), cTierFailed);
+			cFailed += cTierFailed;
+		}
+	}
+	SetSketchTier(tierDefault);
+
+	const SKETCH_PACKED_LUMA rgModes[] = { SKETCH_PACKED_LUMA_STRIDED, SKETCH_PACKED_LUMA_PLANAR };
+	const char* const rgszModes[] = { "strided", "planar" };
+	for (DWORD m = 0; m < 2; m++)
+	{
+		GOLDEN_HASHES modeHashes;
+		SetSketchPackedLuma(rgModes[m]);
+		DWORD cModeFailed = RunCorpus(modeHashes);
+		printf("packed luma %s: %u failures\n", rgszModes[m], cModeFailed);
+		cFailed += cModeFailed;
+	}
+	SetSketchPackedLuma(SKETCH_PACKED_LUMA_AUTO);
+
+	const DWORD cBufferFailed = CheckBufferLines();
+	printf("buffer lines: %u failures\n", cBufferFailed);
+	cFailed += cBufferFailed;
+
+	if (bUpdate)
+	{
+		FILE* pFile = fopen(pszGolden, "w");
+		if (pFile == NULL)
+		{
+			fprintf(stderr, "could not write %s\n", pszGolden);
+			return 1;
+		}
+		fprintf(pFile, "# Reference output hashes of the sketch kernels (64-bit FNV-1a over\n"
+			"# every case of the key). Generated by SketchGoldenTest --update.\n");
+		for (size_t i = 0; i < hashes.keys.size(); i++)
+		{
+			fprintf(pFile, "%s %016llx\n", hashes.keys[i].c_str(), (unsigned long long)hashes.hashes[hashes.keys[i]]);
+		}
+		fclose(pFile);
+		printf("wrote %u hashes to %s\n", (DWORD)hashes.keys.size(), pszGolden);
+	}
+	else
+	{
+		FILE* pFile = fopen(pszGolden, "r");
+		if (pFile == NULL)
+		{
+			fprintf(stderr, "could not read %s\n", pszGolden);
+			return 1;
+		}
+
+		std::map<std::string, UINT64> golden;
+		char szLine[256];
+		while (fgets(szLine, sizeof(szLine), pFile) != NULL)
+		{
+			char szKey[192];
+			unsigned long long ullHash = 0;
+			if (szLine[0] != '#' && sscanf(szLine, "%191s %llx", szKey, &ullHash) == 2)
+			{
+				golden[szKey] = ullHash;
+			}
+		}
+		fclose(pFile);
+
+		for (size_t i = 0; i < hashes.keys.size(); i++)
+		{
+			const std::string& key = hashes.keys[i];
+			std::map<std::string, UINT64>::const_iterator it = golden.find(key);
+			if (it == golden.end())
+			{
+				printf("  %s: no golden hash\n", key.c_str());
+				cFailed++;
+			}
+			else if (it->second != hashes.hashes[key])
+			{
+				printf("  %s: reference hash %016llx, golden %016llx\n", key.c_str(),
+					(unsigned long long)hashes.hashes[key], (unsigned long long)it->second);
+				cFailed++;
+			}
+		}
+	}
+
+	printf("%u keys, %u failures\n", (DWORD)hashes.keys.size(), cFailed);
+	return (cFailed == 0) ? 0 : 1;
+}
+
+// Checks the variants on one raw frame from disk, such as a capture.
+static int CheckFrame(const char* pszPath, const char* pszFormat, DWORD W, DWORD H, LONG lStride)
+{
+	const GOLDEN_FORMAT* pFormat = NULL;
+	for (size_t f = 0; f < sizeof(g_rgFormats) / sizeof(g_rgFormats[0]); f++)
+	{
+		if (strcmp(g_rgFormats[f].pszName, pszFormat) == 0)
+		{
+			pFormat = &g_rgFormats[f];
+		}
+	}
+	const DWORD cbPixel = (pFormat != NULL && pFormat->format == SKETCH_REF_NV12) ? 1 : 2;
+	if (lStride == 0)
+	{
+		lStride = (LONG)(W * cbPixel);
+	}
+	if (pFormat == NULL || W < 4 || H < 4 || lStride < (LONG)(W * cbPixel))
+	{
+		fprintf(stderr, "bad format or size\n");
+		return 2;
+	}
+
+	const DWORD cRows = (pFormat->format == SKETCH_REF_NV12) ? H + (H + 1) / 2 : H;
+	std::vector<BYTE> src(lStride * cRows);
+	FILE* pFile = fopen(pszPath, "rb");
+	if (pFile == NULL)
+	{
+		fprintf(stderr, "could not read %s\n", pszPath);
+		return 1;
+	}
+	// NV12 files usually end after H/2 chroma lines; the rest stays 0.
+	const size_t cbRead = fread(&src[0], 1, src.size(), pFile);
+	fclose(pFile);
+	if (cbRead < (size_t)lStride * H)
+	{
+		fprintf(stderr, "%s holds %u bytes, less than one frame\n", pszPath, (DWORD)cbRead);
+		return 1;
+	}
+
+	CSketchScratchArena scratch;
+	CSketchThreadPool pool1(3, 1), pool64(0);
+	CSketchThreadPool* rgpPools[] = { &pool1, &pool64 };
+	const SKETCH_RECT rcDest = { 0, 0, W, H };
+	std::vector<BYTE> expected;
+	DWORD cFailed = 0;
+
+	for (int bFiltered = 0; bFiltered < 2; bFiltered++)
+	{
+		expected.assign(lStride * cRows, GOLDEN_MARKER);
+		ReferenceEdgeDetection(pFormat->format, bFiltered != 0, rcDest, &expected[0], lStride, &src[0], lStride, W, H);
+		cFailed += CheckEdgeVariants(bFiltered ? "EdgeDectectionF" : "EdgeDectection", *pFormat, bFiltered != 0,
+			rcDest, NULL, 0, SKETCH_PREFILTER_MEDIAN3, 0, src, lStride, W, H, expected, scratch, rgpPools, 2);
+		printf("EdgeDectection%s_%s %016llx\n", bFiltered ? "F" : "", pFormat->pszName,
+			(unsigned long long)Hash(HASH_SEED, &expected[0], expected.size()));
+	}
+
+	printf("%u failures\n", cFailed);
+	return (cFailed == 0) ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && strcmp(argv[1], "--golden") == 0)
+	{
+		const bool bUpdate = (argc >= 4 && strcmp(argv[3], "--update") == 0);
+		return CheckGolden(argv[2], bUpdate);
+	}
+	if (argc >= 6 && strcmp(argv[1], "--frame") == 0)
+	{
+		return CheckFrame(argv[2], argv[3], (DWORD)atoi(argv[4]), (DWORD)atoi(argv[5]), (argc >= 7) ? (LONG)atoi(argv[6]) : 0);
+	}
+
+	fprintf(stderr, "usage: %s --golden file [--update]\n"
+		"       %s --frame file NV12|YUY2|UYVY width height [stride]\n", argv[0], argv[0]);
+	return 2;
+}
@@ -0,0 +1,644 @@
+// Scalar reference for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#include "SketchReference.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// Luma sample of pixel (x, y).
+static inline BYTE Luma(SKETCH_REF_FORMAT format, const BYTE* pSrc, LONG lSrcStride, DWORD x, DWORD y)
+{
+	const BYTE* pRow = pSrc + (LONG)y * lSrcStride;
+	switch (format)
+	{
+	case SKETCH_REF_YUY2:
+		return pRow[x * 2];
+	case SKETCH_REF_UYVY:
+		return pRow[x * 2 + 1];
+	default:
+		return pRow[x];
+	}
+}
+
+static inline DWORD BytesPerPixel(SKETCH_REF_FORMAT format)
+{
+	return (format == SKETCH_REF_NV12) ? 1 : 2;
+}
+
+// Luma plane, width*height, pre-filtered as the F variants see it.
+// dwMedianRadius is that of SKETCH_PREFILTER_MEDIAN_RADIUS.
+static void FilteredPlane(SKETCH_REF_FORMAT format, const BYTE* pSrc, LONG lSrcStride, DWORD W, DWORD H,
+	SKETCH_PREFILTER prefilter, DWORD dwMedianRadius, std::vector<BYTE>& plane)
+{
+	DWORD r = 1;
+	if (prefilter == SKETCH_PREFILTER_NONE)
+	{
+		r = 0;
+	}
+	else if (prefilter == SKETCH_PREFILTER_MEDIAN5)
+	{
+		r = 2;
+	}
+	else if (prefilter == SKETCH_PREFILTER_MEDIAN_RADIUS)
+	{
+		r = std::min(dwMedianRadius, (DWORD)SKETCH_MEDIAN_MAX_RADIUS);
+	}
+
+	// Binomial3's pass down the columns, rounded on its own.
+	std::vector<BYTE> down(W * H);
+	for (DWORD y = 1; prefilter == SKETCH_PREFILTER_BINOMIAL3 && y + 1 < H; y++)
+	{
+		for (DWORD x = 0; x < W; x++)
+		{
+			down[y * W + x] = (BYTE)((Luma(format, pSrc, lSrcStride, x, y - 1) + 2 * Luma(format, pSrc, lSrcStride, x, y) +
+				Luma(format, pSrc, lSrcStride, x, y + 1) + 2) / 4);
+		}
+	}
+
+	std::vector<BYTE> block;
+	plane.resize(W * H);
+	for (DWORD y = 0; y < H; y++)
+	{
+		for (DWORD x = 0; x < W; x++)
+		{
+			if (y < r || y + r >= H || x < r || x + r >= W)
+			{
+				plane[y * W + x] = Luma(format, pSrc, lSrcStride, x, y);
+				continue;
+			}
+
+			if (prefilter == SKETCH_PREFILTER_BINOMIAL3)
+			{
+				plane[y * W + x] = (BYTE)((down[y * W + x - 1] + 2 * down[y * W + x] + down[y * W + x + 1] + 2) / 4);
+				continue;
+			}
+
+			// The block around the pixel, row by row.
+			const DWORD n = 2 * r + 1;
+			DWORD dwSum = 0;
+			block.resize(n * n);
+			for (DWORD i = 0; i < n * n; i++)
+			{
+				block[i] = Luma(format, pSrc, lSrcStride, x + i % n - r, y + i / n - r);
+				dwSum += block[i];
+			}
+
+			if (prefilter == SKETCH_PREFILTER_BOX3)
+			{
+				plane[y * W + x] = (BYTE)((dwSum + 4) / 9);
+				continue;
+			}
+			std::nth_element(block.begin(), block.begin() + n * n / 2, block.end());
+			plane[y * W + x] = block[n * n / 2];
+		}
+	}
+}
+
+// The sketch grey level of gradient g. floor is the chroma gradient of a
+// chroma-aware region, or 0.
+static inline BYTE EdgeLevel(int g, int level, int floor)
+{
+	g = std::max(g, floor);
+	const int v = level - g * g;
+	return (BYTE)((v < 0) ? 0 : v);
+}
+
+static inline BYTE Roberts(int p1, int p2, int p3, int p4, int level, int floor)
+{
+	return EdgeLevel((p1 > p4) ? p1 - p4 : ((p2 > p3) ? p2 - p3 : p3 - p2), level, floor);
+}
+
+// Gradient of a 3x3 detector over the neighbourhood p, row by row,
+// saturated at 255.
+static int Gradient3x3(BYTE bDetector, const int p[9])
+{
+	int g = 0;
+	if (bDetector == SKETCH_DETECTOR_LAPLACIAN)
+	{
+		g = abs(p[0] + p[1] + p[2] + p[3] + p[5] + p[6] + p[7] + p[8] - 8 * p[4]) / 4;
+	}
+	else
+	{
+		const int edge = (bDetector == SKETCH_DETECTOR_SCHARR) ? 3 : 1;
+		const int mid = (bDetector == SKETCH_DETECTOR_SCHARR) ? 10 : 2;
+		const int gx = edge * (p[2] + p[8] - p[0] - p[6]) + mid * (p[5] - p[3]);
+		const int gy = edge * (p[6] + p[8] - p[0] - p[2]) + mid * (p[7] - p[1]);
+		g = (abs(gx) + abs(gy)) / ((bDetector == SKETCH_DETECTOR_SCHARR) ? 16 : 4);
+	}
+	return std::min(g, 255);
+}
+
+void ReferenceMedianFilter(
+	SKETCH_REF_FORMAT   format,
+	BYTE*               pDest,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	LONG                lDestStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels)
+{
+	std::vector<BYTE> plane;
+	FilteredPlane(format, pSrc, lSrcStride, dwWidthInPixels, dwHeightInPixels, SKETCH_PREFILTER_MEDIAN3, 0, plane);
+
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		memcpy(pDest + (LONG)y * lDestStride, &plane[y * dwWidthInPixels], dwWidthInPixels);
+	}
+
+	if (format == SKETCH_REF_NV12)
+	{
+		memcpy(pDest, pSrc, lDestStride);
+		memcpy(pDest + (LONG)(dwHeightInPixels - 1) * lDestStride, pSrc + (LONG)(dwHeightInPixels - 1) * lSrcStride, lDestStride);
+	}
+}
+
+void ReferenceMedianFilterRadius(
+	SKETCH_REF_FORMAT   format,
+	BYTE*               pDest,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	LONG                lDestStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels,
+	DWORD               dwRadius)
+{
+	std::vector<BYTE> plane;
+	FilteredPlane(format, pSrc, lSrcStride, dwWidthInPixels, dwHeightInPixels, SKETCH_PREFILTER_MEDIAN_RADIUS, dwRadius, plane);
+
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		memcpy(pDest + (LONG)y * lDestStride, &plane[y * dwWidthInPixels], dwWidthInPixels);
+	}
+}
+
+// Chroma gradient of pixel (x, y), an edge pixel of a chroma-aware region:
+// the largest |difference| of U or V across the diagonals between the
+// pixel's pair and the next one, on this line's chroma and the next's.
+static BYTE ChromaGradient(SKETCH_REF_FORMAT format, const BYTE* pSrc, LONG lSrcStride, DWORD W, DWORD H, DWORD x, DWORD y)
+{
+	const DWORD j = x / 2;
+	if (j + 1 >= W / 2)
+	{
+		return 0;
+	}
+
+	// Chroma sample k, U V U V ..., of a line, and the next line's.
+	const BYTE* pRow = NULL;
+	const BYTE* pNext = NULL;
+	DWORD dwStep = 2;
+	switch (format)
+	{
+	case SKETCH_REF_YUY2:
+		pRow = pSrc + (LONG)y * lSrcStride + 1;
+		pNext = pRow + lSrcStride;
+		break;
+	case SKETCH_REF_UYVY:
+		pRow = pSrc + (LONG)y * lSrcStride;
+		pNext = pRow + lSrcStride;
+		break;
+	default:
+		pRow = pSrc + (LONG)(H + y / 2) * lSrcStride;
+		pNext = pSrc + (LONG)(H + std::min(y / 2 + 1, H / 2 - 1)) * lSrcStride;
+		dwStep = 1;
+		break;
+	}
+
+	int g = 0;
+	for (DWORD k = 2 * j; k < 2 * j + 2; k++)
+	{
+		g = std::max(g, abs(pRow[k * dwStep] - pNext[(k + 2) * dwStep]));
+		g = std::max(g, abs(pRow[(k + 2) * dwStep] - pNext[k * dwStep]));
+	}
+	return (BYTE)g;
+}
+
+// The last region in the list holding pixel (x, y), or NULL.
+static const SKETCH_REGION* FindRegion(const SKETCH_REGION* pRegions, DWORD cRegions, DWORD x, DWORD y)
+{
+	for (DWORD r = cRegions; r > 0; r--)
+	{
+		const SKETCH_RECT& rc = pRegions[r - 1].rc;
+		if (rc.left <= x && x < rc.right && rc.top <= y && y < rc.bottom)
+		{
+			return &pRegions[r - 1];
+		}
+	}
+	return NULL;
+}
+
+// NV12 chroma: height/2 lines, where the U V pairs of the pixels in the
+// regions are 128 and the rest is copied.
+static void ChromaPlane(const SKETCH_REGION* pRegions, DWORD cRegions, BYTE* pDest, LONG lDestStride,
+	const BYTE* pSrc, LONG lSrcStride, DWORD W, DWORD H)
+{
+	for (DWORD cy = 0; cy < (H >> 1); cy++)
+	{
+		BYTE* pDestRow = pDest + (LONG)(H + cy) * lDestStride;
+
+		memcpy(pDestRow, pSrc + (LONG)(H + cy) * lSrcStride, W);
+		for (DWORD x = 0; x < W; x++)
+		{
+			if (FindRegion(pRegions, cRegions, x, 2 * cy) != NULL || FindRegion(pRegions, cRegions, x, 2 * cy + 1) != NULL)
+			{
+				pDestRow[x & ~1u] = 128;
+				if ((x | 1) < W)
+				{
+					pDestRow[x | 1] = 128;
+				}
+			}
+		}
+	}
+}
+
+void ReferenceEdgeDetection(
+	SKETCH_REF_FORMAT   format,
+	bool                bFiltered,
+	const SKETCH_RECT&  rcDest,
+	BYTE*               pDest,
+	LONG                lDestStride,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels)
+{
+	const SKETCH_REGION region = { rcDest, SKETCH_THRESHOLD_DEFAULT, 0, 0, 0 };
+
+	ReferenceEdgeDetectionRegions(format, bFiltered, &region, 1, pDest, lDestStride, pSrc, lSrcStride,
+		dwWidthInPixels, dwHeightInPixels, SKETCH_PREFILTER_MEDIAN3, 0);
+}
+
+void ReferenceEdgeDetectionRegions(
+	SKETCH_REF_FORMAT   format,
+	bool                bFiltered,
+	const SKETCH_REGION* pRegions,
+	DWORD               cRegions,
+	BYTE*               pDest,
+	LONG                lDestStride,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels,
+	SKETCH_PREFILTER    prefilter,
+	DWORD               dwMedianRadius)
+{
+	const DWORD W = dwWidthInPixels, H = dwHeightInPixels;
+	const DWORD cbRow = W * BytesPerPixel(format);
+	const bool bFilteredNV12 = bFiltered && format == SKETCH_REF_NV12;
+
+	std::vector<BYTE> filtered;
+	if (bFiltered)
+	{
+		FilteredPlane(format, pSrc, lSrcStride, W, H, prefilter, dwMedianRadius, filtered);
+	}
+
+	for (DWORD y = 0; y < H; y++)
+	{
+		const BYTE* pSrcRow = pSrc + (LONG)y * lSrcStride;
+		BYTE* pDestRow = pDest + (LONG)y * lDestStride;
+
+		// Everything outside the regions is the source.
+		memcpy(pDestRow, pSrcRow, cbRow);
+
+		// The two lines the gradient is taken over.
+		std::vector<BYTE> a(W), b(W);
+		const DWORD yA = bFilteredNV12 ? y - 1 : y;
+		for (DWORD x = 0; y > 0 && y + 1 < H && x < W; x++)
+		{
+			a[x] = bFiltered ? filtered[yA * W + x] : Luma(format, pSrc, lSrcStride, x, yA);
+			b[x] = bFiltered ? filtered[(yA + 1) * W + x] : Luma(format, pSrc, lSrcStride, x, yA + 1);
+		}
+
+		for (DWORD x = 0; x < W; x++)
+		{
+			const SKETCH_REGION* pRegion = FindRegion(pRegions, cRegions, x, y);
+			if (pRegion == NULL)
+			{
+				continue;
+			}
+
+			// Line 0 is a copy and the last line keeps its luma.
+			BYTE bLuma = Luma(format, pSrc, lSrcStride, x, y);
+			if (y > 0 && y + 1 < H && x == 0)
+			{
+				bLuma = (bFiltered && format == SKETCH_REF_UYVY) ? a[1] : a[0];
+			}
+			else if (y > 0 && y + 1 < H && x == W - 1)
+			{
+				bLuma = a[W - 1];
+			}
+			else if (y > 0 && y + 1 < H && pRegion->bDetector > SKETCH_DETECTOR_ROBERTS &&
+				pRegion->bDetector < SKETCH_DETECTOR_COUNT)
+			{
+				// Centred on the pixel, without the NV12 lag.
+				int p[9];
+				for (DWORD i = 0; i < 9; i++)
+				{
+					const DWORD xi = x + i % 3 - 1, yi = y + i / 3 - 1;
+					p[i] = bFiltered ? filtered[yi * W + xi] : Luma(format, pSrc, lSrcStride, xi, yi);
+				}
+				bLuma = EdgeLevel(Gradient3x3(pRegion->bDetector, p), 255 - pRegion->bThreshold,
+					pRegion->bChroma ? ChromaGradient(format, pSrc, lSrcStride, W, H, x, y) : 0);
+			}
+			else if (y > 0 && y + 1 < H)
+			{
+				bLuma = Roberts(a[x], a[x + 1], b[x], b[x + 1], 255 - pRegion->bThreshold,
+					pRegion->bChroma ? ChromaGradient(format, pSrc, lSrcStride, W, H, x, y) : 0);
+			}
+			if (pRegion->bInvert)
+			{
+				bLuma = 255 - bLuma;
+			}
+
+			switch (format)
+			{
+			case SKETCH_REF_YUY2:
+				pDestRow[x * 2] = bLuma;
+				pDestRow[x * 2 + 1] = (y > 0) ? 128 : pSrcRow[x * 2 + 1];
+				break;
+			case SKETCH_REF_UYVY:
+				pDestRow[x * 2] = (y > 0) ? 128 : pSrcRow[x * 2];
+				pDestRow[x * 2 + 1] = bLuma;
+				break;
+			default:
+				pDestRow[x] = bLuma;
+				break;
+			}
+		}
+	}
+
+	if (format == SKETCH_REF_NV12)
+	{
+		ChromaPlane(pRegions, cRegions, pDest, lDestStride, pSrc, lSrcStride, W, H);
+	}
+}
+
+// Rounded blend of a and b, with b weighted w/256.
+static inline BYTE Lerp(BYTE a, BYTE b, DWORD w)
+{
+	return (BYTE)((a * (256 - w) + b * w + 128) >> 8);
+}
+
+// One 2x step of the scaled path over a dense w*h plane: along the rows,
+// then across the lines, each output pixel 3:1 between the input pixel a
+// quarter pixel away and its neighbour on the far side.
+static void Upsample2x(const std::vector<BYTE>& plane, DWORD w, DWORD h, std::vector<BYTE>& doubled)
+{
+	std::vector<BYTE> rows(2 * w * h);
+	for (DWORD y = 0; y < h; y++)
+	{
+		for (DWORD x = 0; x < w; x++)
+		{
+			const BYTE bLeft = plane[y * w + ((x > 0) ? x - 1 : 0)];
+			const BYTE bPixel = plane[y * w + x];
+			const BYTE bRight = plane[y * w + ((x + 1 < w) ? x + 1 : x)];
+
+			rows[y * 2 * w + 2 * x] = Lerp(bLeft, bPixel, 192);
+			rows[y * 2 * w + 2 * x + 1] = Lerp(bPixel, bRight, 64);
+		}
+	}
+
+	doubled.resize(4 * w * h);
+	for (DWORD y = 0; y < 2 * h; y++)
+	{
+		const DWORD j = y / 2;
+		const DWORD yA = (y & 1) ? j : ((j > 0) ? j - 1 : 0);
+		const DWORD yB = (y & 1) ? ((j + 1 < h) ? j + 1 : j) : j;
+
+		for (DWORD x = 0; x < 2 * w; x++)
+		{
+			doubled[y * 2 * w + x] = Lerp(rows[yA * 2 * w + x], rows[yB * 2 * w + x], (y & 1) ? 64 : 192);
+		}
+	}
+}
+
+void ReferenceEdgeDetectionScaled(
+	SKETCH_REF_FORMAT   format,
+	DWORD               dwScale,
+	const SKETCH_REGION* pRegions,
+	DWORD               cRegions,
+	BYTE*               pDest,
+	LONG                lDestStride,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels,
+	SKETCH_PREFILTER    prefilter,
+	DWORD               dwMedianRadius)
+{
+	const DWORD W = dwWidthInPixels, H = dwHeightInPixels;
+	const DWORD w = (W + dwScale - 1) / dwScale, h = (H + dwScale - 1) / dwScale;
+
+	// Box average, over the pixels a block has at the edges.
+	std::vector<BYTE> low(w * h);
+	for (DWORD ly = 0; ly < h; ly++)
+	{
+		for (DWORD lx = 0; lx < w; lx++)
+		{
+			DWORD dwSum = 0, cPixels = 0;
+			for (DWORD y = ly * dwScale; y < std::min(ly * dwScale + dwScale, H); y++)
+			{
+				for (DWORD x = lx * dwScale; x < std::min(lx * dwScale + dwScale, W); x++)
+				{
+					dwSum += Luma(format, pSrc, lSrcStride, x, y);
+					cPixels++;
+				}
+			}
+			low[ly * w + lx] = (BYTE)((dwSum + cPixels / 2) / cPixels);
+		}
+	}
+
+	std::vector<BYTE> filtered;
+	FilteredPlane(SKETCH_REF_NV12, &low[0], (LONG)w, w, h, prefilter, dwMedianRadius, filtered);
+
+	// The regions scaled down and grown by a pixel all round.
+	std::vector<SKETCH_REGION> grown;
+	for (DWORD r = 0; r < cRegions; r++)
+	{
+		SKETCH_REGION region = pRegions[r];
+		const DWORD right = std::min<DWORD>(region.rc.right, W), bottom = std::min<DWORD>(region.rc.bottom, H);
+
+		if (region.rc.left >= right || region.rc.top >= bottom)
+		{
+			continue;
+		}
+		region.rc.left = (region.rc.left >= dwScale) ? region.rc.left / dwScale - 1 : 0;
+		region.rc.top = (region.rc.top >= dwScale) ? region.rc.top / dwScale - 1 : 0;
+		region.rc.right = (right + dwScale - 1) / dwScale + 1;
+		region.rc.bottom = (bottom + dwScale - 1) / dwScale + 1;
+		grown.push_back(region);
+	}
+
+	// The edge map: the reduced luma on its border, edges inside it, 0
+	// outside the grown regions.
+	std::vector<BYTE> edges(w * h, 0);
+	for (DWORD ly = 0; ly < h; ly++)
+	{
+		for (DWORD lx = 0; lx < w; lx++)
+		{
+			const SKETCH_REGION* pRegion = grown.empty() ? NULL : FindRegion(&grown[0], (DWORD)grown.size(), lx, ly);
+			if (pRegion == NULL)
+			{
+				continue;
+			}
+			if (ly == 0 || ly == h - 1 || lx == 0 || lx == w - 1)
+			{
+				edges[ly * w + lx] = low[ly * w + lx];
+				continue;
+			}
+			edges[ly * w + lx] = Roberts(filtered[ly * w + lx], filtered[ly * w + lx + 1], filtered[(ly + 1) * w + lx],
+				filtered[(ly + 1) * w + lx + 1], 255 - pRegion->bThreshold, 0);
+		}
+	}
+
+	DWORD dwPlaneWidth = w, dwPlaneHeight = h;
+	for (DWORD s = dwScale; s > 1; s /= 2)
+	{
+		std::vector<BYTE> doubled;
+		Upsample2x(edges, dwPlaneWidth, dwPlaneHeight, doubled);
+		edges.swap(doubled);
+		dwPlaneWidth *= 2;
+		dwPlaneHeight *= 2;
+	}
+
+	for (DWORD y = 0; y < H; y++)
+	{
+		const BYTE* pSrcRow = pSrc + (LONG)y * lSrcStride;
+		BYTE* pDestRow = pDest + (LONG)y * lDestStride;
+
+		memcpy(pDestRow, pSrcRow, W * BytesPerPixel(format));
+		for (DWORD x = 0; x < W; x++)
+		{
+			const SKETCH_REGION* pRegion = FindRegion(pRegions, cRegions, x, y);
+			if (pRegion == NULL)
+			{
+				continue;
+			}
+
+			BYTE bLuma = edges[y * dwPlaneWidth + x];
+			if (pRegion->bInvert)
+			{
+				bLuma = 255 - bLuma;
+			}
+
+			switch (format)
+			{
+			case SKETCH_REF_YUY2:
+				pDestRow[x * 2] = bLuma;
+				pDestRow[x * 2 + 1] = 128;
+				break;
+			case SKETCH_REF_UYVY:
+				pDestRow[x * 2] = 128;
+				pDestRow[x * 2 + 1] = bLuma;
+				break;
+			default:
+				pDestRow[x] = bLuma;
+				break;
+			}
+		}
+	}
+
+	if (format == SKETCH_REF_NV12)
+	{
+		ChromaPlane(pRegions, cRegions, pDest, lDestStride, pSrc, lSrcStride, W, H);
+	}
+}
+
+void ReferenceYUY2toRGB(
+	BYTE*               pDest,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels)
+{
+	const DWORD cbPlane = dwWidthInPixels * dwHeightInPixels;
+
+	for (DWORD y = 0; y < dwHeightInPixels; y++)
+	{
+		const BYTE* pRow = pSrc + (LONG)y * lSrcStride;
+		for (DWORD x = 0; x < dwWidthInPixels; x++)
+		{
+			int rdif = 0, invdif = 0, bdif = 0;
+			if ((x & 1) == 0)
+			{
+				// V of the pair is read from the next pixel's chroma byte.
+				const int U = pRow[x * 2 + 1] - 128;
+				const int V = pRow[x * 2 + 3] - 128;
+				rdif = V + ((V * 103) >> 8);
+				invdif = ((U * 88) >> 8) + ((V * 183) >> 8);
+				bdif = U + ((U * 198) >> 8);
+			}
+
+			const int Y = pRow[x * 2];
+			const int rgv[3] = { Y + rdif, Y - invdif, Y + bdif };
+			for (DWORD c = 0; c < 3; c++)
+			{
+				// The kernel keeps the sum unsigned: below 0 wraps past 255.
+				pDest[c * cbPlane + y * dwWidthInPixels + x] = (BYTE)((rgv[c] < 0 || rgv[c] > 255) ? 255 : rgv[c]);
+			}
+		}
+	}
+}
+
+// One colour's term of the RGB gradient. The kernel wrote
+// abs(a)+abs(b) with the unparenthesized macro, which parses as
+// (a > 0) ? a : ((-a + (b > 0)) ? b : -b).
+static inline DWORD RgbTerm(int a, int b)
+{
+	return (DWORD)((a > 0) ? a : ((-a + (b > 0)) ? b : -b));
+}
+
+void ReferenceEdgeDetection_YUY2RGB(
+	const SKETCH_RECT&  rcDest,
+	BYTE*               pDest,
+	LONG                lDestStride,
+	const BYTE*         pSrc,
+	LONG                lSrcStride,
+	DWORD               dwWidthInPixels,
+	DWORD               dwHeightInPixels)
+{
+	const DWORD W = dwWidthInPixels, H = dwHeightInPixels;
+	const DWORD y0 = std::min<DWORD>(rcDest.bottom, H);
+	const DWORD x0 = std::min<DWORD>(rcDest.left, W);
+	const DWORD x1 = std::min<DWORD>(rcDest.right, W);
+
+	std::vector<BYTE> rgb(3 * W * H);
+	ReferenceYUY2toRGB(&rgb[0], pSrc, lSrcStride, W, H);
+
+	for (DWORD y = 0; y < H; y++)
+	{
+		const BYTE* pSrcRow = pSrc + (LONG)y * lSrcStride;
+		BYTE* pDestRow = pDest + (LONG)y * lDestStride;
+
+		memcpy(pDestRow, pSrcRow, W * 2);
+		if (y <= rcDest.top || y + 1 >= y0)
+		{
+			continue;
+		}
+
+		for (DWORD p = x0; p < x1; p++)
+		{
+			if (p == 0 || p + 1 == W)
+			{
+				pDestRow[p * 2] = pSrcRow[p * 2];
+				pDestRow[p * 2 + 1] = 128;
+				continue;
+			}
+
+			DWORD dwVal = 0;
+			for (DWORD c = 0; c < 3; c++)
+			{
+				const BYTE* pPlane = &rgb[c * W * H + y * W];
+				dwVal += RgbTerm(pPlane[p] - pPlane[p + W + 1], pPlane[p + 1] - pPlane[p + W]);
+			}
+			pDestRow[p * 2] = (dwVal < 255) ? (BYTE)dwVal : 255;
+			pDestRow[p * 2 + 1] = 128;
+		}
+	}
+}
@@ -0,0 +1,140 @@
+// Scalar reference for the sketch kernels.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+
+#ifndef SKETCHREFERENCE_H
+#define SKETCHREFERENCE_H
+
+#include "SketchKernels.h"
+
+//
+// One plain per-pixel loop per kernel, written from what the kernels
+// produce rather than how, so the golden test can diff any optimized or
+// threaded variant against it. Nothing here is fast, and nothing here may
+// change without regenerating the golden checksums.
+//
+// The quirks of the shipped kernels are part of their output and are kept:
+//
+//  - The Roberts gradient is g = (P1 > P4) ? P1 - P4 : |P2 - P3|, mapped to
+//    229 - g*g saturated at 0.
+//  - The edge detectors only change the pixels in rcDest or the regions
+//    (clipped to the frame; the last region holding a pixel applies) and
+//    copy the rest from the source. A pixel in the rectangle
+//    is a copy on line 0 of the frame and keeps its luma with neutral
+//    chroma on the last line and in the first and last column (taken from
+//    the filtered row for the F variants); elsewhere it is an edge.
+//  - EdgeDectectionF_UYVY takes its first column from filtered pixel 1.
+//  - EdgeDectectionF_NV12 pairs filtered lines y-1 and y; its chroma
+//    gradients still use the chroma lines of y and y+2, and its 3x3
+//    detectors lines y-1 to y+1.
+//  - MedianFilter_NV12 copies a whole destination stride of source for
+//    its first and last lines.
+//  - NV12 chroma has height/2 lines; the U V pairs of the pixels in
+//    rcDest are 128.
+//  - YUY2toRGB only applies chroma to even pixels, and a negative result
+//    saturates to 255.
+//
+
+enum SKETCH_REF_FORMAT
+{
+    SKETCH_REF_NV12,
+    SKETCH_REF_YUY2,
+    SKETCH_REF_UYVY
+};
+
+// MedianFilter_*: the 3x3 median of the luma into a dense plane; the
+// border pixels are copied.
+void ReferenceMedianFilter(
+    SKETCH_REF_FORMAT   format,
+    BYTE*               pDest,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    LONG                lDestStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels);
+
+// MedianFilterRadius_*: the median of the (2*dwRadius+1)^2 block into a
+// dense plane, dwWidthInPixels bytes a line; the pixels within dwRadius of
+// the border are copied.
+void ReferenceMedianFilterRadius(
+    SKETCH_REF_FORMAT   format,
+    BYTE*               pDest,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    LONG                lDestStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels,
+    DWORD               dwRadius);
+
+// EdgeDectection_* (bFiltered false) and EdgeDectectionF_* (true).
+void ReferenceEdgeDetection(
+    SKETCH_REF_FORMAT   format,
+    bool                bFiltered,
+    const SKETCH_RECT&  rcDest,
+    BYTE*               pDest,
+    LONG                lDestStride,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels);
+
+// The same over a list of regions, each with its own threshold,
+// inversion, chroma edges and detector (SKETCH_FRAME::pRegions), and the F
+// variants over the luma pre-filtered by prefilter (dwMedianRadius is that
+// of SKETCH_PREFILTER_MEDIAN_RADIUS). The detectors are as the kernels
+// run them with scratch.
+void ReferenceEdgeDetectionRegions(
+    SKETCH_REF_FORMAT   format,
+    bool                bFiltered,
+    const SKETCH_REGION* pRegions,
+    DWORD               cRegions,
+    BYTE*               pDest,
+    LONG                lDestStride,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels,
+    SKETCH_PREFILTER    prefilter,
+    DWORD               dwMedianRadius);
+
+// EdgeDectectionScaled, over a list of regions (rcDest with the defaults
+// is the one-region list), with prefilter. See SketchKernels.h for what it
+// computes.
+void ReferenceEdgeDetectionScaled(
+    SKETCH_REF_FORMAT   format,
+    DWORD               dwScale,
+    const SKETCH_REGION* pRegions,
+    DWORD               cRegions,
+    BYTE*               pDest,
+    LONG                lDestStride,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels,
+    SKETCH_PREFILTER    prefilter,
+    DWORD               dwMedianRadius);
+
+// YUY2toRGB into three dense width*height planes.
+void ReferenceYUY2toRGB(
+    BYTE*               pDest,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels);
+
+// EdgeDectection_YUY2RGB. For rcDest.top == 0, full-width rectangles and
+// unpadded strides this is what the shipped kernel did; it read the wrong
+// lines, or past its RGB planes, otherwise.
+void ReferenceEdgeDetection_YUY2RGB(
+    const SKETCH_RECT&  rcDest,
+    BYTE*               pDest,
+    LONG                lDestStride,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels);
+
+#endif